@@ -0,0 +1,727 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 2026 by the lftp contributors (see the AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/stat.h>
+#if defined(HAVE_LINUX_IO_URING_H)
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/io_uring.h>
+# if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#  define USE_IO_URING 1
+# endif
+#endif
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "AsyncIO.h"
+#include "ResMgr.h"
+#include "xmalloc.h"
+#include "misc.h"
+#include "log.h"
+#include "ProtoLog.h"
+
+#define ASYNC_READ_SIZE 0x10000
+
+struct AsyncFile::Handle
+{
+   int fd;
+   int refs;
+   Handle(int f) : fd(f), refs(1) {}
+   void Ref() { refs++; }
+   void Unref() {
+      if(--refs>0)
+	 return;
+      close(fd);
+      delete this;
+   }
+};
+
+AsyncFile::Request::Request(Handle *h,bool w,off_t o,int s)
+   : file_node(this), engine_node(this), work_node(this),
+     handle(h), offset(o), size(s), consumed(0),
+     write(w), done(false), orphan(false), result(0)
+{
+   handle->Ref();
+   buf=(char*)xmalloc(size);
+   iov.iov_base=buf;
+   iov.iov_len=size;
+}
+AsyncFile::Request::~Request()
+{
+   xfree(buf);
+   handle->Unref();
+}
+int AsyncFile::Request::fd() const
+{
+   return handle->fd;
+}
+
+AsyncFile::AsyncFile(int fd)
+   : handle(new Handle(fd)), queued(0),
+     read_pos(0), read_size(0), read_eof(false), error(0)
+{
+   depth=ResMgr::Query("file:io-queue-depth",0);
+   if(depth<1)
+      depth=1;
+}
+AsyncFile::~AsyncFile()
+{
+   DropAll();
+   handle->Unref();
+}
+
+AsyncFile *AsyncFile::Open(int fd)
+{
+   if(!AsyncIOEngine::Get())
+      return 0;
+   struct stat st;
+   if(fstat(fd,&st)==-1 || !S_ISREG(st.st_mode))
+      return 0;
+   int dup_fd=dup(fd);
+   if(dup_fd==-1)
+      return 0;
+   fcntl(dup_fd,F_SETFD,FD_CLOEXEC);
+   return new AsyncFile(dup_fd);
+}
+
+bool AsyncFile::Submit(Request *r)
+{
+   AsyncIOEngine *engine=AsyncIOEngine::Get();
+   if(!engine || !engine->Submit(r))
+   {
+      delete r;
+      return false;
+   }
+   queue.add_tail(r->file_node);
+   queued++;
+   return true;
+}
+void AsyncFile::Drop(Request *r)
+{
+   r->file_node.remove();
+   queued--;
+   if(r->done)
+      delete r;
+   else
+      r->orphan=true;	// the engine deletes it
+}
+void AsyncFile::DropAll()
+{
+   while(queued>0)
+      Drop(queue.first_obj());
+}
+
+int AsyncFile::Read(off_t pos,char *buf,int size)
+{
+   Request *r=(queued>0 ? queue.first_obj() : 0);
+   if(r && r->offset+r->consumed!=pos)
+   {
+      // seek, discard the read ahead
+      DropAll();
+      r=0;
+   }
+   if(!r)
+   {
+      read_pos=pos;
+      read_eof=false;
+   }
+   if(read_size<size)
+      read_size=(size>ASYNC_READ_SIZE ? size : ASYNC_READ_SIZE);
+   while(queued<depth && !read_eof)
+   {
+      if(!Submit(new Request(handle,false,read_pos,read_size)))
+	 break;
+      read_pos+=read_size;
+   }
+   r=(queued>0 ? queue.first_obj() : 0);
+   if(!r || !r->done)
+   {
+      errno=EAGAIN;
+      return -1;
+   }
+   if(r->result<0)
+   {
+      errno=-r->result;
+      DropAll();
+      return -1;
+   }
+   int avail=r->result-r->consumed;
+   if(avail<=0)
+   {
+      read_eof=true;
+      return 0;
+   }
+   if(size>avail)
+      size=avail;
+   memcpy(buf,r->buf+r->consumed,size);
+   r->consumed+=size;
+   if(r->consumed<r->result)
+      return size;
+   if(r->result<r->size)
+   {
+      // a short read, the file ends here (or it grows and the following
+      // requests could have missed a part).
+      DropAll();
+      read_pos=pos+size;
+      read_eof=true;
+      return size;
+   }
+   Drop(r);
+   return size;
+}
+
+void AsyncFile::CollectWrites()
+{
+   xlist_for_each_safe(Request,queue,node,r,next)
+   {
+      if(!r->done)
+	 continue;
+      if(r->result<0 || (r->result==0 && r->size>0))
+      {
+	 if(!error)
+	    error=(r->result<0 ? -r->result : ENOSPC);
+      }
+      else if(r->result<r->size && !error)
+      {
+	 // a short write, restart with the rest
+	 Request *rest=new Request(handle,true,r->offset+r->result,r->size-r->result);
+	 memcpy(rest->buf,r->buf+r->result,rest->size);
+	 if(!Submit(rest))
+	    error=EIO;
+      }
+      Drop(r);
+   }
+}
+
+int AsyncFile::Write(off_t pos,const char *buf,int size)
+{
+   CollectWrites();
+   if(error)
+   {
+      errno=error;
+      return -1;
+   }
+   if(queued>=depth)
+   {
+      errno=EAGAIN;
+      return -1;
+   }
+   Request *r=new Request(handle,true,pos,size);
+   memcpy(r->buf,buf,size);
+   if(!Submit(r))
+   {
+      errno=EAGAIN;
+      return -1;
+   }
+   return size;
+}
+
+int AsyncFile::Flush()
+{
+   CollectWrites();
+   if(error)
+   {
+      errno=error;
+      return -1;
+   }
+   if(queued>0)
+   {
+      errno=EAGAIN;
+      return -1;
+   }
+   return 0;
+}
+
+int AsyncFile::Wait()
+{
+   for(;;)
+   {
+      int res=Flush();
+      if(res==0 || errno!=EAGAIN)
+	 return res;
+      AsyncIOEngine *engine=AsyncIOEngine::Get();
+      if(!engine)
+      {
+	 errno=EIO;
+	 return -1;
+      }
+      engine->Wait();
+   }
+}
+
+off_t AsyncFile::FirstPendingWrite()
+{
+   CollectWrites();
+   off_t first=-1;
+   xlist_for_each(Request,queue,node,r)
+   {
+      if(r->write && (first==-1 || r->offset<first))
+	 first=r->offset;
+   }
+   return first;
+}
+
+#ifdef USE_IO_URING
+class IOUringEngine : public AsyncIOEngine
+{
+   int ring_fd;
+   unsigned entries;
+   unsigned *sq_head,*sq_tail,*sq_mask,*sq_array;
+   unsigned *cq_head,*cq_tail,*cq_mask;
+   struct io_uring_sqe *sqes;
+   struct io_uring_cqe *cqes;
+   void *sq_ptr,*cq_ptr;
+   size_t sq_len,cq_len,sqes_len;
+   unsigned in_flight;
+   unsigned unsubmitted;
+
+   void Unmap();
+   void Enter();
+
+   bool Start(AsyncFile::Request *r);
+   void Reap();
+   int GetFD() { return ring_fd; }
+   void Abandon() { Unmap(); }
+
+public:
+   IOUringEngine();
+   ~IOUringEngine();
+   bool Ok() const { return ring_fd!=-1; }
+};
+
+IOUringEngine::IOUringEngine() : AsyncIOEngine("io_uring"),
+   sqes(0), sq_ptr(MAP_FAILED), cq_ptr(MAP_FAILED),
+   sq_len(0), cq_len(0), sqes_len(0), in_flight(0), unsubmitted(0)
+{
+   struct io_uring_params p;
+   memset(&p,0,sizeof(p));
+   ring_fd=syscall(__NR_io_uring_setup,64,&p);
+   if(ring_fd==-1)
+   {
+      ProtoLog::LogError(9,"io_uring_setup: %s",strerror(errno));
+      return;
+   }
+   fcntl(ring_fd,F_SETFD,FD_CLOEXEC);
+   entries=p.sq_entries;
+   if(entries>p.cq_entries)
+      entries=p.cq_entries;
+   sq_len=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+   cq_len=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+   bool single_mmap=(p.features&IORING_FEAT_SINGLE_MMAP);
+   if(single_mmap && cq_len>sq_len)
+      sq_len=cq_len;
+   sq_ptr=mmap(0,sq_len,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ring_fd,IORING_OFF_SQ_RING);
+   if(sq_ptr==MAP_FAILED)
+      goto fail;
+   cq_ptr=single_mmap ? sq_ptr
+      : mmap(0,cq_len,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ring_fd,IORING_OFF_CQ_RING);
+   if(cq_ptr==MAP_FAILED)
+      goto fail;
+   sqes_len=p.sq_entries*sizeof(struct io_uring_sqe);
+   sqes=(struct io_uring_sqe*)mmap(0,sqes_len,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ring_fd,IORING_OFF_SQES);
+   if(sqes==MAP_FAILED)
+   {
+      sqes=0;
+      goto fail;
+   }
+   sq_head=(unsigned*)((char*)sq_ptr+p.sq_off.head);
+   sq_tail=(unsigned*)((char*)sq_ptr+p.sq_off.tail);
+   sq_mask=(unsigned*)((char*)sq_ptr+p.sq_off.ring_mask);
+   sq_array=(unsigned*)((char*)sq_ptr+p.sq_off.array);
+   cq_head=(unsigned*)((char*)cq_ptr+p.cq_off.head);
+   cq_tail=(unsigned*)((char*)cq_ptr+p.cq_off.tail);
+   cq_mask=(unsigned*)((char*)cq_ptr+p.cq_off.ring_mask);
+   cqes=(struct io_uring_cqe*)((char*)cq_ptr+p.cq_off.cqes);
+   return;
+fail:
+   ProtoLog::LogError(9,"io_uring mmap: %s",strerror(errno));
+   Unmap();
+}
+void IOUringEngine::Unmap()
+{
+   if(sqes)
+      munmap(sqes,sqes_len);
+   if(cq_ptr!=MAP_FAILED && cq_ptr!=sq_ptr)
+      munmap(cq_ptr,cq_len);
+   if(sq_ptr!=MAP_FAILED)
+      munmap(sq_ptr,sq_len);
+   sqes=0;
+   sq_ptr=cq_ptr=MAP_FAILED;
+   if(ring_fd!=-1)
+      close(ring_fd);
+   ring_fd=-1;
+}
+IOUringEngine::~IOUringEngine()
+{
+   Unmap();
+}
+
+void IOUringEngine::Enter()
+{
+   while(unsubmitted>0)
+   {
+      int res=syscall(__NR_io_uring_enter,ring_fd,unsubmitted,0,0,NULL,0);
+      if(res<=0)
+	 break;	 // retry on next Start or Reap
+      unsubmitted-=res;
+   }
+}
+
+bool IOUringEngine::Start(AsyncFile::Request *r)
+{
+   if(in_flight>=entries)
+      return false;
+   unsigned tail=*sq_tail;
+   unsigned index=tail&*sq_mask;
+   struct io_uring_sqe *sqe=&sqes[index];
+   memset(sqe,0,sizeof(*sqe));
+   sqe->opcode=(r->write ? IORING_OP_WRITEV : IORING_OP_READV);
+   sqe->fd=r->fd();
+   sqe->off=r->offset;
+   sqe->addr=(unsigned long)&r->iov;
+   sqe->len=1;
+   sqe->user_data=(unsigned long)r;
+   sq_array[index]=index;
+   __atomic_store_n(sq_tail,tail+1,__ATOMIC_RELEASE);
+   in_flight++;
+   unsubmitted++;
+   Enter();
+   return true;
+}
+
+void IOUringEngine::Reap()
+{
+   Enter();
+   unsigned head=*cq_head;
+   for(;;)
+   {
+      unsigned tail=__atomic_load_n(cq_tail,__ATOMIC_ACQUIRE);
+      if(head==tail)
+	 break;
+      struct io_uring_cqe *cqe=&cqes[head&*cq_mask];
+      AsyncFile::Request *r=(AsyncFile::Request*)(unsigned long)cqe->user_data;
+      int res=cqe->res;
+      __atomic_store_n(cq_head,++head,__ATOMIC_RELEASE);
+      in_flight--;
+      Complete(r,res);
+   }
+}
+#endif // USE_IO_URING
+
+
+#ifdef HAVE_PTHREAD_H
+class ThreadEngine : public AsyncIOEngine
+{
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+   xlist_head<AsyncFile::Request> todo;
+   xlist_head<AsyncFile::Request> done;
+   int notify_pipe[2];
+   enum { MAX_THREADS=16 };
+   pthread_t threads[MAX_THREADS];
+   int thread_count;
+   int busy;   // threads doing I/O
+   bool quit;
+   bool abandoned;
+
+   static void *Worker(void *);
+   void Work();
+   bool AddThread();
+
+   bool Start(AsyncFile::Request *r);
+   void Reap();
+   int GetFD() { return notify_pipe[0]; }
+   void Abandon();
+
+public:
+   ThreadEngine();
+   ~ThreadEngine();
+   bool Ok() const { return notify_pipe[0]!=-1; }
+};
+
+ThreadEngine::ThreadEngine() : AsyncIOEngine("threads"),
+   thread_count(0), busy(0), quit(false), abandoned(false)
+{
+   pthread_mutex_init(&mutex,0);
+   pthread_cond_init(&cond,0);
+   if(pipe(notify_pipe)==-1)
+   {
+      ProtoLog::LogError(9,"pipe: %s",strerror(errno));
+      notify_pipe[0]=notify_pipe[1]=-1;
+      return;
+   }
+   SMTask::NewFD(notify_pipe[0]);
+   SMTask::NewFD(notify_pipe[1]);
+   for(int i=0; i<2; i++)
+   {
+      fcntl(notify_pipe[i],F_SETFL,O_NONBLOCK);
+      fcntl(notify_pipe[i],F_SETFD,FD_CLOEXEC);
+   }
+}
+ThreadEngine::~ThreadEngine()
+{
+   if(abandoned)
+      return;
+   // let the threads finish the queued writes
+   pthread_mutex_lock(&mutex);
+   quit=true;
+   pthread_cond_broadcast(&cond);
+   pthread_mutex_unlock(&mutex);
+   for(int i=0; i<thread_count; i++)
+      pthread_join(threads[i],0);
+   pthread_cond_destroy(&cond);
+   pthread_mutex_destroy(&mutex);
+   if(notify_pipe[0]!=-1)
+   {
+      close(notify_pipe[0]);
+      close(notify_pipe[1]);
+   }
+}
+void ThreadEngine::Abandon()
+{
+   // the threads did not survive fork, and the mutex could be locked.
+   abandoned=true;
+   close(notify_pipe[0]);
+   close(notify_pipe[1]);
+   notify_pipe[0]=notify_pipe[1]=-1;
+}
+
+bool ThreadEngine::AddThread()
+{
+   // the signals are handled by the main thread
+   sigset_t all,old;
+   sigfillset(&all);
+   pthread_sigmask(SIG_SETMASK,&all,&old);
+   int res=pthread_create(&threads[thread_count],0,Worker,this);
+   pthread_sigmask(SIG_SETMASK,&old,0);
+   if(res!=0)
+   {
+      ProtoLog::LogError(9,"pthread_create: %s",strerror(res));
+      return false;
+   }
+   thread_count++;
+   return true;
+}
+
+void *ThreadEngine::Worker(void *e)
+{
+   static_cast<ThreadEngine*>(e)->Work();
+   return 0;
+}
+void ThreadEngine::Work()
+{
+   pthread_mutex_lock(&mutex);
+   for(;;)
+   {
+      if(todo.get_next()==&todo)
+      {
+	 if(quit)
+	    break;
+	 pthread_cond_wait(&cond,&mutex);
+	 continue;
+      }
+      AsyncFile::Request *r=todo.first_obj();
+      r->work_node.remove();
+      busy++;
+      pthread_mutex_unlock(&mutex);
+
+      int res;
+      do {
+	 if(r->write)
+	    res=pwrite(r->fd(),r->buf,r->size,r->offset);
+	 else
+	    res=pread(r->fd(),r->buf,r->size,r->offset);
+      } while(res==-1 && errno==EINTR);
+      r->result=(res==-1 ? -errno : res);
+
+      pthread_mutex_lock(&mutex);
+      busy--;
+      done.add_tail(r->work_node);
+      if(write(notify_pipe[1],"",1)==-1)
+	 ;  // the pipe is full, the main loop will wake up anyway
+   }
+   pthread_mutex_unlock(&mutex);
+}
+
+bool ThreadEngine::Start(AsyncFile::Request *r)
+{
+   pthread_mutex_lock(&mutex);
+   todo.add_tail(r->work_node);
+   int idle=thread_count-busy;
+   pthread_cond_signal(&cond);
+   pthread_mutex_unlock(&mutex);
+   // one thread per request in flight, so that they can be done in parallel
+   if(idle<=0 && thread_count<MAX_THREADS)
+      AddThread();
+   if(thread_count==0)
+   {
+      r->work_node.remove();
+      return false;
+   }
+   return true;
+}
+
+void ThreadEngine::Reap()
+{
+   char buf[256];
+   while(read(notify_pipe[0],buf,sizeof(buf))>0)
+      ;
+   xlist_head<AsyncFile::Request> completed;
+   pthread_mutex_lock(&mutex);
+   while(done.get_next()!=&done)
+   {
+      AsyncFile::Request *r=done.first_obj();
+      r->work_node.remove();
+      completed.add_tail(r->work_node);
+   }
+   pthread_mutex_unlock(&mutex);
+   while(completed.get_next()!=&completed)
+   {
+      AsyncFile::Request *r=completed.first_obj();
+      r->work_node.remove();
+      Complete(r,r->result);
+   }
+}
+#endif // HAVE_PTHREAD_H
+
+
+SMTaskRef<AsyncIOEngine> AsyncIOEngine::engine;
+
+AsyncIOEngine::AsyncIOEngine(const char *t)
+   : pid(getpid()), running_count(0), type(t)
+{
+}
+
+AsyncIOEngine *AsyncIOEngine::New(const char *type)
+{
+#if defined(USE_IO_URING) || defined(HAVE_PTHREAD_H)
+   bool is_auto=!strcmp(type,"auto");
+#endif
+#ifdef USE_IO_URING
+   if(is_auto || !strcmp(type,"io_uring"))
+   {
+      IOUringEngine *e=new IOUringEngine();
+      if(e->Ok())
+	 return e;
+      SMTask::Delete(e);
+   }
+#endif
+#ifdef HAVE_PTHREAD_H
+   if(is_auto || !strcmp(type,"threads"))
+   {
+      ThreadEngine *e=new ThreadEngine();
+      if(e->Ok())
+	 return e;
+      SMTask::Delete(e);
+   }
+#endif
+   return 0;
+}
+
+AsyncIOEngine *AsyncIOEngine::Get()
+{
+   const char *type=ResMgr::Query("file:io-engine",0);
+   if(engine && engine->pid!=getpid())
+   {
+      // the process was forked, start the requests anew in this process.
+      ProtoLog::LogNote(9,"restarting %s I/O engine after fork",engine->type);
+      engine->Abandon();
+      xlist_head<AsyncFile::Request> restart;
+      while(engine->running_count>0)
+      {
+	 AsyncFile::Request *r=engine->running.first_obj();
+	 r->engine_node.remove();
+	 engine->running_count--;
+	 restart.add_tail(r->engine_node);
+      }
+      engine=New(engine->type);
+      while(restart.get_next()!=&restart)
+      {
+	 AsyncFile::Request *r=restart.first_obj();
+	 r->engine_node.remove();
+	 if(!engine || !engine->Submit(r))
+	 {
+	    r->result=-EIO;
+	    r->done=true;
+	    if(r->orphan)
+	       delete r;
+	 }
+      }
+   }
+   if(!strcmp(type,"none"))
+      return 0;
+   if(engine && strcmp(type,"auto") && strcmp(type,engine->type)
+   && engine->running_count==0)
+      engine=0;  // the setting was changed
+   if(!engine)
+   {
+      engine=New(type);
+      if(engine)
+	 ProtoLog::LogNote(9,"using %s I/O engine",engine->type);
+   }
+   return engine.get_non_const();
+}
+
+bool AsyncIOEngine::Submit(AsyncFile::Request *r)
+{
+   if(!Start(r))
+      return false;
+   running.add_tail(r->engine_node);
+   running_count++;
+   // the engine could have been scheduled already in this pass
+   Block(GetFD(),POLLIN);
+   return true;
+}
+
+void AsyncIOEngine::Complete(AsyncFile::Request *r,int result)
+{
+   r->engine_node.remove();
+   running_count--;
+   r->result=result;
+   r->done=true;
+   if(r->orphan)
+      delete r;
+}
+
+void AsyncIOEngine::Wait()
+{
+   struct pollfd pfd;
+   pfd.fd=GetFD();
+   pfd.events=POLLIN;
+   poll(&pfd,1,1000);
+   Reap();
+}
+
+int AsyncIOEngine::Do()
+{
+   if(running_count==0)
+      return STALL;
+   int was_running=running_count;
+   Reap();
+   if(running_count>0)
+      Block(GetFD(),POLLIN);
+   return running_count<was_running ? MOVED : STALL;
+}
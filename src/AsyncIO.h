@@ -0,0 +1,132 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 2026 by the lftp contributors (see the AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASYNCIO_H
+#define ASYNCIO_H 1
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "SMTask.h"
+#include "xlist.h"
+
+class AsyncIOEngine;
+
+// Reads and writes of a regular file done by an I/O engine (io_uring or
+// a pool of threads) instead of the main loop, so that a slow disk does not
+// stall other transfers. Reads are done ahead and writes behind the current
+// position, with up to file:io-queue-depth requests in flight.
+//
+// The methods follow read(2)/write(2) conventions; -1 with errno==EAGAIN
+// means the requests are not complete yet, the engine wakes up the main
+// loop when they are.
+class AsyncFile
+{
+public:
+   struct Handle;
+   struct Request
+   {
+      xlist<Request> file_node;	 // AsyncFile::queue
+      xlist<Request> engine_node; // AsyncIOEngine::running
+      xlist<Request> work_node;	 // used by the engine internally
+      Handle *handle;
+      off_t offset;
+      char *buf;
+      int size;
+      int consumed;
+      bool write;
+      bool done;
+      bool orphan;   // the file is closed, delete on completion
+      int result;    // bytes transferred or -errno
+      struct iovec iov;
+
+      Request(Handle *h,bool w,off_t o,int s);
+      ~Request();
+      int fd() const;
+   };
+
+private:
+   Handle *handle;
+   xlist_head<Request> queue;	 // in order of submission
+   int queued;
+   int depth;
+   off_t read_pos;   // offset of the next read ahead
+   int read_size;
+   bool read_eof;
+   int error;	     // errno of a failed write
+
+   AsyncFile(int fd);
+
+   bool Submit(Request *r);
+   void Drop(Request *r);
+   void DropAll();
+   void CollectWrites();
+
+public:
+   // returns 0 when async I/O is disabled or fd is not a regular file.
+   // The descriptor is duplicated and can be closed by the caller.
+   static AsyncFile *Open(int fd);
+   ~AsyncFile();
+
+   int Read(off_t pos,char *buf,int size);
+   int Write(off_t pos,const char *buf,int size);
+   // 0 when all writes are complete, -1 on error or EAGAIN
+   int Flush();
+   // wait for the writes synchronously
+   int Wait();
+   // the offset of the first write not complete yet, or -1 if all are.
+   off_t FirstPendingWrite();
+};
+
+class AsyncIOEngine : public SMTask
+{
+   friend class AsyncFile;
+
+   static SMTaskRef<AsyncIOEngine> engine;
+
+   pid_t pid;
+   xlist_head<AsyncFile::Request> running;
+   int running_count;
+
+   static AsyncIOEngine *New(const char *type);
+   static AsyncIOEngine *Get();
+   bool Submit(AsyncFile::Request *r);
+   void Wait();
+
+protected:
+   const char *type;
+
+   // start the request, false if no more requests can be queued now
+   virtual bool Start(AsyncFile::Request *r)=0;
+   // call Complete for finished requests
+   virtual void Reap()=0;
+   // readable when there are completions
+   virtual int GetFD()=0;
+   // the process was forked, release the resources without touching them
+   virtual void Abandon()=0;
+
+   void Complete(AsyncFile::Request *r,int result);
+
+   AsyncIOEngine(const char *t);
+
+public:
+   const char *GetClassName() { return "AsyncIOEngine"; }
+   int Do();
+};
+
+#endif//ASYNCIO_H
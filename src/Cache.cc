@@ -19,47 +19,200 @@
 
 #include <config.h>
 #include "Cache.h"
+#include "c-ctype.h"
 
+// Removes expired entries and the least recently used ones over the limits.
+// All the entries are checked for expiration not more often than once a second.
 void Cache::Trim()
 {
+   if(expire_timer.Stopped())
+   {
+      Expire();
+      expire_timer.Reset();
+   }
    long sizelimit=res_max_size->Query(0);
-
-   long size=0;
-   CacheEntry **scan=&chain;
-   while(scan[0])
+   while(lru.get_prev()!=&lru)
    {
-      if(scan[0]->Stopped())
-	 delete replace_value(scan[0],scan[0]->next);
+      CacheEntry *e=lru.get_prev()->get_obj();
+      if(e->Stopped())
+	 DeleteEntry(e);
+      else if(total_size>sizelimit)
+      {
+	 DeleteEntry(e);
+	 evictions++;
+      }
       else
+	 break;
+   }
+   if(!res_site_size)
+      return;
+   for(CacheSite *site=sites.each_begin(); site; site=sites.each_next())
+   {
+      long site_limit=res_site_size->Query(site->name);
+      if(site_limit<=0)
+	 continue;
+      while(site->size>site_limit)
       {
-	 size+=scan[0]->EstimateSize();
-	 scan=&scan[0]->next;
+	 bool last=(site->count==1);
+	 DeleteEntry(site->lru.get_prev()->get_obj());
+	 evictions++;
+	 if(last)
+	    break;  // the site is freed with its last entry
       }
    }
-// printf("Cache::Trim size=%ld, limit=%ld\n",size,sizelimit);
-   while(chain && size>sizelimit)
+}
+void Cache::Expire()
+{
+   for(CacheEntry *e=IterateFirst(); e; )
    {
-      size-=chain->EstimateSize();
-      delete replace_value(chain,chain->next);
+      if(e->Stopped())
+	 e=IterateDelete();
+      else
+	 e=IterateNext();
    }
 }
 void Cache::Flush()
 {
-   while(chain)
-      delete replace_value(chain,chain->next);
+   while(lru.get_next()!=&lru)
+      DeleteEntry(lru.get_next()->get_obj());
 }
 CacheEntry *Cache::IterateFirst()
 {
-   curr=&chain;
-   return *curr;
+   curr=lru.get_next();
+   return curr->get_obj();
 }
 CacheEntry *Cache::IterateNext()
 {
-   curr=&curr[0]->next;
-   return *curr;
+   curr=curr->get_next();
+   return curr->get_obj();
 }
 CacheEntry *Cache::IterateDelete()
 {
-   delete replace_value(curr[0],curr[0]->next);
-   return *curr;
+   CacheEntry *e=curr->get_obj();
+   curr=curr->get_next();
+   DeleteEntry(e);
+   return curr->get_obj();
+}
+
+void Cache::DeleteEntry(CacheEntry *e)
+{
+   e->lru_node.remove();
+   e->site_lru_node.remove();
+   total_size-=e->size;
+   e->site->size-=e->size;
+   if(--e->site->count==0)
+      sites.remove(xstring::get_tmp(e->site->name));
+   IndexRemove(e);
+   entry_count--;
+   delete e;
+}
+void Cache::SizeChanged(CacheEntry *e)
+{
+   int size=e->EstimateSize();
+   total_size+=size-e->size;
+   e->site->size+=size-e->size;
+   e->size=size;
+}
+CacheEntry *Cache::Found(CacheEntry *e)
+{
+   if(!e)
+   {
+      misses++;
+      return 0;
+   }
+   hits++;
+   e->lru_node.remove();
+   lru.add(e->lru_node);
+   e->site_lru_node.remove();
+   e->site->lru.add(e->site_lru_node);
+   return e;
+}
+
+void Cache::AddCacheEntry(CacheEntry *e,unsigned hash,const char *site_name)
+{
+   if(!site_name)
+      site_name="";
+   CacheSite *site=sites.lookup(site_name);
+   if(!site)
+   {
+      site=new CacheSite(site_name);
+      sites.add(site_name,site);
+   }
+   e->site=site;
+   site->count++;
+   lru.add(e->lru_node);
+   site->lru.add(e->site_lru_node);
+   SizeChanged(e);
+
+   e->hash=hash;
+   entry_count++;
+   if(entry_count<=index.count())
+   {
+      IndexAdd(e);
+      return;
+   }
+   // grow the index and add all the entries anew.
+   int size=index.count()*2;
+   if(size<64)
+      size=64;
+   index.get_space(size);
+   index.set_length(size);
+   for(int i=0; i<size; i++)
+      index[i]=0;
+   xlist_for_each(CacheEntry,lru,node,scan)
+      IndexAdd(scan);
+}
+void Cache::IndexAdd(CacheEntry *e)
+{
+   CacheEntry *&bucket=index[e->hash&(index.count()-1)];
+   e->hash_next=bucket;
+   bucket=e;
+}
+void Cache::IndexRemove(CacheEntry *e)
+{
+   CacheEntry **scan=&index[e->hash&(index.count()-1)];
+   while(*scan!=e)
+      scan=&scan[0]->hash_next;
+   *scan=e->hash_next;
+}
+
+CacheEntry *Cache::HashFirst(unsigned h) const
+{
+   if(!index)
+      return 0;
+   CacheEntry *e=index[h&(index.count()-1)];
+   while(e && e->hash!=h)
+      e=e->hash_next;
+   return e;
+}
+CacheEntry *Cache::HashNext(const CacheEntry *e)
+{
+   unsigned h=e->hash;
+   e=e->hash_next;
+   while(e && e->hash!=h)
+      e=e->hash_next;
+   return const_cast<CacheEntry*>(e);
+}
+
+unsigned Cache::Hash(unsigned h,const char *s)
+{
+   if(s)
+   {
+      while(*s)
+	 h+=(h<<5)+(unsigned char)*s++;
+   }
+   return h+(h<<5);
+}
+unsigned Cache::HashNoCase(unsigned h,const char *s)
+{
+   if(s)
+   {
+      while(*s)
+	 h+=(h<<5)+(unsigned char)c_tolower(*s++);
+   }
+   return h+(h<<5);
+}
+unsigned Cache::Hash(unsigned h,int n)
+{
+   return (h+(h<<5))^n;
 }
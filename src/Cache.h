@@ -21,42 +21,91 @@
 #define CACHE_H
 
 #include "Timer.h"
+#include "xmap.h"
+
+class Cache;
 
 class CacheEntry : public Timer
 {
    friend class Cache;
-   CacheEntry *next;
+   xlist<CacheEntry> lru_node;	 // most recently used first
+   xlist<CacheEntry> site_lru_node;
+   struct CacheSite *site;
+   int size;		 // as accounted in the cache totals
+   unsigned hash;	 // of the key, for the cache index
+   CacheEntry *hash_next;
 public:
-   CacheEntry() { next=0; }
+   CacheEntry() : lru_node(this), site_lru_node(this), site(0), size(0), hash(0), hash_next(0) {}
    virtual int EstimateSize() const { return 1; }
    virtual ~CacheEntry() {}
 };
+
+struct CacheSite
+{
+   xstring_c name;
+   xlist_head<CacheEntry> lru;
+   long size;
+   int count;
+   CacheSite(const char *n) : name(n), size(0), count(0) {}
+};
+
 class Cache
 {
    const ResType *res_max_size;
+   const ResType *res_site_size;
    const ResType *res_enable;
+
+   xlist_head<CacheEntry> lru;
+   long total_size;
+   xmap_p<CacheSite> sites;
+
+   // entries by hash of their keys, chained by hash_next.
+   xarray<CacheEntry*> index;
+   int entry_count;
+   void IndexAdd(CacheEntry *e);
+   void IndexRemove(CacheEntry *e);
+
+   xlist<CacheEntry> *curr;
+
+   Timer expire_timer;	 // for sweeping out all the expired entries
+
 protected:
-   CacheEntry *chain;
-   CacheEntry **curr;
+   long hits;
+   long misses;
+   long evictions;
+
    CacheEntry *IterateFirst();
    CacheEntry *IterateNext();
    CacheEntry *IterateDelete();
+
+   // iterate entries with given hash of the key (they may still differ).
+   CacheEntry *HashFirst(unsigned h) const;
+   static CacheEntry *HashNext(const CacheEntry *e);
+
+   void DeleteEntry(CacheEntry *e);
+   // a lookup result: counts hits and misses and marks the entry as used.
+   CacheEntry *Found(CacheEntry *e);
+   // to be called when data of an entry change.
+   void SizeChanged(CacheEntry *e);
+   void Expire();
+
 public:
+   // for computing hashes of entry keys.
+   static unsigned Hash(unsigned h,const char *s);
+   static unsigned HashNoCase(unsigned h,const char *s);
+   static unsigned Hash(unsigned h,int n);
+
    void Trim();
    void Flush();
-   Cache(const ResType *s,const ResType *e) {
-      res_max_size=s;
-      res_enable=e;
-      chain=0;
-      curr=0;
-   }
+   Cache(const ResType *s,const ResType *e,const ResType *site_s=0)
+      : res_max_size(s), res_site_size(site_s), res_enable(e),
+	total_size(0), entry_count(0), curr(0), expire_timer(1),
+	hits(0), misses(0), evictions(0) {}
    ~Cache() { Flush(); }
    bool IsEnabled(const char *closure) { return res_enable->QueryBool(closure); }
    long SizeLimit() { return res_max_size->Query(0); }
-   void AddCacheEntry(CacheEntry *e) {
-      e->next=chain;
-      chain=e;
-   }
+   long TotalSize() const { return total_size; }
+   void AddCacheEntry(CacheEntry *e,unsigned hash,const char *site);
 };
 
 #endif//CACHE_H
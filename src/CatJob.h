@@ -36,6 +36,7 @@ protected:
    void	NextFile();
 
 public:
+   const char *GetClassName() { return "CatJob"; }
    int Do();
    int Done();
    int ExitCode();
@@ -31,6 +31,7 @@ class CharReader : public SMTask
    int	 Do();
 
 public:
+   const char *GetClassName() { return "CharReader"; }
    enum { NOCHAR=-2, EOFCHAR=-1 };
 
    int	 GetChar() { return ch; };
@@ -0,0 +1,472 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 2026 by the lftp contributors (see the AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <string.h>
+#include "c-ctype.h"
+
+#include "Checksum.h"
+#include "WorkerPool.h"
+#include "misc.h"
+
+static const char *const algo_names[Checksum::ALGO_COUNT]={
+   "crc32","crc32c","md5","sha1","sha256"
+};
+static const int digest_sizes[Checksum::ALGO_COUNT]={
+   4,4,MD5_DIGEST_SIZE,SHA1_DIGEST_SIZE,SHA256_DIGEST_SIZE
+};
+// reflected polynomials of CRC-32 (IEEE 802.3) and CRC-32C (Castagnoli)
+static const unsigned crc_poly[2]={0xEDB88320,0x82F63B78};
+
+// the data are passed to a worker in parts of this size; when this much
+// is waiting for the worker, the main loop waits for it.
+#define HASH_PART     (256*1024)
+#define HASH_BACKLOG  (4*1024*1024)
+// the data kept while the algorithms are not chosen; beyond that the
+// checksum is given up.
+#define HASH_UNCHOSEN (16*1024*1024)
+
+unsigned Checksum::crc_table[2][8][256];
+
+void Checksum::InitCRCTables()
+{
+   if(crc_table[0][0][1])
+      return;
+   for(int t=0; t<2; t++)
+   {
+      for(unsigned i=0; i<256; i++)
+      {
+	 unsigned crc=i;
+	 for(int k=0; k<8; k++)
+	    crc=(crc>>1)^(crc_poly[t]&-(crc&1));
+	 crc_table[t][0][i]=crc;
+      }
+      // tables for processing 8 bytes at a time (slicing-by-8).
+      for(unsigned i=0; i<256; i++)
+	 for(int s=1; s<8; s++)
+	 {
+	    unsigned crc=crc_table[t][s-1][i];
+	    crc_table[t][s][i]=(crc>>8)^crc_table[t][0][crc&0xFF];
+	 }
+   }
+}
+
+unsigned Checksum::UpdateCRC(const unsigned (*table)[256],unsigned crc,
+			     const unsigned char *p,size_t len)
+{
+   while(len>=8)
+   {
+      unsigned a=crc^(p[0]|p[1]<<8|p[2]<<16|(unsigned)p[3]<<24);
+      crc=table[7][a&0xFF]^table[6][(a>>8)&0xFF]
+	 ^table[5][(a>>16)&0xFF]^table[4][a>>24]
+	 ^table[3][p[4]]^table[2][p[5]]
+	 ^table[1][p[6]]^table[0][p[7]];
+      p+=8;
+      len-=8;
+   }
+   while(len-->0)
+      crc=(crc>>8)^table[0][(crc^*p++)&0xFF];
+   return crc;
+}
+
+// a part of the data hashed by a worker thread.
+class ChecksumHashJob : public WorkerJob
+{
+public:
+   Checksum *checksum;
+   xstring data;
+
+   ChecksumHashJob(Checksum *c) : checksum(c) {}
+   void Run() {
+      checksum->Hash((const unsigned char*)data.get(),data.length());
+   }
+   void Finish() {
+      checksum->job=0;
+      if(checksum->pending.length()>=HASH_PART)
+	 checksum->SubmitPending();
+   }
+};
+
+Checksum::Checksum(unsigned a)
+   : algos(0), chosen(false), size(0), finished(false), job(0)
+{
+   SetAlgos(a);
+}
+Checksum::Checksum()
+   : algos(0), chosen(false), size(0), finished(false), job(0)
+{
+}
+Checksum::~Checksum()
+{
+   pending.unset();
+   while(job)
+      WorkerPool::Wait(job);
+}
+
+void Checksum::InitAlgos()
+{
+   crc32=crc32c=0xFFFFFFFF;
+   if(Has(CRC32) || Has(CRC32C))
+      InitCRCTables();
+   if(Has(MD5))
+      md5_init_ctx(&md5);
+   if(Has(SHA1))
+      sha1_init_ctx(&sha1);
+   if(Has(SHA256))
+      sha256_init_ctx(&sha256);
+}
+
+void Checksum::SetAlgos(unsigned a)
+{
+   if(chosen)
+      return;
+   chosen=true;
+   algos=a;
+   InitAlgos();
+   if(!algos)
+      pending.unset();
+   else if(pending.length()>=HASH_PART)
+      SubmitPending();
+}
+
+// it is called by a worker, only one at a time.
+void Checksum::Hash(const unsigned char *p,size_t len)
+{
+   if(Has(CRC32))
+      crc32=UpdateCRC(crc_table[0],crc32,p,len);
+   if(Has(CRC32C))
+      crc32c=UpdateCRC(crc_table[1],crc32c,p,len);
+   if(Has(MD5))
+      md5_process_bytes(p,len,&md5);
+   if(Has(SHA1))
+      sha1_process_bytes(p,len,&sha1);
+   if(Has(SHA256))
+      sha256_process_bytes(p,len,&sha256);
+}
+
+void Checksum::SubmitPending()
+{
+   job=new ChecksumHashJob(this);
+   job->data.move_here(pending);
+   // the job can be finished right away, it clears the pointer then.
+   WorkerPool::Submit(job);
+}
+
+void Checksum::Update(const void *buf,size_t len)
+{
+   if(finished || len==0 || (chosen && !algos))
+      return;
+   size+=len;
+   if(chosen && !job && !pending && WorkerPool::Threads()==0)
+   {
+      Hash((const unsigned char*)buf,len);
+      return;
+   }
+   pending.append((const char*)buf,len);
+   if(!chosen && pending.length()>=HASH_UNCHOSEN)
+   {
+      chosen=true;
+      algos=0;
+      pending.unset();
+      return;
+   }
+   if(!chosen || pending.length()<HASH_PART)
+      return;
+   if(job && pending.length()>=HASH_BACKLOG)
+      WorkerPool::Wait(job);  // it submits the pending data
+   if(!job)
+      SubmitPending();
+}
+
+static void to_hex(xstring_c& out,const unsigned char *p,int len)
+{
+   static const char hex[]="0123456789abcdef";
+   xstring& s=xstring::get_tmp("");
+   while(len-->0)
+   {
+      s.append(hex[*p>>4]);
+      s.append(hex[*p++&15]);
+   }
+   out.set(s);
+}
+
+void Checksum::Finish()
+{
+   if(finished)
+      return;
+   finished=true;
+   while(job)
+      WorkerPool::Wait(job);
+   if(pending)
+   {
+      Hash((const unsigned char*)pending.get(),pending.length());
+      pending.unset();
+   }
+   unsigned char res[SHA256_DIGEST_SIZE];
+   for(int a=0; a<ALGO_COUNT; a++)
+   {
+      if(!Has(a))
+	 continue;
+      switch((algo_t)a)
+      {
+      case CRC32:
+      case CRC32C: {
+	 // the CRC is written as a big endian number.
+	 unsigned crc=~(a==CRC32?crc32:crc32c);
+	 for(int i=0; i<4; i++)
+	    res[i]=crc>>(24-i*8);
+	 break;
+      }
+      case MD5:
+	 md5_finish_ctx(&md5,res);
+	 break;
+      case SHA1:
+	 sha1_finish_ctx(&sha1,res);
+	 break;
+      case SHA256:
+	 sha256_finish_ctx(&sha256,res);
+	 break;
+      case ALGO_COUNT:
+	 break;
+      }
+      to_hex(digest[a],res,digest_sizes[a]);
+   }
+}
+
+static int base64_value(char c)
+{
+   if(c>='A' && c<='Z')
+      return c-'A';
+   if(c>='a' && c<='z')
+      return c-'a'+26;
+   if(c>='0' && c<='9')
+      return c-'0'+52;
+   if(c=='+' || c=='-')
+      return 62;
+   if(c=='/' || c=='_')
+      return 63;
+   return -1;
+}
+
+// decode base64 of exactly size bytes, false if it is not.
+static bool base64_decode(const char *s,int len,unsigned char *out,int size)
+{
+   while(len>0 && s[len-1]=='=')
+      len--;
+   if(len!=(size*8+5)/6)
+      return false;
+   unsigned acc=0;
+   int bits=0,n=0;
+   for(int i=0; i<len; i++)
+   {
+      int v=base64_value(s[i]);
+      if(v<0)
+	 return false;
+      acc=(acc<<6)|v;
+      bits+=6;
+      if(bits>=8)
+      {
+	 bits-=8;
+	 out[n++]=(acc>>bits)&0xFF;
+      }
+   }
+   return n==size;
+}
+
+static bool is_hex(const char *s,int len)
+{
+   for(int i=0; i<len; i++)
+      if(!c_isxdigit(s[i]))
+	 return false;
+   return true;
+}
+
+bool Checksum::SetExpected(int a,const char *value)
+{
+   int len=strlen(value);
+   int size=digest_sizes[a];
+   if(len==size*2 && is_hex(value,len))
+   {
+      expected[a].set(xstring::get_tmp(value).c_lc());
+      return true;
+   }
+   unsigned char res[SHA256_DIGEST_SIZE];
+   if(!base64_decode(value,len,res,size))
+      return false;
+   to_hex(expected[a],res,size);
+   return true;
+}
+
+bool Checksum::HasExpected() const
+{
+   for(int a=0; a<ALGO_COUNT; a++)
+      if(Has(a) && expected[a])
+	 return true;
+   return false;
+}
+
+bool Checksum::SetExpectedFromReply(int a,const char *reply)
+{
+   // only the last line has the result.
+   const char *line=reply;
+   const char *nl;
+   while((nl=strchr(line,'\n'))!=0 && nl[1])
+      line=nl+1;
+   if(line[0]!='2' || !c_isdigit(line[1]) || !c_isdigit(line[2]))
+      return false;
+   const char *p=line+3;
+   p+=strspn(p," \t");
+   int len=strcspn(p," \t\r\n");
+   // HASH replies with the algorithm and the range before the digest.
+   if(FindAlgo(xstring::get_tmp(p,len))==a)
+   {
+      for(int field=0; field<2; field++)
+      {
+	 p+=len;
+	 p+=strspn(p," \t");
+	 len=strcspn(p," \t\r\n");
+      }
+   }
+   if(len>2 && p[0]=='0' && (p[1]=='x' || p[1]=='X'))
+      p+=2,len-=2;
+   if(len!=digest_sizes[a]*2 || !is_hex(p,len))
+      return false;
+   expected[a].set(xstring::get_tmp(p,len).c_lc());
+   return true;
+}
+
+void Checksum::SetExpectedFromList(const char *list)
+{
+   char *copy=alloca_strdup(list);
+   for(char *t=strtok(copy,","); t; t=strtok(0,","))
+   {
+      while(*t==' ' || *t=='\t')
+	 t++;
+      char *eq=strchr(t,'=');
+      if(!eq)
+	 continue;
+      *eq++=0;
+      int a=FindAlgo(t);
+      if(a<0 || !Has(a))
+	 continue;
+      // the structured field syntax has the value in colons.
+      int len=strcspn(eq," \t;");
+      eq[len]=0;
+      if(eq[0]==':' && len>1 && eq[len-1]==':')
+      {
+	 eq[len-1]=0;
+	 eq++;
+      }
+      SetExpected(a,eq);
+   }
+}
+
+unsigned Checksum::ListAlgos(const char *list)
+{
+   unsigned mask=0;
+   char *copy=alloca_strdup(list);
+   for(char *t=strtok(copy,","); t; t=strtok(0,","))
+   {
+      t+=strspn(t," \t");
+      t[strcspn(t,"=")]=0;
+      int a=FindAlgo(t);
+      if(a>=0)
+	 mask|=1<<a;
+   }
+   return mask;
+}
+
+int Checksum::Compare(xstring *msg) const
+{
+   int res=-1;
+   for(int a=0; a<ALGO_COUNT; a++)
+   {
+      if(!digest[a] || !expected[a])
+	 continue;
+      if(strcmp(digest[a],expected[a]))
+      {
+	 msg->setf(_("%s checksum mismatch: expected %s, got %s"),
+	    AlgoName(a),expected[a].get(),digest[a].get());
+	 return 0;
+      }
+      res=1;
+   }
+   return res;
+}
+
+int Checksum::DigestSize(int a)
+{
+   return digest_sizes[a];
+}
+const char *Checksum::AlgoName(int a)
+{
+   return algo_names[a];
+}
+
+// SHA-256, sha256 and SHA256 are the same; SHA is SHA-1 (RFC 3230).
+int Checksum::FindAlgo(const char *name)
+{
+   char *n=alloca_strdup(name);
+   char *store=n;
+   for(const char *p=name; *p; p++)
+      if(*p!='-')
+	 *store++=c_tolower(*p);
+   *store=0;
+   if(!strcmp(n,"sha"))
+      return SHA1;
+   for(int a=0; a<ALGO_COUNT; a++)
+      if(!strcmp(n,algo_names[a]))
+	 return a;
+   return -1;
+}
+
+unsigned Checksum::ParseList(const char *list)
+{
+   unsigned mask=0;
+   char *copy=alloca_strdup(list);
+   for(char *t=strtok(copy,", "); t; t=strtok(0,", "))
+   {
+      int a=FindAlgo(t);
+      if(a>=0)
+	 mask|=1<<a;
+   }
+   return mask;
+}
+
+const char *Checksum::ValidateList(xstring_c *s)
+{
+   if(!*s)
+      return 0;
+   char *copy=alloca_strdup(*s);
+   for(char *t=strtok(copy,", "); t; t=strtok(0,", "))
+      if(FindAlgo(t)<0)
+	 return _("unknown checksum algorithm");
+   return 0;
+}
+
+const char *Checksum::ValidateAlgo(xstring_c *s)
+{
+   if(xstrlen(*s)==0)
+      return 0;
+   int a=FindAlgo(*s);
+   if(a<0)
+      return _("unknown checksum algorithm");
+   s->set(algo_names[a]);
+   return 0;
+}
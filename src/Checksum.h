@@ -0,0 +1,109 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 2026 by the lftp contributors (see the AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H 1
+
+#include <sys/types.h>
+#include "md5.h"
+#include "sha1.h"
+#include "sha256.h"
+#include "xstring.h"
+
+class ChecksumHashJob;
+
+// Computes several digests of a byte stream in one pass and keeps the
+// reference values of the same digests obtained elsewhere (from a server
+// reply or a header) to compare them at the end.
+// The hashing is done by the CPU worker pool when it has threads. The
+// algorithms can be chosen after the data have started to come, the data
+// are kept until then, up to a limit; with no algorithms chosen by then the
+// checksum is not computed.
+class Checksum
+{
+   friend class ChecksumHashJob;
+
+public:
+   enum algo_t { CRC32, CRC32C, MD5, SHA1, SHA256, ALGO_COUNT };
+
+private:
+   unsigned algos;   // bit mask of algo_t
+   bool chosen;	     // the algorithms are set
+   off_t size;
+   bool finished;
+
+   xstring pending;	   // the data not hashed yet
+   ChecksumHashJob *job;   // a worker is hashing a part of the data
+   void InitAlgos();
+   void Hash(const unsigned char *p,size_t len);
+   void SubmitPending();
+
+   unsigned crc32;
+   unsigned crc32c;
+   md5_ctx md5;
+   sha1_ctx sha1;
+   sha256_ctx sha256;
+
+   xstring_c digest[ALGO_COUNT];    // hex, set by Finish
+   xstring_c expected[ALGO_COUNT];  // hex
+
+   static unsigned crc_table[2][8][256];
+   static void InitCRCTables();
+   static unsigned UpdateCRC(const unsigned (*table)[256],unsigned crc,
+			     const unsigned char *p,size_t len);
+
+public:
+   Checksum(unsigned algos);
+   Checksum();	  // the algorithms are set later
+   ~Checksum();
+
+   void SetAlgos(unsigned a);
+   bool AlgosChosen() const { return chosen; }
+   bool Has(int a) const { return algos&(1<<a); }
+   unsigned GetAlgos() const { return algos; }
+
+   void Update(const void *buf,size_t len);
+   void Finish();
+   off_t GetSize() const { return size; }
+   const char *GetDigest(int a) const { return digest[a]; }
+
+   // the reference value in hex or base64.
+   bool SetExpected(int a,const char *value);
+   const char *GetExpected(int a) const { return expected[a]; }
+   bool HasExpected() const;
+   // a reply line like `213 SHA-256 0-1000 <hex> file' (HASH)
+   // or `250 <hex>' (XCRC, XMD5, XSHA1, XSHA256).
+   bool SetExpectedFromReply(int a,const char *reply);
+   // a list like `SHA-256=<base64>, MD5=<base64>' (Digest header).
+   void SetExpectedFromList(const char *list);
+   // the algorithms of such a list.
+   static unsigned ListAlgos(const char *list);
+   // 1 if the digests match the reference, 0 on a mismatch (with
+   // an explanation in msg), -1 if there is nothing to compare.
+   int Compare(xstring *msg) const;
+
+   static int DigestSize(int a);
+   static const char *AlgoName(int a);
+   static int FindAlgo(const char *name);
+   static unsigned ParseList(const char *list);
+   static const char *ValidateList(xstring_c *s);
+   static const char *ValidateAlgo(xstring_c *s);
+};
+
+#endif//CHECKSUM_H
@@ -29,6 +29,7 @@ CDECL_END
 class ChmodJob : public TreatFileJob
 {
 public:
+   const char *GetClassName() { return "ChmodJob"; }
    enum verbosity { V_NONE, V_CHANGES, V_ALL };
 
 private:
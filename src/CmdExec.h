@@ -61,6 +61,7 @@ extern CmdFeeder *lftp_feeder;	 // feeder to use after 'lftp' command
 class CmdExec : public SessionJob, public ResClient
 {
 public:
+   const char *GetClassName() { return "CmdExec"; }
 // current command data
    Ref<ArgV> args;
    Ref<FDStream> output;
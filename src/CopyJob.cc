@@ -206,7 +206,7 @@ int CopyJobEnv::Do()
    int m=STALL;
    if(done)
       return m;
-   if(waiting_num<parallel)
+   if(waiting_num-WaitingFinishing(parallel)<parallel)
    {
       NextFile();
       if(waiting_num==0)
@@ -42,6 +42,7 @@ protected:
    void PrepareToDie();
 
 public:
+   const char *GetClassName() { return "CopyJob"; }
    CopyJob(FileCopy *c1,const char *n,const char *op1);
    ~CopyJob();
 
@@ -68,6 +69,7 @@ public:
    double GetTimeSpent() { return c->GetTimeSpent(); }
    off_t GetBytesCount() { return c->GetBytesCount(); }
    double GetTransferRate() { return c->GetTransferRate(); }
+   bool IsFinishing() { return c->IsFinishing(); }
    off_t GetSize() { return c->GetSize(); }
    off_t GetPos()  { return c->GetPos(); }
    float GetRate() { return c->GetRate(); }
@@ -132,6 +134,7 @@ protected:
    Ref<CopyJobCreator> cj_new;
 
 public:
+   const char *GetClassName() { return "CopyJobEnv"; }
    int Do();
    int Done();
    virtual int ExitCode() { return errors!=0; }
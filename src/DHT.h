@@ -222,6 +222,7 @@ class DHT : public SMTask, protected ProtoLog, public ResClient
    SMTaskRef<IOBuffer> state_io;
 
 public:
+   const char *GetClassName() { return "DHT"; }
    DHT(int af,const xstring &id);
    ~DHT();
    int Do();
@@ -25,6 +25,7 @@
 class DummyProto : public FileAccess
 {
 public:
+   const char *GetClassName() { return "DummyProto"; }
    int Do();
    int Done();
    const char *GetProto() const;
@@ -38,6 +38,7 @@ class EditJob : public SessionJob
    void Finish(int code);
 
 public:
+   const char *GetClassName() { return "EditJob"; }
    EditJob(FileAccess *s,const char *f,const char *t)
       : SessionJob(s), file(f), temp_file(t), keep(false),
         mtime(0), exit_code(0), done(false) {}
@@ -67,11 +67,13 @@ void FileAccess::Init()
    saved_errno=0;
    mkdir_p=false;
    rename_f=false;
+   allow_deferred=false;
    ascii=false;
    norest_manual=false;
 
    entity_size=NO_SIZE;
    entity_date=NO_DATE;
+   not_modified=false;
 
    res_prefix=0;
 
@@ -195,6 +197,7 @@ void FileAccess::Close()
    opt_size=0;
    fileset_for_info=0;
    retries=0;
+   limit=FILE_END;
    entity_size=NO_SIZE;
    entity_date=NO_DATE;
    ascii=false;
@@ -202,6 +205,10 @@ void FileAccess::Close()
    location.set(0);
    entity_content_type.set(0);
    entity_charset.set(0);
+   entity_digest.set(0);
+   validator.set(0);
+   cond_validator.set(0);
+   not_modified=false;
    ClearError();
 }
 
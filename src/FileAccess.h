@@ -48,6 +48,7 @@ class FileAccess : public SMTask, public ResClient, protected ProtoLog
 {
    static bool class_inited;
 public:
+   const char *GetClassName() { return "FileAccess"; }
    static class LsCache *cache;
    enum open_mode
    {
@@ -135,6 +136,7 @@ protected:
 
    bool	 mkdir_p;
    bool	 rename_f;
+   bool	 allow_deferred;
 
    int	 saved_errno;
 
@@ -181,6 +183,11 @@ protected:
 
    xstring_c entity_content_type;
    xstring_c entity_charset;
+   xstring_c entity_digest;   // like `SHA-256=<base64>, MD5=<base64>'
+
+   xstring_c validator;	      // of the listing received, like ETag
+   xstring_c cond_validator;  // get the listing only if it does not match
+   bool not_modified;	      // the listing matches cond_validator
 
    xstring_c last_disconnect_cause;
 
@@ -248,10 +255,30 @@ public:
    void	 GetInfoArray(FileSet *info);
    int	 InfoArrayPercentDone() { return fileset_for_info->curr_pct(); }
 
+   // Let simple requests (remove, mkdir, chmod) be reported done before the
+   // server replies, so that the next ones can be sent without waiting.
+   // The caller has to collect the late failures with GetDeferredError
+   // until DeferredCount drops to zero.
+   void	 AllowDeferred(bool yes=true) { allow_deferred=yes; }
+   virtual int DeferredCount() { return 0; }
+   virtual const char *GetDeferredError() { return 0; }
+
    virtual const char *CurrentStatus();
 
    virtual int Read(Buffer *buf,int size) = 0;
    virtual int Write(const void *buf,int size) = 0;
+   // kernel-assisted Read/Write to/from a local file at its current offset,
+   // NOT_SUPP means the usual Read/Write has to be used. Zero size checks if
+   // it is possible and makes the session stop buffering more data.
+   virtual int DirectRead(int fd,int size) { return NOT_SUPP; }
+   virtual int DirectWrite(int fd,int size) { return NOT_SUPP; }
+   // a command (for QUOTE_CMD) asking the server for a checksum of the file
+   // with one of the Checksum algorithms in the mask, returned in algo.
+   virtual const char *ChecksumCommand(const char *file,unsigned algos,int *algo) const { return 0; }
+   // the algorithm ChecksumCommand would use, -1 if none,
+   // CHECKSUM_UNKNOWN while the server features are not known yet.
+   enum { CHECKSUM_UNKNOWN=-2 };
+   virtual int ChecksumAlgo(unsigned algos) const { return -1; }
    virtual int Buffered();
    virtual int StoreStatus() = 0;
    virtual bool IOReady();
@@ -329,6 +356,11 @@ public:
    const char *GetSuggestedFileName() { return suggested_filename; }
    const char *GetEntityContentType() { return entity_content_type; }
    const char *GetEntityCharset() { return entity_charset; }
+   const char *GetEntityDigest() { return entity_digest; }
+
+   const char *GetValidator() const { return validator; }
+   void SetConditional(const char *v) { cond_validator.set(v); }
+   bool NotModified() const { return not_modified; }
 
    void Reconfig(const char *);
 
@@ -496,6 +528,7 @@ protected:
    ~ListInfo();
 
 public:
+   const char *GetClassName() { return "ListInfo"; }
    ListInfo(FileAccess *session,const char *path);
 
    void SetExclude(const char *p,const PatternSet *e) { exclude_prefix=p; exclude=e; excluded=new FileSet(); }
@@ -535,6 +568,7 @@ protected:
    ~DirList();
 
 public:
+   const char *GetClassName() { return "DirList"; }
    DirList(FileAccess *s,ArgV *a);
 
    virtual int Do() = 0;
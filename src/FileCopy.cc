@@ -47,11 +47,15 @@
 #include "ArgV.h"
 
 #define skip_threshold 0x1000
+#define direct_copy_size 0x100000
 
 ResDecl rate_period  ("xfer:rate-period","15", ResMgr::UNumberValidate,ResMgr::NoClosure);
 ResDecl eta_period   ("xfer:eta-period", "120",ResMgr::UNumberValidate,ResMgr::NoClosure);
 ResDecl max_redir    ("xfer:max-redirections", "5",ResMgr::UNumberValidate,ResMgr::NoClosure);
 ResDecl buffer_size  ("xfer:buffer-size","0x10000",ResMgr::UNumberValidate,ResMgr::NoClosure);
+ResDecl kernel_copy  ("xfer:kernel-copy","yes",ResMgr::BoolValidate,ResMgr::NoClosure);
+ResDecl checksum_algos("xfer:checksum","crc32,crc32c,md5,sha1,sha256",Checksum::ValidateList,ResMgr::NoClosure);
+ResDecl checksum_file("xfer:checksum-file","",Checksum::ValidateAlgo,ResMgr::NoClosure);
 
 // It's bad when lftp receives data in small chunks, try to accumulate
 // data in a kernel buffer using a delay and slurp it at once:
@@ -149,6 +153,13 @@ int FileCopy::Do()
       if(get->CanSeek())
 	 get->Seek(put->GetRealPos());
    pre_DO_COPY:
+      if(!checksum && put->WantChecksum() && !line_buffer
+      && (ResMgr::QueryBool("xfer:verify",0) || *checksum_file.Query(0)))
+      {
+	 // the algorithms are chosen when the servers are ready.
+	 checksum=new Checksum();
+	 checksum_pos=0;
+      }
       get->Resume();
       get->StartTransfer();
       RateReset();
@@ -255,7 +266,7 @@ int FileCopy::Do()
 	    if(!put->CanSeek(get->GetRealPos()) || skip<skip_threshold)
 	    {
 	       // we have to skip some data
-	       get->Get(&b,&s);
+	       get->GetSpan(&b,&s);
 	       if(skip>s)
 		  skip=s;
 	       if(skip==0)
@@ -270,9 +281,29 @@ int FileCopy::Do()
 	    return MOVED;
 	 }
       }
+      if(direct_copy && !checksum)
+      {
+	 int res=DirectCopy();
+	 if(res==0)
+	    return m;
+	 if(res>0)
+	 {
+	    bytes_count+=res;
+	    rate_add=put_buf+res;
+	    put_buf=put->Buffered();
+	    rate_add-=put_buf;
+	    RateAdd(rate_add);
+	    if(high_watermark<put_pos+res)
+	    {
+	       high_watermark=put_pos+res;
+	       high_watermark_timeout.Reset();
+	    }
+	    return MOVED;
+	 }
+      }
       if(put->IsFull())
 	 get->Suspend(); // stall the get.
-      get->Get(&b,&s);
+      get->GetSpan(&b,&s);
       if(b==0) // eof
       {
 	 debug((10,"copy: get hit eof\n"));
@@ -329,6 +360,8 @@ int FileCopy::Do()
       }
       else
       {
+	 if(checksum)
+	    UpdateChecksum(b,s);
 	 put->Put(b,s);
 	 get->Skip(s);
 	 bytes_count+=s;
@@ -364,6 +397,8 @@ int FileCopy::Do()
 	 SetError(_("file size decreased during transfer"));
 	 return MOVED;
       }
+      if(checksum && !FinishChecksum())
+	 return m;
    pre_CONFIRM_WAIT:
       if(put->IsAutoRename())
 	 put->SetSuggestedFileName(get->GetSuggestedFileName());
@@ -449,6 +484,7 @@ FileCopy::FileCopy(FileCopyPeer *s,FileCopyPeer *d,bool c)
       max_buf=1;
    s->SetMaxBuffered(max_buf);
    d->SetMaxBuffered(max_buf);
+   SetMemoryGroup(IOBuffer::NewMemoryGroup());
    put_buf=0;
    put_eof_pos=0;
    high_watermark=0;
@@ -458,6 +494,8 @@ FileCopy::FileCopy(FileCopyPeer *s,FileCopyPeer *d,bool c)
    remove_source_later=false;
    remove_target_first=false;
    line_buffer_max=0;
+   direct_copy=kernel_copy.QueryBool(0);
+   checksum_pos=0;
 }
 FileCopy::~FileCopy()
 {
@@ -471,6 +509,129 @@ FileCopy *FileCopy::New(FileCopyPeer *s,FileCopyPeer *d,bool c)
       return res;
    return new FileCopy(s,d,c);
 }
+void FileCopy::UpdateChecksum(const char *b,int s)
+{
+   off_t p=get->GetRealPos();
+   if(p>checksum_pos)
+   {
+      // some data were not seen (continued transfer or a seek).
+      checksum=0;
+      return;
+   }
+   if(p+s<=checksum_pos)
+      return;  // seen before the roll-back
+   checksum->Update(b+(checksum_pos-p),p+s-checksum_pos);
+   checksum_pos=p+s;
+   if(!checksum->AlgosChosen())
+      ChooseChecksum();
+   else if(!checksum->GetAlgos())
+      checksum=0;  // the server was too slow to tell its features
+}
+// Hash only what can be compared: the algorithm of the checksum file and
+// one the source or the target server can report. Returns false while
+// a server has not told its features yet.
+bool FileCopy::ChooseChecksum()
+{
+   unsigned algos=0;
+   int a=Checksum::FindAlgo(checksum_file.Query(0));
+   if(a>=0)
+      algos|=1<<a;
+   if(ResMgr::QueryBool("xfer:verify",0))
+   {
+      unsigned allowed=Checksum::ParseList(checksum_algos.Query(0));
+      const char *digest=get->GetEntityDigest();
+      unsigned listed=(digest ? Checksum::ListAlgos(digest)&allowed : 0);
+      FileCopyPeer *peer[2]={get.get_non_const(),put.get_non_const()};
+      for(int i=0; i<2 && !listed; i++)
+      {
+	 const FileAccessRef& session=peer[i]->GetSession();
+	 if(!session)
+	    continue;
+	 int a=session->ChecksumAlgo(allowed);
+	 if(a==FA::CHECKSUM_UNKNOWN)
+	    return false;
+	 if(a>=0)
+	    listed=1<<a;
+      }
+      algos|=listed;
+   }
+   if(!algos)
+   {
+      checksum=0;
+      return true;
+   }
+   checksum->SetAlgos(algos);
+   return true;
+}
+// Complete the checksum at eof and get the reference value from the source,
+// then pass it to put for verification. Returns false while waiting.
+bool FileCopy::FinishChecksum()
+{
+   if(!checksum_query)
+   {
+      if(!checksum->AlgosChosen() && !ChooseChecksum())
+	 return false;
+      if(!checksum)
+	 return true;
+      if(get->range_start>0 || get->range_limit!=FILE_END || put->range_start>0
+      || checksum_pos!=get->GetRealPos()
+      || (get->GetSize()>=0 && checksum_pos!=get->GetSize()))
+      {
+	 // it does not cover the whole file.
+	 checksum=0;
+	 return true;
+      }
+      checksum->Finish();
+      const char *digest=get->GetEntityDigest();
+      if(digest)
+	 checksum->SetExpectedFromList(digest);
+      const FileAccessRef& session=get->GetSession();
+      if(!checksum->HasExpected() && session && get->GetFile()
+      && ResMgr::QueryBool("xfer:verify",0))
+      {
+	 checksum_query=new ChecksumQuery(session,get->GetFile(),checksum.get_non_const());
+	 checksum_query->Roll();
+      }
+   }
+   if(checksum_query && !checksum_query->Done())
+      return false;
+   checksum_query=0;
+   put->SetChecksum(checksum.borrow());
+   return true;
+}
+
+// Copy data between a local file and a session with splice or sendfile,
+// bypassing the buffers. Returns the number of bytes copied, 0 to wait
+// or -1 if the usual way has to be used.
+int FileCopy::DirectCopy()
+{
+   if(line_buffer || get->range_limit!=FILE_END)
+      return -1;
+   // buffered data go the usual way, but no more data get buffered.
+   bool drain=(get->Size()>0 || put->Size()>0);
+   int len=(drain ? 0 : direct_copy_size);
+   int res;
+   int fd=put->GetDirectFD();
+   if(fd!=-1)
+   {
+      res=get->DirectCopy(fd,len);
+      if(res>0)
+	 put->DirectMoved(res);
+   }
+   else
+   {
+      fd=get->GetDirectFD();
+      if(fd==-1)
+	 return -1;
+      res=put->DirectCopy(fd,len);
+      if(res>0)
+	 get->DirectMoved(res);
+      if(res>=0)
+	 get->Suspend();  // the file is read by the session now.
+   }
+   return drain ? -1 : res;
+}
+
 void FileCopy::SuspendInternal()
 {
    super::SuspendInternal();
@@ -814,6 +975,21 @@ bool FileCopyPeer::ShouldRename() const
    return (auto_rename || temp_file) && suggested_filename;
 }
 
+// write the checksum next to the local file in the format of md5sum(1).
+void FileCopyPeer::WriteChecksumFile(const char *file)
+{
+   int a=Checksum::FindAlgo(checksum_file.Query(0));
+   if(a<0 || !checksum->GetDigest(a))
+      return;
+   const char *sum_file=xstring::cat(file,".",Checksum::AlgoName(a),NULL);
+   const xstring& line=xstring::cat(checksum->GetDigest(a),"  ",basename_ptr(file),"\n",NULL);
+   int fd=open(sum_file,O_WRONLY|O_CREAT|O_TRUNC,0644);
+   if(fd==-1 || write(fd,line,line.length())!=(int)line.length())
+      debug((3,"%s: %s\n",sum_file,strerror(errno)));
+   if(fd!=-1)
+      close(fd);
+}
+
 FileCopyPeer::FileCopyPeer(dir_t m) : IOBuffer(m)
 {
    want_size=false;
@@ -972,10 +1148,10 @@ int FileCopyPeerFA::Do()
 	    goto fxp_eof;
 	 return m;
       }
-      res=Put_LL(buffer+buffer_ptr,Size());
+      res=Put_LL(Span(),SpanSize());
       if(res>0)
       {
-	 buffer_ptr+=res;
+	 Consume(res);
 	 m=MOVED;
       }
       else if(res<0)
@@ -996,7 +1172,7 @@ int FileCopyPeerFA::Do()
 	       // FIXME: set date for real.
 	       date_set=true;
 	       if(!verify && do_verify)
-		  verify=new FileVerificator(session,file);
+		  verify=new FileVerificator(session,file,checksum.get_non_const());
 	       else
 		  done=true;
 	       return MOVED;
@@ -1030,6 +1206,11 @@ int FileCopyPeerFA::Do()
 	 return m;
       if(fxp)
 	 return m;
+      if(OverMemoryLimit())
+      {
+	 Timeout(100);
+	 return m;
+      }
       res=TuneGetSize(Get_LL(get_size));
       if(res>0)
       {
@@ -1041,6 +1222,7 @@ int FileCopyPeerFA::Do()
 	 return MOVED;
       if(eof)
       {
+	 entity_digest.set(session->GetEntityDigest());
 	 session->Close();
 	 return MOVED;
       }
@@ -1313,6 +1495,23 @@ int FileCopyPeerFA::Put_LL(const char *buf,int len)
    return res;
 }
 
+int FileCopyPeerFA::DirectCopy(int fd,int len)
+{
+   if(fxp || do_mkdir || eof
+   || session->IsClosed() || session->OpenMode()!=FAmode)
+      return -1;
+   off_t io_at=pos;
+   if(GetRealPos()!=io_at)
+      return -1;
+   int res=(mode==GET ? session->DirectRead(fd,len) : session->DirectWrite(fd,len));
+   if(res<0)
+      return res==FA::DO_AGAIN ? 0 : -1;
+   pos+=res;
+   if(mode==PUT)
+      seek_pos+=res;
+   return res;
+}
+
 int FileCopyPeerFA::PutEOF_LL()
 {
    if(mode==GET && session)
@@ -1357,6 +1556,9 @@ void FileCopyPeerFA::Init()
    can_seek0=true;
    if(FAmode==FA::LIST || FAmode==FA::LONG_LIST)
       Save(FileAccess::cache->SizeLimit());
+   // let the session pass its buffer segments here without copying
+   if(mode==GET && FAmode==FA::RETRIEVE)
+      SetSegmented(true);
    if(mode==PUT)
       file.set(UseTempFile(file));
 }
@@ -1431,6 +1633,9 @@ FileCopyPeerFDStream::FileCopyPeerFDStream(const Ref<FDStream>& o,dir_t m)
 void FileCopyPeerFDStream::Init()
 {
    seek_base=0;
+   direct_fd=-1;
+   direct_ok=false;
+   async_checked=false;
    create_fg_data=true;
    need_seek=false;
    can_seek = can_seek0 = stream->can_seek();
@@ -1543,6 +1748,7 @@ int FileCopyPeerFDStream::Do()
       }
       else if(verify->Done())
       {
+	 xstring_c name(stream?stream->full_name.get():0);
 	 if(ShouldRename() && stream && stream->full_name)
 	 {
 	    const char *new_name=dir_file(dirname(stream->full_name),suggested_filename);
@@ -1562,8 +1768,12 @@ int FileCopyPeerFDStream::Do()
 		  else
 		     debug((3,"%s\n",err));
 	       }
+	       else
+		  name.set(new_name);
 	    }
 	 }
+	 if(checksum && name)
+	    WriteChecksumFile(name);
 	 done=true;
 	 m=MOVED;
       }
@@ -1586,6 +1796,18 @@ int FileCopyPeerFDStream::Do()
 	    // make sure the stream is open - it may create an empty file.
 	    if(stream && !stream->is_closed() && getfd()==-1)
 	       return m;
+	    if(async)
+	    {
+	       // wait for the delayed writes
+	       if(async->Flush()==-1)
+	       {
+		  if(E_RETRY(errno))
+		     return m;
+		  SetError(xstring::cat(stream->name.get(),": ",strerror(errno),NULL));
+		  return MOVED;
+	       }
+	       async=0;
+	    }
 	    if(!date_set && date!=NO_DATE && do_set_date)
 	    {
 	       if(date==NO_DATE_YET)
@@ -1597,7 +1819,7 @@ int FileCopyPeerFDStream::Do()
 	    if(stream && close_when_done && !stream->Done())
 	       return m;
 	    if(!verify && do_verify)
-	       verify=new FileVerificator(stream);
+	       verify=new FileVerificator(stream,checksum.get_non_const());
 	    else
 	       done=true;
 	    return MOVED;
@@ -1613,9 +1835,9 @@ int FileCopyPeerFDStream::Do()
       if(check_min_size && !eof && Size()<PUT_LL_MIN
       && put_ll_timer && !put_ll_timer->Stopped())
 	 break;
-      res=Put_LL(buffer+buffer_ptr,Size());
+      res=Put_LL(Span(),SpanSize());
       if(res>0)
-	 buffer_ptr+=res;
+	 Consume(res);
       if(res!=0)
 	 m=MOVED;
       break;
@@ -1623,6 +1845,11 @@ int FileCopyPeerFDStream::Do()
    case GET:
       if(eof)
 	 return m;
+      if(OverMemoryLimit())
+      {
+	 Timeout(100);
+	 return m;
+      }
 
       res=TuneGetSize(Get_LL(get_size));
       if(res>0)
@@ -1637,6 +1864,62 @@ int FileCopyPeerFDStream::Do()
    return m;
 }
 
+int FileCopyPeerFDStream::GetDirectFD()
+{
+   if(ascii || need_seek || !can_seek || eof)
+      return -1;
+   if(mode==PUT)
+   {
+      // don't create the file before there are data for it.
+      if(!write_allowed || stream->fd==-1)
+	 return -1;
+   }
+   int fd=getfd();
+   if(fd==-1)
+      return -1;
+   if(fd!=direct_fd)
+   {
+      struct stat st;
+      direct_fd=fd;
+      direct_ok=(fstat(fd,&st)!=-1 && S_ISREG(st.st_mode));
+   }
+   return direct_ok?fd:-1;
+}
+
+// regular files are read and written by the asynchronous I/O engine when
+// it is enabled. The explicit offsets make need_seek unnecessary, the fd
+// position is kept in sync for the kernel-assisted copying.
+AsyncFile *FileCopyPeerFDStream::GetAsync(int fd)
+{
+   if(!async_checked)
+   {
+      async_checked=true;
+      if(!ascii && can_seek)
+	 async=AsyncFile::Open(fd);
+   }
+   return async.get_non_const();
+}
+
+// the delayed writes not complete yet are not in the file.
+off_t FileCopyPeerFDStream::GetWrittenPos(off_t p)
+{
+   if(mode!=PUT || !async)
+      return p;
+   if(async->Flush()==-1 && errno!=EAGAIN)
+      return -1;
+   off_t first=async->FirstPendingWrite();
+   if(first!=-1 && first-seek_base<p)
+      p=first-seek_base;
+   return p;
+}
+
+void FileCopyPeerFDStream::DirectMoved(int len)
+{
+   pos+=len;
+   if(mode==PUT)
+      put_ll_timer->Reset();
+}
+
 bool FileCopyPeerFDStream::IOReady()
 {
    return seek_pos==pos || stream->fd!=-1;
@@ -1716,16 +1999,26 @@ int FileCopyPeerFDStream::Get_LL(int len)
       }
    }
 
-   if(need_seek)  // this does not combine with ascii.
+   AsyncFile *af=GetAsync(fd);
+   if(need_seek && !af)  // this does not combine with ascii.
       lseek(fd,seek_base+pos,SEEK_SET);
 
    char *p=GetSpace(ascii?len*2:len);
-   res=read(fd,p,len);
+   if(af)
+   {
+      res=af->Read(seek_base+pos,p,len);
+      if(res>0)
+	 lseek(fd,seek_base+pos+res,SEEK_SET);
+   }
+   else
+      res=read(fd,p,len);
    if(res==-1)
    {
       if(E_RETRY(errno))
       {
-	 Block(fd,POLLIN);
+	 // the I/O engine wakes us up when the data are read
+	 if(!af)
+	    Block(fd,POLLIN);
 	 return 0;
       }
       if(stream->NonFatalError(errno))
@@ -1801,21 +2094,38 @@ int FileCopyPeerFDStream::Put_LL(const char *buf,int len)
    if(len==0)
       return skip_cr;
 
-   if(need_seek)  // this does not combine with ascii.
+   AsyncFile *af=GetAsync(fd);
+   if(need_seek && !af)  // this does not combine with ascii.
       lseek(fd,seek_base+pos-Size(),SEEK_SET);
 
-   int res=write(fd,buf,len);
+   int res;
+   if(af)
+   {
+      off_t offset=seek_base+pos-Size();
+      res=af->Write(offset,buf,len);
+      if(res>0)
+	 lseek(fd,offset+res,SEEK_SET);
+      else if(res<0 && !E_RETRY(errno))
+      {
+	 // a delayed write has failed, the data are lost.
+	 SetError(xstring::cat(stream->name.get(),": ",strerror(errno),NULL));
+	 return -1;
+      }
+   }
+   else
+      res=write(fd,buf,len);
    if(res<0)
    {
       if(E_RETRY(errno))
       {
-	 Block(fd,POLLOUT);
+	 if(!af)
+	    Block(fd,POLLOUT);
 	 return 0;
       }
       if(errno==EPIPE)
       {
 	 broken=true;
-	 buffer.truncate(buffer_ptr);
+	 Consume(Size());
 	 eof=true;
 	 return -1;
       }
@@ -1982,39 +2292,85 @@ int FileCopyPeerMemory::Do()
    return m;
 }
 
+// ChecksumQuery
+ChecksumQuery::ChecksumQuery(const FileAccess *s,const char *f,Checksum *c)
+   : checksum(c), algo(-1)
+{
+   const char *cmd=s->ChecksumCommand(f,c->GetAlgos(),&algo);
+   if(!cmd)
+      return;
+   Log::global->Format(9,"copy: asking for the checksum: %s\n",cmd);
+   session=s->Clone();
+   session->Open(cmd,FA::QUOTE_CMD);
+   reply=new IOBufferFileAccess(session);
+}
+int ChecksumQuery::Do()
+{
+   if(!reply)
+      return STALL;
+   if(!reply->Error())
+   {
+      if(!reply->Eof())
+	 return STALL;
+      const char *b;
+      int s;
+      reply->Get(&b,&s);
+      if(!checksum->SetExpectedFromReply(algo,xstring::get_tmp(b,s)))
+	 Log::global->Format(9,"copy: no %s checksum in the reply\n",Checksum::AlgoName(algo));
+   }
+   reply=0;
+   session->Close();
+   return MOVED;
+}
+
 // FileVerificator
-void FileVerificator::Init0()
+void FileVerificator::Init0(Checksum *c)
 {
+   checksum=c;
+   verify_pgrp=0;
    done=false;
    if(!ResMgr::QueryBool("xfer:verify",0)
-   || ResMgr::Query("xfer:verify-command",0).is_empty())
+   || (!checksum && ResMgr::Query("xfer:verify-command",0).is_empty()))
       done=true;
 }
-void FileVerificator::InitVerify(const char *f)
+void FileVerificator::InitVerify(const char *f,const char *cwd,pid_t pgrp)
 {
    if(done)
       return;
+   verify_file.set(f);
+   verify_cwd.set(cwd);
+   verify_pgrp=pgrp;
+   if(!checksum)
+      StartCommand();
+}
+void FileVerificator::StartCommand()
+{
    ArgV *args=new ArgV(ResMgr::Query("xfer:verify-command",0));
-   args->Append(f);
-   Log::global->Format(9,"running %s %s\n",args->a0(),f);
+   args->Append(verify_file);
+   Log::global->Format(9,"running %s %s\n",args->a0(),verify_file.get());
    verify_process=new InputFilter(args);
    verify_process->StderrToStdout();
+   if(verify_pgrp)
+      verify_process->SetProcGroup(verify_pgrp);
+   if(verify_cwd)
+      verify_process->SetCwd(verify_cwd);
    verify_buffer=new IOBufferFDStream(verify_process.Cast<FDStream>(),IOBuffer::GET);
 }
 FileVerificator::FileVerificator(const char *f)
 {
-   Init0();
+   Init0(0);
    InitVerify(f);
 }
-FileVerificator::FileVerificator(const FDStream *stream)
+FileVerificator::FileVerificator(const FDStream *stream,Checksum *c)
 {
-   Init0();
+   Init0(c);
    if(done)
       return;
    const char *f=stream->full_name;
    if(!f)
    {
-      done=true;
+      if(!checksum)
+	 done=true;
       return;
    }
    const char *cwd=stream->GetCwd();
@@ -2027,25 +2383,23 @@ FileVerificator::FileVerificator(const FDStream *stream)
       if(*f==0)
 	 f=".";
    }
-   InitVerify(f);
-   if(verify_process)
-   {
-      verify_process->SetProcGroup(stream->GetProcGroup());
-      verify_process->SetCwd(cwd);
-   }
+   InitVerify(f,cwd,stream->GetProcGroup());
 }
-FileVerificator::FileVerificator(const FileAccess *session,const char *f)
+FileVerificator::FileVerificator(const FileAccess *session,const char *f,Checksum *c)
 {
-   Init0();
+   Init0(c);
    if(done)
       return;
+   // ask the server for the checksum of the stored file.
+   if(checksum && !checksum->HasExpected())
+      query=new ChecksumQuery(session,f,checksum);
    if(strcmp(session->GetProto(),"file"))
    {
-      done=true;
+      if(!checksum)
+	 done=true;
       return;
    }
-   InitVerify(f);
-   verify_process->SetCwd(session->GetCwd());
+   InitVerify(f,session->GetCwd());
 }
 
 FileVerificator::~FileVerificator() {}
@@ -2055,6 +2409,26 @@ int FileVerificator::Do()
    int m=STALL;
    if(done)
       return m;
+   if(!verify_process)
+   {
+      if(query && !query->Done())
+	 return m;
+      if(checksum->Compare(&error_text)>=0)
+      {
+	 if(!error_text)
+	    Log::global->Format(9,"copy: the checksum is correct\n");
+	 done=true;
+	 return MOVED;
+      }
+      // no reference value, use the verify command.
+      if(!verify_file || ResMgr::Query("xfer:verify-command",0).is_empty())
+      {
+	 done=true;
+	 return MOVED;
+      }
+      StartCommand();
+      m=MOVED;
+   }
    verify_process->Kill(SIGCONT);
    if(!verify_buffer->Eof())
       return m;
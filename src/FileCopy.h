@@ -35,6 +35,8 @@
 #include "Speedometer.h"
 #include "Timer.h"
 #include "log.h"
+#include "AsyncIO.h"
+#include "Checksum.h"
 
 class FileCopyPeer : public IOBuffer
 {
@@ -67,7 +69,11 @@ protected:
    xstring_c suggested_filename;
    bool auto_rename;
 
+   Ref<Checksum> checksum;  // of the data passed, for the verification
+   void WriteChecksumFile(const char *file);
+
 public:
+   const char *GetClassName() { return "FileCopyPeer"; }
    off_t range_start; // NOTE: ranges are implemented only partially. (FIXME)
    off_t range_limit;
 
@@ -91,6 +97,9 @@ public:
 
    void DontCopyDate() { do_set_date=false; }
    void DontVerify() { do_verify=false; }
+   // the data can be verified by its checksum.
+   bool WantChecksum() const { return do_verify && !ascii; }
+   void SetChecksum(Checksum *c) { checksum=c; }
    bool NeedDate() { return do_set_date; }
    void MakeTargetDir() { do_mkdir=true; }
 
@@ -112,6 +121,9 @@ public:
 
    virtual void RemoveFile() { file_removed=true; }
    virtual void NeedSeek() {} // fd is shared, seek before access.
+   // the position before which all data are in the file (not yet on the
+   // disk), at most p; -1 on error.
+   virtual off_t GetWrittenPos(off_t p) { return p; }
 
    void CannotSeek(int p)
       {
@@ -138,9 +150,19 @@ public:
    void StartTransfer() { start_transfer=true; }
 
    virtual const char *GetURL() { return 0; }
+   // the file name in the session and the checksums the server sent with it.
+   virtual const char *GetFile() { return 0; }
+   virtual const char *GetEntityDigest() { return 0; }
    virtual FileCopyPeer *Clone() { return 0; }
    virtual const Ref<FDStream>& GetLocal() const { return Ref<FDStream>::null; }
 
+   // for kernel-assisted copying (see FileCopy::DirectCopy):
+   // a local peer gives its file descriptor, positioned at pos;
+   virtual int GetDirectFD() { return -1; }
+   virtual void DirectMoved(int len) {}
+   // a session peer moves data between the session and that file.
+   virtual int DirectCopy(int fd,int len) { return -1; }
+
    const char *GetSuggestedFileName() { return suggested_filename; }
    void SetSuggestedFileName(const char *f) { if(f) suggested_filename.set(f); }
    void AutoRename(bool yes=true) { auto_rename=yes; }
@@ -152,6 +174,7 @@ public:
 class FileCopy : public SMTask
 {
 public:
+   const char *GetClassName() { return "FileCopy"; }
    SMTaskRef<FileCopyPeer> get;
    SMTaskRef<FileCopyPeer> put;
 
@@ -191,6 +214,16 @@ private:
    Ref<Buffer> line_buffer;
    int  line_buffer_max;
 
+   bool direct_copy;
+   int DirectCopy();
+
+   Ref<Checksum> checksum;
+   off_t checksum_pos;	 // the data before it is in the checksum
+   SMTaskRef<class ChecksumQuery> checksum_query;
+   void UpdateChecksum(const char *b,int s);
+   bool ChooseChecksum();
+   bool FinishChecksum();
+
    bool CheckFileSizeAtEOF() const;
 
 protected:
@@ -221,10 +254,14 @@ public:
    void SetDate(time_t t,int p=0) { get->SetDate(t,p); }
    void SetDate(const FileTimestamp &t) { SetDate(t.ts,t.ts_prec); }
    void SetSize(off_t s) { get->SetSize(s); }
+   // transfers of one job share a part of xfer:memory-limit.
+   void SetMemoryGroup(int g) { get->SetMemoryGroup(g); put->SetMemoryGroup(g); }
+   int GetMemoryGroup() const { return get->GetMemoryGroup(); }
 
    bool SetContinue(bool new_cont) { return replace_value(cont,new_cont); }
 
    bool Done() { return state==ALL_DONE; }
+   virtual bool IsFinishing() const { return false; }
    bool Error() { return error_text!=0; }
    const char *ErrorText() { return error_text; }
    void SetError(const char *str);
@@ -265,18 +302,41 @@ public:
    static const char *TempFileName(const char *file);
 };
 
+// Asks the server for a checksum of a file and stores it as the reference.
+class ChecksumQuery : public SMTask
+{
+   FileAccessRef session;
+   SMTaskRef<IOBuffer> reply;
+   Checksum *checksum;
+   int algo;
+public:
+   const char *GetClassName() { return "ChecksumQuery"; }
+   ChecksumQuery(const FileAccess *s,const char *f,Checksum *c);
+   int Do();
+   bool Done() { return !reply; }
+};
+
 class FileVerificator : public SMTask
 {
    bool done;
    xstring error_text;
    SMTaskRef<IOBufferFDStream> verify_buffer;
    Ref<InputFilter> verify_process;
-   void Init0();
-   void InitVerify(const char *f);
+   xstring_c verify_file;
+   xstring_c verify_cwd;
+   pid_t verify_pgrp;
+   // the checksum computed during the transfer is checked first, the
+   // verify command is used only when there is no reference value.
+   Checksum *checksum;
+   SMTaskRef<ChecksumQuery> query;
+   void Init0(Checksum *c);
+   void InitVerify(const char *f,const char *cwd=0,pid_t pgrp=0);
+   void StartCommand();
 public:
+   const char *GetClassName() { return "FileVerificator"; }
    FileVerificator(const char *f);
-   FileVerificator(const FDStream *);
-   FileVerificator(const FileAccess *,const char *f);
+   FileVerificator(const FDStream *,Checksum *c=0);
+   FileVerificator(const FileAccess *,const char *f,Checksum *c=0);
    ~FileVerificator();
    int Do();
    bool Done() { return done; }
@@ -327,6 +387,7 @@ class FileCopyPeerFA : public FileCopyPeer
    int Get_LL(int size);
    int Put_LL(const char *buf,int size);
    int PutEOF_LL();
+   int DirectCopy(int fd,int len);
 
    // to read data in larger quantities, delay the read op
    Timer get_ll_timer;
@@ -339,6 +400,8 @@ class FileCopyPeerFA : public FileCopyPeer
    UploadState upload_state;
    int redirections;
 
+   xstring_c entity_digest;   // saved before the session is closed
+
    SMTaskRef<FileVerificator> verify;
 
 protected:
@@ -346,6 +409,7 @@ protected:
    ~FileCopyPeerFA();
 
 public:
+   const char *GetClassName() { return "FileCopyPeerFA"; }
    void Init();
    FileCopyPeerFA(FileAccess *s,const char *f,int m);
    FileCopyPeerFA(const FileAccessRef& s,const char *f,int m);
@@ -379,6 +443,8 @@ public:
    const char *GetURL() {
       return orig_url ? orig_url : session->GetFileURL(file);
    }
+   const char *GetFile() { return file; }
+   const char *GetEntityDigest() { return entity_digest; }
    FileCopyPeer *Clone();
 };
 
@@ -394,6 +460,14 @@ class FileCopyPeerFDStream : public FileCopyPeer
    void Seek_LL();
 
    int getfd();
+   int GetDirectFD();
+   void DirectMoved(int len);
+   int direct_fd;   // fd checked for kernel-assisted copying
+   bool direct_ok;
+
+   Ref<AsyncFile> async;
+   bool async_checked;
+   AsyncFile *GetAsync(int fd);
 
    bool create_fg_data;
    bool need_seek;
@@ -402,6 +476,7 @@ class FileCopyPeerFDStream : public FileCopyPeer
    SMTaskRef<FileVerificator> verify;
 
 public:
+   const char *GetClassName() { return "FileCopyPeerFDStream"; }
    void Init();
    FileCopyPeerFDStream(const Ref<FDStream>& o,dir_t m);
    FileCopyPeerFDStream(FDStream *o,dir_t m);
@@ -414,6 +489,7 @@ public:
 
    void DontCreateFgData() { create_fg_data=false; }
    void NeedSeek() { need_seek=true; }
+   off_t GetWrittenPos(off_t p);
    void CloseWhenDone() { close_when_done=true; }
    void WantSize();
    void RemoveFile();
@@ -439,6 +515,7 @@ private:
    SMTaskRef<DirList> dl;
 
 public:
+   const char *GetClassName() { return "FileCopyPeerDirList"; }
    FileCopyPeerDirList(FA *s,ArgV *v); // consumes s and v.
 
    int Do();
@@ -455,6 +532,7 @@ private:
    int max_size;
 
 public:
+   const char *GetClassName() { return "FileCopyPeerMemory"; }
    FileCopyPeerMemory(int m) : FileCopyPeer(PUT), max_size(m) {}
    FileCopyPeerMemory(const xstring& s) : FileCopyPeer(GET), max_size(0) {
       Put(s);
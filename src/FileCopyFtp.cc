@@ -36,6 +36,7 @@ void FileCopyFtp::Close()
 {
    ftp_src->Close();
    ftp_dst->Close();
+   src_done=dst_done=false;
 }
 
 int FileCopyFtp::Do()
@@ -66,14 +67,14 @@ int FileCopyFtp::Do()
    get->Resume();
    put->Resume();
 
-   if(ftp_src->IsClosed())
+   if(ftp_src->IsClosed() && !src_done)
    {
       get->OpenSession();
       ftp_src->SetCopyMode(Ftp::COPY_SOURCE,passive_source,protect,
 	    !(passive_source^passive_ssl_connect),src_retries,src_try_time);
       m=MOVED;
    }
-   if(ftp_dst->IsClosed())
+   if(ftp_dst->IsClosed() && !dst_done)
    {
       put->OpenSession();
       ftp_dst->SetCopyMode(Ftp::COPY_DEST,!passive_source,protect,
@@ -178,16 +179,19 @@ int FileCopyFtp::Do()
       return MOVED;
    }
 
-   // exchange copy address
-   if(ftp_dst->SetCopyAddress(ftp_src) || ftp_src->SetCopyAddress(ftp_dst))
-      m=MOVED;
-
-   if(!ftp_dst->CopyStoreAllowed()
-   && ftp_src->CopyIsReadyForStore() && ftp_dst->CopyIsReadyForStore())
+   if(!src_done && !dst_done)
    {
-      ftp_dst->CopyAllowStore();
-      m=MOVED;
-      RateReset();
+      // exchange copy address
+      if(ftp_dst->SetCopyAddress(ftp_src) || ftp_src->SetCopyAddress(ftp_dst))
+	 m=MOVED;
+
+      if(!ftp_dst->CopyStoreAllowed()
+      && ftp_src->CopyIsReadyForStore() && ftp_dst->CopyIsReadyForStore())
+      {
+	 ftp_dst->CopyAllowStore();
+	 m=MOVED;
+	 RateReset();
+      }
    }
 
    // check for timeout when one session is done, and the other is stuck
@@ -196,16 +200,33 @@ int FileCopyFtp::Do()
    if(src_res==FA::OK && dst_res==FA::IN_PROGRESS)
       ftp_dst->CopyCheckTimeout(ftp_src);
 
-   off_t add=ftp_dst->GetPos()-put->GetRealPos();
-   if(add>0)
+   if(!dst_done)
    {
-      RateAdd(add);
-      bytes_count+=add;
+      off_t add=ftp_dst->GetPos()-put->GetRealPos();
+      if(add>0)
+      {
+	 RateAdd(add);
+	 bytes_count+=add;
+      }
+
+      off_t pos=ftp_dst->GetPos();
+      get->SetPos(pos);
+      put->SetPos(pos);
    }
 
-   off_t pos=ftp_dst->GetPos();
-   get->SetPos(pos);
-   put->SetPos(pos);
+   // let the next copy use the connection of the completed side.
+   if(src_res==FA::OK && !src_done)
+   {
+      ftp_src->Close();
+      src_done=true;
+      m=MOVED;
+   }
+   if(dst_res==FA::OK && !dst_done)
+   {
+      ftp_dst->Close();
+      dst_done=true;
+      m=MOVED;
+   }
 
    return m;
 }
@@ -217,6 +238,7 @@ void FileCopyFtp::Init()
    src_retries=dst_retries=0;
    src_try_time=dst_try_time=0;
    disable_fxp=false;
+   src_done=dst_done=false;
 #if USE_SSL
    protect=false;
    orig_passive_ssl_connect=passive_ssl_connect=true;
@@ -38,14 +38,20 @@ class FileCopyFtp : public FileCopy
    int dst_retries;
    time_t src_try_time;
    time_t dst_try_time;
+   // a session is closed as soon as its side of the copy is complete,
+   // so that its connection can be used for the next file.
+   bool src_done;
+   bool dst_done;
 
    void Close();
 
 public:
+   const char *GetClassName() { return "FileCopyFtp"; }
    void Init();
    FileCopyFtp(FileCopyPeer *src,FileCopyPeer *dst,bool cont,bool rp);
 
    int Do();
+   bool IsFinishing() const { return src_done || dst_done; }
 
    static FileCopy *New(FileCopyPeer *src,FileCopyPeer *dst,bool cont);
 };
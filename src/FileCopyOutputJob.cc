@@ -67,10 +67,10 @@ int FileCopyPeerOutputJob::Do()
 
    while(Size()>0)
    {
-      int res=Put_LL(buffer+buffer_ptr,Size());
+      int res=Put_LL(Span(),SpanSize());
       if(res>0)
       {
-	 buffer_ptr+=res;
+	 Consume(res);
 	 m=MOVED;
       }
       if(res<0)
@@ -28,6 +28,7 @@ class FileCopyPeerOutputJob : public FileCopyPeer
    int Put_LL(const char *buf,int len);
 
 public:
+   const char *GetClassName() { return "FileCopyPeerOutputJob"; }
    FileCopyPeerOutputJob(const JobRef<OutputJob>& o);
 
    int Do();
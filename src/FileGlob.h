@@ -35,6 +35,7 @@ protected:
    void	 add(const FileInfo *info);
    void	 add_force(const FileInfo *info);
 public:
+   const char *GetClassName() { return "Glob"; }
    const char *GetPattern() { return pattern; }
    FileSet *GetResult() { return &list; }
    Glob(FileAccess *s,const char *p);
@@ -104,6 +105,7 @@ class GenericGlob : public Glob
    SMTaskRef<ListInfo> li;
 
 public:
+   const char *GetClassName() { return "GenericGlob"; }
    int	 Do();
    const char *Status();
 
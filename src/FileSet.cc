@@ -95,6 +95,7 @@ void FileInfo::SetGroup(const char *g)
 void FileSet::add_before(int pos,FileInfo *fi)
 {
    files.insert(fi,pos);
+   Changed();
 }
 void FileSet::Add(FileInfo *fi)
 {
@@ -120,6 +121,33 @@ void FileSet::Sub(int i)
    files.remove(i);
    if(ind>i)
       ind--;
+   Changed();
+}
+
+/* removes the entries unset by a subtraction, in one pass */
+void FileSet::RemoveUnset()
+{
+   int i=0;
+   while(i<fnum && files[i])
+      i++;
+   if(i==fnum)
+      return;
+   assert(!sorted);
+   int new_ind=ind;
+   int j=i;
+   for( ; i<fnum; i++)
+   {
+      if(!files[i])
+      {
+	 if(i<ind)
+	    new_ind--;
+	 continue;
+      }
+      files[j++]=files[i].borrow();
+   }
+   files.set_length(j);
+   ind=new_ind;
+   Changed();
 }
 FileInfo *FileSet::Borrow(int i)
 {
@@ -193,16 +221,18 @@ void FileSet::Merge(const FileSet *set)
       j++;
    }
    files.move_here(new_set);
+   Changed();
 }
 
 void FileSet::PrependPath(const char *path)
 {
    for(int i=0; i<fnum; i++)
       files[i]->SetName(dir_file(path, files[i]->name));
+   Changed();
 }
 
 FileSet::FileSet()
-   : sort_mode(BYNAME), ind(0)
+   : sort_mode(BYNAME), ind(0), lookups(0)
 {
 }
 
@@ -214,6 +244,7 @@ FileSet::~FileSet()
  * be a bit of a pain to implement. */
 FileSet::FileSet(FileSet const *set)
 {
+   lookups=0;
    if(!set) {
       ind=0;
       return;
@@ -299,6 +330,7 @@ void FileSet::Sort(sort_e newsort, bool casefold, bool reverse)
 	 fi->name.set(basename_ptr(fi->longname));
       }
       files.qsort(files_sort_name);
+      Changed();
    }
 
    xmap<bool> dup;
@@ -355,6 +387,7 @@ void FileSet::UnsortFlat()
       files[i]->name.move_here(files[i]->longname);
    }
    files.qsort(files_sort_name);
+   Changed();
 }
 
 void FileSet::Empty()
@@ -362,27 +395,32 @@ void FileSet::Empty()
    Unsort();
    files.unset();
    ind=0;
+   Changed();
 }
 
 void FileSet::SubtractSame(const FileSet *set,int ignore)
 {
    if(!set)
       return;
+   int j=0;
    for(int i=0; i<fnum; i++)
    {
-      FileInfo *f=set->FindByName(files[i]->name);
+      FileInfo *f=set->FindNextByName(&j,files[i]->name);
       if(f && files[i]->SameAs(f,ignore))
-	 Sub(i--);
+	 files[i]=0;
    }
+   RemoveUnset();
 }
 
 void FileSet::SubtractAny(const FileSet *set)
 {
    if(!set)
       return;
+   int j=0;
    for(int i=0; i<fnum; i++)
-      if(set->FindByName(files[i]->name))
-	 Sub(i--);
+      if(set->FindNextByName(&j,files[i]->name))
+	 files[i]=0;
+   RemoveUnset();
 }
 
 void FileSet::SubtractNotIn(const FileSet *set)
@@ -391,48 +429,56 @@ void FileSet::SubtractNotIn(const FileSet *set)
       Empty();
       return;
    }
+   int j=0;
    for(int i=0; i<fnum; i++)
-      if(!set->FindByName(files[i]->name))
-	 Sub(i--);
+      if(!set->FindNextByName(&j,files[i]->name))
+	 files[i]=0;
+   RemoveUnset();
 }
 void FileSet::SubtractSameType(const FileSet *set)
 {
    if(!set)
       return;
+   int j=0;
    for(int i=0; i<fnum; i++)
    {
-      FileInfo *f=set->FindByName(files[i]->name);
+      FileInfo *f=set->FindNextByName(&j,files[i]->name);
       if(f && files[i]->defined&FileInfo::TYPE && f->defined&FileInfo::TYPE
       && files[i]->filetype==f->filetype)
-	 Sub(i--);
+	 files[i]=0;
    }
+   RemoveUnset();
 }
 void FileSet::SubtractDirs(const FileSet *set)
 {
    if(!set)
       return;
+   int j=0;
    for(int i=0; i<fnum; i++)
    {
       if(!files[i]->TypeIs(FileInfo::DIRECTORY))
 	 continue;
-      FileInfo *f=set->FindByName(files[i]->name);
+      FileInfo *f=set->FindNextByName(&j,files[i]->name);
       if(f && f->TypeIs(f->DIRECTORY))
-	 Sub(i--);
+	 files[i]=0;
    }
+   RemoveUnset();
 }
 void FileSet::SubtractNotOlderDirs(const FileSet *set)
 {
    if(!set)
       return;
+   int j=0;
    for(int i=0; i<fnum; i++)
    {
       if(!files[i]->TypeIs(FileInfo::DIRECTORY)
       || !files[i]->Has(FileInfo::DATE))
 	 continue;
-      FileInfo *f=set->FindByName(files[i]->name);
+      FileInfo *f=set->FindNextByName(&j,files[i]->name);
       if(f && f->TypeIs(f->DIRECTORY) && f->NotOlderThan(files[i]->date))
-	 Sub(i--);
+	 files[i]=0;
    }
+   RemoveUnset();
 }
 
 void FileSet::SubtractTimeCmp(bool (FileInfo::*cmp)(time_t) const,time_t t)
@@ -443,11 +489,9 @@ void FileSet::SubtractTimeCmp(bool (FileInfo::*cmp)(time_t) const,time_t t)
       && files[i]->filetype!=FileInfo::NORMAL)
 	 continue;
       if((files[i].get()->*cmp)(t))
-      {
-	 Sub(i);
-	 i--;
-      }
+	 files[i]=0;
    }
+   RemoveUnset();
 }
 
 void FileSet::SubtractSizeOutside(const Range *r)
@@ -458,11 +502,9 @@ void FileSet::SubtractSizeOutside(const Range *r)
       && files[i]->filetype!=FileInfo::NORMAL)
 	 continue;
       if(files[i]->SizeOutside(r))
-      {
-	 Sub(i);
-	 i--;
-      }
+	 files[i]=0;
    }
+   RemoveUnset();
 }
 void FileSet::SubtractDirs()
 {
@@ -470,11 +512,9 @@ void FileSet::SubtractDirs()
    {
       if(files[i]->defined&FileInfo::TYPE
       && files[i]->filetype==FileInfo::DIRECTORY)
-      {
-	 Sub(i);
-	 i--;
-      }
+	 files[i]=0;
    }
+   RemoveUnset();
 }
 void FileSet::SubtractNotDirs()
 {
@@ -482,11 +522,9 @@ void FileSet::SubtractNotDirs()
    {
       if(!(files[i]->defined&FileInfo::TYPE)
       || files[i]->filetype!=FileInfo::DIRECTORY)
-      {
-	 Sub(i);
-	 i--;
-      }
+	 files[i]=0;
    }
+   RemoveUnset();
 }
 
 void FileSet::ExcludeDots()
@@ -494,11 +532,9 @@ void FileSet::ExcludeDots()
    for(int i=0; i<fnum; i++)
    {
       if(!strcmp(files[i]->name,".") || !strcmp(files[i]->name,".."))
-      {
-	 Sub(i);
-	 i--;
-      }
+	 files[i]=0;
    }
+   RemoveUnset();
 }
 void FileSet::ExcludeCompound()
 {
@@ -508,8 +544,9 @@ void FileSet::ExcludeCompound()
       if(!strncmp(name,"./~",3))
 	 name+=3;
       if(strchr(name,'/'))
-	 Sub(i--);
+	 files[i]=0;
    }
+   RemoveUnset();
 }
 
 void FileSet::ExcludeUnaccessible(const char *user)
@@ -523,11 +560,9 @@ void FileSet::ExcludeUnaccessible(const char *user)
 	 mask=(!strcmp(files[i]->user,user)?0400:0044);
       if((files[i]->TypeIs(FileInfo::NORMAL)    && !(files[i]->mode&mask))
       || (files[i]->TypeIs(FileInfo::DIRECTORY) && !(files[i]->mode&mask&(files[i]->mode<<2))))
-      {
-	 Sub(i);
-	 i--;
-      }
+	 files[i]=0;
    }
+   RemoveUnset();
 }
 
 bool  FileInfo::SameAs(const FileInfo *fi,int ignore) const
@@ -648,8 +683,51 @@ int FileSet::FindGEIndByName(const char *name) const
    return u;
 }
 
+static unsigned name_hash_value(const char *name)
+{
+   unsigned hash=0x12345678;
+   while(*name)
+      hash+=(hash<<5)+(unsigned char)*name++;
+   return hash;
+}
+
+void FileSet::BuildNameHash() const
+{
+   int size=64;
+   while(size<fnum*2)
+      size*=2;
+   name_hash.get_space(size);
+   name_hash.set_length(size);
+   for(int i=0; i<size; i++)
+      name_hash[i]=0;
+   unsigned mask=size-1;
+   for(int i=0; i<fnum; i++)
+   {
+      unsigned h=name_hash_value(files[i]->name)&mask;
+      while(name_hash[h])
+	 h=(h+1)&mask;
+      name_hash[h]=i+1;
+   }
+}
+
 FileInfo *FileSet::FindByName(const char *name) const
 {
+   /* a binary search is fine for a few lookups, the hash pays off when
+    * there are many of them without changes of the set (e.g. in mirror). */
+   if(!name_hash && fnum>=64 && ++lookups>fnum/16)
+      BuildNameHash();
+   if(name_hash)
+   {
+      unsigned mask=name_hash.count()-1;
+      for(unsigned h=name_hash_value(name)&mask; name_hash[h]; h=(h+1)&mask)
+      {
+	 const Ref<FileInfo>& fi=files[name_hash[h]-1];
+	 if(!strcmp(fi->name,name))
+	    return fi.get_non_const();
+      }
+      return 0;
+   }
+
    int n = FindGEIndByName(name);
 
    if(n < fnum && !strcmp(files[n]->name,name))
@@ -658,6 +736,24 @@ FileInfo *FileSet::FindByName(const char *name) const
    return 0;
 }
 
+/* finds a file by name walking the array from *pos, which is advanced;
+ * the names have to be looked up in increasing order, so that matching
+ * two sets takes linear time. */
+FileInfo *FileSet::FindNextByName(int *pos,const char *name) const
+{
+   while(*pos<fnum)
+   {
+      const Ref<FileInfo>& fi=files[*pos];
+      int cmp=strcmp(fi->name,name);
+      if(cmp>0)
+	 return 0;
+      if(cmp==0)
+	 return fi.get_non_const();
+      ++*pos;
+   }
+   return 0;
+}
+
 static bool do_exclude_match(const char *prefix,const FileInfo *fi,const PatternSet *x)
 {
    const char *name=dir_file(prefix,fi->name);
@@ -679,12 +775,12 @@ void  FileSet::Exclude(const char *prefix,const PatternSet *x,FileSet *fsx)
       if(do_exclude_match(prefix,files[i],x))
       {
 	 if(fsx)
-	    fsx->Add(Borrow(i));
+	    fsx->Add(files[i].borrow());
 	 else
-	    Sub(i);
-	 i--;
+	    files[i]=0;
       }
    }
+   RemoveUnset();
 }
 
 #if 0
@@ -859,6 +955,8 @@ FileInfo::FileInfo(const FileInfo &fi)
    size=fi.size;
    nlinks=fi.nlinks;
    longname.set(fi.longname);
+   if(fi.extra && fi.extra->etag)
+      SetETag(fi.extra->etag);
 }
 FileInfo::~FileInfo()
 {
@@ -1075,7 +1173,7 @@ FileInfo *FileInfo::parse_ls_line(const char *line_c,int line_len,const char *tz
       }
    }
    fi->SetName(name);
-   fi->SetLongName(line_c);
+   fi->longname.nset(line_c,line_len);
 
    return fi;
 }
@@ -1162,11 +1260,13 @@ void FileInfo::MakeLongName()
    if(defined&DATE)
       date_str=TimeDate(date).IsoDateTime();
 
-   longname.vset(filetype_s,format_perms(mode1),"  ",usergroup," ",size_str,
+   xstring s;
+   s.vset(filetype_s,format_perms(mode1),"  ",usergroup," ",size_str,
       " ",date_str," ",name.get(),NULL);
 
    if(defined&SYMLINK_DEF)
-      longname.vappend(" -> ",symlink.get(),NULL);
+      s.vappend(" -> ",symlink.get(),NULL);
+   longname.move_here(s);
 }
 
 size_t FileSet::EstimateMemory() const
@@ -1180,6 +1280,9 @@ size_t FileSet::EstimateMemory() const
       size+=xstrlen(files[i]->name);
       size+=xstrlen(files[i]->symlink);
       size+=xstrlen(files[i]->longname);
+      const FileInfo::Extra *extra=files[i]->extra;
+      if(extra)
+	 size+=sizeof(*extra)+extra->data.length()+xstrlen(extra->uri)+xstrlen(extra->etag);
    }
    return size;
 }
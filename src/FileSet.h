@@ -22,6 +22,7 @@
 
 #include <sys/types.h>
 #include "xarray.h"
+#include "Ref.h"
 
 #undef TYPE
 
@@ -46,17 +47,29 @@ struct FileTimestamp
 
 class FileInfo
 {
+   friend class FileSet;
+
    void def(unsigned m) { defined|=m; need&=~m; }
+
+   // rarely used strings are kept out of line, so that big file sets
+   // take less memory.
+   struct Extra
+   {
+      xstring_c uri;
+      xstring_c etag;
+      xstring data;
+   };
+   Ref<Extra> extra;
+   Extra *GetExtra() { if(!extra) extra=new Extra; return extra.get_non_const(); }
+   xstring_c longname;	 // the server's listing line, or made on demand
+
 public:
    xstring  name;
-   xstring  longname;
    xstring_c symlink;
-   xstring_c uri;
-   mode_t   mode;
    FileTimestamp date;
    off_t    size;
-   xstring  data;
-   const char *user, *group;
+   const char *user, *group;	 // from StringPool
+   mode_t   mode;
    int      nlinks;
 
    enum	 type
@@ -119,8 +132,12 @@ public:
    bool  SizeOutside(const Range *r) const;
    bool	 TypeIs(type t) const { return (defined&TYPE) && filetype==t; }
 
-   void	 SetAssociatedData(const void *d,int len) { data.nset((const char*)d,len); }
-   const void *GetAssociatedData() const { return data; }
+   void	 SetAssociatedData(const void *d,int len) { GetExtra()->data.nset((const char*)d,len); }
+   const void *GetAssociatedData() const { return extra?extra->data.get():0; }
+   void	 SetURI(const char *u) { GetExtra()->uri.set(u); }
+   const char *GetURI() const { return extra?extra->uri.get():0; }
+   void	 SetETag(const char *e) { GetExtra()->etag.set(e); }
+   const char *GetETag() const { return extra?extra->etag.get():0; }
 
    void SetRank(int r) { rank=r; }
    int GetRank() const { return rank; }
@@ -154,8 +171,17 @@ private:
 
    int	 ind;
 
+   /* open addressing hash of file indexes+1 by name, built when there are
+    * many lookups by name and dropped on any change of the files array. */
+   mutable xarray<int> name_hash;
+   mutable int lookups;
+   void BuildNameHash() const;
+   void Changed() { name_hash.unset(); lookups=0; }
+
    void	 Sub(int);
    FileInfo *Borrow(int);
+   void	 RemoveUnset();
+   FileInfo *FindNextByName(int *pos,const char *name) const;
 
    void add_before(int pos,FileInfo *fi);
    void assert_sorted() const;
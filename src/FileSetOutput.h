@@ -99,6 +99,7 @@ class clsJob : public SessionJob
    enum { INIT, START_LISTING, GETTING_LIST_INFO, DONE } state;
 
 public:
+   const char *GetClassName() { return "clsJob"; }
    clsJob(FA *s, ArgV *a, FileSetOutput *_opts, OutputJob *output);
    int Done();
    int Do();
@@ -42,7 +42,10 @@
 #endif
 
 FDStream::FDStream(int new_fd,const char *new_name)
-   : close_when_done(false), closed(false), fd(new_fd), name(new_name?expand_home_relative(new_name):0), status(0) {}
+   : close_when_done(false), closed(false), fd(new_fd), name(new_name?expand_home_relative(new_name):0), status(0)
+{
+   SMTask::NewFD(fd);
+}
 FDStream::FDStream()
    : close_when_done(false), closed(false), fd(-1), status(0) {}
 
@@ -74,6 +77,7 @@ void FDStream::SetFD(int new_fd,bool c)
    DoCloseFD();
    fd=new_fd;
    close_when_done=c;
+   SMTask::NewFD(fd);
 }
 bool FDStream::Done()
 {
@@ -166,6 +170,8 @@ int OutputFilter::getfd()
       error_text.vset(_("pipe() failed: "),strerror(errno),NULL);
       return -1;
    }
+   SMTask::NewFD(p[0]);
+   SMTask::NewFD(p[1]);
 
    ProcWait::Signal(false);
 
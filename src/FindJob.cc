@@ -378,7 +378,7 @@ FinderJob::prf_res FinderJob_List::ProcessFile(const char *d,const FileInfo *fi)
       FileInfo n(*fi);
       n.SetName(path_to_show);
       n.MakeLongName();
-      buf->Put(n.longname);
+      buf->Put(n.GetLongName());
    } else {
       buf->Put(path_to_show);
    }
@@ -94,6 +94,7 @@ protected:
    bool ProcessingURL() { return session!=SessionJob::session; }
 
 public:
+   const char *GetClassName() { return "FinderJob"; }
    int Do();
    int Done() { return state==DONE; }
    int ExitCode() { return state!=DONE || (errors && !quiet); }
@@ -124,6 +125,7 @@ protected:
    void Finish();
 
 public:
+   const char *GetClassName() { return "FinderJob_List"; }
    FinderJob_List(FileAccess *s,ArgV *a,FDStream *o);
    void DoLongListing(bool yes=true) { long_listing=yes; }
 
@@ -60,6 +60,7 @@ class FinderJob_Du : public FinderJob
    void Pop();
 
 public:
+   const char *GetClassName() { return "FinderJob_Du"; }
    FinderJob_Du(FileAccess *s,ArgV *a,FDStream *o);
    ~FinderJob_Du();
    int Done();
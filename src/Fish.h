@@ -101,6 +101,7 @@ class Fish : public SSH_Access
    bool	 encode_file;
 
 public:
+   const char *GetClassName() { return "Fish"; }
    static void ClassInit();
 
    Fish();
@@ -146,6 +147,7 @@ class FishDirList : public DirList
    const xstring_ca pattern;
 
 public:
+   const char *GetClassName() { return "FishDirList"; }
    FishDirList(Fish *s,ArgV *a)
       : DirList(s,a), pattern(args->CombineShellQuoted(1)) {}
    const char *Status();
@@ -159,6 +161,7 @@ class FishListInfo : public GenericParseListInfo
 {
    FileSet *Parse(const char *buf,int len);
 public:
+   const char *GetClassName() { return "FishListInfo"; }
    FishListInfo(Fish *session,const char *path)
       : GenericParseListInfo(session,path)
       {
@@ -32,6 +32,7 @@ class FtpDirList : public DirList
    void FormatGeneric(class FileInfo *);
 
 public:
+   const char *GetClassName() { return "FtpDirList"; }
    FtpDirList(FileAccess *s,ArgV *a)
       : DirList(s,a), pattern(args->Combine(1)) {}
    const char *Status();
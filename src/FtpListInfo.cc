@@ -58,11 +58,64 @@ FileSet *FtpListInfo::Parse(const char *buf,int len)
    }
 }
 
+// Parse the listing with a single parser. Returns 0 as soon as it is clear
+// the parser does not fit: it fails on the first line or makes too many errors.
+FileSet *Ftp::ParseLongListWith(FtpLineParser parser,const char *buf,int len,int *err) const
+{
+   *err=0;
+   Ref<FileSet> set(new FileSet);
+   const char *tz=Query("timezone",hostname);
+   xstring line;
+   bool first=true;
+   for(;;)
+   {
+      const char *nl=(const char*)memchr(buf,'\n',len);
+      if(!nl)
+	 break;
+      line.nset(buf,nl-buf);
+      line.chomp('\r');
+      len-=nl+1-buf;
+      buf=nl+1;
+      if(line.length()==0)
+	 continue;
+
+      FileInfo *info=(*parser)(line.get_non_const(),err,tz);
+      if(info && info->name.length()>1)
+	 info->name.chomp('/');
+      if(info && !strchr(info->name,'/'))
+	 set->Add(info);
+      else
+	 delete info;
+
+      if(*err>0 && (first || *err>16))
+	 return 0;
+      first=false;
+   }
+   return set.borrow();
+}
+
 FileSet *Ftp::ParseLongList(const char *buf,int len,int *err_ret) const
 {
    if(err_ret)
       *err_ret=0;
 
+   // most likely the listing has the same format as the last time.
+   SiteData *site=GetSiteData();
+   const char *signature=(conn?conn->feat_signature.get():0);
+   int known=site->GetListParser(signature);
+   if(known>=0)
+   {
+      int known_err;
+      FileSet *known_set=ParseLongListWith(line_parsers[known],buf,len,&known_err);
+      if(known_set)
+      {
+	 if(err_ret)
+	    *err_ret=known_err;
+	 return known_set;
+      }
+      LogNote(10,"listing format has changed, detecting it again");
+   }
+
    int err[number_of_parsers];
    FileSet *set[number_of_parsers];
    int i;
@@ -145,6 +198,9 @@ FileSet *Ftp::ParseLongList(const char *buf,int len,int *err_ret) const
       the_set=&set[i];
       the_err=&err[i];
    }
+   // remember the parser if it was a clear winner or made no errors.
+   if(guessed_parser || (*the_err==0 && (*the_set)->count()>0))
+      site->SetListParser(the_set-set,signature);
 leave:
    for(i=0; i<number_of_parsers; i++)
       if(&set[i]!=the_set)
@@ -25,7 +25,9 @@
 class FtpListInfo : public GenericParseListInfo
 {
    FileSet *ParseShortList(const char *buf,int len);
+   bool CanParsePartially() { return true; }
 public:
+   const char *GetClassName() { return "FtpListInfo"; }
    virtual FileSet *Parse(const char *buf,int len);
    FtpListInfo(FileAccess *session,const char *path) : GenericParseListInfo(session,path) {}
 };
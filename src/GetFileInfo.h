@@ -67,6 +67,7 @@ class GetFileInfo : public ListInfo
    void PrepareToDie();
 
 public:
+   const char *GetClassName() { return "GetFileInfo"; }
    GetFileInfo(const FileAccessRef& a, const char *path, bool showdir);
    virtual ~GetFileInfo();
 
@@ -44,6 +44,7 @@ protected:
    bool reverse;
 
 public:
+   const char *GetClassName() { return "GetJob"; }
    GetJob(FileAccess *s,ArgV *a,bool c=false);
 
    void DeleteFiles() { delete_files=true; }
@@ -275,6 +275,8 @@ void Http::ResetRequestData()
    inflate=0;
    seen_ranges_bytes=false;
    entity_date_set=false;
+   validator.set(0);
+   not_modified=false;
 }
 
 void Http::Close()
@@ -756,6 +758,14 @@ void Http::SendRequest(const char *connection,const char *f)
 	 else
 	    Send("Range: bytes=%lld-%lld\r\n",(long long)pos,(long long)limit-1);
       }
+      if(mode==LONG_LIST && cond_validator)
+      {
+	 // an entity tag is quoted, a date is not.
+	 if(cond_validator[0]=='"' || !strncmp(cond_validator,"W/",2))
+	    Send("If-None-Match: %s\r\n",cond_validator.get());
+	 else
+	    Send("If-Modified-Since: %s\r\n",cond_validator.get());
+      }
       break;
 
    case STORE:
@@ -917,8 +927,8 @@ int Http::SendArrayInfoRequest()
 	 name=&xstring::get_tmp(*name);
 	 name->append('/');
       }
-      if(fi->uri)
-	 file_url.set(dir_file(GetConnectURL(),fi->uri));
+      if(fi->GetURI())
+	 file_url.set(dir_file(GetConnectURL(),fi->GetURI()));
       else
 	 file_url.unset();
       SendRequest(array_send==fileset_for_info->count()-1 ? 0 : "keep-alive", *name);
@@ -1040,6 +1050,9 @@ void Http::HandleHeaderLine(const char *name,const char *value)
       if(opt_date)
 	 *opt_date=t;
 
+      if(mode==LONG_LIST && !validator)
+	 validator.set(value);
+
       if(mode==ARRAY_INFO && !propfind)
       {
 	 FileInfo *fi=fileset_for_info->curr();
@@ -1145,6 +1158,20 @@ void Http::HandleHeaderLine(const char *name,const char *value)
       }
       return;
    }
+   case_hh("Content-MD5",'C')
+      // it is the digest of the body sent, not of the whole file.
+      if(status_code!=H_Ok)
+	 return;
+      value=xstring::cat("MD5=",value,NULL);
+      goto case_Digest;
+   case_hh("Digest",'D')
+      if(!H_2XX(status_code))
+	 return;
+   case_Digest:
+      if(entity_digest)
+	 value=xstring::cat(entity_digest.get(),", ",value,NULL);
+      entity_digest.set(value);
+      return;
    case_hh("WWW-Authenticate",'W') {
       if(status_code!=H_Unauthorized)
 	 return;
@@ -1167,6 +1194,13 @@ void Http::HandleHeaderLine(const char *name,const char *value)
    default:
       break;
    }
+   // ETag hashes the same as Connection.
+   if(!strcasecmp(name,"ETag"))
+   {
+      if(mode==LONG_LIST && H_2XX(status_code))
+	 validator.set(value);
+      return;
+   }
    LogNote(10,"unhandled header line `%s'",name);
 }
 
@@ -1801,7 +1835,14 @@ int Http::Do()
 	 return MOVED;
       }
 
-      if(!H_2XX(status_code))
+      if(status_code==H_Not_Modified && mode==LONG_LIST && cond_validator)
+      {
+	 // the listing cached before is still valid.
+	 LogNote(9,"the listing is not modified");
+	 not_modified=true;
+	 body_size=0;
+      }
+      else if(!H_2XX(status_code))
       {
 	 xstring err;
 	 int code=NO_FILE;
@@ -1876,6 +1917,8 @@ int Http::Do()
 	 entity_size=NO_SIZE;
 	 if(opt_size)
 	    *opt_size=NO_SIZE;
+	 // the digests are of the compressed data.
+	 entity_digest.set(0);
 	 // start the inflation
 	 inflate=new DirectedBuffer(DirectedBuffer::GET);
 	 inflate->SetTranslator(new DataInflator());
@@ -1888,6 +1931,8 @@ int Http::Do()
 	    *opt_size=body_size;
       }
 
+      // plain bodies are only moved out of recv_buf, chunked ones are parsed.
+      conn->recv_buf->SetSegmented(!chunked);
       LogNote(9,_("Receiving body..."));
       rate_limit=new RateLimit(hostname);
       if(real_pos<0) // assume Range: did not work
@@ -2055,6 +2100,37 @@ int Http::Read(Buffer *buf,int size)
    }
    return res;
 }
+int Http::DirectRead(int fd,int size)
+{
+   if(Error() || mode!=RETRIEVE || state!=RECEIVING_BODY || real_pos!=pos
+   || chunked || inflate || !conn || conn->recv_buf->Eof()
+   || (body_size>=0 && bytes_received>=body_size)
+   || (entity_size>=0 && pos>=entity_size)
+   || (rate_limit && !rate_limit->Unlimited(RateLimit::GET)))
+   {
+      if(conn && conn->recv_buf)
+	 conn->recv_buf->SetDirect(false);
+      return NOT_SUPP;
+   }
+   // don't take the next response on a keep-alive connection.
+   if(body_size>=0 && size>body_size-bytes_received)
+      size=body_size-bytes_received;
+   int res=conn->recv_buf->DirectGet(fd,size);
+   if(res<0)
+      return NOT_SUPP;
+   if(res==0)
+   {
+      if(conn->recv_buf->Size()>0)
+	 return NOT_SUPP;
+      return DO_AGAIN;
+   }
+   _UpdatePos(res);
+   pos+=res;
+   if(rate_limit)
+      rate_limit->BytesGot(res);
+   TrySuccess();
+   return res;
+}
 void Http::_Skip(int to_skip)
 {
    if(inflate)
@@ -2086,7 +2162,10 @@ get_again:
       Disconnect();
       return DO_AGAIN;
    }
-   conn->recv_buf->Get(&buf1,&size1);
+   if(chunked)
+      conn->recv_buf->Get(&buf1,&size1);
+   else
+      conn->recv_buf->GetSpan(&buf1,&size1);
    if(buf1==0) // eof
    {
       LogNote(9,_("Hit EOF"));
@@ -201,6 +201,7 @@ protected:
    bool use_head;
 
 public:
+   const char *GetClassName() { return "Http"; }
    static void ClassInit();
 
    Http();
@@ -217,6 +218,7 @@ public:
    int Done();
    int Read(Buffer *,int);
    int Write(const void *,int);
+   int DirectRead(int fd,int size);
    int StoreStatus();
    int SendEOT();
    int Buffered();
@@ -249,6 +251,7 @@ public:
 class HFtp : public Http
 {
 public:
+   const char *GetClassName() { return "HFtp"; }
    HFtp();
    HFtp(const HFtp *);
    ~HFtp();
@@ -265,6 +268,7 @@ public:
 class Https : public Http
 {
 public:
+   const char *GetClassName() { return "Https"; }
    Https();
    Https(const Https *);
    ~Https();
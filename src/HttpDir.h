@@ -29,6 +29,7 @@ class HttpListInfo : public GenericParseListInfo
 {
    FileSet *Parse(const char *buf,int len);
 public:
+   const char *GetClassName() { return "HttpListInfo"; }
    HttpListInfo(Http *session,const char *path)
       : GenericParseListInfo(session,path)
       {
@@ -59,6 +60,7 @@ class HttpDirList : public DirList
    void ParsePropsFormat(const char *b,int len,bool eof);
 
 public:
+   const char *GetClassName() { return "HttpDirList"; }
    HttpDirList(FileAccess *s,ArgV *a);
    ~HttpDirList();
    const char *Status();
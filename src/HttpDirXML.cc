@@ -138,6 +138,10 @@ void xml_context::process_chardata()
       if(tm!=Http::ATOTM_ERROR)
 	 fi->SetDate(tm,0);
    }
+   else if(in("DAV:getetag"))
+   {
+      fi->SetETag(chardata);
+   }
    else if(in("DAV:creator-displayname"))
    {
       fi->SetUser(chardata);
@@ -222,7 +226,7 @@ void HttpDirList::ParsePropsFormat(const char *b,int len,bool eof)
       if(!info)
 	 break;
       info->MakeLongName();
-      buf->Put(info->longname);
+      buf->Put(info->GetLongName());
       if(ls_options.append_type)
       {
 	 if(info->filetype==info->DIRECTORY)
@@ -59,6 +59,7 @@ protected:
    IdNamePair *lookup(const char *id);
 
 public:
+   const char *GetClassName() { return "IdNameCache"; }
    IdNameCache();
    virtual ~IdNameCache();
    void Clear() { free(); init(); }
@@ -149,6 +149,17 @@ void Job::RemoveWaiting(const Job *j)
    if(i>=0)
       waiting.remove(i);
 }
+/* An FXP transfer which has one side confirmed need not hold its slot,
+   so the setup for the next file can overlap the end of the previous one.
+   Returns the number of such jobs, up to max. */
+int Job::WaitingFinishing(int max)
+{
+   int n=0;
+   for(int i=0; i<waiting_num && n<max; i++)
+      if(waiting[i]->IsFinishing())
+	 n++;
+   return n;
+}
 
 class KilledJob : public Job
 {
@@ -49,6 +49,7 @@ protected:
    virtual ~Job();
 
 public:
+   const char *GetClassName() { return "Job"; }
    int	 jobno;
    Job	 *parent;
 
@@ -58,6 +59,7 @@ public:
    template<class T> void AddWaiting(const JobRef<T>& r) { AddWaiting(r.get_non_const()); }
    void RemoveWaiting(const Job *);
    void ReplaceWaiting(Job *from,Job *to);
+   int WaitingFinishing(int max);
 
    void SetParent(Job *j);
    void SetParentFg(Job *j, bool f=true)
@@ -145,6 +147,8 @@ public:
    virtual off_t GetBytesCount();
    virtual double GetTimeSpent();
    virtual double GetTransferRate();
+   // the data are transferred, only a server confirmation is awaited (FXP).
+   virtual bool IsFinishing() { return false; }
 
    void WaitDone();
 };
@@ -156,6 +160,7 @@ protected:
    FileAccess *Clone() const { return session->Clone(); }
 
 public:
+   const char *GetClassName() { return "SessionJob"; }
    FileAccessRef session;
 
    xstring& FormatStatus(xstring&,int,const char *);
@@ -313,7 +313,10 @@ int LocalAccess::Read(Buffer *buf0,int size)
       if(ascii || lseek(fd,pos,SEEK_SET)==-1)
 	 real_pos=0;
       else
+      {
 	 real_pos=pos;
+	 async=AsyncFile::Open(fd);
+      }
    }
    stream->Kill(SIGCONT);
 read_again:
@@ -325,6 +328,9 @@ read_again:
       res=read(fd,buf,size/2);
    else
 #endif
+   if(async)
+      res=async->Read(real_pos,buf,size);
+   else
       res=read(fd,buf,size);
 
    if(res<0)
@@ -332,7 +338,9 @@ read_again:
       saved_errno=errno;
       if(E_RETRY(saved_errno))
       {
-	 Block(stream->getfd(),POLLIN);
+	 // the I/O engine wakes us up when the data are read
+	 if(!async)
+	    Block(stream->getfd(),POLLIN);
 	 return DO_AGAIN;
       }
       if(stream->NonFatalError(saved_errno))
@@ -388,7 +396,10 @@ int LocalAccess::Write(const void *vbuf,int len)
       if(ascii || lseek(fd,pos,SEEK_SET)==-1)
 	 real_pos=0;
       else
+      {
 	 real_pos=pos;
+	 async=AsyncFile::Open(fd);
+      }
       if(real_pos<pos)
       {
 	 error_code=STORE_FAILED;
@@ -433,15 +444,19 @@ int LocalAccess::Write(const void *vbuf,int len)
       return skip_cr;
    }
 
-   int res=write(fd,buf,len);
+   int res=(async ? async->Write(real_pos,buf,len) : write(fd,buf,len));
    if(res<0)
    {
       saved_errno=errno;
       if(E_RETRY(saved_errno))
       {
-	 Block(stream->getfd(),POLLOUT);
+	 if(!async)
+	    Block(stream->getfd(),POLLOUT);
 	 return DO_AGAIN;
       }
+      // a delayed write has failed, the data are lost.
+      if(async)
+	 return SEE_ERRNO;
       if(stream->NonFatalError(saved_errno))
       {
 	 // in case of full disk, check file correctness.
@@ -481,6 +496,13 @@ int LocalAccess::StoreStatus()
       if(stream->error())
 	 SetError(NO_FILE,stream->error_text);
    }
+   if(async && error_code==OK && async->Flush()==-1)
+   {
+      if(E_RETRY(errno))
+	 return IN_PROGRESS;
+      SetError(STORE_FAILED,strerror(errno));
+   }
+   async=0;
    stream=0;
    if(error_code==OK && entity_date!=NO_DATE)
    {
@@ -499,6 +521,7 @@ void LocalAccess::Close()
 {
    done=false;
    error_code=OK;
+   async=0;
    stream=0;
    FileAccess::Close();
 }
@@ -22,15 +22,18 @@
 
 #include "FileAccess.h"
 #include "Filter.h"
+#include "AsyncIO.h"
 
 class LocalAccess : public FileAccess
 {
    Ref<FDStream> stream;
+   Ref<AsyncFile> async;   // asynchronous I/O of a regular file
    bool done;
    void errno_handle();
    void fill_array_info();
 
 public:
+   const char *GetClassName() { return "LocalAccess"; }
    void Init();
    LocalAccess();
    LocalAccess(const LocalAccess *);
@@ -19,10 +19,17 @@
 
 #include <config.h>
 #include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
 #include "FileAccess.h"
 #include "LsCache.h"
 #include "plural.h"
 #include "misc.h"
+#include "WorkerPool.h"
 
 int LsCacheEntry::EstimateSize() const
 {
@@ -55,8 +62,12 @@ LsCacheEntry::LsCacheEntry(const FileAccess *p_loc,const char *a,int m,int e,con
 void LsCacheEntryData::SetData(int e,const char *d,int l,const FileSet *fs)
 {
    afset=fs?new FileSet(fs):0;
-   data.nset(d,l);
+   // negative length means there is no text.
+   data.nset(d,l<0?0:l);
+   has_text=(l>=0);
    err_code=e;
+   stored_fset.unset();
+   stored_count=-1;
 }
 void LsCacheEntryData::GetData(int *e,const char **d,int *l,const FileSet **fs)
 {
@@ -66,27 +77,52 @@ void LsCacheEntryData::GetData(int *e,const char **d,int *l,const FileSet **fs)
       *l=data.length();
    }
    if(fs)
+   {
+      ParseStoredFileSet();
       *fs=afset;
+   }
    *e=err_code;
 }
 bool LsCacheEntryLoc::Matches(const FileAccess *p_loc,const char *a,int m)
 {
    return (m==-1 || mode==m) && arg.eq(a) && p_loc->SameLocationAs(loc);
 }
+// All network protocols compare host names and paths in SameLocationAs;
+// local files are not cached.
+unsigned LsCacheEntryLoc::Hash(const FileAccess *p_loc,const char *a,int m)
+{
+   unsigned h=Cache::Hash(0,p_loc->GetProto());
+   h=Cache::HashNoCase(h,p_loc->GetHostName());
+   h=Cache::Hash(h,p_loc->GetCwd().path);
+   h=Cache::Hash(h,a);
+   return Cache::Hash(h,m);
+}
 
 ResDecl res_cache_empty_listings("cache:cache-empty-listings","no",ResMgr::BoolValidate,0);
 ResDecl res_cache_enable("cache:enable","yes",ResMgr::BoolValidate,0);
 ResDecl res_cache_expire("cache:expire","60m",ResMgr::TimeIntervalValidate,0);
 ResDecl res_cache_expire_neg("cache:expire-negative","1m",ResMgr::TimeIntervalValidate,0);
 ResDecl res_cache_size  ("cache:size","16M",ResMgr::UNumberValidate,ResMgr::NoClosure);
+ResDecl res_cache_site_size("cache:site-size","0",ResMgr::UNumberValidate,0);
+ResDecl res_cache_persist("cache:persist","no",ResMgr::BoolValidate,0);
+ResDecl res_cache_persist_expire("cache:persist-expire","7d",ResMgr::TimeIntervalValidate,ResMgr::NoClosure);
 
-LsCache::LsCache() : Cache(&res_cache_size,&res_cache_enable) {}
+LsCache::LsCache() : Cache(&res_cache_size,&res_cache_enable,&res_cache_site_size)
+{
+   disk_cleaned=false;
+   disk_writer=0;
+}
+
+LsCache::~LsCache()
+{
+   WaitDisk();
+}
 
 void LsCache::Add(const FileAccess *p_loc,const char *a,int m,int e,const char *d,int l,const FileSet *fs)
 {
    if(!strcmp(p_loc->GetProto(),"file"))
       return;  // don't cache local objects
-   if(l == 0 &&
+   if((l == 0 || (l < 0 && (!fs || fs->count() == 0))) &&
 	 !res_cache_empty_listings.QueryBool(p_loc->GetHostName()))
       return;
    if(e!=FA::OK && e!=FA::NO_FILE && e!=FA::NOT_SUPP)
@@ -99,12 +135,17 @@ void LsCache::Add(const FileAccess *p_loc,const char *a,int m,int e,const char *
    {
       if(!IsEnabled(p_loc->GetHostName()))
 	 return;
-      AddCacheEntry(new LsCacheEntry(p_loc,a,m,e,d,l,fs));
+      c=new LsCacheEntry(p_loc,a,m,e,d,l,fs);
+      AddCacheEntry(c,LsCacheEntryLoc::Hash(p_loc,a,m),p_loc->GetHostName());
    }
    else
    {
       c->SetData(e,d,l,fs);
+      SizeChanged(c);
    }
+   c->SetValidator(p_loc->GetValidator());
+   if(e==FA::OK && IsPersistent(p_loc,a,m))
+      Store(p_loc,a,m,c);
 }
 
 void LsCache::Add(const FileAccess *p_loc,const char *a,int m,int e,const Buffer *ubuf,const FileSet *fs)
@@ -130,37 +171,53 @@ LsCacheEntry *LsCache::Find(const FileAccess *p_loc,const char *a,int m)
       return 0;
 
    LsCacheEntry *c;
-   for(c=IterateFirst(); c; c=IterateNext())
+   for(c=HashFirst(LsCacheEntryLoc::Hash(p_loc,a,m)); c; c=HashNext(c))
    {
       if(c->Matches(p_loc,a,m))
 	 break;
    }
    if(c && c->Stopped())
    {
-      Trim();
+      DeleteEntry(c);
       return 0;
    }
    return c;
 }
 
-bool LsCache::Find(const FileAccess *p_loc,const char *a,int m,int *e,const char **d,int *l,const FileSet **fs)
+LsCacheEntry *LsCache::FindOrLoad(const FileAccess *p_loc,const char *a,int m)
 {
    LsCacheEntry *c=Find(p_loc,a,m);
+   if(!c && IsEnabled(p_loc->GetHostName()))
+      c=Load(p_loc,a,m);
+   return c;
+}
+
+bool LsCache::Find(const FileAccess *p_loc,const char *a,int m,int *e,const char **d,int *l,const FileSet **fs)
+{
+   LsCacheEntry *c=(LsCacheEntry*)Found(FindOrLoad(p_loc,a,m));
    if(!c)
       return false;
    c->GetData(e,d,l,fs);
+   // only the file set is kept, the caller has to get the text anew.
+   if(d && !c->HasText() && !(fs && *fs))
+      return false;
    return true;
 }
 
 const FileSet *LsCache::FindFileSet(const FileAccess *p_loc,const char *a,int m)
 {
-   LsCacheEntry *c=Find(p_loc,a,m);
+   LsCacheEntry *c=(LsCacheEntry*)Found(FindOrLoad(p_loc,a,m));
    if(!c)
       return 0;
-   return c->GetFileSet(c->loc);
+   if(c->HasFileSet())
+      return c->GetFileSet(c->loc);
+   const FileSet *fs=c->GetFileSet(c->loc);
+   SizeChanged(c);
+   return fs;
 }
 const FileSet *LsCacheEntryData::GetFileSet(const FileAccess *parser)
 {
+   ParseStoredFileSet();
    if(afset)
       return afset;
    if(err_code!=FA::OK)
@@ -177,15 +234,17 @@ void LsCache::UpdateFileSet(const FileAccess *p_loc,const char *a,int m,const Fi
    if(!c)
       return;
    c->UpdateFileSet(fs);
+   SizeChanged(c);
+   if(IsPersistent(p_loc,a,m))
+      Store(p_loc,a,m,c);
 }
 
 void LsCache::List()
 {
+   Expire();
    Trim();
 
-   long vol=0;
-   for(LsCacheEntry *c=IterateFirst(); c; c=IterateNext())
-      vol+=c->EstimateSize();
+   long vol=TotalSize();
 
    printf(plural("%ld $#l#byte|bytes$ cached",vol),vol);
 
@@ -194,6 +253,7 @@ void LsCache::List()
       puts(_(", no size limit"));
    else
       printf(_(", maximum size %ld\n"),sizelimit);
+   printf(_("%ld hits, %ld misses, %ld evictions\n"),hits,misses,evictions);
 }
 
 void LsCache::Changed(change_mode m,const FileAccess *f,const char *dir)
@@ -214,6 +274,412 @@ void LsCache::Changed(change_mode m,const FileAccess *f,const char *dir)
       else
 	 c=IterateNext();
    }
+
+   if(!res_cache_persist.QueryBool(f->GetHostName()))
+      return;
+   Unlink(f,f->GetCwd().path);
+   Unlink(f,fdir);
+   if(m==TREE_CHANGED)
+   {
+      xstring& key=xstring::get_tmp(f->GetConnectURL(f->NO_PATH|f->NO_PASSWORD));
+      key.append(' ').append(fdir);
+      trees_changed[key]=SMTask::now.UnixTime();
+   }
+}
+
+/* The persistent cache keeps a file per directory listing in the lftp cache
+ * directory, named by a hash of the key and checked by the key kept inside.
+ * A file is written under a temporary name and then renamed, so that lftp
+ * processes sharing the directory see either the old or the new listing.
+ * The modification time of the file is the time the listing was got or
+ * last revalidated. */
+
+#define DISK_MAGIC "lftp-ls-cache 1"
+
+static void disk_key(xstring& key,const FileAccess *p_loc,const char *dir,int m)
+{
+   key.set(p_loc->GetConnectURL(FA::NO_PATH|FA::NO_PASSWORD));
+   key.append(' ');
+   if(dir)
+      key.append_url_encoded(dir,strlen(dir)," %",URL_ALLOW_8BIT);
+   key.appendf(" %d",m);
+}
+static const xstring& disk_file(const char *dir,const xstring& key)
+{
+   return xstring::format("%s/%08x",dir,Cache::Hash(0,key));
+}
+
+static void append_file(xstring& buf,const FileInfo *fi)
+{
+   buf.appendf("%o %d %o %lld %d %lld %d",fi->defined,fi->filetype,(unsigned)fi->mode,
+      (long long)fi->date.ts,fi->date.ts_prec,(long long)fi->size,fi->nlinks);
+   const char *field[]={fi->user,fi->group,fi->symlink,fi->GetURI(),fi->name};
+   for(unsigned i=0; i<sizeof(field)/sizeof(*field); i++)
+   {
+      buf.append(' ');
+      append_text_field(buf,field[i]);
+   }
+   buf.append('\n');
+}
+static FileInfo *parse_file(char *line)
+{
+   unsigned defined,mode;
+   int type,prec,nlinks,n=0;
+   long long date,size;
+   if(sscanf(line,"%o %d %o %lld %d %lld %d%n",&defined,&type,&mode,
+	 &date,&prec,&size,&nlinks,&n)<7)
+      return 0;
+   enum { USER, GROUP, SYMLINK, URI, NAME, FIELDS };
+   char *field[FIELDS];
+   char *next=0;
+   for(int i=0; i<FIELDS; i++)
+   {
+      field[i]=strtok_r(i?0:line+n," ",&next);
+      if(!field[i])
+	 return 0;
+   }
+   const char *name=get_text_field(field[NAME]);
+   if(!name)
+      return 0;
+   FileInfo *fi=new FileInfo(name);
+   const char *s;
+   if((s=get_text_field(field[USER]))!=0)
+      fi->SetUser(s);
+   if((s=get_text_field(field[GROUP]))!=0)
+      fi->SetGroup(s);
+   fi->symlink.set(get_text_field(field[SYMLINK]));
+   if((s=get_text_field(field[URI]))!=0)
+      fi->SetURI(s);
+   fi->filetype=(FileInfo::type)type;
+   fi->mode=mode;
+   fi->date.set(date,prec);
+   fi->size=size;
+   fi->nlinks=nlinks;
+   fi->defined=defined;
+   fi->need=0;
+   return fi;
+}
+
+// cuts the first line off p, 0 if there is no complete line.
+static char *next_line(char *&p,const char *end)
+{
+   char *nl=(char*)memchr(p,'\n',end-p);
+   if(!nl)
+      return 0;
+   *nl=0;
+   char *line=p;
+   p=nl+1;
+   return line;
+}
+
+// the file set is parsed only when it is used.
+void LsCacheEntryData::ParseStoredFileSet()
+{
+   if(stored_count<0)
+      return;
+   Ref<FileSet> fs(new FileSet);
+   char *p=stored_fset.get_non_const();
+   const char *end=p+stored_fset.length();
+   for(int i=0; i<stored_count && fs; i++)
+   {
+      char *line=next_line(p,end);
+      FileInfo *fi=line?parse_file(line):0;
+      if(fi)
+	 fs->Add(fi);
+      else
+	 fs=0;	// damaged, the listing will be parsed instead
+   }
+   afset=fs.borrow();
+   stored_fset.unset();
+   stored_count=-1;
+}
+
+struct LsCacheDiskEntry
+{
+   xstring buf;	  // the file contents, the fields point into it
+   const char *validator;
+   const char *data;
+   int data_len;
+   char *files;	  // lines of the file set
+   int files_len;
+   int count;	  // of the files, -1 if no file set is stored
+};
+
+/* The header lines are: magic, key, validator, data length (-1 if there is
+ * no text) and file count.
+ * Only the beginning of the file is read to get the validator; a key too
+ * long to fit there just makes the request unconditional. */
+#define DISK_HEADER_MAX 0x1000
+
+static bool read_disk_entry(const char *file,const xstring& key,LsCacheDiskEntry *e,bool header_only)
+{
+   if(!read_file(file,e->buf,header_only?DISK_HEADER_MAX:-1))
+      return false;
+   char *p=e->buf.get_non_const();
+   const char *end=p+e->buf.length();
+   char *line[4];
+   for(int i=0; i<(header_only?3:4); i++)
+   {
+      line[i]=next_line(p,end);
+      if(!line[i])
+	 return false;
+   }
+   if(strcmp(line[0],DISK_MAGIC) || strcmp(line[1],key))
+      return false;
+   e->validator=(strcmp(line[2],"-")?line[2]:0);
+   if(header_only)
+      return true;
+   if(sscanf(line[3],"%d %d",&e->data_len,&e->count)!=2
+   || e->data_len<-1 || e->data_len>end-p || (e->data_len<0 && e->count<0))
+      return false;
+   e->data=p;
+   e->files=p+(e->data_len<0?0:e->data_len);
+   e->files_len=end-e->files;
+   return true;
+}
+
+static bool write_all(int fd,const char *buf,int len)
+{
+   while(len>0)
+   {
+      int res=write(fd,buf,len);
+      if(res<=0)
+	 return false;
+      buf+=res;
+      len-=res;
+   }
+   return true;
+}
+
+bool LsCache::IsPersistent(const FileAccess *p_loc,const char *a,int m)
+{
+   // only whole directory listings, they can be found by path on changes.
+   if(a && a[0])
+      return false;
+   if(m!=FA::LIST && m!=FA::LONG_LIST && m!=FA::MP_LIST)
+      return false;
+   if(!strcmp(p_loc->GetProto(),"file"))
+      return false;
+   return res_cache_persist.QueryBool(p_loc->GetHostName());
+}
+
+const char *LsCache::DiskDir()
+{
+   if(!disk_dir)
+   {
+      const char *home=get_lftp_cache_dir();
+      if(!home)
+	 return 0;
+      disk_dir.set(dir_file(home,"ls"));
+      mkdir(disk_dir,0700);
+   }
+   return disk_dir;
+}
+
+// remove listings not used for long and temporary files left behind.
+void LsCache::CleanDisk()
+{
+   disk_cleaned=true;
+   TimeIntervalR expire(res_cache_persist_expire.Query(0));
+   if(expire.IsInfty())
+      return;
+   DIR *d=opendir(disk_dir);
+   if(!d)
+      return;
+   time_t old=SMTask::now.UnixTime()-expire.Seconds();
+   struct dirent *de;
+   while((de=readdir(d))!=0)
+   {
+      if(de->d_name[0]=='.')
+	 continue;
+      const char *file=dir_file(disk_dir,de->d_name);
+      struct stat st;
+      if(lstat(file,&st)!=-1 && S_ISREG(st.st_mode) && st.st_mtime<old)
+	 unlink(file);
+   }
+   closedir(d);
+}
+
+bool LsCache::TreeChangedSince(const FileAccess *p_loc,time_t t)
+{
+   if(trees_changed.count()==0)
+      return false;
+   xstring key;
+   key.set(p_loc->GetConnectURL(FA::NO_PATH|FA::NO_PASSWORD));
+   key.append(' ').append(p_loc->GetCwd().path);
+   for(time_t changed=trees_changed.each_begin(); !trees_changed.each_finished();
+	 changed=trees_changed.each_next())
+   {
+      if(changed>=t && key.begins_with(trees_changed.each_key()))
+	 return true;
+   }
+   return false;
+}
+
+void LsCache::Store(const FileAccess *p_loc,const char *a,int m,LsCacheEntry *c)
+{
+   const char *dir=DiskDir();
+   if(!dir)
+      return;
+   if(!disk_cleaned)
+      CleanDisk();
+
+   int e;
+   const char *d;
+   int l;
+   const FileSet *fs;
+   c->GetData(&e,&d,&l,&fs);
+
+   xstring key;
+   disk_key(key,p_loc,p_loc->GetCwd().path,m);
+   const char *validator=c->GetValidator();
+   xstring buf(DISK_MAGIC "\n");
+   buf.append(key).append('\n');
+   buf.append(validator?validator:"-").append('\n');
+   buf.appendf("%d %d\n",c->HasText()?l:-1,fs?fs->count():-1);
+   buf.append(d,l);
+   for(int i=0; fs && i<fs->count(); i++)
+      append_file(buf,(*fs)[i]);
+
+   xstring *data=new xstring;
+   data->move_here(buf);
+   disk_queue.add(disk_file(dir,key),data);
+   FlushDisk();
+}
+
+class LsCache::DiskWriter : public WorkerJob
+{
+   LsCache *cache;
+   xmap_p<xstring> files;
+protected:
+   void Run() {
+      for(xstring *data=files.each_begin(); data; data=files.each_next())
+      {
+	 const xstring& file=files.each_key();
+	 xstring tmp;
+	 tmp.setf("%s.%d",file.get(),(int)getpid());
+	 int fd=open(tmp,O_WRONLY|O_CREAT|O_TRUNC,0600);
+	 if(fd==-1)
+	    continue;
+	 bool ok=write_all(fd,*data,data->length());
+	 if(close(fd)==-1)
+	    ok=false;
+	 if(!ok || rename(tmp,file)==-1)
+	    unlink(tmp);
+      }
+   }
+   void Finish() {
+      cache->disk_writer=0;
+      cache->FlushDisk();
+   }
+public:
+   DiskWriter(LsCache *c) : cache(c) { files.move_here(c->disk_queue); }
+};
+
+// start writing the queued listings unless a batch is being written.
+void LsCache::FlushDisk()
+{
+   if(disk_writer || disk_queue.count()==0)
+      return;
+   disk_writer=new DiskWriter(this);
+   WorkerPool::Submit(disk_writer);
+}
+
+void LsCache::WaitDisk()
+{
+   while(disk_writer)
+   {
+      DiskWriter *w=disk_writer;
+      WorkerPool::Wait(w);
+      if(disk_writer==w)
+	 break;	 // the pool is gone with its threads
+   }
+}
+
+LsCacheEntry *LsCache::Load(const FileAccess *p_loc,const char *a,int m,bool revalidated)
+{
+   if(!IsPersistent(p_loc,a,m))
+      return 0;
+   const char *dir=DiskDir();
+   if(!dir)
+      return 0;
+   WaitDisk();
+   xstring key;
+   disk_key(key,p_loc,p_loc->GetCwd().path,m);
+   xstring file;
+   file.set(disk_file(dir,key));
+
+   // check the age before reading the file.
+   struct stat st;
+   if(stat(file,&st)==-1)
+      return 0;
+   const char *closure=p_loc->GetHostName();
+   TimeIntervalR expire(res_cache_expire.Query(closure));
+   time_t age=SMTask::now.UnixTime()-st.st_mtime;
+   if(revalidated)
+      age=0;
+   else if(TreeChangedSince(p_loc,st.st_mtime))
+   {
+      unlink(file);
+      return 0;
+   }
+   else if(!expire.IsInfty() && age>=expire.Seconds())
+      return 0;  // the validator can still be used.
+   if(age<0)
+      age=0;
+
+   LsCacheDiskEntry e;
+   if(!read_disk_entry(file,key,&e,false))
+      return 0;
+   if(revalidated)
+      utime(file,0);
+
+   Trim();
+   LsCacheEntry *c=new LsCacheEntry(p_loc,a,m,FA::OK,e.data,e.data_len,0);
+   c->SetStoredFileSet(e.files,e.files_len,e.count);
+   c->SetValidator(e.validator);
+   if(!expire.IsInfty())
+      c->Set(TimeInterval(expire.Seconds()-age,0));
+   AddCacheEntry(c,LsCacheEntryLoc::Hash(p_loc,a,m),closure);
+   return c;
+}
+
+void LsCache::Unlink(const FileAccess *p_loc,const char *dir)
+{
+   const char *disk=DiskDir();
+   if(!disk || !dir)
+      return;
+   WaitDisk();
+   static const int modes[]={FA::LIST,FA::LONG_LIST,FA::MP_LIST};
+   xstring key;
+   for(unsigned i=0; i<sizeof(modes)/sizeof(*modes); i++)
+   {
+      disk_key(key,p_loc,dir,modes[i]);
+      unlink(disk_file(disk,key));
+   }
+}
+
+const char *LsCache::FindValidator(const FileAccess *p_loc,const char *a,int m)
+{
+   if(!IsEnabled(p_loc->GetHostName()) || !IsPersistent(p_loc,a,m))
+      return 0;
+   const char *dir=DiskDir();
+   if(!dir)
+      return 0;
+   WaitDisk();
+   xstring key;
+   disk_key(key,p_loc,p_loc->GetCwd().path,m);
+   static LsCacheDiskEntry e;
+   if(!read_disk_entry(disk_file(dir,key),key,&e,true))
+      return 0;
+   return e.validator;
+}
+
+bool LsCache::Revalidate(const FileAccess *p_loc,const char *a,int m)
+{
+   if(!IsEnabled(p_loc->GetHostName()))
+      return false;
+   return Find(p_loc,a,m) || Load(p_loc,a,m,true);
 }
 
 /* Mark a path as a directory or file. (We have other ways of knowing this;
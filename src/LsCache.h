@@ -37,6 +37,7 @@ class LsCacheEntryLoc
 public:
    bool Matches(const FileAccess *p_loc,const char *a,int m);
    LsCacheEntryLoc(const FileAccess *p_loc,const char *a,int m);
+   static unsigned Hash(const FileAccess *p_loc,const char *a,int m);
    int EstimateSize() const { return xstrlen(arg)+(arg!=0); }
    const char *GetClosure() const;
 };
@@ -44,14 +45,25 @@ class LsCacheEntryData
 {
    int	 err_code;
    xstring data;
+   bool has_text;	  // false if only the file set is kept
    Ref<FileSet> afset;    // associated file set
+   xstring_c validator;	  // like ETag, to check if the listing has changed
+   xstring stored_fset;	  // lines of the file set read from disk
+   int stored_count;	  // their number, -1 if there are none
+   void ParseStoredFileSet();
 public:
    LsCacheEntryData(int e,const char *d,int l,const FileSet *fs);
    void SetData(int e,const char *d,int l,const FileSet *fs);
    void GetData(int *e,const char **d,int *l,const FileSet **fs);
    const FileSet *GetFileSet(const FileAccess *parser);
-   void UpdateFileSet(const FileSet *fs) { if(afset) afset->Merge(fs); }
-   int EstimateSize() const { return data.length()+(afset?afset->EstimateMemory():0); }
+   bool HasFileSet() const { return afset!=0; }
+   bool HasText() const { return has_text; }
+   void SetStoredFileSet(const char *s,int len,int count)
+      { stored_fset.nset(s,len); stored_count=count; }
+   void SetValidator(const char *v) { validator.set(v); }
+   const char *GetValidator() const { return validator; }
+   void UpdateFileSet(const FileSet *fs) { ParseStoredFileSet(); if(afset) afset->Merge(fs); }
+   int EstimateSize() const { return data.length()+stored_fset.length()+(afset?afset->EstimateMemory():0); }
 };
 
 class LsCacheEntry : public CacheEntry, public LsCacheEntryLoc, public LsCacheEntryData
@@ -67,14 +79,50 @@ class LsCache : public Cache
    LsCacheEntry *IterateFirst() { return (LsCacheEntry*)Cache::IterateFirst(); }
    LsCacheEntry *IterateNext()  { return (LsCacheEntry*)Cache::IterateNext(); }
    LsCacheEntry *IterateDelete(){ return (LsCacheEntry*)Cache::IterateDelete(); }
+   LsCacheEntry *HashFirst(unsigned h) { return (LsCacheEntry*)Cache::HashFirst(h); }
+   LsCacheEntry *HashNext(LsCacheEntry *c) { return (LsCacheEntry*)Cache::HashNext(c); }
+
+   // listings are also kept on disk for other lftp processes and later runs.
+   bool IsPersistent(const FileAccess *p_loc,const char *a,int m);
+   xstring_c disk_dir;
+   const char *DiskDir();
+   bool disk_cleaned;
+   void CleanDisk();
+   // trees changed by this process, their older listings on disk are stale.
+   xmap<time_t> trees_changed;
+   bool TreeChangedSince(const FileAccess *p_loc,time_t t);
+   void Store(const FileAccess *p_loc,const char *a,int m,LsCacheEntry *c);
+   // listings are written by a worker thread, one batch at a time; the
+   // queue keeps the latest contents by file name until then.
+   class DiskWriter;
+   xmap_p<xstring> disk_queue;
+   DiskWriter *disk_writer;
+   void FlushDisk();
+   void WaitDisk();  // until the queued listings are on disk
+   LsCacheEntry *Load(const FileAccess *p_loc,const char *a,int m,bool revalidated=false);
+   void Unlink(const FileAccess *p_loc,const char *dir);
+   LsCacheEntry *FindOrLoad(const FileAccess *p_loc,const char *a,int m);
+
 public:
    LsCache();
+   ~LsCache();
    void Add(const FileAccess *p_loc,const char *a,int m,int err,const char *d,int l,const FileSet *f=0);
    void Add(const FileAccess *p_loc,const char *a,int m,int err,const Buffer *ubuf,const FileSet *f=0);
+   // cache only the file set, when the listing text is not needed.
+   void AddFileSet(const FileAccess *p_loc,const char *a,int m,const FileSet *f)
+      {
+	 if(f)
+	    Add(p_loc,a,m,FA::OK,0,-1,f);
+      }
    bool Find(const FileAccess *p_loc,const char *a,int m,int *err,const char **d, int *l,const FileSet **f=0);
    const FileSet *FindFileSet(const FileAccess *p_loc,const char *a,int m);
    void UpdateFileSet(const FileAccess *p_loc,const char *a,int m,const FileSet *fs);
 
+   // the validator (like ETag) of a listing on disk, even an expired one.
+   const char *FindValidator(const FileAccess *p_loc,const char *a,int m);
+   // the server said the listing on disk is not modified, use it again.
+   bool Revalidate(const FileAccess *p_loc,const char *a,int m);
+
    int IsDirectory(const FileAccess *p_loc,const char *dir);
    void SetDirectory(const FileAccess *p_loc, const char *path, bool dir);
 
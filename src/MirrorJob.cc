@@ -100,6 +100,9 @@ final:
       s.appendf(plural("%sTotal: %d director$y|ies$, %d file$|s$, %d symlink$|s$\n",
 		     stats.dirs,stats.tot_files,stats.tot_symlinks),
 	 tab,stats.dirs,stats.tot_files,stats.tot_symlinks);
+   if(stats.pruned_dirs)
+      s.appendf(plural("%sUnchanged: %d director$y|ies$ skipped\n",stats.pruned_dirs),
+	 tab,stats.pruned_dirs);
    if(stats.new_files || stats.new_symlinks)
       s.appendf(plural("%sNew: %d file$|s$, %d symlink$|s$\n",
 		     stats.new_files,stats.new_symlinks),
@@ -301,7 +304,8 @@ void  MirrorJob::HandleFile(FileInfo *file)
       {
 	 bool remove_target=false;
 	 bool cont_this=false;
-	 bool use_pget=(pget_n>1) && target_is_local;
+	 // uploads write the parts at offsets, pgetJob checks the protocol.
+	 bool use_pget=(pget_n>1) && (target_is_local || source_is_local);
 	 if(file->Has(file->SIZE) && file->size<pget_minchunk*2)
 	    use_pget=false;
 	 if(target_is_local)
@@ -362,8 +366,9 @@ void  MirrorJob::HandleFile(FileInfo *file)
 
 	 if(script)
 	 {
-	    ArgV args(use_pget?"pget":"get");
-	    if(use_pget)
+	    bool script_pget=use_pget && target_is_local;
+	    ArgV args(script_pget?"pget":"get");
+	    if(script_pget)
 	    {
 	       args.Append("-n");
 	       args.Append(pget_n);
@@ -468,6 +473,15 @@ void  MirrorJob::HandleFile(FileInfo *file)
 	       }
 	    }
 	 }
+	 if(!create_target_subdir && root_mirror->snapshot && !FlagSet(SCAN_ALL_FIRST)
+	 && root_mirror->snapshot->Unchanged(source_name_rel,file))
+	 {
+	    if(verbose_report>=3)
+	       Report(_("Skipping unchanged directory `%s'"),target_name_rel);
+	    root_mirror->snapshot->Keep(source_name_rel);
+	    stats.pruned_dirs++;
+	    goto skip;
+	 }
 
       do_submirror:
 	 // launch sub-mirror
@@ -481,6 +495,8 @@ void  MirrorJob::HandleFile(FileInfo *file)
 	 mj->target_relative_dir.set(target_name_rel);
 
 	 mj->create_target_dir=create_target_subdir;
+	 if(root_mirror->snapshot)
+	    mj->source_dir_info=new FileInfo(*file);
 
 	 if(verbose_report>=3) {
 	    if(FlagSet(SCAN_ALL_FIRST))
@@ -1090,7 +1106,7 @@ int   MirrorJob::Do()
       }
       if(max_error_count>0 && stats.error_count>=max_error_count)
 	 goto pre_FINISHING;
-      while(transfer_count<parallel && state==WAITING_FOR_TRANSFER)
+      while(transfer_count-WaitingFinishing(parallel)<parallel && state==WAITING_FOR_TRANSFER)
       {
 	 file=to_transfer->curr();
 	 if(!file)
@@ -1331,6 +1347,7 @@ int   MirrorJob::Do()
 
       // all jobs finished and src dir removed, if needed.
 
+      RecordSnapshot();
       transfer_count++; // parent mirror will decrement it.
       if(parent_mirror)
 	 parent_mirror->stats.Add(stats);
@@ -1628,7 +1645,7 @@ void MirrorJob::Statistics::Reset()
 {
    tot_files=new_files=mod_files=del_files=
    tot_symlinks=new_symlinks=mod_symlinks=del_symlinks=
-   dirs=del_dirs=0;
+   dirs=del_dirs=pruned_dirs=0;
 }
 void MirrorJob::Statistics::Add(const Statistics &s)
 {
@@ -1642,6 +1659,7 @@ void MirrorJob::Statistics::Add(const Statistics &s)
    del_symlinks+=s.del_symlinks;
    dirs        +=s.dirs;
    del_dirs    +=s.del_dirs;
+   pruned_dirs +=s.pruned_dirs;
    error_count +=s.error_count;
    bytes       +=s.bytes;
    time	       +=s.time;
@@ -1676,6 +1694,35 @@ void MirrorJob::SetOnChange(const char *oc)
    on_change.set(oc);
 }
 
+void MirrorJob::SetSnapshot(const char *file,const char *source,const char *target,const char *options)
+{
+   snapshot=new MirrorSnapshot(file,source,target,options);
+   snapshot->Load();
+}
+
+void MirrorJob::RecordSnapshot()
+{
+   MirrorSnapshot *s=root_mirror->snapshot.get_non_const();
+   if(!s)
+      return;
+   if(parent_mirror)
+   {
+      // a directory with errors has to be mirrored again.
+      if(source_dir_info && source_set && stats.error_count==0)
+      {
+	 int subdirs=0;
+	 source_set->Count(&subdirs,0,0,0);
+	 s->Add(source_relative_dir,source_dir_info,subdirs==0);
+      }
+      return;
+   }
+   // the directories are not recorded when scanning all first.
+   if(script_only || FlagSet(SCAN_ALL_FIRST))
+      return;
+   if(!s->Save())
+      eprintf("mirror: %s: %s\n",s->GetFile(),strerror(errno));
+}
+
 const char *MirrorJob::AddPattern(Ref<PatternSet>& exclude,char opt,const char *optarg)
 {
    PatternSet::Type type=
@@ -1802,6 +1849,7 @@ CMD(mirror)
       OPT_TRANSFER_ALL,
       OPT_TARGET_FLAT,
       OPT_DELETE_EXCLUDED,
+      OPT_SNAPSHOT,
    };
    static const struct option mirror_opts[]=
    {
@@ -1864,6 +1912,7 @@ CMD(mirror)
       {"transfer-all",no_argument,0,OPT_TRANSFER_ALL},
       {"flat",no_argument,0,OPT_TARGET_FLAT},
       {"delete-excluded",no_argument,0,OPT_DELETE_EXCLUDED},
+      {"snapshot",required_argument,0,OPT_SNAPSHOT},
       {0}
    };
 
@@ -1890,6 +1939,8 @@ CMD(mirror)
    bool	 no_empty_dirs=ResMgr::QueryBool("mirror:no-empty-dirs",0);
    const char *script_file=0;
    const char *on_change=0;
+   const char *snapshot=0;
+   xstring snapshot_options;  // the options changing what a run does
    const char *recursion_mode=0;
    bool single_file=false;
    bool single_dir=false;
@@ -1944,6 +1995,7 @@ CMD(mirror)
       case('X'):
       case('I'):
       {
+	 snapshot_options.appendf("%d %s\n",opt,optarg);
 	 const char *err=MirrorJob::AddPattern(exclude,opt,optarg);
 	 if(err)
 	 {
@@ -1957,6 +2009,7 @@ CMD(mirror)
       case('X'+'f'):
       case('I'+'f'):
       {
+	 snapshot_options.appendf("%d %s\n",opt,optarg);
 	 const char *err=MirrorJob::AddPatternsFrom(exclude,opt-'f',optarg);
 	 if(err)
 	 {
@@ -1990,6 +2043,7 @@ CMD(mirror)
 	 /*fallthrough*/
       case('F'): // mirror for a single directory (or glob pattern).
       {
+	 snapshot_options.appendf("%d %s\n",opt,optarg);
 	 xstring pattern(basename_ptr(optarg));
 	 if(opt=='F') {
 	    single_dir=true;
@@ -2015,6 +2069,7 @@ CMD(mirror)
 	 older_than=optarg;
 	 break;
       case(OPT_SIZE_RANGE):
+	 snapshot_options.appendf("size %s\n",optarg);
 	 size_range=new Range(optarg);
 	 if(size_range->Error())
 	 {
@@ -2117,6 +2172,9 @@ CMD(mirror)
       case(OPT_DELETE_EXCLUDED):
 	 flags|=MirrorJob::DELETE_EXCLUDED;
 	 break;
+      case(OPT_SNAPSHOT):
+	 snapshot=optarg;
+	 break;
       case('?'):
 	 eprintf(_("Try `help %s' for more information.\n"),args->a0());
       no_job:
@@ -2256,6 +2314,18 @@ CMD(mirror)
 	 use_pget=use_pget2;
    }
 
+   // the snapshot is only valid for the same source, target and options.
+   xstring_c snapshot_source,snapshot_target;
+   if(snapshot) {
+      snapshot_source.set(source_session->GetFileURL(source_dir,FA::NO_PASSWORD));
+      snapshot_target.set(target_session->GetFileURL(target_dir,FA::NO_PASSWORD));
+      snapshot_options.appendf("flags %d\n",flags&~(MirrorJob::REPORT_NOT_DELETED|MirrorJob::LOOP));
+      snapshot_options.appendf("newer %s\nolder %s\nrecursion %s\n",
+	 newer_than?newer_than:"",older_than?older_than:"",recursion_mode?recursion_mode:"");
+      snapshot_options.appendf("remove %d %d\nskip-noaccess %d\n",
+	 remove_source_files,remove_source_dirs,skip_noaccess);
+   }
+
    JobRef<MirrorJob> j(new MirrorJob(0,source_session.borrow(),target_session.borrow(),source_dir,target_dir));
    j->SetFlags(flags,1);
    j->SetVerbose(verbose);
@@ -2312,6 +2382,8 @@ CMD(mirror)
    j->SetMaxErrorCount(max_error_count);
    if(on_change)
       j->SetOnChange(on_change);
+   if(snapshot)
+      j->SetSnapshot(snapshot,snapshot_source,snapshot_target,snapshot_options);
 
    return j.borrow();
 
@@ -25,10 +25,12 @@
 #include "Job.h"
 #include "PatternSet.h"
 #include "misc.h"
+#include "MirrorSnapshot.h"
 
 class MirrorJob : public Job
 {
 public:
+   const char *GetClassName() { return "MirrorJob"; }
    enum recursion_mode_t {
       RECURSION_ALWAYS,
       RECURSION_NEVER,
@@ -121,6 +123,7 @@ private:
       int dirs,del_dirs;
       int tot_symlinks,new_symlinks,mod_symlinks,del_symlinks;
       int error_count;
+      int pruned_dirs;
       long long bytes;
       double time;
       Statistics();
@@ -173,6 +176,10 @@ private:
 
    xstring_c on_change;
 
+   Ref<MirrorSnapshot> snapshot;  // in the root mirror only
+   Ref<FileInfo> source_dir_info; // the source directory as listed in parent
+   void RecordSnapshot();
+
    mode_t get_mode_mask();
 
    int source_redirections;
@@ -278,6 +285,7 @@ public:
       }
    void SetMaxErrorCount(int ec) { max_error_count=ec; }
    void SetOnChange(const char *oc);
+   void SetSnapshot(const char *file,const char *source,const char *target,const char *options);
    static const char *AddPattern(Ref<PatternSet>& exclude,char opt,const char *optarg);
    static const char *AddPatternsFrom(Ref<PatternSet>& exclude,char opt,const char *file);
 
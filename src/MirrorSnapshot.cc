@@ -0,0 +1,171 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 2026 by the lftp contributors (see the AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include "MirrorSnapshot.h"
+#include "misc.h"
+
+/* The snapshot is a text file: a magic line, the source and target URLs,
+   a hash of the options, then a line per directory:
+      date precision leaf etag path
+   The strings are url-encoded, `-' stands for none. */
+#define SNAPSHOT_MAGIC "lftp-mirror-snapshot 2"
+
+MirrorSnapshot::MirrorSnapshot(const char *f,const char *s,const char *t,const char *o)
+   : file(f), source(s), target(t)
+{
+   unsigned hash=0x12345678;
+   for(const char *p=o; p && *p; p++)
+      hash+=(hash<<5)+(unsigned char)*p;
+   options_hash.set(xstring::format("%08x",hash));
+}
+
+MirrorSnapshot::Dir *MirrorSnapshot::NewDir(const FileInfo *fi,bool leaf)
+{
+   Dir *d=new Dir;
+   if(fi->Has(fi->DATE))
+      d->date=fi->date;
+   else
+      d->date.set(NO_DATE,0);
+   d->etag.set(fi->GetETag());
+   d->leaf=leaf;
+   return d;
+}
+
+bool MirrorSnapshot::Load()
+{
+   xstring buf;
+   if(!read_file(file,buf))
+      return false;
+
+   // header lines: magic, source, target and options.
+   char *p=buf.get_non_const();
+   char *end=p+buf.length();
+   char *header[4];
+   for(int i=0; i<4; i++)
+   {
+      char *nl=(char*)memchr(p,'\n',end-p);
+      if(!nl)
+	 return false;
+      *nl=0;
+      header[i]=p;
+      p=nl+1;
+   }
+   // a snapshot of another source, target or options is of no use.
+   if(strcmp(header[0],SNAPSHOT_MAGIC)
+   || xstrcmp(get_text_field(header[1]),source) || xstrcmp(get_text_field(header[2]),target)
+   || strcmp(header[3],options_hash))
+      return false;
+
+   while(p<end)
+   {
+      char *line=p;
+      char *nl=(char*)memchr(p,'\n',end-p);
+      if(!nl)
+	 break;	  // a partial line
+      *nl=0;
+      p=nl+1;
+      long long date;
+      int prec,leaf,n=0;
+      if(sscanf(line,"%lld %d %d %n",&date,&prec,&leaf,&n)<3 || n==0)
+	 continue;
+      char *next=0;
+      const char *etag_field=strtok_r(line+n," ",&next);
+      const char *path_field=strtok_r(0," ",&next);
+      if(!etag_field || !path_field)
+	 continue;
+      Dir *d=new Dir;
+      d->date.set(date,prec);
+      d->etag.set(get_text_field(etag_field));
+      d->leaf=leaf;
+      const char *path=get_text_field(path_field);
+      old_dirs.add(path?path:"",d);
+   }
+   return true;
+}
+
+bool MirrorSnapshot::Save()
+{
+   xstring buf(SNAPSHOT_MAGIC "\n");
+   append_text_field(buf,source);
+   buf.append('\n');
+   append_text_field(buf,target);
+   buf.append('\n');
+   buf.append(options_hash);
+   buf.append('\n');
+   for(const Dir *d=new_dirs.each_begin(); d; d=new_dirs.each_next())
+   {
+      buf.appendf("%lld %d %d ",(long long)d->date.ts,d->date.ts_prec,d->leaf);
+      append_text_field(buf,d->etag);
+      buf.append(' ');
+      append_text_field(buf,new_dirs.each_key());
+      buf.append('\n');
+   }
+
+   const xstring& tmp=xstring::format("%s.%d",file.get(),(int)getpid());
+   FILE *f=fopen(tmp,"w");
+   if(!f)
+      return false;
+   bool ok=(fwrite(buf.get(),1,buf.length(),f)==buf.length());
+   if(fclose(f)!=0)
+      ok=false;
+   if(!ok || rename(tmp,file)==-1)
+   {
+      int e=errno;
+      unlink(tmp);
+      errno=e;
+      return false;
+   }
+   return true;
+}
+
+bool MirrorSnapshot::Unchanged(const char *path,const FileInfo *fi) const
+{
+   const Dir *d=old_dirs.lookup(path);
+   if(!d || !d->leaf)
+      return false;
+   const char *etag=fi->GetETag();
+   if(etag && d->etag)
+      return !strcmp(etag,d->etag);
+   // a coarse timestamp does not show changes made within its precision.
+   return fi->Has(fi->DATE) && fi->date.ts_prec==0
+      && d->date.ts!=NO_DATE && d->date.ts_prec==0
+      && fi->date.ts==d->date.ts;
+}
+
+void MirrorSnapshot::Add(const char *path,const FileInfo *fi,bool leaf)
+{
+   new_dirs.add(path,NewDir(fi,leaf));
+}
+
+void MirrorSnapshot::Keep(const char *path)
+{
+   const Dir *old=old_dirs.lookup(path);
+   if(!old)
+      return;
+   Dir *d=new Dir;
+   d->date=old->date;
+   d->etag.set(old->etag);
+   d->leaf=old->leaf;
+   new_dirs.add(path,d);
+}
@@ -0,0 +1,71 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 2026 by the lftp contributors (see the AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MIRRORSNAPSHOT_H
+#define MIRRORSNAPSHOT_H 1
+
+#include "xstring.h"
+#include "xmap.h"
+#include "FileSet.h"
+
+// Directory timestamps and validators of a mirror source saved after a
+// run, so that the next run can skip directories which have not changed.
+// A directory's timestamp only changes when entries are added, removed or
+// renamed in it, not when something deeper changes, so only directories
+// without subdirectories are considered for skipping.
+class MirrorSnapshot
+{
+   struct Dir
+   {
+      FileTimestamp date;
+      xstring_c etag;
+      bool leaf;  // had no subdirectories
+   };
+
+   xstring_c file;
+   xstring_c source;
+   xstring_c target;
+   xstring_c options_hash;  // of the options of the run
+   xmap_p<Dir> old_dirs;   // loaded from the file
+   xmap_p<Dir> new_dirs;   // seen or kept in this run
+
+   static Dir *NewDir(const FileInfo *fi,bool leaf);
+
+public:
+   // options describe what the run does, like patterns and --delete.
+   MirrorSnapshot(const char *file,const char *source,const char *target,const char *options);
+
+   // read the snapshot, false if it does not exist, is of another mirror
+   // or of a run with other options.
+   bool Load();
+   // write the directories of this run to a new file replacing the old one.
+   bool Save();
+
+   // the directory at path has been seen unchanged and without subdirectories.
+   bool Unchanged(const char *path,const FileInfo *fi) const;
+   // record a directory mirrored successfully in this run.
+   void Add(const char *path,const FileInfo *fi,bool leaf);
+   // keep the old record of a directory skipped in this run.
+   void Keep(const char *path);
+
+   const char *GetFile() const { return file; }
+   int GetCount() const { return old_dirs.count(); }
+};
+
+#endif//MIRRORSNAPSHOT_H
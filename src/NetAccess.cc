@@ -503,9 +503,13 @@ do_again:
       {
 	 session->Open("",mode);
 	 session->UseCache(use_cache);
+	 if(use_cache && conditional)
+	    session->SetConditional(FileAccess::cache->FindValidator(session,"",mode));
 	 ubuf=new IOBufferFileAccess(session);
 	 ubuf->SetSpeedometer(new Speedometer());
-	 if(FileAccess::cache->IsEnabled(session->GetHostName()))
+	 // the MP_LIST text is shown only by .mplist, the file set is enough
+	 // and the parsed parts of the listing free their text.
+	 if(FileAccess::cache->IsEnabled(session->GetHostName()) && mode!=FA::MP_LIST)
 	    ubuf->Save(FileAccess::cache->SizeLimit());
 	 session->Roll();
 	 ubuf->Roll();
@@ -516,7 +520,11 @@ do_again:
    {
       if(ubuf->Error())
       {
-	 FileAccess::cache->Add(session,"",mode,session->GetErrorCode(),ubuf);
+	 parsed.unset();
+	 if(ubuf->IsSaving())
+	    FileAccess::cache->Add(session,"",mode,session->GetErrorCode(),ubuf);
+	 else
+	    FileAccess::cache->Add(session,"",mode,session->GetErrorCode(),ubuf->ErrorText(),strlen(ubuf->ErrorText())+1);
 	 if(mode==FA::MP_LIST)
 	 {
 	    mode=FA::LONG_LIST;
@@ -530,17 +538,48 @@ do_again:
       }
 
       if(!ubuf->Eof())
+      {
+	 if(CanParsePartially())
+	 {
+	    ParsePart();
+	    if(mode!=old_mode)
+	    {
+	       // the listing is not in the expected format, try another mode.
+	       parsed.unset();
+	       ubuf=0;
+	       return MOVED;
+	    }
+	 }
 	 return m;
+      }
 
-      // now we have all the index in ubuf; parse it.
+      if(session->NotModified())
+      {
+	 // the listing on disk is still valid, get it from the cache.
+	 if(FileAccess::cache->Revalidate(session,"",mode))
+	    Log::global->Write(11,"ListInfo: cached listing is not modified\n");
+	 else
+	    conditional=false;
+	 ubuf=0;
+	 goto do_again;
+      }
+
+      // now we have the rest of the index in ubuf; parse it.
       const char *b;
       int len;
       ubuf->Get(&b,&len);
       old_mode=mode;
-      set=Parse(b,len);
-
-      // cache the list and the set.
-      FileAccess::cache->Add(session,"",old_mode,FA::OK,ubuf,set);
+      if(parsed.count()==0 || len>0)
+	 set=Parse(b,len);
+      if(parsed.count()>0 && mode==old_mode)
+	 set=MergeParts(set.borrow());
+      parsed.unset();
+
+      // cache the list and the set, or just the set without the text.
+      if(ubuf->IsSaving())
+	 FileAccess::cache->Add(session,"",old_mode,FA::OK,ubuf,mode==old_mode?set.get():0);
+      else if(mode==old_mode)
+	 FileAccess::cache->AddFileSet(session,"",old_mode,set);
 
 got_fileset:
       if(set)
@@ -621,6 +660,41 @@ got_fileset:
    return m;
 }
 
+// Parse the complete lines received so far, when there are enough of them.
+void GenericParseListInfo::ParsePart()
+{
+   const char *b;
+   int len;
+   ubuf->Get(&b,&len);
+   if(len<0x10000)
+      return;
+   const char *nl=(const char*)memrchr(b,'\n',len);
+   if(!nl)
+      return;
+   len=nl+1-b;
+   FileSet *set=Parse(b,len);
+   ubuf->Skip(len);
+   if(set)
+      parsed.append(set);
+}
+
+// Merge the parsed parts and the last one pairwise, so that each entry is
+// copied only log(parts) times.
+FileSet *GenericParseListInfo::MergeParts(FileSet *last)
+{
+   if(last)
+      parsed.append(last);
+   while(parsed.count()>1)
+   {
+      for(int i=0; i+1<parsed.count(); i++)
+      {
+	 parsed[i]->Merge(parsed[i+1]);
+	 parsed.remove(i+1);
+      }
+   }
+   return parsed.count()>0?parsed[0].borrow():0;
+}
+
 bool GenericParseListInfo::ResolveRedirect(const FileInfo *fi)
 {
    if(fi->filetype!=fi->REDIRECT || redir_count>=max_redir)
@@ -637,13 +711,14 @@ bool GenericParseListInfo::ResolveRedirect(const FileInfo *fi)
    if(!u.proto) {
       // relative URI
       redir_session=session->Clone();
-      if(loc[0]=='/' || fi->uri) {
+      const char *uri=fi->GetURI();
+      if(loc[0]=='/' || uri) {
 	 if(loc[0]!='/') {
-	    const char *slash=strrchr(fi->uri,'/');
+	    const char *slash=strrchr(uri,'/');
 	    if(slash)
-	       loc.prepend(fi->uri,slash+1-fi->uri);
+	       loc.prepend(uri,slash+1-uri);
 	 }
-	 redir_fi->uri.set(loc);
+	 redir_fi->SetURI(loc);
 	 redir_fi->name.set(loc);
 	 redir_fi->name.url_decode();
       } else {
@@ -657,7 +732,7 @@ bool GenericParseListInfo::ResolveRedirect(const FileInfo *fi)
       // absolute URL
       redir_session=FileAccess::New(&u);
       redir_fi->name.set(u.path?u.path.get():"/");
-      redir_fi->uri.set(url::path_ptr(u.orig_url));
+      redir_fi->SetURI(url::path_ptr(u.orig_url));
    }
 
    if(!redir_fs)
@@ -673,7 +748,8 @@ bool GenericParseListInfo::ResolveRedirect(const FileInfo *fi)
 
 GenericParseListInfo::GenericParseListInfo(FileAccess *s,const char *p)
    : ListInfo(s,p), redir_resolution(false), redir_count(0),
-     max_redir(ResMgr::Query("xfer:max-redirections",0))
+     max_redir(ResMgr::Query("xfer:max-redirections",0)),
+     conditional(true)
 {
    get_time_for_dirs=true;
    can_get_prec_time=true;
@@ -33,11 +33,26 @@ protected:
       int current_connection_limit;
       int connection_limit;
       Timer connection_limit_timer;
+      int list_parser;
+      xstring_c list_signature;
 
    public:
       SiteData(const xstring &site)
 	 : current_connection_limit(0), connection_limit(0),
-	   connection_limit_timer("net:connection-limit-timer",site) {}
+	   connection_limit_timer("net:connection-limit-timer",site),
+	   list_parser(-1) {}
+
+      // the listing parser which worked for the site last time, as long
+      // as the server identifies itself the same way (if known).
+      int GetListParser(const char *sig) const {
+	 if(sig && list_signature && strcmp(sig,list_signature))
+	    return -1;
+	 return list_parser;
+      }
+      void SetListParser(int p,const char *sig) {
+	 list_parser=p;
+	 list_signature.set(sig);
+      }
 
       void SetConnectionLimit(int L) {
 	 connection_limit=L;
@@ -174,17 +189,25 @@ class GenericParseListInfo : public ListInfo
    Ref<FileSet> redir_fs;
    bool ResolveRedirect(const FileInfo *fi);
 
+   bool conditional;	 // ask for the listing only if it has changed
+
 protected:
    int mode;
    SMTaskRef<IOBuffer> ubuf;
+   RefArray<FileSet> parsed;	 // parts parsed while the listing arrives
 
    bool get_time_for_dirs;
    bool can_get_prec_time;
 
    virtual FileSet *Parse(const char *buf,int len)
       { return session->ParseLongList(buf,len); }
+   // line-based listings can be parsed in parts before the end comes.
+   virtual bool CanParsePartially() { return false; }
+   void ParsePart();
+   FileSet *MergeParts(FileSet *last);
 
 public:
+   const char *GetClassName() { return "GenericParseListInfo"; }
    GenericParseListInfo(FileAccess *session,const char *path);
    int Do();
    const char *Status();
@@ -69,6 +69,7 @@ class OutputJob : public Job
    const SMTaskRef<FileCopyPeer>& OutputPeer() const;
 
 public:
+   const char *GetClassName() { return "OutputJob"; }
    OutputJob(FDStream *output, const char *a0);
    OutputJob(const char *path, const char *a0, FA *fa=0);
    void PrepareToDie();
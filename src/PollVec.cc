@@ -19,7 +19,13 @@
 
 #include <config.h>
 #include "trio.h"
+#include <errno.h>
+#include <string.h>
+#include <time.h>
 #include "PollVec.h"
+#if USE_EPOLL
+# include <sys/epoll.h>
+#endif
 
 static inline bool operator<(const timeval& a,const timeval& b)
 {
@@ -28,6 +34,121 @@ static inline bool operator<(const timeval& a,const timeval& b)
    return a.tv_usec<b.tv_usec;
 }
 
+PollVec::PollVec()
+{
+   method=new_method=SELECT;
+#if USE_EPOLL
+   epfd=-1;
+   need_rebuild=false;
+   verify_pos=0;
+#endif
+   FD_ZERO(&in_polled);
+   FD_ZERO(&out_polled);
+   FD_ZERO(&in_ready);
+   FD_ZERO(&out_ready);
+   Empty();
+   SetMethod(DefaultMethod());
+}
+PollVec::~PollVec()
+{
+#if USE_EPOLL
+   if(epfd!=-1)
+      close(epfd);
+#endif
+}
+
+const char *PollVec::MethodName(method_t m)
+{
+   switch(m)
+   {
+   case SELECT: return "select";
+   case POLL:   return "poll";
+   case EPOLL:  return "epoll";
+   }
+   return "";
+}
+bool PollVec::MethodByName(const char *name,method_t *m)
+{
+   if(!strcmp(name,"select"))
+      *m=SELECT;
+   else if(!strcmp(name,"poll"))
+      *m=POLL;
+#if USE_EPOLL
+   else if(!strcmp(name,"epoll"))
+      *m=EPOLL;
+#endif
+   else if(!strcmp(name,"auto") || !*name)
+      *m=DefaultMethod();
+   else
+      return false;
+   return true;
+}
+PollVec::method_t PollVec::DefaultMethod()
+{
+#if USE_EPOLL
+   return EPOLL;
+#else
+   return POLL;
+#endif
+}
+void PollVec::SetMethod(method_t m)
+{
+   // switching in the middle of a cycle would lose the fds already added,
+   // so it is delayed till the next Empty.
+   new_method=m;
+}
+
+PollVec::fd_state& PollVec::state(int fd)
+{
+   if(fd>=fd_states.count()) {
+      static const fd_state zero={0,0,0,0};
+      fd_states.grow_space(fd+1);
+      fd_states.allocate(fd+1-fd_states.count(),zero);
+   }
+   return fd_states[fd];
+}
+void PollVec::ClearPolled()
+{
+   for(int i=0; i<polled_fds.count(); i++) {
+      fd_state &s=fd_states[polled_fds[i]];
+      s.polled=s.ready=0;
+   }
+   polled_fds.truncate();
+}
+
+void PollVec::Empty()
+{
+   for(int i=0; i<want_fds.count(); i++)
+      fd_states[want_fds[i]].want=0;
+   want_fds.truncate();
+   FD_ZERO(&in);
+   FD_ZERO(&out);
+   nfds=0;
+   tv_timeout.tv_sec=-1;
+   tv_timeout.tv_usec=0;
+
+   if(new_method==method)
+      return;
+
+   FD_ZERO(&in_polled);
+   FD_ZERO(&out_polled);
+   ClearPolled();
+#if USE_EPOLL
+   if(epfd!=-1) {
+      close(epfd);
+      epfd=-1;
+   }
+   for(int i=0; i<fd_states.count(); i++)
+      fd_states[i].reg=0;
+   if(new_method==EPOLL) {
+      epfd=epoll_create1(EPOLL_CLOEXEC);
+      if(epfd==-1)
+	 new_method=POLL;
+   }
+#endif
+   method=new_method;
+}
+
 void PollVec::AddTimeoutU(unsigned t)
 {
    struct timeval new_timeout={static_cast<time_t>(t/1000000),static_cast<suseconds_t>(t%1000000)};
@@ -37,43 +158,241 @@ void PollVec::AddTimeoutU(unsigned t)
 
 void PollVec::AddFD(int fd,int mask)
 {
-   if(mask&IN)
-      FD_SET(fd,&in);
-   if(mask&OUT)
-      FD_SET(fd,&out);
-   if(nfds<=fd)
-      nfds=fd+1;
+   if(method==SELECT) {
+      if(fd>=FD_SETSIZE) {
+	 // cannot wait for it with select, switch to poll and retry soon.
+	 SetMethod(POLL);
+	 NoWait();
+	 return;
+      }
+      if(mask&IN)
+	 FD_SET(fd,&in);
+      if(mask&OUT)
+	 FD_SET(fd,&out);
+      if(nfds<=fd)
+	 nfds=fd+1;
+      return;
+   }
+   fd_state &s=state(fd);
+   if(!s.want)
+      want_fds.append(fd);
+   s.want|=mask;
 }
 bool PollVec::FDReady(int fd,int mask)
 {
    bool res=false;
+   if(method==SELECT) {
+      if(fd>=FD_SETSIZE)
+	 return true;
+      if(mask&IN)
+	 res|=(!FD_ISSET(fd,&in_polled) || FD_ISSET(fd,&in_ready));
+      if(mask&OUT)
+	 res|=(!FD_ISSET(fd,&out_polled) || FD_ISSET(fd,&out_ready));
+      return res;
+   }
+   if(fd>=fd_states.count())
+      return true;
+   const fd_state &s=fd_states[fd];
    if(mask&IN)
-      res|=(!FD_ISSET(fd,&in_polled) || FD_ISSET(fd,&in_ready));
+      res|=(!(s.polled&IN) || (s.ready&IN));
    if(mask&OUT)
-      res|=(!FD_ISSET(fd,&out_polled) || FD_ISSET(fd,&out_ready));
+      res|=(!(s.polled&OUT) || (s.ready&OUT));
    return res;
 }
+void PollVec::NewFD(int fd)
+{
+   // the number may be reused; the cached registration is not valid for it.
+   if(fd>=0 && fd<fd_states.count())
+      fd_states[fd].reg=0;
+}
 void PollVec::FDSetNotReady(int fd,int mask)
 {
-   if(mask&IN)
-      FD_CLR(fd,&in_ready);
-   if(mask&OUT)
-      FD_CLR(fd,&out_ready);
+   if(method==SELECT) {
+      if(fd>=FD_SETSIZE)
+	 return;
+      if(mask&IN)
+	 FD_CLR(fd,&in_ready);
+      if(mask&OUT)
+	 FD_CLR(fd,&out_ready);
+      return;
+   }
+   if(fd<fd_states.count())
+      fd_states[fd].ready&=~mask;
+}
+
+void PollVec::BlockSelect(const timeval *timeout)
+{
+   in_ready=in_polled=in;
+   out_ready=out_polled=out;
+   timeval select_timeout;
+   if(timeout)
+      select_timeout=*timeout;
+   select(nfds,&in_ready,&out_ready,0,timeout?&select_timeout:0);
 }
 
+void PollVec::BlockPoll(int timeout_ms)
+{
+   ClearPolled();
+   pfds.get_space(want_fds.count());
+   pfds.set_length(want_fds.count());
+   for(int i=0; i<want_fds.count(); i++) {
+      int fd=want_fds[i];
+      fd_state &s=fd_states[fd];
+      struct pollfd &p=pfds[i];
+      p.fd=fd;
+      p.events=((s.want&IN)?POLLIN:0)|((s.want&OUT)?POLLOUT:0);
+      p.revents=0;
+      s.polled=s.want;
+   }
+   polled_fds.set(want_fds);
+   if(poll(pfds.get_non_const(),pfds.count(),timeout_ms)<=0)
+      return;
+   for(int i=0; i<pfds.count(); i++) {
+      const struct pollfd &p=pfds[i];
+      if(!p.revents)
+	 continue;
+      fd_state &s=fd_states[p.fd];
+      // errors and hangups are reported as readiness, like select does.
+      if(p.revents&(POLLERR|POLLHUP|POLLNVAL))
+	 s.ready=s.polled;
+      if(p.revents&POLLIN)
+	 s.ready|=IN;
+      if(p.revents&POLLOUT)
+	 s.ready|=OUT;
+      s.ready&=s.polled;
+   }
+}
+
+#if USE_EPOLL
+void PollVec::EpollUpdate(int fd,int mask)
+{
+   fd_state &s=fd_states[fd];
+   struct epoll_event ev;
+   memset(&ev,0,sizeof(ev));
+   ev.events=((mask&IN)?EPOLLIN:0)|((mask&OUT)?EPOLLOUT:0);
+   ev.data.fd=fd;
+   int op=(s.reg?EPOLL_CTL_MOD:EPOLL_CTL_ADD);
+   int res=epoll_ctl(epfd,op,fd,&ev);
+   if(res==-1 && op==EPOLL_CTL_MOD && errno==ENOENT)
+      res=epoll_ctl(epfd,EPOLL_CTL_ADD,fd,&ev);
+   else if(res==-1 && op==EPOLL_CTL_ADD && errno==EEXIST)
+      res=epoll_ctl(epfd,EPOLL_CTL_MOD,fd,&ev);
+   s.reg=(res==-1?0:mask);
+}
+void PollVec::EpollRebuild()
+{
+   // drops registrations of files closed while still open elsewhere.
+   close(epfd);
+   epfd=epoll_create1(EPOLL_CLOEXEC);
+   for(int i=0; i<polled_fds.count(); i++)
+      fd_states[polled_fds[i]].reg=0;
+   for(int i=0; i<want_fds.count(); i++)
+      fd_states[want_fds[i]].reg=0;
+   need_rebuild=false;
+}
+void PollVec::BlockEpoll(int timeout_ms)
+{
+   // unregister the fds not wanted any more
+   for(int i=0; i<polled_fds.count(); i++) {
+      int fd=polled_fds[i];
+      fd_state &s=fd_states[fd];
+      if(!s.want && s.reg) {
+	 epoll_ctl(epfd,EPOLL_CTL_DEL,fd,0);
+	 s.reg=0;
+      }
+   }
+   ClearPolled();
+
+   if(need_rebuild)
+      EpollRebuild();
+   if(epfd==-1) {
+      SetMethod(POLL);
+      BlockPoll(timeout_ms);
+      return;
+   }
+
+   bool unpollable=false;
+   for(int i=0; i<want_fds.count(); i++) {
+      int fd=want_fds[i];
+      fd_state &s=fd_states[fd];
+      if(s.reg!=s.want)
+	 EpollUpdate(fd,s.want);
+      if(s.reg!=s.want) {
+	 // e.g. a regular file: epoll refuses it, but it is always ready.
+	 unpollable=true;
+	 continue;
+      }
+      s.polled=s.want;
+   }
+   polled_fds.set(want_fds);
+   if(unpollable)
+      timeout_ms=0;
+
+   // Registrations are bound to open files, not to fd numbers, so an fd
+   // closed and reused without NewFD (e.g. inside a library) leaves the
+   // cached registration stale. Re-check a few fds per cycle; EPOLL_CTL_MOD
+   // fails with ENOENT for a stale one and EpollUpdate adds it again.
+   for(int i=0; i<4 && i<want_fds.count(); i++) {
+      if(verify_pos>=want_fds.count())
+	 verify_pos=0;
+      int fd=want_fds[verify_pos++];
+      fd_state &s=fd_states[fd];
+      if(s.reg && s.reg==s.want)
+	 EpollUpdate(fd,s.want);
+   }
+
+   // the rest of ready fds (if any) will be reported by the next call.
+   int max_events=want_fds.count();
+   if(max_events<1)
+      max_events=1;
+   else if(max_events>1024)
+      max_events=1024;
+   struct epoll_event *events=(struct epoll_event*)alloca(max_events*sizeof(*events));
+   int n=epoll_wait(epfd,events,max_events,timeout_ms);
+   for(int i=0; i<n; i++) {
+      int fd=events[i].data.fd;
+      if(fd>=fd_states.count() || !fd_states[fd].reg) {
+	 // a registration for an fd we don't know; it was closed while
+	 // still referenced elsewhere.
+	 need_rebuild=true;
+	 continue;
+      }
+      fd_state &s=fd_states[fd];
+      unsigned e=events[i].events;
+      if(e&(EPOLLERR|EPOLLHUP))
+	 s.ready=s.polled;
+      if(e&EPOLLIN)
+	 s.ready|=IN;
+      if(e&EPOLLOUT)
+	 s.ready|=OUT;
+      s.ready&=s.polled;
+   }
+}
+#endif // USE_EPOLL
+
 void  PollVec::Block()
 {
-   if(nfds<1 && tv_timeout.tv_sec<0)
+   bool no_fds=(method==SELECT ? nfds<1 : want_fds.count()<1);
+   if(no_fds && tv_timeout.tv_sec<0)
    {
       /* dead lock */
       fprintf(stderr,_("%s: BUG - deadlock detected\n"),"PollVec::Block");
       tv_timeout.tv_sec=1;
    }
 
-   in_ready=in_polled=in;
-   out_ready=out_polled=out;
-   timeval *select_timeout=0;
+   if(method==SELECT) {
+      BlockSelect(tv_timeout.tv_sec!=-1?&tv_timeout:0);
+      return;
+   }
+
+   int timeout_ms=-1;
    if(tv_timeout.tv_sec!=-1)
-      select_timeout=&tv_timeout;
-   select(nfds,&in_ready,&out_ready,0,select_timeout);
+      timeout_ms=tv_timeout.tv_sec*1000+(tv_timeout.tv_usec+999)/1000;
+#if USE_EPOLL
+   if(method==EPOLL) {
+      BlockEpoll(timeout_ms);
+      return;
+   }
+#endif
+   BlockPoll(timeout_ms);
 }
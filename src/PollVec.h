@@ -28,8 +28,26 @@ CDECL_BEGIN
 #include <poll.h>
 CDECL_END
 
+#include "xarray.h"
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_EPOLL_CREATE1)
+# define USE_EPOLL 1
+#endif
+
 class PollVec
 {
+public:
+   enum method_t {
+      SELECT,	// select(2) on fd_set, limited by FD_SETSIZE
+      POLL,	// poll(2) over the fds added in this cycle
+      EPOLL,	// persistent epoll(7) registrations, O(ready) reporting
+   };
+
+private:
+   method_t method;
+   method_t new_method;	// applied at the start of the next cycle
+
+   // select method state
    fd_set in;
    fd_set out;
    fd_set in_polled;
@@ -37,25 +55,40 @@ class PollVec
    fd_set in_ready;
    fd_set out_ready;
    int nfds;
+
+   // poll and epoll method state, indexed by fd
+   struct fd_state
+   {
+      unsigned char want;     // events requested in the current cycle
+      unsigned char polled;   // events waited for in the last Block
+      unsigned char ready;    // events reported by the last Block
+      unsigned char reg;      // events registered in the epoll set
+   };
+   xarray<fd_state> fd_states;
+   xarray<int> want_fds;      // fds with non-zero want
+   xarray<int> polled_fds;    // fds with non-zero polled (and reg)
+   xarray<struct pollfd> pfds;
+
+   fd_state& state(int fd);
+   void ClearPolled();
+   void BlockSelect(const timeval *);
+   void BlockPoll(int timeout_ms);
+#if USE_EPOLL
+   int epfd;
+   bool need_rebuild;
+   int verify_pos;	// round-robin index into want_fds for stale checks
+   void BlockEpoll(int timeout_ms);
+   void EpollUpdate(int fd,int events);
+   void EpollRebuild();
+#endif
+
    struct timeval tv_timeout;
 
 public:
-   PollVec() {
-      Empty();
-      FD_ZERO(&in_polled);
-      FD_ZERO(&out_polled);
-      FD_ZERO(&in_ready);
-      FD_ZERO(&out_ready);
-   }
+   PollVec();
+   ~PollVec();
 
-   void	 Empty()
-      {
-	 FD_ZERO(&in);
-	 FD_ZERO(&out);
-	 nfds=0;
-	 tv_timeout.tv_sec=-1;
-	 tv_timeout.tv_usec=0;
-      }
+   void	 Empty();
    void	 Block();
 
    enum {
@@ -72,8 +105,15 @@ public:
    void AddFD(int fd,int events);
    bool FDReady(int fd,int events);
    void FDSetNotReady(int fd,int events);
+   void NewFD(int fd);	// fd was just created, possibly reusing a number
    void NoWait() { tv_timeout.tv_sec=tv_timeout.tv_usec=0; }
    bool WillNotBlock() { return tv_timeout.tv_sec==0 && tv_timeout.tv_usec==0; }
+
+   void SetMethod(method_t m);
+   method_t GetMethod() const { return method; }
+   static const char *MethodName(method_t m);
+   static bool MethodByName(const char *name,method_t *m);
+   static method_t DefaultMethod();
 };
 
 #endif /* POLLVEC_H */
@@ -28,6 +28,7 @@
 class ProcWait : public SMTask
 {
 public:
+   const char *GetClassName() { return "ProcWait"; }
    enum	State
    {
       TERMINATED,
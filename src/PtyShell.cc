@@ -165,6 +165,7 @@ int PtyShell::getfd()
 
    close(ttyfd);
    fd=ptyfd;
+   SMTask::NewFD(fd);
 
    fcntl(fd,F_SETFD,FD_CLOEXEC);
    fcntl(fd,F_SETFL,O_NONBLOCK);
@@ -175,6 +176,8 @@ int PtyShell::getfd()
       pipe_out=pipe0[1];
       close(pipe1[1]);
       pipe_in=pipe1[0];
+      SMTask::NewFD(pipe_in);
+      SMTask::NewFD(pipe_out);
       fcntl(pipe_in,F_SETFD,FD_CLOEXEC);
       fcntl(pipe_in,F_SETFL,O_NONBLOCK);
       fcntl(pipe_out,F_SETFD,FD_CLOEXEC);
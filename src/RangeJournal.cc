@@ -0,0 +1,240 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 2026 by the lftp contributors (see the AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#include "RangeJournal.h"
+#include "misc.h"
+
+/* The journal starts with a header record followed by range records,
+   all of them RECORD_SIZE bytes:
+      header: 8 bytes magic, 8 bytes file size,   4 bytes CRC-32
+      range:  8 bytes start, 8 bytes limit,	  4 bytes CRC-32
+   The numbers are little endian. */
+#define RECORD_SIZE 20
+static const char journal_magic[8]={'L','F','T','P','R','J','1','\n'};
+
+// the journal is rewritten after this number of appended records.
+#define COMPACT_RECORDS 1024
+
+static unsigned crc32(const unsigned char *p,int len)
+{
+   unsigned crc=0xFFFFFFFF;
+   while(len-->0)
+   {
+      crc^=*p++;
+      for(int k=0; k<8; k++)
+	 crc=(crc>>1)^(0xEDB88320&-(crc&1));
+   }
+   return ~crc;
+}
+
+static void put_le(unsigned char *p,unsigned long long v,int n)
+{
+   for(int i=0; i<n; i++,v>>=8)
+      p[i]=v&0xFF;
+}
+static unsigned long long get_le(const unsigned char *p,int n)
+{
+   unsigned long long v=0;
+   while(n-->0)
+      v=(v<<8)|p[n];
+   return v;
+}
+
+static void make_record(unsigned char *r,const void *a8,unsigned long long b)
+{
+   memcpy(r,a8,8);
+   put_le(r+8,b,8);
+   put_le(r+16,crc32(r,16),4);
+}
+static void make_range(unsigned char *r,off_t start,off_t limit)
+{
+   unsigned char a[8];
+   put_le(a,start,8);
+   make_record(r,a,limit);
+}
+static bool check_record(const unsigned char *r)
+{
+   return get_le(r+16,4)==crc32(r,16);
+}
+
+RangeJournal::RangeJournal(const char *f)
+   : file(f), fd(-1), size(-1), appended(0)
+{
+}
+RangeJournal::~RangeJournal()
+{
+   if(fd!=-1)
+      close(fd);
+}
+
+void RangeJournal::Merge(off_t start,off_t limit)
+{
+   if(start>=limit)
+      return;
+   // find the first range which ends at or after start.
+   int i=0;
+   while(i<done.count() && done[i].limit<start)
+      i++;
+   // absorb all the ranges touching [start,limit).
+   int j=i;
+   while(j<done.count() && done[j].start<=limit)
+   {
+      if(done[j].start<start)
+	 start=done[j].start;
+      if(done[j].limit>limit)
+	 limit=done[j].limit;
+      j++;
+   }
+   if(j>i)
+      done.remove(i,j);
+   Range r={start,limit};
+   done.insert(r,i);
+}
+
+bool RangeJournal::Load()
+{
+   int lfd=open(file,O_RDONLY);
+   if(lfd==-1)
+      return false;
+   struct stat st;
+   if(fstat(lfd,&st)==-1 || st.st_size<RECORD_SIZE)
+   {
+      close(lfd);
+      return false;
+   }
+   xstring data;
+   char *buf=data.add_space(st.st_size);
+   int len=0;
+   while(len<st.st_size)
+   {
+      int res=read(lfd,buf+len,st.st_size-len);
+      if(res<=0)
+	 break;
+      len+=res;
+   }
+   close(lfd);
+
+   const unsigned char *r=(const unsigned char*)buf;
+   if(len<RECORD_SIZE || memcmp(r,journal_magic,8) || !check_record(r))
+      return false;
+   size=get_le(r+8,8);
+   done.truncate();
+   for(int pos=RECORD_SIZE; pos+RECORD_SIZE<=len; pos+=RECORD_SIZE)
+   {
+      r=(const unsigned char*)buf+pos;
+      // a record damaged by a crash ends the journal.
+      if(!check_record(r))
+	 break;
+      Merge(get_le(r,8),get_le(r+8,8));
+   }
+   return true;
+}
+
+bool RangeJournal::Compact()
+{
+   xstring& tmp=xstring::get_tmp(file).append(".new");
+   int nfd=open(tmp,O_WRONLY|O_CREAT|O_TRUNC|O_APPEND,0644);
+   if(nfd==-1)
+      return false;
+   fcntl(nfd,F_SETFD,FD_CLOEXEC);
+
+   xstring data;
+   unsigned char *r=(unsigned char*)data.add_space((done.count()+1)*RECORD_SIZE);
+   make_record(r,journal_magic,size);
+   for(int i=0; i<done.count(); i++)
+      make_range(r+(i+1)*RECORD_SIZE,done[i].start,done[i].limit);
+   int len=(done.count()+1)*RECORD_SIZE;
+
+   // the new journal has to be complete on disk before it replaces the old.
+   if(write(nfd,r,len)!=len || fsync(nfd)==-1 || rename(tmp,file)==-1)
+   {
+      close(nfd);
+      unlink(tmp);
+      return false;
+   }
+   if(fd!=-1)
+      close(fd);
+   fd=nfd;
+   appended=0;
+   return true;
+}
+
+void RangeJournal::Add(off_t start,off_t limit)
+{
+   if(start>=limit)
+      return;
+   Merge(start,limit);
+   if(fd==-1 || appended>=COMPACT_RECORDS)
+   {
+      if(Compact())
+	 return;
+      if(fd==-1)
+	 return;
+   }
+   unsigned char r[RECORD_SIZE];
+   make_range(r,start,limit);
+   // a short write is detected by the CRC on load.
+   if(write(fd,r,RECORD_SIZE)==RECORD_SIZE)
+      appended++;
+}
+
+bool RangeJournal::Sync()
+{
+   return fd==-1 || fsync(fd)!=-1;
+}
+
+off_t RangeJournal::NextMissing(off_t pos) const
+{
+   for(int i=0; i<done.count(); i++)
+   {
+      if(done[i].start>pos)
+	 break;
+      if(done[i].limit>pos)
+	 return done[i].limit;
+   }
+   return pos;
+}
+
+void RangeJournal::GetMissing(off_t size,xarray<Range> *missing) const
+{
+   missing->truncate();
+   off_t pos=0;
+   for(int i=0; i<done.count() && pos<size; i++)
+   {
+      if(done[i].start>pos)
+      {
+	 Range r={pos,done[i].start<size?done[i].start:size};
+	 missing->append(r);
+      }
+      if(done[i].limit>pos)
+	 pos=done[i].limit;
+   }
+   if(pos<size)
+   {
+      Range r={pos,size};
+      missing->append(r);
+   }
+}
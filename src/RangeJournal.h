@@ -0,0 +1,78 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 2026 by the lftp contributors (see the AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RANGEJOURNAL_H
+#define RANGEJOURNAL_H 1
+
+#include <sys/types.h>
+#include "xstring.h"
+#include "xarray.h"
+
+// A journal of byte ranges of a file already transferred. It is a binary
+// file with fixed size records, each protected by a CRC. The ranges are
+// appended as they complete, a torn or damaged tail after a crash is
+// ignored on load. The caller has to sync the data before adding their
+// ranges, and sync the journal after that. The journal is compacted to
+// the merged ranges from time to time by writing a new file and renaming
+// it over the old one.
+class RangeJournal
+{
+public:
+   struct Range
+   {
+      off_t start;
+      off_t limit;
+   };
+
+private:
+   xstring_c file;
+   int fd;	  // opened for appending
+   off_t size;	  // the size of the whole file
+   int appended;  // records since the last compaction
+   xarray<Range> done;	// sorted, non-overlapping, non-adjacent
+
+   void Merge(off_t start,off_t limit);
+
+public:
+   RangeJournal(const char *file);
+   ~RangeJournal();
+
+   // read the journal, false if it does not exist or is not a journal.
+   bool Load();
+   // write the merged ranges to a new journal replacing the old one.
+   bool Compact();
+   // record a transferred range.
+   void Add(off_t start,off_t limit);
+   // put the added records to the disk.
+   bool Sync();
+   // the descriptor the records are appended to, for syncing it elsewhere.
+   int GetFD() const { return fd; }
+   // mark a range as transferred in memory only, it is saved by Compact.
+   void SetDone(off_t start,off_t limit) { Merge(start,limit); }
+
+   void SetSize(off_t s) { size=s; }
+   off_t GetSize() const { return size; }
+   const xarray<Range>& GetDone() const { return done; }
+   // the first position not transferred yet at or after pos.
+   off_t NextMissing(off_t pos) const;
+   // the ranges of [0,size) not transferred yet.
+   void GetMissing(off_t size,xarray<Range> *missing) const;
+};
+
+#endif//RANGEJOURNAL_H
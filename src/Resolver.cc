@@ -54,6 +54,10 @@
 #include "ResMgr.h"
 #include "log.h"
 #include "plural.h"
+#include "WorkerPool.h"
+
+// a lookup in a thread holds the thread even when nobody waits for it.
+#define THREAD_MAX_RETRIES 10
 
 #ifndef C_IN
 # define C_IN 1
@@ -111,6 +115,19 @@ Resolver::Resolver(const char *h,const char *p,const char *defp,
    timeout_timer.SetResource("dns:fatal-timeout",hostname);
    Reconfig();
    use_fork=ResMgr::QueryBool("dns:use-fork",0);
+#if defined(HAVE_GETADDRINFO) && INET6
+   use_thread=(WorkerPool::Threads(WorkerPool::RESOLVER)>0);
+#else
+   // gethostbyname and the like return static data, they can't be used
+   // by several threads.
+   use_thread=false;
+#endif
+   lookup_started=false;
+   cancelled=false;
+
+   srv_query=false;
+   srv_max_retries=0;
+   srv_require_trust=false;
 
    error=0;
 
@@ -131,6 +148,36 @@ Resolver::~Resolver()
    }
 }
 
+void Resolver::PrepareToDie()
+{
+   Cancel();
+}
+
+void Resolver::Cancel()
+{
+   __atomic_store_n(&cancelled,true,__ATOMIC_RELAXED);
+}
+bool Resolver::Cancelled() const
+{
+   return __atomic_load_n(&cancelled,__ATOMIC_RELAXED);
+}
+
+// Looks up the addresses in a resolver thread. It keeps the resolver from
+// being deleted until the result is passed back in the main loop.
+class ResolverJob : public WorkerJob
+{
+   Resolver *r;
+protected:
+   void Run() { r->Lookup(); }
+   void Finish() {
+      if(!r->Deleted())
+	 r->LookupFinished();
+   }
+public:
+   ResolverJob(Resolver *r) : r(r) { r->IncRefCount(); }
+   ~ResolverJob() { r->DecRefCount(); }
+};
+
 int   Resolver::Do()
 {
    if(done)
@@ -153,7 +200,34 @@ int   Resolver::Do()
       no_cache=true;
    }
 
-   if(use_fork)
+   if(use_thread)
+   {
+      if(!lookup_started)
+      {
+	 LogNote(4,_("Resolving host address..."));
+	 lookup_started=true;
+	 if(PrepareLookup())
+	 {
+	    WorkerPool::Submit(new ResolverJob(this),WorkerPool::RESOLVER);
+	    return MOVED;
+	 }
+	 LookupFinished();
+	 m=MOVED;
+      }
+      if(!buf)
+      {
+	 // the lookup is in progress in a resolver thread.
+	 if(timeout_timer.Stopped())
+	 {
+	    err_msg.set(_("host name resolve timeout"));
+	    done=true;
+	    Cancel();
+	    return MOVED;
+	 }
+	 return m;
+      }
+   }
+   else if(use_fork)
    {
       if(pipe_to_child[0]==-1)
       {
@@ -165,6 +239,8 @@ int   Resolver::Do()
 	    MakeErrMsg("pipe()");
 	    return MOVED;
 	 }
+	 SMTask::NewFD(pipe_to_child[0]);
+	 SMTask::NewFD(pipe_to_child[1]);
 	 fcntl(pipe_to_child[0],F_SETFL,O_NONBLOCK);
 	 fcntl(pipe_to_child[0],F_SETFD,FD_CLOEXEC);
 	 fcntl(pipe_to_child[1],F_SETFD,FD_CLOEXEC);
@@ -191,6 +267,7 @@ int   Resolver::Do()
 	    pipe_to_child[0]=-1;
 	    buf=new IOBufferFDStream(new FDStream(pipe_to_child[1],"<pipe-out>"),IOBuffer::PUT);
 	    DoGethostbyname();
+	    buf->Put(result);
 	    buf->PutEOF();
 	    while(buf->Size()>0 && !buf->Error() && !buf->Broken())
 	       buf->Roll();  // should flush quickly.
@@ -219,6 +296,7 @@ int   Resolver::Do()
 	 DoGethostbyname();
 	 if(Deleted())
 	    return MOVED;
+	 buf->Put(result);
       }
    }
 
@@ -497,26 +575,28 @@ int SRV_compare(const SRV *sa,const SRV *sb)
 
 void Resolver::LookupSRV_RR()
 {
-   if(!ResMgr::QueryBool("dns:SRV-query",hostname))
+   if(!srv_query)
       return;
 #ifdef HAVE_RES_SEARCH
    const char *tproto=proto?proto.get():"tcp";
    time_t try_time;
    unsigned char answer[0x1000];
-   const char *srv_name=xstring::format("_%s._%s.%s",service.get(),tproto,hostname.get());
-   srv_name=alloca_strdup(srv_name);
+   xstring srv_name;
+   srv_name.vset("_",service.get(),"._",tproto,".",hostname.get(),NULL);
 
    int retries=0;
-   int max_retries=ResMgr::Query("dns:max-retries",hostname);
+   int max_retries=srv_max_retries;
    int len;
    for(;;)
    {
-      if(!use_fork)
+      if(Blocking())
       {
 	 Schedule();
 	 if(Deleted())
 	    return;
       }
+      else if(Cancelled())
+	 return;
       time(&try_time);
 
 #ifndef DNSSEC_LOCAL_VALIDATION
@@ -525,7 +605,7 @@ void Resolver::LookupSRV_RR()
 	 break;
 #else
       val_status_t val_status;
-      bool require_trust = ResMgr::QueryBool("dns:strict-dnssec",hostname);
+      bool require_trust = srv_require_trust;
       len=val_res_search(NULL, srv_name, C_IN, T_SRV, answer, sizeof(answer), &val_status);
       if(len>=0) {
           if(require_trust && !val_istrusted(val_status))
@@ -539,6 +619,8 @@ void Resolver::LookupSRV_RR()
 	 return;
       if(++retries>=max_retries && max_retries)
 	 return;
+      if(Cancelled())
+	 return;
       time_t t=time(0);
       if(t-try_time<5)
 	 sleep(5-(t-try_time));
@@ -676,19 +758,27 @@ void Resolver::LookupSRV_RR()
    for(SRVscan=0; SRVscan<SRVs.count(); SRVscan++)
    {
       port_number=htons(SRVs[SRVscan].port);
-      LookupOne(SRVs[SRVscan].domain);
+      const char *domain=SRVs[SRVscan].domain;
+      LookupName n;
+      if(use_thread)
+      {
+	 // the settings cannot be read in a thread, use the host name's ones.
+	 n.name.set(domain);
+	 memcpy(n.af_order,srv_target.af_order,sizeof(n.af_order));
+	 n.max_retries=srv_target.max_retries;
+	 n.require_trust=srv_target.require_trust;
+      }
+      else if(!PrepareName(domain,&n))
+	 continue;
+      LookupOne(&n);
    }
    port_number=oldport;
 
 #endif // HAVE_RES_SEARCH
 }
 
-void Resolver::LookupOne(const char *name)
+bool Resolver::PrepareName(const char *name,LookupName *n)
 {
-   time_t try_time;
-   int af_index=0;
-   int af_order[16];
-
    const char *order=ResMgr::Query("dns:order",name);
 
    const char *proto_delim=strchr(name,',');
@@ -708,23 +798,43 @@ void Resolver::LookupOne(const char *name)
    int rc=idn2_lookup_ul(name,ascii_name.buf_ptr(),0);
    if(rc!=IDN2_OK) {
       error=idn2_strerror(rc);
-      return;
+      return false;
    }
    name=ascii_name;
 #endif//LIBIDN2
 
-   ParseOrder(order,af_order);
+   n->name.set(name);
+   ParseOrder(order,n->af_order);
+   n->max_retries=ResMgr::Query("dns:max-retries",name);
+   if(use_thread && (n->max_retries==0 || n->max_retries>THREAD_MAX_RETRIES))
+      n->max_retries=THREAD_MAX_RETRIES;
+#ifdef DNSSEC_LOCAL_VALIDATION
+   n->require_trust=ResMgr::QueryBool("dns:strict-dnssec",name);
+#else
+   n->require_trust=false;
+#endif
+   return true;
+}
+
+void Resolver::LookupOne(const LookupName *n)
+{
+   time_t try_time;
+   int af_index=0;
+   const char *name=n->name;
+   const int *af_order=n->af_order;
 
    int retries=0;
-   int max_retries=ResMgr::Query("dns:max-retries",name);
+   int max_retries=n->max_retries;
    for(;;)
    {
-      if(!use_fork)
+      if(Blocking())
       {
 	 Schedule();
 	 if(Deleted())
 	    return;
       }
+      else if(Cancelled())
+	 return;
 
       time(&try_time);
 
@@ -755,7 +865,7 @@ void Resolver::LookupOne(const char *name)
       ainfo_res	= getaddrinfo(name, NULL, &a_hint, &ainfo);
 #else
       val_status_t val_status;
-      bool require_trust=ResMgr::QueryBool("dns:strict-dnssec",name);
+      bool require_trust=n->require_trust;
       ainfo_res	= val_getaddrinfo(NULL, name, NULL, &a_hint, &ainfo,
                                   &val_status);
       if(VAL_GETADDRINFO_HAS_STATUS(ainfo_res) && !val_istrusted(val_status))
@@ -877,14 +987,18 @@ void Resolver::LookupOne(const char *name)
       }
 #endif /* HAVE_GETADDRINFO */
 
+      if(Cancelled())
+	 return;
       time_t t;
       if((t=time(0))-try_time<5)
 	 sleep(5-(t-try_time));
    }
 }
 
-void Resolver::DoGethostbyname()
+// read the settings and the service port, false on error.
+bool Resolver::PrepareLookup()
 {
+   result.truncate();
    if(port_number==0)
    {
       const char *tproto=proto?proto.get():"tcp";
@@ -899,43 +1013,85 @@ void Resolver::DoGethostbyname()
 	    port_number=se->s_port;
 	 else
 	 {
-	    buf->Put("P");
-	    buf->Format(_("no such %s service"),tproto);
-	    return;
+	    result.set("P");
+	    result.appendf(_("no such %s service"),tproto);
+	    return false;
 	 }
       }
    }
 
-   if(service && !portname && !isdigit((unsigned char)hostname[0]))
-      LookupSRV_RR();
-
-   if(!use_fork && Deleted())
-      return;
+   srv_query=(service && !portname && !isdigit((unsigned char)hostname[0])
+	      && ResMgr::QueryBool("dns:SRV-query",hostname));
+   if(srv_query)
+   {
+      srv_max_retries=ResMgr::Query("dns:max-retries",hostname);
+      if(use_thread && (srv_max_retries==0 || srv_max_retries>THREAD_MAX_RETRIES))
+	 srv_max_retries=THREAD_MAX_RETRIES;
+#ifdef DNSSEC_LOCAL_VALIDATION
+      srv_require_trust=ResMgr::QueryBool("dns:strict-dnssec",hostname);
+#endif
+      if(use_thread && !PrepareName(hostname,&srv_target))
+	 srv_query=false;
+   }
 
+   names.truncate();
    const char *h=ResMgr::Query("dns:name",hostname);
    if(!h || !*h)
       h=hostname;
    char *hs=alloca_strdup(h);
    char *tok;
    for(hs=strtok_r(hs,",",&tok); hs; hs=strtok_r(NULL,",",&tok))
-      LookupOne(hs);
+   {
+      LookupName *n=new LookupName;
+      if(PrepareName(hs,n))
+	 names.append(n);
+      else
+	 delete n;
+   }
+   return true;
+}
+
+// the blocking part, it does not use the settings nor the main loop.
+void Resolver::Lookup()
+{
+   LookupSRV_RR();
+
+   if(Blocking() && Deleted())
+      return;
+
+   for(int i=0; i<names.count(); i++)
+      LookupOne(names[i]);
 
-   if(!use_fork && Deleted())
+   if(Blocking() && Deleted())
       return;
 
    if(addr.count()==0)
    {
-      buf->Put("E");
+      result.set("E");
       if(error==0)
 	 error=_("No address found");
-      buf->Put(error);
+      result.append(error);
       return;
    }
-   buf->Put("O");
-   buf->Put((const char*)addr.get(),addr.count()*addr.get_element_size());
+   result.set("O");
+   result.append((const char*)addr.get(),addr.count()*addr.get_element_size());
    addr.unset();
 }
 
+void Resolver::DoGethostbyname()
+{
+   if(PrepareLookup())
+      Lookup();
+}
+
+void Resolver::LookupFinished()
+{
+   buf=new IOBuffer(IOBuffer::GET);
+   buf->Put(result);
+   buf->PutEOF();
+   result.unset();
+}
+
 void Resolver::Reconfig(const char *name)
 {
    if(!name || strncmp(name,"dns:",4))
@@ -955,25 +1111,43 @@ void ResolverCache::Reconfig(const char *r)
 }
 ResolverCacheEntry *ResolverCache::Find(const char *h,const char *p,const char *defp,const char *ser,const char *pr)
 {
-   for(ResolverCacheEntry *c=IterateFirst(); c; c=IterateNext())
+   for(ResolverCacheEntry *c=HashFirst(Hash(h,p,defp,ser,pr)); c; c=HashNext(c))
    {
       if(c->Matches(h,p,defp,ser,pr))
+      {
+	 if(c->Stopped())
+	 {
+	    DeleteEntry(c);
+	    return 0;
+	 }
 	 return c;
+      }
    }
    return 0;
 }
+unsigned ResolverCache::Hash(const char *h,const char *p,const char *defp,const char *ser,const char *pr)
+{
+   unsigned hash=HashNoCase(0,h);
+   hash=Cache::Hash(hash,p);
+   hash=Cache::Hash(hash,defp);
+   hash=Cache::Hash(hash,ser);
+   return Cache::Hash(hash,pr);
+}
 void ResolverCache::Add(const char *h,const char *p,const char *defp,
 	 const char *ser,const char *pr,const sockaddr_u *a,int n)
 {
    Trim();
    ResolverCacheEntry *c=Find(h,p,defp,ser,pr);
    if(c)
+   {
       c->SetData(a,n);
+      SizeChanged(c);
+   }
    else
    {
       if(!IsEnabled(h))
 	 return;
-      AddCacheEntry(new ResolverCacheEntry(h,p,defp,ser,pr,a,n));
+      AddCacheEntry(new ResolverCacheEntry(h,p,defp,ser,pr,a,n),Hash(h,p,defp,ser,pr),h);
    }
 }
 bool ResolverCacheEntryLoc::Matches(const char *h,const char *p,
@@ -995,14 +1169,7 @@ void ResolverCache::Find(const char *h,const char *p,const char *defp,
    if(!IsEnabled(h))
       return;
 
-   ResolverCacheEntry *c=Find(h,p,defp,ser,pr);
+   ResolverCacheEntry *c=(ResolverCacheEntry*)Found(Find(h,p,defp,ser,pr));
    if(c)
-   {
-      if(c->Stopped())
-      {
-	 Trim();
-	 return;
-      }
       c->GetData(a,n);
-   }
 }
@@ -28,6 +28,8 @@
 
 class Resolver : public SMTask, protected ProtoLog, protected Networker
 {
+   friend class ResolverJob;
+
    xstring hostname;
    xstring portname;
 
@@ -49,14 +51,37 @@ class Resolver : public SMTask, protected ProtoLog, protected Networker
    xstring err_msg;
    bool done;
 
+   // a name to look up with its settings. The settings are read before the
+   // lookup, as it can be done in a thread.
+   struct LookupName
+   {
+      xstring_c name;
+      int af_order[16];
+      int max_retries;
+      bool require_trust;
+   };
+   xarray_p<LookupName> names;
+   bool srv_query;
+   int srv_max_retries;
+   bool srv_require_trust;
+   LookupName srv_target;  // settings for SRV targets when in a thread
+
+   xstring result;   // for buf: addresses or an error
+
    void  MakeErrMsg(const char *f);
    void	 DoGethostbyname();
+   bool	 PrepareLookup();
+   bool	 PrepareName(const char *name,LookupName *n);
+   void	 Lookup();
+   void	 LookupFinished();
+   // the lookup blocks the main loop, let other tasks run between queries.
+   bool	 Blocking() const { return !use_fork && !use_thread; }
 
    static int FindAddressFamily(const char *name);
    static bool IsAddressFamilySupporded(int af);
    static void ParseOrder(const char *s,int *o);
 
-   void LookupOne(const char *name);
+   void LookupOne(const LookupName *n);
    void LookupSRV_RR();
    const char *error;
 
@@ -64,8 +89,15 @@ class Resolver : public SMTask, protected ProtoLog, protected Networker
 
    bool no_cache;
    bool use_fork;
+   bool use_thread;  // look up in a resolver thread
+   bool lookup_started;
+   bool cancelled;   // set in the main loop to stop the lookup in a thread
+   void Cancel();
+   bool Cancelled() const;
+   void PrepareToDie();
 
 public:
+   const char *GetClassName() { return "Resolver"; }
    int	 Do();
    bool	 Done() { return done; }
    bool	 Error() { return err_msg!=0; }
@@ -127,6 +159,9 @@ class ResolverCache : public Cache, public ResClient
    ResolverCacheEntry *IterateFirst() { return (ResolverCacheEntry*)Cache::IterateFirst(); }
    ResolverCacheEntry *IterateNext()  { return (ResolverCacheEntry*)Cache::IterateNext(); }
    ResolverCacheEntry *IterateDelete(){ return (ResolverCacheEntry*)Cache::IterateDelete(); }
+   ResolverCacheEntry *HashFirst(unsigned h) { return (ResolverCacheEntry*)Cache::HashFirst(h); }
+   ResolverCacheEntry *HashNext(ResolverCacheEntry *c) { return (ResolverCacheEntry*)Cache::HashNext(c); }
+   static unsigned Hash(const char *h,const char *p,const char *defp,const char *ser,const char *pr);
 public:
    void Add(const char *h,const char *p,const char *defp,
          const char *ser,const char *pr,const sockaddr_u *a,int n);
@@ -927,7 +927,7 @@ void SFtp::HandleExpect(Expect *e)
 	       else if(info)
 	       {
 		  info->MakeLongName();
-		  file_buf->Put(info->longname);
+		  file_buf->Put(info->GetLongName());
 		  file_buf->Put("\n");
 	       }
 	    }
@@ -2052,10 +2052,10 @@ FileInfo *SFtp::MakeFileInfo(const NameAttrs *na)
    if(longname)
       fi->SetLongName(longname);
    MergeAttrs(fi.get_non_const(),a);
-   if(fi->longname && !a->owner)
+   if(longname && !a->owner)
    {
       // try to extract owner/group from long name.
-      Ref<FileInfo> ls(FileInfo::parse_ls_line(fi->longname,0));
+      Ref<FileInfo> ls(FileInfo::parse_ls_line(longname,0));
       if(ls)
       {
 	 if(ls->user)
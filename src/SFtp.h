@@ -34,6 +34,7 @@ class SFtp : public SSH_Access
    const char *utf8_to_lc(const char *);
 
 public:
+   const char *GetClassName() { return "SFtp"; }
 enum packet_type {
    SSH_FXP_INIT     =1,
    SSH_FXP_VERSION  =2,
@@ -808,6 +809,7 @@ class SFtpDirList : public DirList
    LsOptions ls_options;
 
 public:
+   const char *GetClassName() { return "SFtpDirList"; }
    SFtpDirList(SFtp *s,ArgV *a);
    const char *Status();
    int Do();
@@ -821,6 +823,7 @@ class SFtpListInfo : public ListInfo
    SMTaskRef<IOBuffer> ubuf;
 
 public:
+   const char *GetClassName() { return "SFtpListInfo"; }
    SFtpListInfo(SFtp *session,const char *dir)
       : ListInfo(session,dir) {}
    int Do();
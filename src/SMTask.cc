@@ -28,7 +28,9 @@
 
 #include "SMTask.h"
 #include "Timer.h"
+#include "ResMgr.h"
 #include "misc.h"
+#include "xmap.h"
 
 #ifdef TASK_DEBUG
 # define DEBUG(x) do{printf x;fflush(stdout);}while(0)
@@ -40,6 +42,11 @@ xlist_head<SMTask>  SMTask::all_tasks;
 xlist_head<SMTask>  SMTask::ready_tasks;
 xlist_head<SMTask>  SMTask::new_tasks;
 xlist_head<SMTask>  SMTask::deleted_tasks;
+xlist_head<SMTask>  SMTask::sleeping_tasks;
+unsigned long long SMTask::do_avoided;
+bool SMTask::profiling;
+static xmap_p<SMTask::Profile> class_profiles;
+static unsigned long long nested_usec; // time spent in nested Do calls
 
 SMTask	 *SMTask::current;
 
@@ -52,9 +59,18 @@ time_t	 SMTask::last_block;
 
 static SMTask *init_task=new SMTaskInit;
 
+class SMTaskConfig : public ResClient
+{
+public:
+   SMTaskConfig() { Reconfig(0); }
+   void Reconfig(const char *name);
+};
+static SMTaskConfig *config;
+
 SMTask::SMTask()
  : all_tasks_node(this), ready_tasks_node(this),
-   new_tasks_node(this), deleted_tasks_node(this)
+   new_tasks_node(this), deleted_tasks_node(this),
+   sleeping_tasks_node(this)
 {
    // insert in the chain
    all_tasks.add(all_tasks_node);
@@ -64,6 +80,10 @@ SMTask::SMTask()
    running=0;
    ref_count=0;
    deleting=false;
+   event_driven=false;
+   wait_timeout=false;
+   profile=0;
+   class_profile=0;
    new_tasks.add(new_tasks_node);
    DEBUG(("new SMTask %p (count=%d)\n",this,all_tasks.count()));
 }
@@ -104,10 +124,55 @@ void  SMTask::ResumeSlave()
 }
 void SMTask::ResumeInternal()
 {
+   Wake();
    if(!new_tasks_node.listed() && !ready_tasks_node.listed())
       new_tasks.add_tail(new_tasks_node);
 }
 
+void SMTask::AddWaitFD(int fd,int mask)
+{
+   for(int i=0; i<wait_fds.count(); i++) {
+      if(wait_fds[i].fd==fd) {
+	 wait_fds[i].mask|=mask;
+	 return;
+      }
+   }
+   wait_fd w={fd,mask};
+   wait_fds.append(w);
+}
+void SMTask::AddWaitTimeoutU(int us)
+{
+   Time t(now+TimeDiff(0,0,us));
+   if(!wait_timeout || t<wait_until)
+      wait_until=t;
+   wait_timeout=true;
+}
+void SMTask::Sleep()
+{
+   ready_tasks_node.remove();
+   sleeping_tasks.add(sleeping_tasks_node);
+}
+void SMTask::Wake()
+{
+   if(!sleeping_tasks_node.listed())
+      return;
+   sleeping_tasks_node.remove();
+   if(!new_tasks_node.listed() && !ready_tasks_node.listed())
+      new_tasks.add_tail(new_tasks_node);
+}
+bool SMTask::NeedWake()
+{
+   if(deleting)
+      return true;
+   if(wait_timeout && now>=wait_until)
+      return true;
+   for(int i=0; i<wait_fds.count(); i++) {
+      if(block.FDReady(wait_fds[i].fd,wait_fds[i].mask))
+	 return true;
+   }
+   return false;
+}
+
 SMTask::~SMTask()
 {
    DEBUG(("delete SMTask %p (count=%d)\n",this,all_tasks.count()));
@@ -119,10 +184,13 @@ SMTask::~SMTask()
       ready_tasks_node.remove();
    if(new_tasks_node.listed())
       new_tasks_node.remove();
+   if(sleeping_tasks_node.listed())
+      sleeping_tasks_node.remove();
    assert(!deleted_tasks_node.listed());
 
    // remove from the chain
    all_tasks_node.remove();
+   delete profile;
 }
 
 void SMTask::DeleteLater()
@@ -168,9 +236,15 @@ int SMTask::Roll(SMTask *task)
    if(task->running || task->deleting)
       return m;
    Enter(task);
-   while(!task->deleting && task->Do()==MOVED)
+   for(;;) {
+      task->ClearWaits();
+      if(task->deleting || task->CallDo()!=MOVED)
+	 break;
       m=MOVED;
+   }
    Leave(task);
+   if(task->IsSleeping() && (m==MOVED || !task->MaySleep()))
+      task->Wake();
    return m;
 }
 
@@ -205,12 +279,32 @@ int SMTask::ScheduleThis()
       ready_tasks_node.remove();
       return STALL;
    }
+   ClearWaits();
    Enter();	   // mark it current and running.
-   int res=Do();   // let it run.
+   int res=CallDo();   // let it run.
    Leave();	   // unmark it running and change current.
+   if(res==STALL && !deleting && MaySleep())
+      Sleep();
    return res;
 }
 
+void SMTask::ScheduleSleeping()
+{
+   xlist_for_each_safe(SMTask,sleeping_tasks,node,task,next)
+   {
+      if(task->NeedWake()) {
+	 task->Wake();
+	 continue;
+      }
+      // keep waiting for the same events
+      for(int i=0; i<task->wait_fds.count(); i++)
+	 block.AddFD(task->wait_fds[i].fd,task->wait_fds[i].mask);
+      if(task->wait_timeout)
+	 block.AddTimeoutU(TimeDiff(task->wait_until,now).MicroSeconds());
+      do_avoided++;
+   }
+}
+
 int SMTask::ScheduleNew()
 {
    int res=STALL;
@@ -230,6 +324,9 @@ int SMTask::ScheduleNew()
 
 void SMTask::Schedule()
 {
+   if(!config)
+      config=new SMTaskConfig;
+
    block.Empty();
 
    // get time once and assume Do() don't take much time
@@ -239,6 +336,7 @@ void SMTask::Schedule()
    if(timer_timeout.tv_sec>=0)
       block.SetTimeout(timer_timeout);
 
+   ScheduleSleeping();
    int res=ScheduleNew();
    xlist_for_each_safe(SMTask,ready_tasks,node,task,next)
    {
@@ -277,21 +375,173 @@ SMTaskInit::~SMTaskInit()
    Leave();
 }
 
+int SMTask::ProfiledDo()
+{
+   if(!class_profile) {
+      const char *name=GetClassName();
+      class_profile=class_profiles.lookup(name);
+      if(!class_profile) {
+	 class_profile=new Profile();
+	 class_profiles.add(name,class_profile);
+      }
+   }
+   if(!profile)
+      profile=new Profile();
+
+   unsigned long long outer_nested=nested_usec;
+   nested_usec=0;
+   struct timespec t0,t1;
+   clock_gettime(CLOCK_MONOTONIC,&t0);
+   int res=Do();
+   clock_gettime(CLOCK_MONOTONIC,&t1);
+   unsigned long long us=(t1.tv_sec-t0.tv_sec)*1000000ULL+t1.tv_nsec/1000-t0.tv_nsec/1000;
+   // count only own time, nested Do calls are accounted to their tasks.
+   unsigned long long self=(us>nested_usec ? us-nested_usec : 0);
+   nested_usec=outer_nested+us;
+
+   profile->Add(res,self);
+   class_profile->Add(res,self);
+   return res;
+}
+
+void SMTask::ResetProfile()
+{
+   static const Profile zero={0,0,0,0};
+   for(Profile *p=class_profiles.each_begin(); p; p=class_profiles.each_next())
+      *p=zero;
+   xlist_for_each(SMTask,all_tasks,node,scan)
+   {
+      if(scan->profile)
+	 *scan->profile=zero;
+   }
+}
+
+struct ProfileRow
+{
+   const SMTask::Profile *p;
+   const char *name;
+   const char *context;
+   const void *task;
+};
+static bool profile_by_calls;
+static int ProfileRowCmp(const ProfileRow *a,const ProfileRow *b)
+{
+   unsigned long long va=(profile_by_calls ? a->p->calls : a->p->usec);
+   unsigned long long vb=(profile_by_calls ? b->p->calls : b->p->usec);
+   if(va!=vb)
+      return va>vb ? -1 : 1;
+   return strcmp(a->name,b->name);
+}
+static void AppendJSONString(xstring& buf,const char *s)
+{
+   buf.append('"');
+   for( ; *s; s++) {
+      unsigned char c=*s;
+      if(c=='"' || c=='\\')
+	 buf.append('\\').append(c);
+      else if(c<0x20)
+	 buf.appendf("\\u%04x",c);
+      else
+	 buf.append(c);
+   }
+   buf.append('"');
+}
+
+xstring& SMTask::FormatProfile(xstring& buf,bool by_task,bool json,bool by_calls)
+{
+   xarray<ProfileRow> rows;
+   if(by_task) {
+      xlist_for_each(SMTask,all_tasks,node,scan)
+      {
+	 if(!scan->profile)
+	    continue;
+	 const char *c=scan->GetLogContext();
+	 ProfileRow r={scan->profile,scan->GetClassName(),c?c:"",scan};
+	 rows.append(r);
+      }
+   } else {
+      for(Profile *p=class_profiles.each_begin(); p; p=class_profiles.each_next()) {
+	 ProfileRow r={p,class_profiles.each_key(),"",0};
+	 rows.append(r);
+      }
+   }
+   profile_by_calls=by_calls;
+   rows.qsort(ProfileRowCmp);
+
+   if(json) {
+      buf.appendf("{\"profiling\":%s,\"%s\":[",profiling?"true":"false",
+	 by_task?"tasks":"classes");
+      for(int i=0; i<rows.count(); i++) {
+	 const ProfileRow &r=rows[i];
+	 buf.append(i>0?",\n":"\n").append("{\"class\":");
+	 AppendJSONString(buf,r.name);
+	 if(by_task) {
+	    buf.appendf(",\"task\":\"%p\",\"context\":",r.task);
+	    AppendJSONString(buf,r.context);
+	 }
+	 buf.appendf(",\"calls\":%llu,\"moved\":%llu,\"stalled\":%llu,\"usec\":%llu}",
+	    r.p->calls,r.p->moved,r.p->stalled,r.p->usec);
+      }
+      return buf.append("\n]}\n");
+   }
+
+   buf.appendf("%-24s %12s %12s %12s %12s",by_task?"task":"class",
+      "calls","moved","stalled","time(ms)");
+   buf.append(by_task?" context\n":"\n");
+   for(int i=0; i<rows.count(); i++) {
+      const ProfileRow &r=rows[i];
+      buf.appendf("%-24s %12llu %12llu %12llu %12.3f",r.name,
+	 r.p->calls,r.p->moved,r.p->stalled,r.p->usec/1000.);
+      if(by_task)
+	 buf.appendf(" %p %s",r.task,r.context);
+      buf.append('\n');
+   }
+   return buf;
+}
+
 int SMTask::TaskCount()
 {
    return all_tasks.count();
 }
+int SMTask::SleepingTaskCount()
+{
+   return sleeping_tasks.count();
+}
 
 void SMTask::Cleanup()
 {
+   delete config;
+   config=0;
    CollectGarbage();
    Delete(init_task);
    CollectGarbage();
 }
 
 #include <errno.h>
-#include "ResMgr.h"
 ResDecl enospc_fatal ("xfer:disk-full-fatal","no",ResMgr::BoolValidate,ResMgr::NoClosure);
+
+static const char *PollMethodValidate(xstring_c *s)
+{
+   PollVec::method_t m;
+   if(PollVec::MethodByName(*s,&m))
+      return 0;
+#if USE_EPOLL
+   return _("must be one of: auto, select, poll, epoll");
+#else
+   return _("must be one of: auto, select, poll");
+#endif
+}
+ResDecl res_poll_method ("net:poll-method","auto",PollMethodValidate,ResMgr::NoClosure);
+
+void SMTaskConfig::Reconfig(const char *name)
+{
+   if(name && strcmp(name,"net:poll-method"))
+      return;
+   PollVec::method_t m;
+   if(PollVec::MethodByName(res_poll_method.Query(0),&m))
+      SMTask::SetPollMethod(m);
+}
+
 bool SMTask::NonFatalError(int err)
 {
    if(E_RETRY(err))
@@ -327,7 +577,8 @@ void SMTask::PrintTasks()
    {
       const char *c=scan->GetLogContext();
       if(!c) c="";
-      printf("%p\t%c%c%c\t%d\t%s\n",scan,scan->running?'R':' ',
-	 scan->suspended?'S':' ',scan->deleting?'D':' ',scan->ref_count,c);
+      printf("%p\t%c%c%c%c\t%d\t%s\t%s\n",scan,scan->running?'R':' ',
+	 scan->suspended?'S':' ',scan->deleting?'D':' ',
+	 scan->IsSleeping()?'W':' ',scan->ref_count,scan->GetClassName(),c);
    }
 }
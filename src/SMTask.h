@@ -49,6 +49,10 @@ class SMTask
    static xlist_head<SMTask> deleted_tasks;
    xlist<SMTask> deleted_tasks_node;
 
+   // event driven tasks waiting for their fds or timeout
+   static xlist_head<SMTask> sleeping_tasks;
+   xlist<SMTask> sleeping_tasks_node;
+
    static PollVec block;
    enum { SMTASK_MAX_DEPTH=64 };
    static SMTask *stack[SMTASK_MAX_DEPTH];
@@ -61,8 +65,45 @@ class SMTask
    int	 ref_count;
    bool	 deleting;
 
+   // what the last Do of an event driven task waited for
+   bool	 event_driven;
+   struct wait_fd { int fd,mask; };
+   xarray<wait_fd> wait_fds;
+   Time	 wait_until;
+   bool	 wait_timeout;
+
+   void ClearWaits() { wait_fds.truncate(); wait_timeout=false; }
+   void AddWaitFD(int fd,int mask);
+   void AddWaitTimeoutU(int us);
+   bool MaySleep() const { return event_driven && (wait_fds.count()>0 || wait_timeout); }
+   void Sleep();
+   bool NeedWake();
+
+   // scheduler profile, collected when profiling is on
+public:
+   struct Profile
+   {
+      unsigned long long calls;
+      unsigned long long moved;
+      unsigned long long stalled;
+      unsigned long long usec;
+      void Add(int res,unsigned long long us) {
+	 calls++;
+	 (res&MOVED ? moved : stalled)++;
+	 usec+=us;
+      }
+   };
+private:
+   Profile *profile;
+   Profile *class_profile;
+   static bool profiling;
+   int CallDo() { return profiling ? ProfiledDo() : Do(); }
+   int ProfiledDo();
+
    int ScheduleThis();
    static int ScheduleNew();
+   static void ScheduleSleeping();
+   static unsigned long long do_avoided;
 
 protected:
    enum
@@ -80,13 +121,29 @@ protected:
    bool Deleted() const { return deleting; }
    virtual ~SMTask();
 
+   // An event driven task depends only on the fds and timeouts it waits for
+   // in Do. When it stalls, it is not scheduled again until one of them
+   // triggers or the task is woken explicitly.
+   void SetEventDriven(bool e=true) { event_driven=e; }
+
 public:
-   static void Block(int fd,int mask) { block.AddFD(fd,mask); }
-   static void TimeoutU(int us) { block.AddTimeoutU(us); }
+   static void Block(int fd,int mask) {
+      block.AddFD(fd,mask);
+      if(current->event_driven)
+	 current->AddWaitFD(fd,mask);
+   }
+   static void TimeoutU(int us) {
+      block.AddTimeoutU(us);
+      if(current->event_driven)
+	 current->AddWaitTimeoutU(us);
+   }
    static void Timeout(int ms) { TimeoutU(1000*ms); }
    static void TimeoutS(int s) { TimeoutU(1000000*s); }
    static bool Ready(int fd,int mask) { return block.FDReady(fd,mask); }
    static void SetNotReady(int fd,int mask) { block.FDSetNotReady(fd,mask); }
+   static void NewFD(int fd) { block.NewFD(fd); }
+   static void SetPollMethod(PollVec::method_t m) { block.SetMethod(m); }
+   static PollVec::method_t GetPollMethod() { return block.GetMethod(); }
 
    static TimeDate now;
    static void UpdateNow() { now.SetToCurrentTime(); }
@@ -106,7 +163,12 @@ public:
 
    bool IsSuspended() { return suspended|suspended_slave; }
 
+   // reschedule a sleeping event driven task
+   void Wake();
+   bool IsSleeping() const { return sleeping_tasks_node.listed(); }
+
    virtual const char *GetLogContext() { return 0; }
+   virtual const char *GetClassName() { return "SMTask"; }
    static const char *GetCurrentLogContext() { return current->GetLogContext(); }
 
    SMTask();
@@ -130,7 +192,14 @@ public:
    void Enter() { Enter(this); }
    void Leave() { Leave(this); }
 
+   static void SetProfiling(bool on) { profiling=on; }
+   static bool IsProfiling() { return profiling; }
+   static void ResetProfile();
+   static xstring& FormatProfile(xstring& buf,bool by_task,bool json,bool by_calls);
+
    static int TaskCount();
+   static int SleepingTaskCount();
+   static unsigned long long DoAvoidedCount() { return do_avoided; }
    static void PrintTasks();
    static bool NonFatalError(int err);
    static bool TemporaryNetworkError(int err) { return temporary_network_error(err); }
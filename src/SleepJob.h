@@ -40,6 +40,7 @@ class SleepJob : public SessionJob, public Timer
    int break_code;
 
 public:
+   const char *GetClassName() { return "SleepJob"; }
    int Do();
    int Done() { return done; }
    int ExitCode() { return exit_code; }
@@ -44,6 +44,7 @@ protected:
    void WriteTitle(const char *s, int fd) const;
 
 public:
+   const char *GetClassName() { return "StatusLine"; }
    int GetWidth();
    int GetHeight();
    int GetWidthDelayed() const { return LastWidth; }
@@ -30,6 +30,7 @@ class SysCmdJob : public Job
    SMTaskRef<ProcWait> w;
    void PrepareToDie();
 public:
+   const char *GetClassName() { return "SysCmdJob"; }
    SysCmdJob(const char *new_cmd);
    ~SysCmdJob();
    int Do();
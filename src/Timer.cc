@@ -26,14 +26,14 @@
 #define now SMTask::now
 
 xlist_head<Timer> Timer::all_timers;
-xheap<Timer> Timer::running_timers;
+xtimerwheel<Timer> Timer::running_timers;
 int Timer::infty_count;
 
 timeval Timer::GetTimeoutTV()
 {
    Timer *t;
-   while((t=running_timers.get_min())!=0 && t->Stopped())
-      running_timers.pop_min();
+   while((t=running_timers.get_min(tick(now)))!=0 && t->Stopped())
+      running_timers.pop_min(tick(now));
    if(!t) {
       timeval tv={infty_count?HOUR:-1, 0};
       return tv;
@@ -165,7 +165,7 @@ void Timer::re_sort()
 {
    running_timers.remove(running_timers_node);
    if(now<stop && !IsInfty())
-      running_timers.add(running_timers_node);
+      running_timers.add(running_timers_node,tick(stop));
 }
 void Timer::ReconfigAll(const char *r)
 {
@@ -23,7 +23,7 @@
 #include "SMTask.h"
 #include "ResMgr.h"
 #include "xlist.h"
-#include "xheap.h"
+#include "xtimerwheel.h"
 
 class Timer
 {
@@ -37,8 +37,12 @@ class Timer
    static int infty_count;
    static xlist_head<Timer> all_timers;
    xlist<Timer> all_timers_node;
-   static xheap<Timer> running_timers;
-   xheap<Timer>::node running_timers_node;
+   static xtimerwheel<Timer> running_timers;
+   xtimerwheel<Timer>::node running_timers_node;
+
+   static unsigned long long tick(const Time &t) {
+      return (unsigned long long)t.UnixTime()*1000+t.MilliSecond();
+   }
 
    void re_sort();
    void re_set();
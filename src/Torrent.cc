@@ -34,6 +34,7 @@
 #include "Torrent.h"
 #include "TorrentTracker.h"
 #include "DHT.h"
+#include "WorkerPool.h"
 #include "log.h"
 #include "url.h"
 #include "misc.h"
@@ -189,6 +190,32 @@ void Torrent::StopListenerUDP()
 #endif
 }
 
+// SHA1 of a piece computed by a worker thread
+class TorrentPieceHash : public WorkerJob
+{
+public:
+   Torrent *torrent;	 // 0 when the torrent is gone
+   xlist<TorrentPieceHash> node;
+   unsigned piece;
+   bool downloaded;	 // a new piece, not the initial validation
+   xstring peer_id;	 // the peer which sent the last block
+   xstring data;
+   char sha1[SHA1_DIGEST_SIZE];
+
+   TorrentPieceHash(Torrent *t,unsigned p,const xstring& d)
+      : torrent(t), node(this), piece(p), downloaded(false) { data.nset(d,d.length()); }
+   void Run() {
+      sha1_buffer(data.get(),data.length(),sha1);
+   }
+   void Finish() {
+      if(!torrent)
+	 return;
+      node.remove();
+      torrent->hashing_count--;
+      torrent->PieceValidated(piece,sha1,downloaded,peer_id);
+   }
+};
+
 Torrent::Torrent(const char *mf,const char *c,const char *od)
    : metainfo_url(mf),
      pieces_timer(10),
@@ -211,6 +238,7 @@ Torrent::Torrent(const char *mf,const char *c,const char *od)
    stop_if_known=false;
    md_saved=false;
    validate_index=0;
+   hashing_count=0;
    metadata_size=0;
    info=0;
    pieces=0;
@@ -255,6 +283,15 @@ Torrent::Torrent(const char *mf,const char *c,const char *od)
 
 Torrent::~Torrent()
 {
+   // the hashes are finished without us
+   xlist_for_each_safe(TorrentPieceHash,hashing,node,h,next) {
+      h->torrent=0;
+      node->remove();
+   }
+   xlist_for_each_safe(TorrentPieceHash,flushing,fnode,f,fnext) {
+      fnode->remove();
+      delete f;
+   }
 }
 
 bool Torrent::TrackersDone() const
@@ -417,26 +454,86 @@ void Torrent::SHA1(const xstring& str,xstring& buf)
    buf.set_length(SHA1_DIGEST_SIZE);
 }
 
-void Torrent::ValidatePiece(unsigned p)
+bool Torrent::IsHashing(unsigned p) const
+{
+   xlist_for_each(TorrentPieceHash,hashing,node,h) {
+      if(h->piece==p)
+	 return true;
+   }
+   xlist_for_each(TorrentPieceHash,flushing,fnode,f) {
+      if(f->piece==p)
+	 return true;
+   }
+   return false;
+}
+
+// hash the downloaded pieces once the delayed writes have reached the files.
+int Torrent::ValidateFlushedPieces()
+{
+   if(!flushing.first_obj())
+      return STALL;
+   bool pending=false;
+   const char *err=fd_cache->FlushWrites(&pending);
+   if(err) {
+      SetError(err);
+      return MOVED;
+   }
+   if(pending)
+      return STALL;
+   xlist_for_each_safe(TorrentPieceHash,flushing,node,h,next) {
+      node->remove();
+      unsigned p=h->piece;
+      const xstring& buf=RetrieveBlock(p,0,PieceLength(p));
+      if(buf.length()!=PieceLength(p)) {
+	 PieceValidated(p,0,true,h->peer_id);
+	 delete h;
+	 continue;
+      }
+      h->data.nset(buf,buf.length());
+      hashing.add_tail(h->node);
+      hashing_count++;
+      WorkerPool::Submit(h);
+   }
+   return MOVED;
+}
+
+void Torrent::ValidatePiece(unsigned p,const TorrentPeer *src_peer)
 {
    const xstring& buf=Torrent::RetrieveBlock(p,0,PieceLength(p));
+   if(buf.length()!=PieceLength(p)) {
+      PieceValidated(p,0,src_peer!=0,src_peer?src_peer->peer_id:xstring::null);
+      return;
+   }
+   TorrentPieceHash *h=new TorrentPieceHash(this,p,buf);
+   if(src_peer) {
+      h->downloaded=true;
+      h->peer_id.set(src_peer->peer_id);
+   }
+   hashing.add_tail(h->node);
+   hashing_count++;
+   // the hash is done by a worker thread, PieceValidated is called when ready
+   WorkerPool::Submit(h);
+}
+
+void Torrent::PieceValidated(unsigned p,const char *sha1,bool downloaded,const xstring& src_peer_id)
+{
    bool valid=false;
-   if(buf.length()==PieceLength(p)) {
-      xstring& sha1=xstring::get_tmp();
-      SHA1(buf,sha1);
+   if(sha1) {
       if(building) {
-	 building->SetPiece(p,sha1);
+	 building->SetPiece(p,xstring::get_tmp(sha1,SHA1_DIGEST_SIZE));
 	 valid=true;
       } else {
 	 valid=!memcmp(pieces->get()+p*SHA1_DIGEST_SIZE,sha1,SHA1_DIGEST_SIZE);
       }
    }
+   if(validating)
+      recv_rate.Add(PieceLength(p));
    if(!valid) {
       if(building) {
 	 SetError("File validation error");
 	 return;
       }
-      if(buf.length()==PieceLength(p))
+      if(sha1)
 	 LogError(11,"piece %u digest mismatch",p);
       if(my_bitfield->get_bit(p)) {
 	 total_left+=PieceLength(p);
@@ -453,6 +550,28 @@ void Torrent::ValidatePiece(unsigned p)
 	 piece_info[p].free_block_map();
       }
    }
+   if(!downloaded)
+      return;
+   if(!valid) {
+      LogError(0,"new piece %u digest mismatch",p);
+      TorrentPeer *src_peer=FindPeerById(src_peer_id);
+      if(src_peer)
+	 src_peer->MarkPieceInvalid(p);
+      return;
+   }
+   LogNote(3,"piece %u complete",p);
+   timeout_timer.Reset();
+   SetPieceNotWanted(p);
+   for(int i=0; i<peers.count(); i++)
+      peers[i]->Have(p);
+   if(my_bitfield->has_all_set() && !complete) {
+      complete=true;
+      seed_timer.Reset();
+      end_game=false;
+      ScanPeers();
+      SendTrackersRequest("completed");
+      recv_rate.Reset();
+   }
 }
 
 template<typename T>
@@ -1124,8 +1243,14 @@ void TorrentBuild::Finish()
 }
 void TorrentBuild::SetPiece(unsigned p,const xstring& sha)
 {
-   assert(pieces.length()==p*20); // require sequential building
-   pieces.append(sha);
+   // the pieces are hashed in parallel and can come out of order
+   if(pieces.length()<(p+1)*20) {
+      unsigned old_len=pieces.length();
+      pieces.get_space((p+1)*20);
+      memset(pieces.get_non_const()+old_len,0,(p+1)*20-old_len);
+      pieces.set_length((p+1)*20);
+   }
+   memcpy(pieces.get_non_const()+p*20,sha.get(),20);
 }
 const xstring& TorrentBuild::GetMetadata()
 {
@@ -1361,13 +1486,23 @@ int Torrent::Do()
    }
    if(peers_scan_timer.Stopped())
       ScanPeers();
+   m|=ValidateFlushedPieces();
+   if(shutting_down)
+      return m;
    if(validating) {
-      ValidatePiece(validate_index++);
-      if(validate_index<total_pieces) {
-	 recv_rate.Add(piece_length);
-	 return MOVED;
+      // keep all the workers busy, but without reading the whole torrent
+      // into memory. Without workers, one piece is hashed per call.
+      int queue=2*WorkerPool::Threads();
+      if(queue<1)
+	 queue=1;
+      int started=0;
+      while(started<queue && validate_index<total_pieces
+	    && hashing_count<queue) {
+	 ValidatePiece(validate_index++);
+	 started++;
       }
-      recv_rate.Add(last_piece_length);
+      if(validate_index<total_pieces || hashing_count>0)
+	 return started>0 ? MOVED : m;
       validating=false;
       recv_rate.Reset();
       if(total_left==0) {
@@ -1605,7 +1740,7 @@ void FDCache::Clean()
 	 }
 	 if(f->last_used+max_time<now.UnixTime()) {
 	    ProtoLog::LogNote(9,"closing %s",cache.each_key().get());
-	    close(f->fd);
+	    CloseFD(*f,cache.each_key());
 	    cache.remove(cache.each_key());
 	 }
       }
@@ -1633,7 +1768,7 @@ void FDCache::Close(const char *name)
 	    if(i==O_RDONLY) // avoid filling up the cache
 	       posix_fadvise(f.fd,0,0,POSIX_FADV_DONTNEED);
 #endif
-	    close(f.fd);
+	    CloseFD(f,name);
 	 }
 	 cache[i].remove(n);
       }
@@ -1646,7 +1781,7 @@ void FDCache::CloseAll()
       for(const FD *f=&cache.each_begin(); f->last_used; f=&cache.each_next()) {
 	 if(f->fd!=-1) {
 	    ProtoLog::LogNote(9,"closing %s",cache.each_key().get());
-	    close(f->fd);
+	    CloseFD(*f,cache.each_key());
 	 }
 	 cache.remove(cache.each_key());
       }
@@ -1655,7 +1790,7 @@ void FDCache::CloseAll()
 bool FDCache::CloseOne()
 {
    int oldest_mode=0;
-   int oldest_fd=-1;
+   const FD *oldest=0;
    int oldest_time=0;
    const xstring *oldest_key=0;
    for(int i=0; i<3; i++) {
@@ -1666,20 +1801,67 @@ bool FDCache::CloseOne()
 	 if(oldest_key==0 || f->last_used<oldest_time) {
 	    oldest_key=&cache.each_key();
 	    oldest_time=f->last_used;
-	    oldest_fd=f->fd;
+	    oldest=f;
 	    oldest_mode=i;
 	 }
       }
    }
    if(!oldest_key)
       return false;
-   if(oldest_fd!=-1) {
-      ProtoLog::LogNote(9,"closing %s",oldest_key->get());
-      close(oldest_fd);
-   }
+   ProtoLog::LogNote(9,"closing %s",oldest_key->get());
+   CloseFD(*oldest,*oldest_key);
    cache[oldest_mode].remove(*oldest_key);
    return true;
 }
+void FDCache::CloseFD(const FD& f,const char *name)
+{
+   if(f.async) {
+      // the delayed writes have to get to the file
+      if(f.async->Wait()==-1)
+	 ProtoLog::LogError(0,"write(%s): %s",name,strerror(errno));
+      delete f.async;
+   }
+   close(f.fd);
+}
+// the file opened for writing can be written by the I/O engine.
+AsyncFile *FDCache::GetAsync(const char *name)
+{
+   const xstring &n=xstring::get_tmp(name);
+   if(!cache[O_RDWR].exists(n))
+      return 0;
+   FD& f=cache[O_RDWR].lookup_Lv(n);
+   if(f.fd==-1)
+      return 0;
+   if(!f.async)
+      f.async=AsyncFile::Open(f.fd);
+   return f.async;
+}
+// like WaitWrites, but does not block; sets *pending when some of the
+// writes are not complete yet.
+const char *FDCache::FlushWrites(bool *pending)
+{
+   *pending=false;
+   xmap<FD>& cache=this->cache[O_RDWR];
+   for(const FD *f=&cache.each_begin(); f->last_used; f=&cache.each_next()) {
+      if(!f->async || f->async->Flush()==0)
+	 continue;
+      if(errno==EAGAIN)
+	 *pending=true;
+      else
+	 return xstring::format("write(%s): %s",cache.each_key().get(),strerror(errno));
+   }
+   return 0;
+}
+// returns an error message if a delayed write has failed.
+const char *FDCache::WaitWrites()
+{
+   xmap<FD>& cache=this->cache[O_RDWR];
+   for(const FD *f=&cache.each_begin(); f->last_used; f=&cache.each_next()) {
+      if(f->async && f->async->Wait()==-1)
+	 return xstring::format("write(%s): %s",cache.each_key().get(),strerror(errno));
+   }
+   return 0;
+}
 int FDCache::Count() const
 {
    return cache[0].count()+cache[1].count()+cache[2].count();
@@ -1711,7 +1893,7 @@ int FDCache::OpenFile(const char *file,int m,off_t size)
    do {
       fd=open(file,m,0664);
    } while(fd==-1 && (errno==EMFILE || errno==ENFILE) && CloseOne());
-   FD new_entry = {fd,errno,now.UnixTime()};
+   FD new_entry = {fd,errno,now.UnixTime(),0};
    cache[ci].add(file,new_entry);
    if(fd!=-1)
       fcntl(fd,F_SETFD,FD_CLOEXEC);
@@ -1805,7 +1987,12 @@ void Torrent::StoreBlock(unsigned piece,unsigned begin,unsigned len,const char *
 	 SetError(xstring::format("open(%s): %s",file,strerror(errno)));
 	 return;
       }
-      int w=pwrite(fd,buf,MIN(f_rest,len),f_pos);
+      AsyncFile *af=fd_cache->GetAsync(dir_file(output_dir,file));
+      int w=-1;
+      if(af)
+	 w=af->Write(f_pos,buf,MIN(f_rest,len));
+      if(!af || (w==-1 && E_RETRY(errno)))
+	 w=pwrite(fd,buf,MIN(f_rest,len),f_pos);
       int saved_errno=errno;
       if(w==-1) {
 	 SetError(xstring::format("pwrite(%s): %s",file,strerror(saved_errno)));
@@ -1823,26 +2010,14 @@ void Torrent::StoreBlock(unsigned piece,unsigned begin,unsigned len,const char *
    while(bc-->0) {
       SetBlockPresent(piece,b++);
    }
-   if(AllBlocksPresent(piece) && !my_bitfield->get_bit(piece)) {
-      ValidatePiece(piece);
-      if(!my_bitfield->get_bit(piece)) {
-	 LogError(0,"new piece %u digest mismatch",piece);
-	 src_peer->MarkPieceInvalid(piece);
-	 return;
-      }
-      LogNote(3,"piece %u complete",piece);
-      timeout_timer.Reset();
-      SetPieceNotWanted(piece);
-      for(int i=0; i<peers.count(); i++)
-	 peers[i]->Have(piece);
-      if(my_bitfield->has_all_set() && !complete) {
-	 complete=true;
-	 seed_timer.Reset();
-	 end_game=false;
-	 ScanPeers();
-	 SendTrackersRequest("completed");
-	 recv_rate.Reset();
-      }
+   if(AllBlocksPresent(piece) && !my_bitfield->get_bit(piece) && !IsHashing(piece)) {
+      // the piece is read back, so the delayed writes have to be done;
+      // Do validates it when they are.
+      TorrentPieceHash *h=new TorrentPieceHash(this,piece,xstring::null);
+      h->downloaded=true;
+      if(src_peer)
+	 h->peer_id.set(src_peer->peer_id);
+      flushing.add_tail(h->node);
    }
 }
 void Torrent::SendTrackersRequest(const char *event) const
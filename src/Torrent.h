@@ -34,6 +34,7 @@ class FDCache;
 class TorrentBlackList;
 class Torrent;
 class TorrentPeer;
+class TorrentPieceHash;
 
 class BitField : public xarray<unsigned char>
 {
@@ -81,6 +82,7 @@ class TorrentBuild : public SMTask, public ProtoLog
    void Finish();
 
 public:
+   const char *GetClassName() { return "TorrentBuild"; }
    TorrentBuild(const char *top);
    int Do();
    bool Done() const { return done || error; }
@@ -209,6 +211,7 @@ class TorrentListener : public SMTask, protected ProtoLog, protected Networker
    Time last_sent_udp;
    int  last_sent_udp_count;
 public:
+   const char *GetClassName() { return "TorrentListener"; }
    TorrentListener(int a,int type=SOCK_STREAM);
    ~TorrentListener();
    int Do();
@@ -243,6 +246,15 @@ class Torrent : public SMTask, protected ProtoLog, public ResClient, protected N
    unsigned validate_index;
    Ref<Error> invalid_cause;
 
+   // pieces being hashed by worker threads
+   friend class TorrentPieceHash;
+   xlist_head<TorrentPieceHash> hashing;
+   int hashing_count;
+   bool IsHashing(unsigned p) const;
+   // downloaded pieces waiting for their delayed writes to be hashed
+   xlist_head<TorrentPieceHash> flushing;
+   int ValidateFlushedPieces();
+
    static const unsigned PEER_ID_LEN = 20;
    static xstring my_peer_id;
    static xstring my_key;
@@ -461,6 +473,7 @@ class Torrent : public SMTask, protected ProtoLog, public ResClient, protected N
    TorrentPeer *FindPeerById(const xstring& p_id);
 
 public:
+   const char *GetClassName() { return "Torrent"; }
    static void ClassInit();
 
    Torrent(const char *mf,const char *cwd,const char *output_dir);
@@ -482,7 +495,8 @@ public:
    static bool NoTorrentCanAccept();
 
    static void SHA1(const xstring& str,xstring& buf);
-   void ValidatePiece(unsigned p);
+   void ValidatePiece(unsigned p,const TorrentPeer *src_peer=0);
+   void PieceValidated(unsigned p,const char *sha1,bool downloaded,const xstring& src_peer_id);
    unsigned PieceLength(unsigned p) const { return p==total_pieces-1 ? last_piece_length : piece_length; }
    unsigned BlocksInPiece(unsigned p) const { return p==total_pieces-1 ? blocks_in_last_piece : blocks_in_piece; }
 
@@ -576,14 +590,21 @@ class FDCache : public SMTask, public ResClient
       int fd;
       int saved_errno;
       time_t last_used;
+      AsyncFile *async;	 // delayed writes
    };
    int max_count;
    int max_time;
    xmap<FD> cache[3];
    Timer clean_timer;
 
+   void CloseFD(const FD& f,const char *name);
+
 public:
+   const char *GetClassName() { return "FDCache"; }
    int OpenFile(const char *name,int mode,off_t size=0);
+   AsyncFile *GetAsync(const char *name);
+   const char *WaitWrites();
+   const char *FlushWrites(bool *pending);
    void Close(const char *name);
    int Count() const;
    void Clean();
@@ -684,6 +705,7 @@ class TorrentPeer : public SMTask, protected ProtoLog, public Networker
       UT_METADATA_REJECT=2,
    };
 public:
+   const char *GetClassName() { return "TorrentPeer"; }
    enum { TR_ACCEPTED=-1, TR_DHT=-2, TR_PEX=-3 };  // special values for tracker_no
    enum unpack_status_t
    {
@@ -965,6 +987,7 @@ class TorrentDispatcher : public SMTask, protected ProtoLog
    Timer timeout_timer;
    xstring_c peer_name;
 public:
+   const char *GetClassName() { return "TorrentDispatcher"; }
    TorrentDispatcher(int s,const sockaddr_u *a);
    ~TorrentDispatcher();
    int Do();
@@ -979,6 +1002,7 @@ class TorrentJob : public Job
    bool completed;
    bool done;
 public:
+   const char *GetClassName() { return "TorrentJob"; }
    TorrentJob(Torrent *);
    ~TorrentJob();
    int Do();
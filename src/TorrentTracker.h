@@ -58,6 +58,7 @@ class TorrentTracker : public SMTask, protected ProtoLog
    const char *GetLogContext() { return GetURL(); }
 
 public:
+   const char *GetClassName() { return "TorrentTracker"; }
    ~TorrentTracker() {}
    const char *NextRequestIn() const {
       return tracker_timer.TimeLeft().toString(
@@ -126,6 +127,7 @@ class HttpTracker : public TrackerBackend
    SMTaskRef<IOBuffer> tracker_reply;
    int HandleTrackerReply();
 public:
+   const char *GetClassName() { return "HttpTracker"; }
    bool IsActive() const { return tracker_reply!=0; }
    void SendTrackerRequest(const char *event);
    HttpTracker(TorrentTracker *m,ParsedURL *u)
@@ -185,6 +187,7 @@ class UdpTracker : public TrackerBackend, protected Networker
    unsigned NewTransactionId() { return transaction_id=random(); }
 
 public:
+   const char *GetClassName() { return "UdpTracker"; }
    UdpTracker(TorrentTracker *m,ParsedURL *u)
       : TrackerBackend(m),
         hostname(u->host.get()), portname(u->port.get()),
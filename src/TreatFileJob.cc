@@ -37,6 +37,9 @@ TreatFileJob::TreatFileJob(FileAccess *s,ArgV *a)
 
    op=args->a0();
    Begin(a->getcurr());
+
+   // the files are independent, don't wait for each reply.
+   SessionJob::session->AllowDeferred();
 }
 
 /* process a new directory */
@@ -58,6 +61,33 @@ void TreatFileJob::Finish()
 
 TreatFileJob::~TreatFileJob()
 {
+   SessionJob::session->AllowDeferred(false);
+}
+
+/* count failures of the requests the session reported done early */
+int TreatFileJob::ReportDeferred()
+{
+   int m=STALL;
+   const char *err;
+   while((err=SessionJob::session->GetDeferredError())!=0)
+   {
+      failed++;
+      if(!quiet)
+	 eprintf("%s: %s\n",op,err);
+      m=MOVED;
+   }
+   return m;
+}
+
+int TreatFileJob::Do()
+{
+   int m=FinderJob::Do();
+   return m|ReportDeferred();
+}
+
+int TreatFileJob::Done()
+{
+   return FinderJob::Done() && SessionJob::session->DeferredCount()==0;
 }
 
 TreatFileJob::prf_res TreatFileJob::ProcessFile(const char *d,const FileInfo *fi)
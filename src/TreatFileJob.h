@@ -38,12 +38,17 @@ protected:
    virtual void CurrentFinished(const char *d,const FileInfo *fi) { }
 
    void Begin(const char *d);
+   int	ReportDeferred();
 
    /* virtuals */
    void Finish();
    prf_res ProcessFile(const char *d,const FileInfo *fi);
 
 public:
+   const char *GetClassName() { return "TreatFileJob"; }
+   int	 Do();
+   int	 Done();
+   int	 ExitCode() { return FinderJob::ExitCode() || (failed && !quiet); }
    xstring& FormatStatus(xstring&,int,const char *);
    void	 ShowRunStatus(const SMTaskRef<StatusLine>&);
 
@@ -0,0 +1,416 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 2026 by the lftp contributors (see the AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+# include <sched.h>
+#endif
+
+#include "WorkerPool.h"
+#include "ResMgr.h"
+#include "misc.h"
+#include "log.h"
+#include "ProtoLog.h"
+
+#define MAX_WORKERS 64
+
+static const char *WorkerThreadsValidate(xstring_c *value)
+{
+   if(!strcasecmp(*value,"auto"))
+      return 0;
+   return ResMgr::UNumberValidate(value);
+}
+static ResDecl worker_threads("xfer:worker-threads","auto",WorkerThreadsValidate,ResMgr::NoClosure);
+
+WorkerJob::WorkerJob()
+   : queue_node(this), pool_node(this), waiter(0), complete(false)
+{
+}
+WorkerJob::~WorkerJob()
+{
+   if(waiter)
+      waiter->DecRefCount();
+}
+
+#ifdef HAVE_PTHREAD_H
+struct WorkerPool::Worker
+{
+   WorkerPool *pool;
+   int index;
+   pthread_t thread;
+   pthread_mutex_t mutex;
+   xlist_head<WorkerJob> queue;
+};
+struct WorkerPool::Lock
+{
+   pthread_mutex_t mutex;
+   pthread_cond_t work;	   // signalled when a job is queued
+   pthread_cond_t done;	   // broadcast when a job is complete
+   bool abandoned;
+};
+#else
+struct WorkerPool::Worker {};
+struct WorkerPool::Lock {};
+#endif
+
+SMTaskRef<WorkerPool> WorkerPool::pools[KINDS];
+
+int WorkerPool::ThreadsSetting(kind_t k)
+{
+#ifdef HAVE_PTHREAD_H
+   // the lookups mostly wait for the network, the processors do not matter.
+   if(k==RESOLVER)
+   {
+      int n=ResMgr::Query("dns:threads",0);
+      return n>MAX_WORKERS ? MAX_WORKERS : n;
+   }
+   const char *t=ResMgr::Query("xfer:worker-threads",0);
+   int n;
+   if(!strcasecmp(t,"auto"))
+   {
+      // the main thread does the network I/O and takes one processor.
+      n=1;
+#ifdef _SC_NPROCESSORS_ONLN
+      n=sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+      n--;
+   }
+   else
+      n=atoi(t);
+   if(n<0)
+      n=0;
+   if(n>MAX_WORKERS)
+      n=MAX_WORKERS;
+   return n;
+#else
+   return 0;
+#endif
+}
+
+WorkerPool::WorkerPool(kind_t k,int threads)
+   : kind(k), workers(0), worker_count(0), next_worker(0), pid(getpid()),
+     lock(0), pending(0), quit(false)
+{
+   notify_pipe[0]=notify_pipe[1]=-1;
+#ifdef HAVE_PTHREAD_H
+   if(threads<=0)
+      return;
+   if(pipe(notify_pipe)==-1)
+   {
+      ProtoLog::LogError(9,"pipe: %s",strerror(errno));
+      notify_pipe[0]=notify_pipe[1]=-1;
+      return;
+   }
+   SMTask::NewFD(notify_pipe[0]);
+   SMTask::NewFD(notify_pipe[1]);
+   for(int i=0; i<2; i++)
+   {
+      fcntl(notify_pipe[i],F_SETFL,O_NONBLOCK);
+      fcntl(notify_pipe[i],F_SETFD,FD_CLOEXEC);
+   }
+   lock=new Lock;
+   pthread_mutex_init(&lock->mutex,0);
+   pthread_cond_init(&lock->work,0);
+   pthread_cond_init(&lock->done,0);
+   lock->abandoned=false;
+
+   workers=new Worker[threads];
+   // the signals are handled by the main thread
+   sigset_t all,old;
+   sigfillset(&all);
+   pthread_sigmask(SIG_SETMASK,&all,&old);
+   for(int i=0; i<threads; i++)
+   {
+      Worker *w=&workers[worker_count];
+      w->pool=this;
+      w->index=worker_count;
+      pthread_mutex_init(&w->mutex,0);
+      int res=pthread_create(&w->thread,0,WorkerMain,w);
+      if(res!=0)
+      {
+	 ProtoLog::LogError(9,"pthread_create: %s",strerror(res));
+	 pthread_mutex_destroy(&w->mutex);
+	 break;
+      }
+      worker_count++;
+   }
+   pthread_sigmask(SIG_SETMASK,&old,0);
+   if(worker_count>0)
+      ProtoLog::LogNote(9,"started %d %s threads",worker_count,kind==RESOLVER?"resolver":"worker");
+#endif
+}
+
+WorkerPool::~WorkerPool()
+{
+#ifdef HAVE_PTHREAD_H
+   if(lock && !lock->abandoned)
+   {
+      // the jobs are finished by now (the pool is replaced only when idle),
+      // just stop the threads.
+      pthread_mutex_lock(&lock->mutex);
+      quit=true;
+      pthread_cond_broadcast(&lock->work);
+      pthread_mutex_unlock(&lock->mutex);
+      for(int i=0; i<worker_count; i++)
+      {
+	 pthread_join(workers[i].thread,0);
+	 pthread_mutex_destroy(&workers[i].mutex);
+      }
+      pthread_cond_destroy(&lock->work);
+      pthread_cond_destroy(&lock->done);
+      pthread_mutex_destroy(&lock->mutex);
+      delete[] workers;
+      delete lock;
+   }
+   // an abandoned pool leaks its threads' memory, the threads are gone.
+   if(notify_pipe[0]!=-1)
+   {
+      close(notify_pipe[0]);
+      close(notify_pipe[1]);
+   }
+#endif
+}
+
+void WorkerPool::Abandon()
+{
+#ifdef HAVE_PTHREAD_H
+   // the threads did not survive fork, and the mutexes could be locked.
+   if(lock)
+      lock->abandoned=true;
+   worker_count=0;
+#endif
+}
+
+#ifdef HAVE_PTHREAD_H
+void *WorkerPool::WorkerMain(void *a)
+{
+   Worker *w=static_cast<Worker*>(a);
+   w->pool->Work(w->index);
+   return 0;
+}
+
+// take a job from the own queue, or steal one from the tail of another.
+WorkerJob *WorkerPool::TakeJob(int w)
+{
+   for(;;)
+   {
+      for(int i=0; i<worker_count; i++)
+      {
+	 Worker *victim=&workers[(w+i)%worker_count];
+	 pthread_mutex_lock(&victim->mutex);
+	 xlist<WorkerJob> *node=(i==0 ? victim->queue.get_next() : victim->queue.get_prev());
+	 WorkerJob *j=0;
+	 if(node!=&victim->queue)
+	 {
+	    j=node->get_obj();
+	    node->remove();
+	 }
+	 pthread_mutex_unlock(&victim->mutex);
+	 if(j)
+	    return j;
+      }
+      // the job counted in pending is being queued right now.
+      sched_yield();
+   }
+}
+
+void WorkerPool::Work(int w)
+{
+   for(;;)
+   {
+      pthread_mutex_lock(&lock->mutex);
+      while(pending==0 && !quit)
+	 pthread_cond_wait(&lock->work,&lock->mutex);
+      if(pending==0)
+      {
+	 pthread_mutex_unlock(&lock->mutex);
+	 break;
+      }
+      pending--;
+      pthread_mutex_unlock(&lock->mutex);
+
+      WorkerJob *j=TakeJob(w);
+      j->Run();
+
+      pthread_mutex_lock(&lock->mutex);
+      j->complete=true;
+      done.add_tail(j->queue_node);
+      pthread_cond_broadcast(&lock->done);
+      if(write(notify_pipe[1],"",1)==-1)
+	 ;  // the pipe is full, the main loop will wake up anyway
+      pthread_mutex_unlock(&lock->mutex);
+   }
+}
+
+void WorkerPool::Queue(WorkerJob *j)
+{
+   Worker *w=&workers[next_worker];
+   next_worker=(next_worker+1)%worker_count;
+   pthread_mutex_lock(&w->mutex);
+   w->queue.add_tail(j->queue_node);
+   pthread_mutex_unlock(&w->mutex);
+
+   pthread_mutex_lock(&lock->mutex);
+   pending++;
+   pthread_cond_signal(&lock->work);
+   pthread_mutex_unlock(&lock->mutex);
+}
+
+int WorkerPool::Reap()
+{
+   int count=0;
+   char buf[256];
+   while(read(notify_pipe[0],buf,sizeof(buf))>0)
+      ;
+   xlist_head<WorkerJob> completed;
+   pthread_mutex_lock(&lock->mutex);
+   while(done.get_next()!=&done)
+   {
+      WorkerJob *j=done.first_obj();
+      j->queue_node.remove();
+      completed.add_tail(j->queue_node);
+   }
+   pthread_mutex_unlock(&lock->mutex);
+   while(completed.get_next()!=&completed)
+   {
+      WorkerJob *j=completed.first_obj();
+      j->queue_node.remove();
+      j->pool_node.remove();
+      SMTask *waiter=j->waiter;
+      j->Finish();
+      if(waiter)
+	 waiter->Wake();
+      delete j;
+      count++;
+   }
+   return count;
+}
+#else // !HAVE_PTHREAD_H
+void WorkerPool::Queue(WorkerJob *) {}
+int WorkerPool::Reap() { return 0; }
+#endif // HAVE_PTHREAD_H
+
+WorkerPool *WorkerPool::Get(kind_t k)
+{
+   SMTaskRef<WorkerPool>& pool=pools[k];
+   if(pool && pool->pid!=getpid())
+   {
+      // the process was forked, run the jobs anew in this process.
+      ProtoLog::LogNote(9,"restarting worker threads after fork");
+      pool->Abandon();
+      xlist_head<WorkerJob> restart;
+      while(pool->jobs.get_next()!=&pool->jobs)
+      {
+	 WorkerJob *j=pool->jobs.first_obj();
+	 j->pool_node.remove();
+	 if(j->queue_node.listed())
+	    j->queue_node.remove();
+	 j->complete=false;
+	 restart.add_tail(j->pool_node);
+      }
+      pool=new WorkerPool(k,ThreadsSetting(k));
+      while(restart.get_next()!=&restart)
+      {
+	 WorkerJob *j=restart.first_obj();
+	 j->pool_node.remove();
+	 if(pool->worker_count>0)
+	 {
+	    pool->jobs.add_tail(j->pool_node);
+	    pool->Queue(j);
+	    continue;
+	 }
+	 j->Run();
+	 j->Finish();
+	 delete j;
+      }
+      return pool.get_non_const();
+   }
+   int threads=ThreadsSetting(k);
+   if(pool && pool->worker_count!=threads
+   && pool->jobs.get_next()==&pool->jobs)
+      pool=0;  // the setting was changed
+   if(!pool)
+      pool=new WorkerPool(k,threads);
+   return pool.get_non_const();
+}
+
+int WorkerPool::Threads(kind_t k)
+{
+   return Get(k)->worker_count;
+}
+
+bool WorkerPool::Submit(WorkerJob *j,kind_t k)
+{
+   WorkerPool *p=Get(k);
+   if(p->worker_count==0)
+   {
+      j->Run();
+      j->Finish();
+      delete j;
+      return false;
+   }
+   j->waiter=current;
+   if(j->waiter)
+      j->waiter->IncRefCount();
+   p->jobs.add_tail(j->pool_node);
+   p->Queue(j);
+   // the pool could have run already in this pass
+   Block(p->notify_pipe[0],POLLIN);
+   return true;
+}
+
+void WorkerPool::Wait(WorkerJob *j,kind_t k)
+{
+#ifdef HAVE_PTHREAD_H
+   WorkerPool *p=pools[k].get_non_const();
+   // after fork the job is run anew, maybe right away.
+   if(p && p->pid!=getpid())
+      p=Get(k);
+   // without threads Submit has finished the job already.
+   if(!p || !p->lock || p->lock->abandoned)
+      return;
+   pthread_mutex_lock(&p->lock->mutex);
+   while(!j->complete)
+      pthread_cond_wait(&p->lock->done,&p->lock->mutex);
+   pthread_mutex_unlock(&p->lock->mutex);
+   p->Reap();
+#endif
+}
+
+int WorkerPool::Do()
+{
+   if(worker_count==0 || jobs.get_next()==&jobs)
+      return STALL;
+   if(pid!=getpid())
+   {
+      // the lock could be held by a thread lost in fork, don't touch it.
+      Get(kind);
+      return MOVED;
+   }
+   int m=(Reap()>0 ? MOVED : STALL);
+   if(jobs.get_next()!=&jobs)
+      Block(notify_pipe[0],POLLIN);
+   return m;
+}
@@ -0,0 +1,112 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 2026 by the lftp contributors (see the AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H 1
+
+#include <sys/types.h>
+#include "SMTask.h"
+#include "xlist.h"
+
+class WorkerPool;
+
+// A piece of work done by a worker thread: CPU-bound work (hashing,
+// compression), or a blocking call (host name lookup) in a separate pool so
+// that it does not hold up the former.
+// Run is called in the worker thread and must only touch the job's own data;
+// Finish is called later in the main loop. The pool owns the job after
+// Submit and deletes it after Finish.
+class WorkerJob
+{
+   friend class WorkerPool;
+
+   xlist<WorkerJob> queue_node;	 // a worker queue or the done list
+   xlist<WorkerJob> pool_node;	 // all jobs of the pool, main thread only
+   SMTask *waiter;   // woken up on completion
+   bool complete;    // Run has returned
+
+protected:
+   virtual void Run()=0;
+   virtual void Finish() {}
+
+public:
+   WorkerJob();
+   virtual ~WorkerJob();
+};
+
+class WorkerPool : public SMTask
+{
+   friend class WorkerJob;
+
+public:
+   enum kind_t
+   {
+      CPU,	 // xfer:worker-threads
+      RESOLVER,	 // dns:threads
+      KINDS
+   };
+
+private:
+   static SMTaskRef<WorkerPool> pools[KINDS];
+
+   kind_t kind;
+
+   struct Worker;
+   Worker *workers;
+   int worker_count;
+   int next_worker;
+   pid_t pid;
+   int notify_pipe[2];
+
+   // the lock protects the worker queues, the done list and pending count
+   struct Lock;
+   Lock *lock;
+   int pending;	  // queued jobs not taken by a worker yet
+   bool quit;
+   xlist_head<WorkerJob> done;
+   xlist_head<WorkerJob> jobs;	  // submitted and not finished
+
+   static WorkerPool *Get(kind_t k);
+   static int ThreadsSetting(kind_t k);
+   static void *WorkerMain(void *);
+   void Work(int w);
+   WorkerJob *TakeJob(int w);
+   void Queue(WorkerJob *j);
+   int Reap();
+   void Abandon();
+
+   WorkerPool(kind_t k,int threads);
+   ~WorkerPool();
+
+public:
+   const char *GetClassName() { return "WorkerPool"; }
+   int Do();
+
+   // The job is run by a worker, or right away when there are no workers;
+   // false is returned then, and the job is finished and deleted already.
+   // The current task is woken up when the job is finished.
+   static bool Submit(WorkerJob *j,kind_t k=CPU);
+   // wait for a job queued by Submit, it is finished (and deleted) on
+   // return. It must not be called for a job Submit has finished.
+   static void Wait(WorkerJob *j,kind_t k=CPU);
+   // number of worker threads, 0 if the jobs are run in the main loop.
+   static int Threads(kind_t k=CPU);
+};
+
+#endif//WORKERPOOL_H
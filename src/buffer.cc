@@ -19,22 +19,69 @@
 
 #include <config.h>
 #include <errno.h>
+#ifdef HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>
+#endif
 #include "buffer.h"
 #include "FileAccess.h"
 #include "misc.h"
 #include "trio.h"
 #include "Speedometer.h"
 #include "log.h"
+#include "ResMgr.h"
+#include "xmap.h"
+
+ResDecl memory_limit("xfer:memory-limit","0",ResMgr::UNumberValidate,ResMgr::NoClosure);
 
 #define BUFFER_INC	   (8*1024) // should be power of 2
 
+// free segments of SEGMENT_SIZE kept for reuse
+static xarray<char*> segment_pool;
+#define SEGMENT_POOL_MAX	   64
+
+static char *segment_alloc(int size)
+{
+   if(size==Buffer::SEGMENT_SIZE && segment_pool.count()>0) {
+      char *b=segment_pool.last();
+      segment_pool.chop();
+      return b;
+   }
+   return (char*)xmalloc(size);
+}
+static void segment_free(char *b,int size)
+{
+   if(size==Buffer::SEGMENT_SIZE && segment_pool.count()<SEGMENT_POOL_MAX)
+      segment_pool.append(b);
+   else
+      xfree(b);
+}
+
 const char *Buffer::Get() const
 {
    if(Size()==0)
       return eof?0:"";
+   if(segments.count()>0)
+      const_cast<Buffer*>(this)->Linearize();
    return buffer+buffer_ptr;
 }
 
+void Buffer::GetSpan(const char **buf,int *size) const
+{
+   if(LinearSize()>0 || segments_size==0) {
+      *size=LinearSize();
+      *buf=(*size>0 ? buffer+buffer_ptr : eof?0:"");
+      return;
+   }
+   for(int i=0; i<segments.count(); i++) {
+      const Segment &b=segments[i];
+      if(b.Size()>0) {
+	 *buf=b.data+b.start;
+	 *size=b.Size();
+	 return;
+      }
+   }
+}
+
 void Buffer::Get(const char **buf,int *size) const
 {
    *size=Size();
@@ -60,37 +107,141 @@ void Buffer::SaveRollback(off_t p)
       save=false;
    if(!save)
       p=0;
+   FreeSegments();
    buffer.truncate(buffer_ptr=p);
 }
 
 void Buffer::Allocate(int size)
 {
-   if(buffer_ptr>0 && Size()==0 && !save)
+   space_in_segment=false;
+   if(buffer_ptr>0 && LinearSize()==0 && !save)
    {
       buffer.truncate(0);
       buffer_ptr=0;
    }
 
-   size_t in_buffer_real=Size();
+   size_t in_buffer_real=LinearSize();
    /* disable data movement to beginning of the buffer, if:
       1. we save the data explicitly;
       2. we add more data than there is space in the beginning of the buffer
 	 (because the probability of realloc is high anyway);
       3. the gap at beginning is smaller than the amount of data in the buffer
 	 (because the penalty of data movement is high). */
-   if(save || buffer_ptr<size || buffer_ptr<Size())
+   if(save || buffer_ptr<size || buffer_ptr<LinearSize())
       in_buffer_real+=buffer_ptr;
 
    // could be round-robin, but this is easier
    if(buffer.length()>in_buffer_real)
    {
-      buffer.nset(buffer+buffer_ptr,Size());
+      buffer.nset(buffer+buffer_ptr,LinearSize());
       buffer_ptr=0;
    }
 
    buffer.get_space2(in_buffer_real+size,BUFFER_INC);
 }
 
+char *Buffer::GetSegmentSpace(int size)
+{
+   space_in_segment=true;
+   if(segments.count()>0) {
+      Segment &b=segments.last();
+      if(b.Size()==0)
+	 b.start=b.end=0;
+      if(b.Avail()>=size)
+	 return b.data+b.end;
+      if(b.Size()==0) {
+	 // only the last segment can be empty
+	 segment_free(b.data,b.alloc);
+	 segments.chop();
+      }
+   }
+   Segment b;
+   b.alloc=(size>SEGMENT_SIZE ? size : SEGMENT_SIZE);
+   b.data=segment_alloc(b.alloc);
+   b.start=b.end=0;
+   segments.append(b);
+   return b.data;
+}
+int Buffer::SpaceSizeHint(int size) const
+{
+   if(!UseSegments())
+      return size;
+   if(size>SEGMENT_SIZE)
+      size=SEGMENT_SIZE;
+   // fill the last segment before starting a new one
+   if(segments.count()>0) {
+      const Segment &b=segments[segments.count()-1];
+      int avail=(b.Size()==0 ? b.alloc : b.Avail());
+      if(avail<size && avail>=SEGMENT_SIZE/16)
+	 size=avail;
+   }
+   return size;
+}
+void Buffer::AppendToSegments(const char *buf,int size)
+{
+   while(size>0) {
+      int len=size;
+      if(segments.count()>0 && segments.last().Avail()>0 && segments.last().Avail()<len)
+	 len=segments.last().Avail();
+      else if(len>SEGMENT_SIZE)
+	 len=SEGMENT_SIZE;
+      memcpy(GetSegmentSpace(len),buf,len);
+      SpaceAdd(len);
+      buf+=len;
+      size-=len;
+   }
+}
+void Buffer::FreeSegments()
+{
+   for(int i=0; i<segments.count(); i++)
+      segment_free(segments[i].data,segments[i].alloc);
+   segments.truncate();
+   segments_size=0;
+   space_in_segment=false;
+}
+// pass the first segment of o over without copying. Its data becomes the
+// space confirmed by the following SpaceAdd.
+int Buffer::TakeSegment(Buffer *o)
+{
+   Segment s=o->segments[0];
+   int size=s.Size();
+   o->segments.remove(0);
+   o->segments_size-=size;
+   o->pos+=size;
+   if(o->segments.count()==0)
+      o->space_in_segment=false;
+   if(segments.count()>0 && segments.last().Size()==0) {
+      // only the last segment can be empty
+      segment_free(segments.last().data,segments.last().alloc);
+      segments.chop();
+   }
+   s.end=s.start;
+   segments.append(s);
+   space_in_segment=true;
+   return size;
+}
+void Buffer::Linearize()
+{
+   if(segments.count()==0)
+      return;
+   int size=segments_size;
+   Allocate(size);
+   char *space=buffer.get_non_const()+buffer.length();
+   for(int i=0; i<segments.count(); i++) {
+      const Segment &b=segments[i];
+      memcpy(space,b.data+b.start,b.Size());
+      space+=b.Size();
+   }
+   buffer.set_length(buffer.length()+size);
+   FreeSegments();
+}
+void Buffer::SetSegmented(bool on)
+{
+   segmented=on;
+   if(!on)
+      Linearize();
+}
+
 void Buffer::SaveMaxCheck(int size)
 {
    if(save && buffer_ptr+size>save_max)
@@ -103,6 +254,11 @@ void Buffer::Append(const char *buf,int size)
       return;
 
    SaveMaxCheck(size);
+   if(UseSegments())
+   {
+      AppendToSegments(buf,size);
+      return;
+   }
    if(Size()==0 && buffer_ptr>0 && !save)
    {
       buffer.truncate(0);
@@ -130,9 +286,10 @@ void Buffer::Prepend(const char *buf,int size)
    }
    if(buffer_ptr<size)
    {
-      Allocate(size-buffer_ptr);
-      memmove(buffer.get_non_const()+size,buffer+buffer_ptr,Size());
-      SpaceAdd(size-buffer_ptr);
+      int linear=LinearSize();
+      Allocate(size);  // can move the data to the beginning
+      memmove(buffer.get_non_const()+size,buffer+buffer_ptr,linear);
+      buffer.set_length(size+linear);
       buffer_ptr=size;
    }
    memmove(buffer.get_non_const()+buffer_ptr-size,buf,size);
@@ -172,11 +329,46 @@ void Buffer::Skip(int len)
 {
    if(len>Size())
       len=Size();
-   buffer_ptr+=len;
+   Consume(len);
    pos+=len;
 }
+void Buffer::Consume(int len)
+{
+   int linear=LinearSize();
+   if(len<=linear) {
+      buffer_ptr+=len;
+      return;
+   }
+   buffer_ptr+=linear;
+   len-=linear;
+   while(len>0 && segments.count()>0) {
+      Segment &b=segments[0];
+      int n=(len<b.Size() ? len : b.Size());
+      b.start+=n;
+      segments_size-=n;
+      len-=n;
+      if(b.Size()>0)
+	 break;
+      if(segments.count()==1)
+	 b.start=b.end=0;  // keep the last segment for new data
+      else {
+	 segment_free(b.data,b.alloc);
+	 segments.remove(0);
+      }
+   }
+}
 void Buffer::UnSkip(int len)
 {
+   if(LinearSize()==0 && segments.count()>0) {
+      // only the data of the first segment can be restored
+      Segment &b=segments[0];
+      if(len>b.start)
+	 len=b.start;
+      b.start-=len;
+      segments_size+=len;
+      pos-=len;
+      return;
+   }
    if(len>buffer_ptr)
       len=buffer_ptr;
    buffer_ptr-=len;
@@ -185,6 +377,7 @@ void Buffer::UnSkip(int len)
 
 void Buffer::Empty()
 {
+   FreeSegments();
    buffer.truncate(0);
    buffer_ptr=0;
    if(save_max>0)
@@ -194,21 +387,37 @@ void Buffer::Empty()
 // move data from other buffer, prepare for SpaceAdd.
 int Buffer::MoveDataHere(Buffer *o,int max_len)
 {
-   const char *b;
-   int size;
-   o->Get(&b,&size);
+   int size=o->Size();
    if(size>max_len)
       size=max_len;
    if(size>0) {
-      if(size>=64 && Size()==0 && o->Size()==size && !save && !o->save) {
+      if(size>=64 && Size()==0 && o->Size()==size && !save && !o->save
+      && segments.count()==0 && o->segments.count()==0) {
 	 // optimization by swapping buffers
 	 buffer.swap(o->buffer);
 	 buffer_ptr=replace_value(o->buffer_ptr,buffer_ptr);
 	 buffer.set_length_no_z(buffer_ptr);
+	 space_in_segment=false;
 	 o->pos+=size;
+      } else if(segmented && !save && o->LinearSize()==0
+      && o->segments.count()>0 && o->segments[0].Size()<=size
+      && o->segments[0].Size()>=SEGMENT_SIZE/8) {
+	 // pass the first segment over without copying
+	 size=TakeSegment(o);
       } else {
-	 memcpy(GetSpace(size),b,size);
-	 o->Skip(size);
+	 // copy span by span, so that a segmented source is not linearized.
+	 char *space=GetSpace(size);
+	 for(int left=size; left>0; ) {
+	    const char *b;
+	    int len;
+	    o->GetSpan(&b,&len);
+	    if(len>left)
+	       len=left;
+	    memcpy(space,b,len);
+	    space+=len;
+	    left-=len;
+	    o->Skip(len);
+	 }
       }
    }
    return size;
@@ -224,9 +433,13 @@ Buffer::Buffer()
    save=false;
    save_max=0;
    pos=0;
+   segmented=false;
+   space_in_segment=false;
+   segments_size=0;
 }
 Buffer::~Buffer()
 {
+   FreeSegments();
 }
 
 const char *Buffer::GetRateStrS()
@@ -254,7 +467,7 @@ void Buffer::SetErrorCached(const char *e)
 }
 const char *Buffer::Dump() const
 {
-   if(buffer_ptr==0)
+   if(buffer_ptr==0 && segments.count()==0)
       return buffer.dump();
    return xstring::get_tmp(Get(),Size()).dump();
 }
@@ -268,6 +481,9 @@ void DataTranslator::AppendTranslated(Buffer *target,const char *put_buf,int siz
 
 void DirectedBuffer::SetTranslator(DataTranslator *t)
 {
+   // translators need the new data contiguous
+   if(mode==GET)
+      SetSegmented(false);
    if(mode==GET && !translator && Size()>0) {
       // translate unread data
       const char *data;
@@ -433,7 +649,7 @@ void DirectedBuffer::EmbraceNewData(int len)
    if(translator)
    {
       // copy the data to free room for translated data
-      translator->Put(buffer+buffer.length(),len);
+      translator->Put(SpacePtr(),len);
       translator->AppendTranslated(this,0,0);
    }
    else
@@ -444,11 +660,105 @@ void DirectedBuffer::EmbraceNewData(int len)
 
 IOBuffer::IOBuffer(dir_t m)
    : DirectedBuffer(m), event_time(now),
-     max_buf(0), get_size(GET_BUFSIZE)
+     max_buf(0), get_size(GET_BUFSIZE), direct(false), all_buffers_node(this),
+     memory_group(0), group_size(0)
 {
+   all_buffers.add(all_buffers_node);
 }
 IOBuffer::~IOBuffer()
 {
+   all_buffers_node.remove();
+}
+
+xlist_head<IOBuffer> IOBuffer::all_buffers;
+IOBuffer::MemoryUsage IOBuffer::usage;
+int IOBuffer::last_memory_group;
+
+void IOBuffer::SetThrottle(bool throttle)
+{
+   if(throttle==usage.throttle)
+      return;
+   Log::global->Format(9,"buffer: memory usage %lld of %lld, %s\n",
+      usage.total,usage.limit,throttle?"throttling readers":"not throttling");
+   usage.throttle=throttle;
+}
+
+long long IOBuffer::TotalBuffered()
+{
+   long long total=0;
+   xlist_for_each(IOBuffer,all_buffers,node,b)
+   {
+      int size=b->Size();
+      if(size>0)
+	 total+=size;
+   }
+   return total;
+}
+
+// sum up the buffered data once per scheduler pass.
+const IOBuffer::MemoryUsage& IOBuffer::GetMemoryUsage()
+{
+   if(usage.sec==now.UnixTime() && usage.usec==now.MicroSecond())
+      return usage;
+   usage.sec=now.UnixTime();
+   usage.usec=now.MicroSecond();
+   usage.limit=(unsigned long)memory_limit.Query(0);
+   usage.total=0;
+   usage.holders=0;
+   if(usage.limit==0)
+   {
+      // nothing to throttle, don't walk the buffers.
+      SetThrottle(false);
+      return usage;
+   }
+   xmap<long long> group_total;
+   xlist_for_each(IOBuffer,all_buffers,node,b)
+   {
+      int size=b->Size();
+      if(size<=0)
+	 continue;
+      usage.total+=size;
+      if(!b->memory_group) {
+	 usage.holders++;
+	 continue;
+      }
+      long long &t=group_total.lookup_Lv(xstring::get_tmp((const char*)&b->memory_group,sizeof(b->memory_group)));
+      if(t==0)
+	 usage.holders++;
+      t+=size;
+   }
+   xlist_for_each(IOBuffer,all_buffers,gnode,g)
+   {
+      if(g->memory_group)
+	 g->group_size=group_total.lookup(xstring::get_tmp((const char*)&g->memory_group,sizeof(g->memory_group)));
+   }
+   SetThrottle(usage.total>=usage.limit-usage.limit/8);
+   return usage;
+}
+
+// When the total buffered data near the limit, a group may hold no more
+// than its fair share of the limit, but each buffer may hold GET_BUFSIZE,
+// so that a protocol waiting for a whole message can always proceed.
+bool IOBuffer::OverMemoryLimit()
+{
+   int size=Size();
+   if(size<GET_BUFSIZE)
+      return false;
+   const MemoryUsage& u=GetMemoryUsage();
+   if(!u.throttle)
+      return false;
+   long long held=(memory_group && group_size>size ? group_size : size);
+   return held>=u.limit/(u.holders>0?u.holders:1);
+}
+
+void IOBuffer::FormatMemoryUsage(xstring& s)
+{
+   const MemoryUsage& u=GetMemoryUsage();
+   s.append(_("Buffer memory: "));
+   s.append(xhuman(u.limit>0?u.total:TotalBuffered()));
+   if(u.limit>0)
+      s.appendf(_(" of %s%s"),xhuman(u.limit),u.throttle?_(", throttled"):"");
+   s.append('\n');
 }
 
 void IOBuffer::Put(const char *buf,int size)
@@ -496,11 +806,11 @@ int IOBuffer::Do()
    case PUT:
       if(Size()==0)
 	 return STALL;
-      res=Put_LL(buffer+buffer_ptr,Size());
+      res=Put_LL(Span(),SpanSize());
       if(res>0)
       {
 	 RateAdd(res);
-	 buffer_ptr+=res;
+	 Consume(res);
 	 event_time=now;
 	 if(eof)
 	    PutEOF_LL();
@@ -509,9 +819,14 @@ int IOBuffer::Do()
       break;
 
    case GET:
-      if(eof)
+      if(eof || direct)
+	 return STALL;
+      if(OverMemoryLimit())
+      {
+	 Timeout(100);
 	 return STALL;
-      res=TuneGetSize(Get_LL(get_size));
+      }
+      res=TuneGetSize(Get_LL(SpaceSizeHint(get_size)));
       if(res>0)
       {
 	 EmbraceNewData(res);
@@ -557,10 +872,10 @@ int IOBufferStacked::Do()
       }
       if(Size()==0)
 	 return m;
-      res=Put_LL(buffer+buffer_ptr,Size());
+      res=Put_LL(Span(),SpanSize());
       if(res>0)
       {
-	 buffer_ptr+=res;
+	 Consume(res);
 	 m=MOVED;
       }
       break;
@@ -751,7 +1066,162 @@ bool IOBufferFDStream::Done()
    return false;
 }
 
-IOBufferFDStream::~IOBufferFDStream() {}
+IOBufferFDStream::~IOBufferFDStream()
+{
+   if(direct_pipe[0]!=-1)
+   {
+      close(direct_pipe[0]);
+      close(direct_pipe[1]);
+   }
+}
+
+int IOBufferFDStream::DirectGet(int fd,int size)
+{
+#if defined(HAVE_SPLICE) && defined(SPLICE_F_MOVE)
+   if(mode!=GET || translator || eof || Error())
+      return -1;
+   int sock=stream->getfd();
+   if(sock==-1)
+      return -1;
+   if(direct_pipe[0]==-1)
+   {
+      if(pipe(direct_pipe)==-1)
+	 return -1;
+      for(int i=0; i<2; i++)
+      {
+	 fcntl(direct_pipe[i],F_SETFL,fcntl(direct_pipe[i],F_GETFL)|O_NONBLOCK);
+	 fcntl(direct_pipe[i],F_SETFD,FD_CLOEXEC);
+      }
+   }
+   // from now on the socket is read here.
+   direct=true;
+   if(Size()>0 || size==0)
+      return 0;
+
+   if(!Ready(sock,POLLIN))
+   {
+      Block(sock,POLLIN);
+      return 0;
+   }
+   ssize_t res=splice(sock,0,direct_pipe[1],0,size,SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+   if(res==-1)
+   {
+      saved_errno=errno;
+      if(E_RETRY(saved_errno))
+      {
+	 SetNotReady(sock,POLLIN);
+	 Block(sock,POLLIN);
+	 return 0;
+      }
+      if(saved_errno==EINVAL || saved_errno==ENOSYS)
+      {
+	 direct=false;
+	 return -1;
+      }
+      if(NonFatalError(saved_errno))
+	 return 0;
+      stream->MakeErrorText(saved_errno);
+      SetError(stream->error_text,!TemporaryNetworkError(saved_errno));
+      event_time=now;
+      return 0;
+   }
+   event_time=now;
+   if(res==0)
+   {
+      Log::global->Format(10,"buffer: EOF on FD %d\n",sock);
+      eof=true;
+      return 0;
+   }
+   RateAdd(res);
+
+   int moved=0;
+   while(moved<res)
+   {
+      ssize_t w=splice(direct_pipe[0],0,fd,0,res-moved,SPLICE_F_MOVE);
+      if(w<=0)
+	 break;
+      moved+=w;
+   }
+   if(moved<res)
+   {
+      // the file refused the data, leave the rest in the buffer for the
+      // usual way, it will handle the error. The pipe must be emptied, as
+      // the next splice would pass the leftover as fresh data.
+      int left=res-moved;
+      while(left>0)
+      {
+	 int r=read(direct_pipe[0],GetSpace(left),left);
+	 if(r<=0)
+	 {
+	    if(r==-1 && errno==EINTR)
+	       continue;
+	    SetError(xstring::format("read(splice pipe): %s",
+	       r==-1?strerror(errno):"unexpected EOF"),true);
+	    break;
+	 }
+	 SpaceAdd(r);
+	 left-=r;
+      }
+      direct=false;
+   }
+   pos+=moved;
+   return moved;
+#else
+   return -1;
+#endif
+}
+
+int IOBufferFDStream::DirectPut(int fd,int size)
+{
+#ifdef HAVE_SENDFILE
+   if(mode!=PUT || translator || eof || broken || Error())
+      return -1;
+   if(stream->broken())
+   {
+      broken=true;
+      return -1;
+   }
+   if(Size()>0 || size==0)
+      return 0;
+   int sock=stream->getfd();
+   if(sock==-1)
+      return -1;
+
+   ssize_t res=sendfile(sock,fd,0,size);
+   if(res==-1)
+   {
+      saved_errno=errno;
+      if(E_RETRY(saved_errno))
+      {
+	 Block(sock,POLLOUT);
+	 return 0;
+      }
+      if(saved_errno==EINVAL || saved_errno==ENOSYS)
+	 return -1;
+      if(NonFatalError(saved_errno))
+	 return 0;
+      if(saved_errno==EPIPE)
+      {
+	 broken=true;
+	 return -1;
+      }
+      stream->MakeErrorText(saved_errno);
+      SetError(stream->error_text,!TemporaryNetworkError(saved_errno));
+      event_time=now;
+      return 0;
+   }
+   if(res==0)	// end of the file
+      return -1;
+   RateAdd(res);
+   pos+=res;
+   event_time=now;
+   if(put_ll_timer)
+      put_ll_timer->Reset();
+   return res;
+#else
+   return -1;
+#endif
+}
 
 
 // IOBufferFileAccess implementation
@@ -815,7 +1285,7 @@ unsigned Buffer::UnpackUINT32BE(int offset) const
 {
    if(Size()-offset<4)
       return 0;
-   unsigned char *b=(unsigned char*)buffer.get()+buffer_ptr+offset;
+   unsigned char *b=(unsigned char*)Get()+offset;
    return (b[0]<<24)|(b[1]<<16)|(b[2]<<8)|b[3];
 }
 int Buffer::UnpackINT32BE(int offset) const
@@ -829,14 +1299,14 @@ unsigned Buffer::UnpackUINT16BE(int offset) const
 {
    if(Size()-offset<2)
       return 0;
-   unsigned char *b=(unsigned char*)buffer.get()+buffer_ptr+offset;
+   unsigned char *b=(unsigned char*)Get()+offset;
    return (b[0]<<8)|b[1];
 }
 unsigned Buffer::UnpackUINT8(int offset) const
 {
    if(Size()-offset<1)
       return 0;
-   unsigned char *b=(unsigned char*)buffer.get()+buffer_ptr+offset;
+   unsigned char *b=(unsigned char*)Get()+offset;
    return b[0];
 }
 void Buffer::PackUINT64BE(unsigned long long data)
@@ -25,6 +25,7 @@
 #include "Timer.h"
 #include "fg.h"
 #include "xstring.h"
+#include "xlist.h"
 #include "Speedometer.h"
 
 #include <stdarg.h>
@@ -52,6 +53,31 @@ protected:
 
    off_t pos;
 
+   // In segmented mode new data goes to a list of segments following the
+   // linear buffer, so that neither appending nor skipping moves data.
+   // Get() linearizes the data on demand, GetSpan() does not.
+   struct Segment
+   {
+      char *data;
+      int alloc;
+      int start;
+      int end;
+      int Size() const { return end-start; }
+      int Avail() const { return alloc-end; }
+   };
+   bool segmented;
+   bool space_in_segment;	// last GetSpace returned segment space
+   xarray<Segment> segments;
+   int segments_size;
+   bool UseSegments() const { return (segmented && !save) || segments.count()>0; }
+   char *GetSegmentSpace(int size);
+   void AppendToSegments(const char *buf,int size);
+   void FreeSegments();
+   int TakeSegment(Buffer *o);
+   void Linearize();
+
+   int LinearSize() const { return buffer.length()-buffer_ptr; }
+
    Ref<Speedometer> rate;
    void RateAdd(int n);
 
@@ -59,18 +85,25 @@ protected:
 
    void SaveMaxCheck(int addsize);
 
+   // remove data from the beginning, don't advance pos.
+   void Consume(int len);
+   // first contiguous part of the data, e.g. for Put_LL.
+   const char *Span() const { const char *b; int n; GetSpan(&b,&n); return b; }
+   int SpanSize() const { const char *b; int n; GetSpan(&b,&n); return n; }
+
 public:
    bool Error() const { return error_text!=0; }
    bool ErrorFatal() const { return error_fatal; }
    void SetError(const char *e,bool fatal=false);
    void SetErrorCached(const char *e);
    const char *ErrorText() const { return error_text; }
-   int Size() const { return buffer.length()-buffer_ptr; }
+   int Size() const { return LinearSize()+segments_size; }
    bool Eof() const { return eof; }
    bool Broken() const { return broken; }
 
    const char *Get() const;
    void Get(const char **buf,int *size) const;
+   void GetSpan(const char **buf,int *size) const; // first contiguous part
    void Skip(int len); // Get(); consume; Skip()
    void UnSkip(int len); // this only works if there were no Put's.
    void Append(const char *buf,int size);
@@ -83,12 +116,27 @@ public:
    void vFormat(const char *f, va_list v);
    void PutEOF() { eof=true; }
    char *GetSpace(int size) {
+      if(UseSegments())
+	 return GetSegmentSpace(size);
       Allocate(size);
       return buffer.get_non_const()+buffer.length();
    }
+   // the space returned by last GetSpace.
+   char *SpacePtr() {
+      if(space_in_segment)
+	 return segments.last().data+segments.last().end;
+      return buffer.get_non_const()+buffer.length();
+   }
    void SpaceAdd(int size) {
+      if(space_in_segment) {
+	 segments.last().end+=size;
+	 segments_size+=size;
+	 return;
+      }
       buffer.set_length(buffer.length()+size);
    }
+   // size to ask from GetSpace to avoid wasting segment space.
+   int SpaceSizeHint(int size) const;
    void Prepend(const char *buf,int size);
    void Prepend(const char *buf) { Prepend(buf,strlen(buf)); }
    int MoveDataHere(Buffer *o,int len);
@@ -114,7 +162,7 @@ public:
    void PackINT8(int data);
 
    // useful for cache.
-   void Save(int m) { save=true; save_max=m; }
+   void Save(int m) { Linearize(); save=true; save_max=m; }
    bool IsSaving() const { return save; }
    void GetSaved(const char **buf,int *size) const;
    void SaveRollback(off_t p);
@@ -127,6 +175,10 @@ public:
 
    void Empty();
 
+   enum { SEGMENT_SIZE=0x10000 };
+   void SetSegmented(bool on);
+   bool IsSegmented() const { return segmented; }
+
    Buffer();
    ~Buffer();
 
@@ -203,6 +255,31 @@ protected:
    int get_size;
    int TuneGetSize(int res);
 
+   bool direct;	    // the stream is read by DirectGet, not by Do
+
+   // all buffers count against the global xfer:memory-limit. Buffers of
+   // one transfer form a group sharing a single part of the limit.
+   xlist<IOBuffer> all_buffers_node;
+   static xlist_head<IOBuffer> all_buffers;
+   int memory_group;	 // zero if the buffer is a group by itself
+   long long group_size; // data held by the group at the last calculation
+   struct MemoryUsage
+   {
+      long long total;
+      long long limit;
+      int holders;   // number of groups with data
+      bool throttle;
+      time_t sec;    // time of the calculation
+      int usec;
+      MemoryUsage() : total(0), limit(0), holders(0), throttle(false), sec(0), usec(0) {}
+   };
+   static MemoryUsage usage;
+   static int last_memory_group;
+   static const MemoryUsage& GetMemoryUsage();
+   static void SetThrottle(bool throttle);
+   static long long TotalBuffered();
+   bool OverMemoryLimit();
+
    enum {
       GET_BUFSIZE=0x10000,
       PUT_LL_MIN=0x2000,
@@ -211,6 +288,7 @@ protected:
    virtual ~IOBuffer();
 
 public:
+   const char *GetClassName() { return "IOBuffer"; }
    IOBuffer(dir_t m);
    virtual const Time& EventTime()
       {
@@ -238,7 +316,22 @@ public:
    void PutEOF() { DirectedBuffer::PutEOF(); PutEOF_LL(); }
 
    void SetMaxBuffered(int m) { max_buf=m; }
-   bool IsFull() { return Size()+(translator?translator->Size():0) >= max_buf; }
+   bool IsFull() { return Size()+(translator?translator->Size():0) >= max_buf || OverMemoryLimit(); }
+   static void FormatMemoryUsage(xstring& s);
+   static int NewMemoryGroup() { return ++last_memory_group; }
+   void SetMemoryGroup(int g) { memory_group=g; }
+   int GetMemoryGroup() const { return memory_group; }
+
+   // kernel-assisted transfer between the stream and a local file at its
+   // current offset, the data do not pass through the buffer. Data already in
+   // the buffer have to be taken the usual way first, DirectGet stops reading
+   // into the buffer. Returns the number of bytes moved, 0 if nothing can be
+   // moved now or -1 if direct transfer is not possible. Zero size only
+   // checks if it is possible.
+   virtual int DirectGet(int fd,int size) { return -1; }
+   virtual int DirectPut(int fd,int size) { return -1; }
+   void SetDirect(bool d) { direct=d; }
+   bool IsDirect() const { return direct; }
 };
 
 class IOBufferStacked : public IOBuffer
@@ -252,6 +345,7 @@ class IOBufferStacked : public IOBuffer
    void ResumeInternal();
 
 public:
+   const char *GetClassName() { return "IOBufferStacked"; }
    IOBufferStacked(IOBuffer *b) : IOBuffer(b->GetDirection()), down(b) {}
    bool TranslationEOF() const { return down->TranslationEOF()||IOBuffer::TranslationEOF(); }
    void PrepareToDie() { down=0; }
@@ -265,20 +359,28 @@ class IOBufferFDStream : public IOBuffer
    Ref<FDStream> my_stream;
    const Ref<FDStream>& stream;
    Ref<Timer> put_ll_timer;
+   int direct_pipe[2];	// for splice from the socket to a file
 
    int Get_LL(int size);
    int Put_LL(const char *buf,int size);
 
+   void Init() { SetEventDriven(); direct_pipe[0]=direct_pipe[1]=-1; }
+
 public:
+   const char *GetClassName() { return "IOBufferFDStream"; }
+   // the stream is only touched from Do, so the buffer can sleep
+   // while its fd is not ready.
    IOBufferFDStream(FDStream *o,dir_t m)
-      : IOBuffer(m), my_stream(o), stream(my_stream) {}
+      : IOBuffer(m), my_stream(o), stream(my_stream) { Init(); }
    IOBufferFDStream(const Ref<FDStream>& o,dir_t m)
-      : IOBuffer(m), stream(o) {}
+      : IOBuffer(m), stream(o) { Init(); }
    IOBufferFDStream(FDStream *o,dir_t m,Timer *t)
-      : IOBuffer(m), my_stream(o), stream(my_stream), put_ll_timer(t) {}
+      : IOBuffer(m), my_stream(o), stream(my_stream), put_ll_timer(t) { Init(); }
    IOBufferFDStream(const Ref<FDStream>& o,dir_t m,Timer *t)
-      : IOBuffer(m), stream(o), put_ll_timer(t) {}
+      : IOBuffer(m), stream(o), put_ll_timer(t) { Init(); }
    ~IOBufferFDStream();
+   int DirectGet(int fd,int size);
+   int DirectPut(int fd,int size);
    bool Done();
    FgData *GetFgData(bool fg);
    const char *Status() { return stream->status; }
@@ -297,6 +399,7 @@ class IOBufferFileAccess : public IOBuffer
    void ResumeInternal();
 
 public:
+   const char *GetClassName() { return "IOBufferFileAccess"; }
    IOBufferFileAccess(const FileAccessRef& i) : IOBuffer(GET), session(i) {}
    IOBufferFileAccess(FileAccess *fa) : IOBuffer(GET), session(session_ref), session_ref(fa) {}
    ~IOBufferFileAccess() {
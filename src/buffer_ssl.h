@@ -38,6 +38,7 @@ class IOBufferSSL : public IOBuffer
    int dir_mask() const { return (mode==GET?POLLIN:POLLOUT); }
 
 public:
+   const char *GetClassName() { return "IOBufferSSL"; }
    IOBufferSSL(lftp_ssl *s,dir_t m) : IOBuffer(m), my_ssl(s), ssl(my_ssl) {}
    IOBufferSSL(const Ref<lftp_ssl>& s,dir_t m) : IOBuffer(m), ssl(s) {}
    ~IOBufferSSL();
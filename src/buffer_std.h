@@ -29,6 +29,7 @@ class IOBuffer_STDOUT : public IOBuffer
    int Put_LL(const char *buf,int size);
 
 public:
+   const char *GetClassName() { return "IOBuffer_STDOUT"; }
    IOBuffer_STDOUT(Job *m) : IOBuffer(PUT) { master=m; }
 };
 
@@ -367,6 +367,16 @@ const struct CmdExec::cmd_rec CmdExec::static_cmd_table[]=
 	 " -n <maxconn>  set maximum number of connections (default is is taken from\n"
 	 "     pget:default-n setting)\n"
 	 " -O <base> specifies base directory where files should be placed\n")},
+   {"pput",    cmd_get,    N_("pput [OPTS] <lfile> [-o <rfile>]"),
+	 N_("Uploads the specified file using several connections, each writing\n"
+	 "a part of the remote file. The server has to support writing at an offset\n"
+	 "(FTP REST+STOR, SFTP), otherwise a plain put is done.\n"
+	 "\nOptions:\n"
+	 " -c  continue transfer. Requires the status file saved by previous pput\n"
+	 "     of the file to the same target.\n"
+	 " -n <maxconn>  set maximum number of connections (default is taken from\n"
+	 "     pget:default-n setting)\n"
+	 " -O <base> specifies base directory or URL where files should be placed\n")},
    {"put",     cmd_get,    N_("put [OPTS] <lfile> [-o <rfile>]"),
 	 N_("Upload <lfile> with remote name <rfile>.\n"
 	 " -o <rfile> specifies remote file name (default - basename of lfile)\n"
@@ -1749,10 +1759,11 @@ CMD(get)
       cont=true;
       opts="+EaO:qP:";
    }
-   if(!strcmp(op,"pget"))
+   if(!strcmp(op,"pget") || !strcmp(op,"pput"))
    {
       opts="+n:ceO:q";
       n_conn=0; // default, which means to take pget:default-n
+      reverse=(op[1]=='p');
    }
    else if(!strcmp(op,"put") || !strcmp(op,"reput"))
    {
@@ -2086,6 +2097,8 @@ CMD(jobs)
    xstring s("");
    if(!arg) {
       parent->top->FormatJobs(s,v);
+      if(v>1)
+	 IOBuffer::FormatMemoryUsage(s);
    } else {
       for(; arg; arg=args->getnext()) {
 	 if(!isdigit((unsigned char)*arg)) {
@@ -3566,7 +3579,45 @@ CMD(slot)
 
 CMD(tasks)
 {
+   const char *op=args->getarg(1);
+   if(op && !strcmp(op,"profile"))
+   {
+      bool json=false,by_task=false,by_calls=false;
+      for(int i=2; i<args->count(); i++)
+      {
+	 const char *a=args->getarg(i);
+	 if(!strcmp(a,"on") || !strcmp(a,"off"))
+	 {
+	    SMTask::SetProfiling(!strcmp(a,"on"));
+	    exit_code=0;
+	    return 0;
+	 }
+	 else if(!strcmp(a,"reset"))
+	 {
+	    SMTask::ResetProfile();
+	    exit_code=0;
+	    return 0;
+	 }
+	 else if(!strcmp(a,"--json"))
+	    json=true;
+	 else if(!strcmp(a,"--tasks"))
+	    by_task=true;
+	 else if(!strcmp(a,"--sort=calls"))
+	    by_calls=true;
+	 else if(strcmp(a,"--sort=time"))
+	 {
+	    eprintf(_("Usage: %s profile [on|off|reset] [--json] [--tasks] [--sort=time|calls]\n"),args->a0());
+	    return 0;
+	 }
+      }
+      xstring buf;
+      SMTask::FormatProfile(buf,by_task,json,by_calls);
+      Job *j=new echoJob(buf,new OutputJob(output.borrow(),args->a0()));
+      return j;
+   }
    printf("task_count=%d\n",SMTask::TaskCount());
+   printf("sleeping_count=%d do_avoided=%llu\n",SMTask::SleepingTaskCount(),
+      SMTask::DoAvoidedCount());
    SMTask::PrintTasks();
    exit_code=0;
    return 0;
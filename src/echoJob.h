@@ -29,6 +29,7 @@ class echoJob : public Job
    JobRef<OutputJob> output;
 
 public:
+   const char *GetClassName() { return "echoJob"; }
    int	 Do() { return STALL; }
    int	 Done();
    int	 ExitCode();
@@ -39,6 +39,7 @@
 #include "LsCache.h"
 #include "buffer_ssl.h"
 #include "buffer_zlib.h"
+#include "Checksum.h"
 
 #include "ascii_ctype.h"
 #include "misc.h"
@@ -77,6 +78,7 @@ const bool Ftp::ftps=false;
 #define FTPS_DEFAULT_PORT "990"
 #define FTP_DATA_PORT 20
 #define FTPS_DATA_PORT 989
+
 #define HTTP_DEFAULT_PROXY_PORT "3128"
 
 #define super NetAccess
@@ -209,6 +211,7 @@ address_mismatch:
 
 void Ftp::RestCheck(int act)
 {
+   conn->wait_rest=false;
    if(is2XX(act) || is3XX(act))
    {
       real_pos=conn->rest_pos;  // REST successful
@@ -222,6 +225,13 @@ void Ftp::RestCheck(int act)
    {
       if(cmd_unsupported(act))
 	 conn->rest_supported=false;
+      if(mode==STORE && limit!=FILE_END)
+      {
+	 // a part of the file cannot be stored from the beginning,
+	 // STOR has not been sent yet and the file is intact.
+	 SetError(FATAL,all_lines);
+	 return;
+      }
       LogNote(2,_("Switching to NOREST mode"));
       flags|=NOREST_MODE;
       if(mode==STORE)
@@ -250,8 +260,8 @@ void Ftp::NoFileCheck(int act)
       LogNote(2,_("Switching to NOREST mode"));
       flags|=NOREST_MODE;
       real_pos=0;
-      if(mode==STORE)
-	 pos=0;
+      if(mode==STORE && limit==FILE_END)
+	 pos=0;	 // a part of the file fails on retry
       state=EOF_STATE; // retry
       return;
    }
@@ -1007,6 +1017,7 @@ Ftp::Connection::Connection(const char *c)
    fixed_pasv=false;
    translation_activated=false;
    sync_wait=1;	// expect server greetings
+   wait_rest=false;
    multiline_code=0;
    ignore_pass=false;
    try_feat_after_login=false;
@@ -1036,6 +1047,10 @@ Ftp::Connection::Connection(const char *c)
    tvfs_supported=false;
    mode_z_supported=false;
    cepr_supported=false;
+   xcrc_supported=false;
+   xmd5_supported=false;
+   xsha1_supported=false;
+   xsha256_supported=false;
 
    proxy_is_http=false;
    may_show_password=false;
@@ -1090,6 +1105,8 @@ void Ftp::InitFtp()
 
    disconnect_on_close=false;
    last_connection_failed=false;
+   reply_deferred=false;
+   deferred_losses=0;
 
    Reconfig();
 }
@@ -1169,6 +1186,10 @@ bool Ftp::GetBetterConnection(int level,bool limit_reached)
       if(level==0 && xstrcmp(real_cwd,o->real_cwd))
 	 continue;
 
+      // the replies are still awaited by the other session's job
+      if(o->expect->Has(Expect::DEFERRED))
+	 continue;
+
       if(o->conn->data_sock!=-1 || o->state!=EOF_STATE || o->mode!=CLOSED)
       {
 	 /* session is in use; last resort is to takeover an active connection */
@@ -1817,7 +1838,14 @@ int   Ftp::Do()
 	 flags|=NOREST_MODE;
 
       if(mode==STORE && GetFlag(NOREST_MODE) && pos>0)
+      {
+	 if(limit!=FILE_END)
+	 {
+	    SetError(NOT_SUPP,_("REST is not supported, cannot store a part of the file"));
+	    return MOVED;
+	 }
 	 pos=0;
+      }
 
       if(copy_mode==COPY_NONE
       && (mode==RETRIEVE || mode==STORE || mode==LIST || mode==MP_LIST
@@ -2221,6 +2249,9 @@ int   Ftp::Do()
 	 conn->SendCmdF("REST %lld",(long long)conn->rest_pos);
 	 expect->Push(Expect::REST);
 	 real_pos=-1;
+	 // STOR of a part must not truncate the file if REST fails
+	 if(mode==STORE && limit!=FILE_END)
+	    conn->wait_rest=true;
       }
       if(copy_mode!=COPY_DEST || copy_allow_store)
       {
@@ -2432,6 +2463,9 @@ int   Ftp::Do()
 	 if(cset && *cset)
 	    conn->AddDataTranslation(cset,true);
       }
+      // received data is only moved out of data_iobuf, avoid compacting it.
+      if(mode!=STORE && !conn->data_iobuf->GetTranslator())
+	 conn->data_iobuf->SetSegmented(true);
       rate_limit->SetBufferSize(conn->data_iobuf,max_buf);
    /* fallthrough */
    case(DATA_OPEN_STATE):
@@ -2570,6 +2604,10 @@ int   Ftp::Do()
       if(state!=oldstate || Error())
          return MOVED;
 
+      // let the next request go without waiting for this reply.
+      if(!expect->IsEmpty() && DeferReply())
+	 m=MOVED;
+
       // more work to do?
       if(expect->IsEmpty() && mode==ARRAY_INFO && fileset_for_info->curr())
       {
@@ -2851,6 +2889,77 @@ void Ftp::SendArrayInfoRequests()
    }
 }
 
+// pipelining is turned off after this many deferred replies lost.
+#define MAX_DEFERRED_LOSSES 2
+
+// Report a simple request done before the server replies, so that the
+// next one is sent at once. The reply is checked later as DEFERRED.
+// At most ftp:pipeline-depth requests are kept in flight.
+bool Ftp::DeferReply()
+{
+   if(reply_deferred || !allow_deferred || pipeline_depth<2)
+      return false;
+   if(mode!=REMOVE && mode!=REMOVE_DIR && mode!=MAKE_DIR && mode!=CHANGE_MODE)
+      return false;
+   Expect *e=expect->Find(Expect::FILE_ACCESS);
+   if(!e || expect->Count(Expect::DEFERRED)>=pipeline_depth-1)
+      return false;
+   e->check_case=Expect::DEFERRED;
+   e->arg.set(dir_file(cwd,file));
+   reply_deferred=true;
+   return true;
+}
+
+// The connection is closed with deferred replies outstanding; the server
+// may or may not have performed the requests. If it happens again, the
+// server probably cannot cope with pipelining, so stop using it.
+void Ftp::LoseDeferred()
+{
+   while(!expect->IsEmpty())
+   {
+      Expect *e=expect->Pop();
+      if(e->check_case==Expect::DEFERRED)
+	 deferred_errors.AppendFormat("%s: %s",e->arg.get(),_("connection closed before the reply"));
+      delete e;
+   }
+   CountDeferredLoss();
+}
+
+void Ftp::CountDeferredLoss()
+{
+   if(++deferred_losses==MAX_DEFERRED_LOSSES && pipeline_depth>1)
+   {
+      LogNote(2,_("Turning off pipelining"));
+      pipeline_depth=1;
+   }
+}
+
+// A deferred request failed temporarily, e.g. the server throttles
+// pipelined commands. Send it once more with the full path, as the
+// current directory may have changed since.
+bool Ftp::ResendDeferred(const Expect *e,int act)
+{
+   if(!(is4XX(act) || Transient5XX(act)) || act==421 || e->resent)
+      return false;
+   CountDeferredLoss();
+   conn->SendCmd2(e->cmd,e->arg);
+   Expect *again=new Expect(Expect::DEFERRED,e->arg,e->cmd);
+   again->resent=true;
+   expect->Push(again);
+   return true;
+}
+
+int Ftp::DeferredCount()
+{
+   return (expect?expect->Count(Expect::DEFERRED):0)+deferred_errors.Count();
+}
+const char *Ftp::GetDeferredError()
+{
+   if(deferred_errors.Count()==0)
+      return 0;
+   return deferred_error.set_allocated(deferred_errors.Pop());
+}
+
 int Ftp::ReplyLogPriority(int code) const
 {
    // Greeting messages
@@ -3248,6 +3357,8 @@ void Ftp::ControlClose()
 {
    if(conn && conn->control_send)
       conn->control_send->PutEOF();
+   if(expect && expect->Has(Expect::DEFERRED))
+      LoseDeferred();
    conn=0;
    expect=0;
 }
@@ -3441,7 +3552,10 @@ int  Ftp::FlushSendQueue(bool all)
    if(conn->send_cmd_buffer.Size()==0)
       return m;
 
-   while(conn->sync_wait<=0 || all || !GetFlag(SYNC_MODE))
+   // in sync mode, commands whose replies are deferred can still be pipelined.
+   while(conn->sync_wait<=0 || all || !(GetFlag(SYNC_MODE) || conn->wait_rest)
+   || (!conn->wait_rest && conn->sync_wait<pipeline_depth
+       && expect->FirstAre(Expect::DEFERRED,conn->sync_wait)))
    {
       int res=conn->FlushSendQueueOneCmd();
       if(!res)
@@ -3587,6 +3701,9 @@ void  Ftp::Close()
 
    flags&=~NOREST_MODE;	// can depend on a particular file
    eof=false;
+   reply_deferred=false;
+   if(!allow_deferred)
+      deferred_errors.Empty();
 
    Resume();
    ExpandTildeInCWD();
@@ -3675,6 +3792,29 @@ bool Ftp::ExpectQueue::Has(Expect::expect_t cc) const
 	 return true;
    return false;
 }
+Ftp::Expect *Ftp::ExpectQueue::Find(Expect::expect_t cc) const
+{
+   for(Expect *scan=first; scan; scan=scan->next)
+      if(cc==scan->check_case)
+	 return scan;
+   return 0;
+}
+bool Ftp::ExpectQueue::FirstAre(Expect::expect_t cc,int n) const
+{
+   const Expect *scan=first;
+   for( ; scan && n>0; scan=scan->next, n--)
+      if(cc!=scan->check_case)
+	 return false;
+   return n==0;
+}
+int Ftp::ExpectQueue::Count(Expect::expect_t cc) const
+{
+   int n=0;
+   for(const Expect *scan=first; scan; scan=scan->next)
+      if(cc==scan->check_case)
+	 n++;
+   return n;
+}
 bool Ftp::ExpectQueue::FirstIs(Expect::expect_t cc) const
 {
    if(first && first->check_case==cc)
@@ -3716,6 +3856,7 @@ void Ftp::ExpectQueue::Close()
       case(Expect::SSCN):
       case(Expect::CCC):
 #endif
+      case(Expect::DEFERRED):
 	 break;
       case(Expect::CWD_CURR):
       case(Expect::CWD):
@@ -3853,6 +3994,37 @@ int   Ftp::Read(Buffer *buf,int size)
    return(size);
 }
 
+int   Ftp::DirectRead(int fd,int size)
+{
+   if(Error() || mode!=RETRIEVE || eof || ascii
+   || !conn || !conn->data_iobuf || state!=DATA_OPEN_STATE
+   || real_pos!=pos || conn->data_iobuf->Eof()
+   || !rate_limit->Unlimited(RateLimit::GET))
+   {
+      if(conn && conn->data_iobuf)
+	 conn->data_iobuf->SetDirect(false);
+      return NOT_SUPP;
+   }
+   int res=conn->data_iobuf->DirectGet(fd,size);
+   if(res<0)
+      return NOT_SUPP;
+   if(res==0)
+   {
+      // the buffered data have to be read the usual way.
+      if(conn->data_iobuf->Size()>0)
+	 return NOT_SUPP;
+      return DO_AGAIN;
+   }
+   rate_limit->BytesGot(res);
+   real_pos+=res;
+   pos+=res;
+
+   TrySuccess();
+   flags|=IO_FLAG;
+
+   return(res);
+}
+
 /*
    Write - send data to ftp server
 
@@ -3908,6 +4080,85 @@ int   Ftp::Write(const void *buf,int size)
    return(size);
 }
 
+int   Ftp::DirectWrite(int fd,int size)
+{
+   if(mode!=STORE || ascii || !rate_limit->Unlimited(RateLimit::PUT))
+      return NOT_SUPP;
+
+   if(Error())
+      return(error_code);
+
+   if(!conn || state!=DATA_OPEN_STATE || (expect->Has(Expect::REST) && real_pos==-1))
+      return DO_AGAIN;
+
+   if(!conn->data_iobuf)
+      return DO_AGAIN;
+
+   int res=conn->data_iobuf->DirectPut(fd,size);
+   if(res<0)
+      return NOT_SUPP;
+   if(res==0)
+      return DO_AGAIN;
+
+   if(retries+persist_retries>0
+   && conn->data_iobuf->GetPos()>Buffered()+0x20000)
+   {
+      // reset retry count if some data were actually written to server.
+      LogNote(10,"resetting retry count");
+      TrySuccess();
+   }
+
+   rate_limit->BytesPut(res);
+   pos+=res;
+   real_pos+=res;
+   flags|=IO_FLAG;
+   return(res);
+}
+
+const char *Ftp::ChecksumCmd(const Connection *conn,unsigned algos,int *algo)
+{
+   const char *cmd=0;
+   int a=-1;
+   if(conn->hash_algo_supported)
+   {
+      a=Checksum::FindAlgo(conn->hash_algo_supported);
+      if(a>=0 && (algos&(1<<a)))
+	 cmd="HASH";
+   }
+   // prefer the stronger algorithms.
+   if(!cmd && conn->xsha256_supported && (algos&(1<<Checksum::SHA256)))
+      cmd="XSHA256",a=Checksum::SHA256;
+   if(!cmd && conn->xsha1_supported && (algos&(1<<Checksum::SHA1)))
+      cmd="XSHA1",a=Checksum::SHA1;
+   if(!cmd && conn->xmd5_supported && (algos&(1<<Checksum::MD5)))
+      cmd="XMD5",a=Checksum::MD5;
+   if(!cmd && conn->xcrc_supported && (algos&(1<<Checksum::CRC32)))
+      cmd="XCRC",a=Checksum::CRC32;
+   if(cmd)
+      *algo=a;
+   return cmd;
+}
+const char *Ftp::ChecksumCommand(const char *file,unsigned algos,int *algo) const
+{
+   if(!conn)
+      return 0;
+   const char *cmd=ChecksumCmd(conn,algos,algo);
+   if(!cmd)
+      return 0;
+   return xstring::cat(cmd," ",file,NULL);
+}
+int Ftp::ChecksumAlgo(unsigned algos) const
+{
+   // FEAT is sent before the login or just after it.
+   if(!conn || state==CONNECTING_STATE || state==HTTP_PROXY_CONNECTED
+   || state==CONNECTED_STATE || state==USER_RESP_WAITING_STATE
+   || expect->Has(Expect::FEAT))
+      return CHECKSUM_UNKNOWN;
+   int a=-1;
+   ChecksumCmd(conn,algos,&a);
+   return a;
+}
+
 int   Ftp::StoreStatus()
 {
    if(Error())
@@ -4042,6 +4293,7 @@ void Ftp::TuneConnectionAfterFEAT()
 
 void Ftp::Connection::CheckFEAT(char *reply,const char *line,bool trust)
 {
+   feat_signature.set(reply);
    if(trust) {
       // turn off these pre-FEAT extensions only when trusting FEAT reply,
       // as some servers forget to advertise them.
@@ -4061,6 +4313,11 @@ void Ftp::Connection::CheckFEAT(char *reply,const char *line,bool trust)
    tvfs_supported=false;
    mode_z_supported=false;
    cepr_supported=false;
+   hash_algo_supported.set(0);
+   xcrc_supported=false;
+   xmd5_supported=false;
+   xsha1_supported=false;
+   xsha256_supported=false;
 
    char *scan=strchr(reply,'\n');
    if(scan)
@@ -4115,6 +4372,23 @@ void Ftp::Connection::CheckFEAT(char *reply,const char *line,bool trust)
 	 mode_z_supported=true;
 	 mode_z_opts_supported.set(f[6]==' '?f+7:NULL);
       }
+      else if(!strncasecmp(f,"HASH ",5)) {
+	 // the current algorithm is marked with a star.
+	 char *save;
+	 for(char *a=strtok_r(f+5,";",&save); a; a=strtok_r(0,";",&save)) {
+	    int len=strlen(a);
+	    if(len>1 && a[len-1]=='*')
+	       hash_algo_supported.nset(a,len-1);
+	 }
+      }
+      else if(!strcasecmp(f,"XCRC"))
+	 xcrc_supported=true;
+      else if(!strcasecmp(f,"XMD5"))
+	 xmd5_supported=true;
+      else if(!strcasecmp(f,"XSHA1"))
+	 xsha1_supported=true;
+      else if(!strcasecmp(f,"XSHA256"))
+	 xsha256_supported=true;
       else if(!strcasecmp(f,"SITE SYMLINK"))
 	 site_symlink_supported=true;
       else if(!strcasecmp(f,"SITE MKDIR"))
@@ -4351,6 +4625,23 @@ void Ftp::CheckResp(int act)
       NoFileCheck(act);
       break;
 
+   case Expect::DEFERRED:
+      if(is2XX(act))
+	 break;
+      if(site_cmd_unsupported(act))
+      {
+	 if(exp->cmd.begins_with("SITE CHMOD"))
+	    conn->site_chmod_supported=false;
+	 else if(exp->cmd.begins_with("MFF"))
+	    conn->mff_supported=false;
+      }
+      else if(ResendDeferred(exp,act))
+	 break;
+      if(act==421)
+	 CountDeferredLoss();
+      deferred_errors.AppendFormat("%s: %s",arg,line.get());
+      break;
+
    case Expect::PRET:
       if(cmd_unsupported(act))
       {
@@ -4765,7 +5056,7 @@ int   Ftp::Done()
    || mode==LINK || mode==SYMLINK
    || copy_mode!=COPY_NONE)
    {
-      if(state==WAITING_STATE && expect->IsEmpty())
+      if(state==WAITING_STATE && (expect->IsEmpty() || reply_deferred))
 	 return(OK);
       return(IN_PROGRESS);
    }
@@ -4813,6 +5104,9 @@ void Ftp::Reconfig(const char *name)
    rest_list = QueryBool("rest-list");
 
    nop_interval = Query("nop-interval").to_number(1,30);
+   pipeline_depth = Query("pipeline-depth").to_number(1,1024);
+   if(deferred_losses>=MAX_DEFERRED_LOSSES)
+      pipeline_depth=1;
 
    allow_skey = QueryBool("skey-allow");
    force_skey = QueryBool("skey-force");
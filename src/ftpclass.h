@@ -38,6 +38,7 @@ class TelnetDecode : public DataTranslator {
 class IOBufferTelnet : public IOBufferStacked
 {
 public:
+   const char *GetClassName() { return "IOBufferTelnet"; }
    IOBufferTelnet(IOBuffer *b) : IOBufferStacked(b) {
       if(mode==PUT)
 	 SetTranslator(new TelnetEncode());
@@ -88,6 +89,7 @@ class Ftp : public NetAccess
 
       int multiline_code; // the code of multiline response.
       int sync_wait;	  // number of commands in flight.
+      bool wait_rest;	  // hold the commands until REST reply comes.
       bool ignore_pass;	  // logged in just with user
       bool try_feat_after_login;
       bool tune_after_login;
@@ -101,6 +103,7 @@ class Ftp : public NetAccess
       bool vms_path;
 
       bool have_feat_info;
+      xstring_c feat_signature;  // FEAT reply identifying the server
       bool mdtm_supported;
       bool size_supported;
       bool rest_supported;
@@ -121,6 +124,10 @@ class Ftp : public NetAccess
       bool tvfs_supported;
       bool mode_z_supported;
       bool cepr_supported;
+      bool xcrc_supported;
+      bool xmd5_supported;
+      bool xsha1_supported;
+      bool xsha256_supported;
 
       bool ssl_after_proxy;
 
@@ -153,6 +160,7 @@ class Ftp : public NetAccess
 
       xstring_c mlst_attr_supported;
       xstring_c mode_z_opts_supported;
+      xstring_c hash_algo_supported;   // the current HASH algorithm
 
       Connection(const char *c);
       ~Connection();
@@ -224,6 +232,7 @@ class Ftp : public NetAccess
 	 EPSV,		// check response for EPSV and save address
 	 PORT,		// check response for PORT or EPRT
 	 FILE_ACCESS,	// generic check for file access
+	 DEFERRED,	// file access already reported done, save failures
 	 PWD,		// check response for PWD and save it to home
 	 RNFR,
 	 USER,		// check response for USER
@@ -249,10 +258,11 @@ class Ftp : public NetAccess
       expect_t check_case;
       xstring_c cmd;
       xstring_c arg;
+      bool resent;	// DEFERRED request sent again after a transient failure
       Expect *next;
 
-      Expect(expect_t e,const char *a=0,const char *c=0) : check_case(e), cmd(c), arg(a) {}
-      Expect(expect_t e,char c) : check_case(e)
+      Expect(expect_t e,const char *a=0,const char *c=0) : check_case(e), cmd(c), arg(a), resent(false) {}
+      Expect(expect_t e,char c) : check_case(e), resent(false)
 	 {
 	    char cc[2]={c,0};
 	    arg.set(cc);
@@ -274,10 +284,13 @@ class Ftp : public NetAccess
       void Push(Expect::expect_t e);
       Expect *Pop();
       Expect *FindLastCWD() const;
+      Expect *Find(Expect::expect_t) const;
       int Count() const { return count; }
+      int Count(Expect::expect_t) const;
       bool IsEmpty() const { return count==0; }
       bool Has(Expect::expect_t) const;
       bool FirstIs(Expect::expect_t) const;
+      bool FirstAre(Expect::expect_t,int n) const;
       void Close();
    };
 
@@ -339,6 +352,10 @@ private:
    int	FlushSendQueueOneCmd();
    int	FlushSendQueue(bool all=false);
    void	SendArrayInfoRequests();
+   bool	DeferReply();
+   void	LoseDeferred();
+   void	CountDeferredLoss();
+   bool	ResendDeferred(const Expect *e,int act);
    void	SendSiteIdle();
    void	SendAcct();
    void	SendSiteGroup();
@@ -346,6 +363,7 @@ private:
    void	SendUTimeRequest();
    void SendAuth(const char *auth);
    void TuneConnectionAfterFEAT();
+   static const char *ChecksumCmd(const Connection *conn,unsigned algos,int *algo);
    void SendOPTS_MLST();
    void SendPROT(char want_prot);
 
@@ -390,6 +408,7 @@ private:
    xstring_c charset;
    xstring_c list_options;
    int nop_interval;
+   int pipeline_depth;
    bool verify_data_address;
    bool verify_data_port;
    bool	rest_list;
@@ -405,7 +424,13 @@ private:
 
    bool disconnect_on_close;
 
+   bool reply_deferred;		// the current request is reported done early
+   int deferred_losses;		// connections closed with such replies pending
+   StringSet deferred_errors;	// failures of such requests
+   xstring_c deferred_error;
+
 public:
+   const char *GetClassName() { return "Ftp"; }
    enum copy_mode_t { COPY_NONE, COPY_SOURCE, COPY_DEST };
 private:
    copy_mode_t copy_mode;
@@ -436,6 +461,7 @@ private:
 
    typedef FileInfo *(*FtpLineParser)(char *line,int *err,const char *tz);
    static FtpLineParser line_parsers[];
+   FileSet *ParseLongListWith(FtpLineParser parser,const char *buf,int len,int *err) const;
 
    int CanRead();
 
@@ -479,6 +505,10 @@ public:
 
    int   Read(Buffer *buf,int size);
    int   Write(const void *buf,int size);
+   int   DirectRead(int fd,int size);
+   int   DirectWrite(int fd,int size);
+   const char *ChecksumCommand(const char *file,unsigned algos,int *algo) const;
+   int ChecksumAlgo(unsigned algos) const;
    int   Buffered();
    void  Close();
    bool	 IOReady();
@@ -500,6 +530,8 @@ public:
    const char *CurrentStatus();
 
    int	 Done();
+   int	 DeferredCount();
+   const char *GetDeferredError();
 
    enum flag_mask
    {
@@ -568,6 +600,7 @@ public:
 class FtpS : public Ftp
 {
 public:
+   const char *GetClassName() { return "FtpS"; }
    FtpS();
    FtpS(const FtpS *);
    ~FtpS();
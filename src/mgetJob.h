@@ -33,6 +33,7 @@ class mgetJob : public GetJob
    FileAccessRef local_session;
 
 public:
+   const char *GetClassName() { return "mgetJob"; }
    int	 Do();
    xstring& FormatStatus(xstring&,int,const char *);
    void	 ShowRunStatus(const SMTaskRef<StatusLine>&);
@@ -1103,6 +1103,60 @@ int lftp_fallocate(int fd,off_t sz)
 #endif
 }
 
+int lftp_fdatasync(int fd)
+{
+#if defined(HAVE_FDATASYNC)
+   return fdatasync(fd);
+#else
+   return fsync(fd);
+#endif
+}
+
+bool read_file(const char *file,xstring& buf,int max)
+{
+   buf.truncate();
+   int fd=open(file,O_RDONLY);
+   if(fd==-1)
+      return false;
+   int res=0;
+   for(;;)
+   {
+      int size=0x10000;
+      if(max>=0 && size>max-(int)buf.length())
+	 size=max-buf.length();
+      if(size==0)
+	 break;
+      buf.get_space(buf.length()+size);
+      res=read(fd,buf.get_non_const()+buf.length(),size);
+      if(res<=0)
+	 break;
+      buf.set_length(buf.length()+res);
+   }
+   close(fd);
+   return res!=-1;
+}
+
+void append_text_field(xstring& buf,const char *s)
+{
+   if(!s || !*s)
+   {
+      buf.append('-');
+      return;
+   }
+   if(*s=='-')
+   {
+      buf.append("%2D");
+      s++;
+   }
+   buf.append_url_encoded(s," %",URL_ALLOW_8BIT);
+}
+const char *get_text_field(const char *f)
+{
+   if(!strcmp(f,"-"))
+      return 0;
+   return url::decode(f);
+}
+
 void call_dynamic_hook(const char *name) {
 #if defined(HAVE_DLOPEN) && defined(RTLD_DEFAULT)
    typedef void (*func)();
@@ -145,6 +145,15 @@ bool is_ipv4_address(const char *);
 bool is_ipv6_address(const char *);
 
 int lftp_fallocate(int fd,off_t sz);
+int lftp_fdatasync(int fd);
+
+// reads the file into buf, at most max bytes if max>=0.
+bool read_file(const char *file,xstring& buf,int max=-1);
+
+// a string field of a space-separated text record: url-encoded,
+// `-' stands for none. get_text_field returns a temporary.
+void append_text_field(xstring& buf,const char *s);
+const char *get_text_field(const char *f);
 
 void call_dynamic_hook(const char *name);
 
@@ -62,12 +62,30 @@ mkdirJob::mkdirJob(FileAccess *s,ArgV *a)
       fprintf(stderr,"Usage: %s [-p] [-f] paths...\n",op);
       return;
    }
+   orig_session->AllowDeferred();
+}
+
+void mkdirJob::PrepareToDie()
+{
+   session->Close();
+   orig_session->AllowDeferred(false);
+   super::PrepareToDie();
 }
 
 int mkdirJob::Do()
 {
-   if(Done())
-      return STALL;
+   int m=STALL;
+   // failures of the directories the session reported created early
+   const char *err;
+   while((err=orig_session->GetDeferredError())!=0)
+   {
+      failed++;
+      if(!quiet)
+	 fprintf(stderr,"%s: %s\n",args->getarg(0),err);
+      m=MOVED;
+   }
+   if(curr==0)
+      return m;
    if(session->IsClosed())
    {
       ParsedURL u(curr,true);
@@ -86,7 +104,7 @@ int mkdirJob::Do()
 
    int res=session->Done();
    if(res==FA::DO_AGAIN || res==FA::IN_PROGRESS)
-      return STALL;
+      return m;
    if(res<0)
    {
       failed++;
@@ -102,7 +120,7 @@ int mkdirJob::Do()
 xstring& mkdirJob::FormatStatus(xstring& s,int v,const char *prefix)
 {
    SessionJob::FormatStatus(s,v,prefix);
-   if(Done())
+   if(Done() || !curr)
       return s;
 
    return s.appendf("%s`%s' [%s]\n",prefix,curr,session->CurrentStatus());
@@ -110,7 +128,7 @@ xstring& mkdirJob::FormatStatus(xstring& s,int v,const char *prefix)
 
 void  mkdirJob::ShowRunStatus(const SMTaskRef<StatusLine>& s)
 {
-   if(Done())
+   if(Done() || !curr)
       return;
 
    s->Show("%s `%s' [%s]",args->getarg(0),
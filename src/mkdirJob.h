@@ -36,8 +36,9 @@ class mkdirJob : public SessionJob
    bool	 opt_p;
 
 public:
+   const char *GetClassName() { return "mkdirJob"; }
    int	 Do();
-   int	 Done() { return curr==0; }
+   int	 Done() { return curr==0 && SessionJob::session->DeferredCount()==0; }
    int	 ExitCode() { return failed!=0; }
 
    xstring& FormatStatus(xstring&,int,const char *);
@@ -45,7 +46,7 @@ public:
    void	 SayFinal();
 
    mkdirJob(FileAccess *session,ArgV *a);
-   void PrepareToDie() { session->Close(); SessionJob::PrepareToDie(); }
+   void PrepareToDie();
 
    void	 BeQuiet() { quiet=true; }
 
@@ -44,6 +44,7 @@ class mmvJob : public SessionJob
    bool isRemoving() const { return session->OpenMode()==FA::REMOVE; }
 
 public:
+   const char *GetClassName() { return "mmvJob"; }
    int	 Do();
    int	 Done() { return done; }
    int	 ExitCode() { return error_count>0; }
@@ -35,6 +35,7 @@ class mvJob : public SessionJob
    bool	 done;
 
 public:
+   const char *GetClassName() { return "mvJob"; }
    int	 Do();
    int	 Done() { return done; }
    int	 ExitCode() { return failed; }
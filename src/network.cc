@@ -270,6 +270,7 @@ int Networker::SocketCreateUnbound(int af,int type,int proto,const char *hostnam
    int s=socket(af,type,proto);
    if(s<0)
       return s;
+   SMTask::NewFD(s);
 
    NonBlock(s);
    CloseOnExec(s);
@@ -352,6 +353,7 @@ int Networker::SocketAccept(int fd,sockaddr_u *u,const char *hostname)
    int a=accept(fd,&u->sa,&len);
    if(a<0)
       return a;
+   SMTask::NewFD(a);
    NonBlock(a);
    CloseOnExec(a);
    KeepAlive(a);
@@ -24,10 +24,16 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <math.h>
 #include "pgetJob.h"
 #include "url.h"
 #include "misc.h"
 #include "log.h"
+#include "WorkerPool.h"
+
+CDECL_BEGIN
+#include "md5.h"
+CDECL_END
 
 ResType pget_vars[] = {
    {"pget:save-status",	"10s",   ResMgr::TimeIntervalValidate,ResMgr::NoClosure},
@@ -59,7 +65,7 @@ int pgetJob::Do()
    {
       if(status_file)
       {
-	 remove(status_file);
+	 RemoveStatus();
 	 status_file.set(0);
       }
    }
@@ -88,7 +94,7 @@ int pgetJob::Do()
    {
       if(chunks[0]->Error())
       {
-	 Log::global->Format(0,"pget: chunk[%d] error: %s\n",0,chunks[0]->ErrorText());
+	 Log::global->Format(0,"%s: chunk[%d] error: %s\n",op.get(),0,chunks[0]->ErrorText());
 	 no_parallel=true;
 	 c->Resume();
       }
@@ -114,6 +120,14 @@ int pgetJob::Do()
    if(Done())
       return m;
 
+   // a connection freed by the main transfer takes over a part of a slow chunk
+   if(chunks && c->IsSuspended() && c->GetPos()>=limit0 && main_replaced_at!=limit0)
+   {
+      main_replaced_at=limit0;
+      if(SplitSlowestChunk(c->GetRate()))
+	 m=MOVED;
+   }
+
    off_t offset=c->GetPos();
    off_t size=c->GetSize();
 
@@ -122,16 +136,28 @@ int pgetJob::Do()
       if(size==NO_SIZE_YET)
 	 return m;
 
-      if(size==NO_SIZE || (c->put && c->put->GetLocal()==0))
+      bool remote_target=(!upload && c->put && c->put->GetLocal()==0);
+      bool no_ranges=(upload && !CanStoreRanges());
+      if(size==NO_SIZE || remote_target || no_ranges)
       {
-	 Log::global->Write(0,_("pget: falling back to plain get"));
+	 if(upload)
+	    Log::global->Write(0,_("pput: falling back to plain put"));
+	 else
+	    Log::global->Write(0,_("pget: falling back to plain get"));
 	 Log::global->Write(0," (");
-	 if(c->put && c->put->GetLocal()==0)
+	 if(remote_target)
 	 {
 	    Log::global->Write(0,_("the target file is remote"));
 	    if(size==NO_SIZE)
 	       Log::global->Write(0,", ");
 	 }
+	 if(no_ranges)
+	 {
+	    Log::global->Format(0,_("%s cannot store a part of a file"),
+	       c->put->GetSession()->GetProto());
+	    if(size==NO_SIZE)
+	       Log::global->Write(0,", ");
+	 }
 	 if(size==NO_SIZE)
 	    Log::global->Write(0,_("the source file size is unknown"));
 	 Log::global->Write(0,")\n");
@@ -140,19 +166,31 @@ int pgetJob::Do()
 	 return m;
       }
 
-      // Make sure the destination file is open before starting chunks,
-      // it disables temp-name creation in the chunk's Init.
-      if(c->put->GetLocal()->getfd()==-1)
-	 return m;
+      if(upload)
+      {
+	 // The main transfer truncates the target file when it starts
+	 // from the beginning, so let it create the file first.
+	 if(c->GetRangeStart()==0 && !TargetCreated())
+	    return m;
+	 c->get->NeedSeek(); // seek before reading
+      }
+      else
+      {
+	 // Make sure the destination file is open before starting chunks,
+	 // it disables temp-name creation in the chunk's Init.
+	 if(c->put->GetLocal()->getfd()==-1)
+	    return m;
 
-      c->put->NeedSeek(); // seek before writing
+	 c->put->NeedSeek(); // seek before writing
+      }
 
+      off_t limit=size;
       if(pget_cont)
-	 LoadStatus();
+	 limit=LoadStatus();
       else if(status_file)
-	 remove(status_file);
+	 RemoveStatus();
       if(!chunks)
-	 InitChunks(offset,size);
+	 InitChunks(offset,limit);
 
       m=MOVED;
 
@@ -161,11 +199,13 @@ int pgetJob::Do()
 	 no_parallel=true;
 	 return m;
       }
+      if(upload)
+	 LimitMainUpload();
       if(!pget_cont)
       {
 	 SaveStatus();
 	 status_timer.Reset();
-	 if(ResMgr::QueryBool("file:use-fallocate",0)) {
+	 if(!upload && ResMgr::QueryBool("file:use-fallocate",0)) {
 	    // allocate space after creating *.lftp-pget-status file,
 	    // so that the incomplete status is more obvious.
 	    const Ref<FDStream>& local=c->put->GetLocal();
@@ -193,7 +233,7 @@ int pgetJob::Do()
    {
       if(chunks[i]->Error())
       {
-	 Log::global->Format(0,"pget: chunk[%d] error: %s\n",i,chunks[i]->ErrorText());
+	 Log::global->Format(0,"%s: chunk[%d] error: %s\n",op.get(),i,chunks[i]->ErrorText());
 	 no_parallel=true;
 	 break;
       }
@@ -227,6 +267,22 @@ int pgetJob::Do()
       return MOVED;
    }
 
+   for(int i=0; i<chunks.count(); i++)
+   {
+      ChunkXfer *chunk=chunks[i].get_non_const();
+      if(!chunk->Done() || chunk->replaced)
+	 continue;
+      chunk->replaced=true;
+      double t=chunk->GetTimeSpent();
+      float rate=(t>0 ? chunk->GetBytesCount()/t : chunk->GetRate());
+      if(SplitSlowestChunk(rate))
+      {
+	 chunks_done=false;
+	 m=MOVED;
+      }
+      break;   // the array could have changed
+   }
+
    return m;
 }
 
@@ -329,17 +385,65 @@ pgetJob::pgetJob(FileCopy *c1,const char *n,int m)
    total_xfer_rate=0;
    no_parallel=false;
    chunks_done=false;
+   main_replaced_at=-1;
+   main_saved=0;
+   status_syncing=false;
    pget_cont=c->SetContinue(false);
    max_chunks=m?m:ResMgr::Query("pget:default-n",0);
    total_eta=-1;
    status_timer.SetResource("pget:save-status",0);
-   const Ref<FDStream>& local=c->put->GetLocal();
-   if(local && local->full_name)
+   upload=(c->put->GetLocal()==0 && c->get->GetLocal()!=0);
+   if(upload)
+      op.set("pput");
+   if(upload)
+      SetUploadStatusFile();
+   else
    {
-      status_file.vset(local->full_name.get(),".lftp-pget-status",NULL);
-      if(pget_cont)
-	 LoadStatus0();
+      // the status is kept beside the local file
+      const Ref<FDStream>& local=c->put->GetLocal();
+      if(local && local->full_name)
+	 status_file.vset(local->full_name.get(),".lftp-pget-status",NULL);
    }
+   if(status_file && pget_cont)
+      LoadStatus0();
+}
+
+// The source directory may be read-only or shared by several uploads,
+// so the status is kept in the cache directory by the target url.
+void pgetJob::SetUploadStatusFile()
+{
+   const FileAccessRef& session=c->put->GetSession();
+   const char *file=c->put->GetFile();
+   const char *home=get_lftp_cache_dir();
+   if(!session || !file || !home)
+      return;
+   const xstring& url=session->GetFileURL(file,FA::NO_PASSWORD);
+
+   struct md5_ctx ctx;
+   md5_init_ctx(&ctx);
+   md5_process_bytes(url,url.length(),&ctx);
+   xstring digest;
+   digest.get_space(MD5_DIGEST_SIZE);
+   md5_finish_ctx(&ctx,digest.get_non_const());
+   digest.set_length(MD5_DIGEST_SIZE);
+
+   xstring name;
+   digest.hexdump_to(name);
+   name.c_lc();
+   const char *dir=dir_file(home,"pput");
+   mkdir(dir,0700);
+   status_file.set(dir_file(dir,name));
+}
+
+// When the chunks have stored their parts, a retry of the main transfer
+// must not start over and truncate the target file.
+void pgetJob::LimitMainUpload()
+{
+   off_t size=GetSize();
+   c->put->range_limit=size;
+   const FileAccessRef& session=c->put->GetSession();
+   if(session)
+      session->SetLimit(size);
 }
 void pgetJob::PrepareToDie()
 {
@@ -352,11 +456,17 @@ pgetJob::~pgetJob()
 
 pgetJob::ChunkXfer *pgetJob::NewChunk(const char *remote,off_t start,off_t limit)
 {
-   const Ref<FDStream>& local=c->put->GetLocal();
-   FileCopyPeerFDStream
-		*dst_peer=new FileCopyPeerFDStream(local,FileCopyPeer::PUT);
-   dst_peer->NeedSeek(); // seek before writing
-   dst_peer->SetBase(0);
+   FileCopyPeer *dst_peer;
+   if(upload)
+      dst_peer=c->put->Clone();	 // a new session writing at the offset
+   else
+   {
+      const Ref<FDStream>& local=c->put->GetLocal();
+      FileCopyPeerFDStream *local_peer=new FileCopyPeerFDStream(local,FileCopyPeer::PUT);
+      local_peer->NeedSeek(); // seek before writing
+      local_peer->SetBase(0);
+      dst_peer=local_peer;
+   }
 
    FileCopy *c1=FileCopy::New(c->get->Clone(),dst_peer,false);
    c1->SetRange(start,limit);
@@ -364,6 +474,7 @@ pgetJob::ChunkXfer *pgetJob::NewChunk(const char *remote,off_t start,off_t limit
    c1->DontCopyDate();
    c1->DontVerify();
    c1->FailIfCannotSeek();
+   c1->SetMemoryGroup(c->GetMemoryGroup());
 
    ChunkXfer *chunk=new ChunkXfer(c1,remote,start,limit);
    chunk->cmdline.setf("\\chunk %lld-%lld",(long long)start,(long long)(limit-1));
@@ -376,44 +487,318 @@ pgetJob::ChunkXfer::ChunkXfer(FileCopy *c1,const char *name,
 {
    start=s;
    limit=lim;
+   saved=s;
+   replaced=false;
 }
 
+// Find the chunk which would be finished last at the current rates and give
+// its back part to a new chunk, which is expected to go at the given rate.
+// The parts are sized so that both finish at the same time.
+bool pgetJob::SplitSlowestChunk(float rate)
+{
+   off_t min_chunk_size=ResMgr::Query("pget:min-chunk-size",0);
+   if(min_chunk_size<1)
+      min_chunk_size=1;
+
+   int victim=-2;   // -1 means the main transfer
+   double victim_eta=0;
+   off_t victim_rem=0;
+   float victim_rate=0;
+   for(int i=-1; i<chunks.count(); i++)
+   {
+      FileCopy *vc;
+      off_t lim;
+      if(i<0)
+      {
+	 vc=c.get_non_const();
+	 lim=limit0;
+      }
+      else
+      {
+	 if(chunks[i]->Done() || chunks[i]->Error())
+	    continue;
+	 vc=chunks[i]->c.get_non_const();
+	 lim=chunks[i]->limit;
+      }
+      // the data read ahead have to be written by the same transfer.
+      off_t pos=vc->GetPos();
+      if(vc->get && vc->get->GetRealPos()>pos)
+	 pos=vc->get->GetRealPos();
+      off_t rem=lim-pos;
+      if(rem<min_chunk_size)
+	 continue;
+      float r=vc->GetRate();
+      // a stalled transfer is the slowest; of several such, take the one
+      // with the most data left.
+      double eta=(r>0 ? rem/r : HUGE_VAL);
+      if(victim==-2 || eta>victim_eta || (eta==victim_eta && rem>victim_rem))
+      {
+	 victim=i;
+	 victim_eta=eta;
+	 victim_rem=rem;
+	 victim_rate=r;
+      }
+   }
+   if(victim==-2)
+      return false;
+
+   // the rates are unknown at start, assume they are equal then.
+   if(victim_rate<=0)
+      victim_rate=(rate>0 ? rate : 1);
+   if(rate<=0)
+      rate=victim_rate;
+   off_t take=off_t(victim_rem*(double(rate)/(rate+victim_rate)));
+   if(take<min_chunk_size)
+      return false;
+
+   off_t limit,split;
+   if(victim<0)
+   {
+      limit=limit0;
+      split=limit-take;
+      limit0=split;
+   }
+   else
+   {
+      ChunkXfer *v=chunks[victim].get_non_const();
+      limit=v->limit;
+      split=limit-take;
+      v->limit=split;
+      v->SetRangeLimit(split);
+      v->cmdline.setf("\\chunk %lld-%lld",(long long)v->start,(long long)(split-1));
+   }
+   Log::global->Format(10,"pget: splitting chunk[%d] at %lld, new chunk %lld-%lld\n",
+      victim+1,(long long)split,(long long)split,(long long)limit);
+   ChunkXfer *chunk=NewChunk(GetName(),split,limit);
+   chunk->SetParentFg(this,false);
+   chunks.insert(chunk,victim+1);   // keep the chunks ordered
+   return true;
+}
+
+// The target has to write at the given offset and keep the rest of the file.
+// HTTP is not in the list, a PUT with Content-Range replaces the whole
+// resource or gets rejected.
+bool pgetJob::CanStoreRanges()
+{
+   const FileAccessRef& session=c->put->GetSession();
+   if(!session)
+      return false;
+   const char *proto=session->GetProto();
+   return !strcmp(proto,"ftp") || !strcmp(proto,"ftps")
+       || !strcmp(proto,"sftp") || !strcmp(proto,"file");
+}
+
+// the main transfer has written some data, so the target file is created
+bool pgetJob::TargetCreated()
+{
+   const FileAccessRef& session=c->put->GetSession();
+   return session && session->IsOpen() && session->GetPos()>0;
+}
+
+// take the data transferred since the last call.
+void pgetJob::SaveRange(off_t *saved,off_t pos,off_t limit,xarray<RangeJournal::Range> *ranges)
+{
+   if(limit!=FILE_END && pos>limit)
+      pos=limit;
+   if(pos<=*saved)
+      return;
+   RangeJournal::Range r={*saved,pos};
+   ranges->append(r);
+   *saved=pos;
+}
+
+// Syncs the file in a worker thread so that the main loop does not wait for
+// the disk, then records the ranges in the journal. The journal records of
+// the previous sync are put to the disk with the data.
+class pgetJob::StatusSync : public WorkerJob
+{
+   pgetJob *job;
+   int data_fd;
+   int journal_fd;
+   xarray<RangeJournal::Range> ranges;
+   bool ok;
+protected:
+   void Run() {
+      ok=(data_fd==-1 || lftp_fdatasync(data_fd)!=-1);
+      if(journal_fd!=-1)
+	 fsync(journal_fd);
+   }
+   void Finish() {
+      if(!job->Deleted())
+	 job->StatusSynced(ranges,ok);
+   }
+public:
+   StatusSync(pgetJob *j,int dfd,int jfd,const xarray<RangeJournal::Range>& r)
+      : job(j), data_fd(dfd==-1?-1:dup(dfd)), journal_fd(jfd==-1?-1:dup(jfd)), ok(false)
+      {
+	 job->IncRefCount();
+	 ranges.set(r);
+      }
+   ~StatusSync() {
+      if(data_fd!=-1)
+	 close(data_fd);
+      if(journal_fd!=-1)
+	 close(journal_fd);
+      job->DecRefCount();
+   }
+};
+
 void pgetJob::SaveStatus()
 {
-   if(!status_file)
+   if(!status_file || status_syncing)
       return;
 
-   FILE *f=fopen(status_file,"w");
-   if(!f)
+   if(!journal)
+   {
+      journal=new RangeJournal(status_file);
+      journal->SetSize(GetSize());
+      journal->Compact();  // create the file
+   }
+   journal->SetSize(GetSize());
+
+   xarray<RangeJournal::Range> ranges;
+   int data_fd=-1;
+   if(upload)
+   {
+      // the server confirms the data only at the end of a part,
+      // the bytes sent could be lost.
+      for(int i=0; i<chunks.count(); i++)
+      {
+	 ChunkXfer *chunk=chunks[i].get_non_const();
+	 if(chunk->Done() && !chunk->Error())
+	    SaveRange(&chunk->saved,chunk->limit,chunk->limit,&ranges);
+      }
+   }
+   else
+   {
+      // the data before these positions are in the file, the sync puts
+      // them on the disk before their ranges are recorded.
+      off_t main_pos=c->put->GetWrittenPos(GetPos());
+      if(main_pos<0)
+	 return;
+      xarray<off_t> pos;
+      for(int i=0; i<chunks.count(); i++)
+      {
+	 ChunkXfer *chunk=chunks[i].get_non_const();
+	 off_t p=chunk->GetPos();
+	 if(!chunk->Done())
+	    p=chunk->c->put->GetWrittenPos(p);
+	 if(p<0)
+	    return;
+	 pos.append(p);
+      }
+
+      // the main transfer writes sequentially, everything before its start
+      // is transferred already.
+      SaveRange(&main_saved,main_pos,chunks?limit0:FILE_END,&ranges);
+      for(int i=0; i<chunks.count(); i++)
+      {
+	 ChunkXfer *chunk=chunks[i].get_non_const();
+	 SaveRange(&chunk->saved,pos[i],chunk->limit,&ranges);
+      }
+      // all the chunks write to the same file.
+      const Ref<FDStream>& local=c->put->GetLocal();
+      if(local)
+	 data_fd=local->getfd();
+   }
+
+   status_syncing=true;
+   WorkerPool::Submit(new StatusSync(this,data_fd,journal->GetFD(),ranges));
+}
+
+void pgetJob::StatusSynced(const xarray<RangeJournal::Range>& ranges,bool ok)
+{
+   status_syncing=false;
+   if(!ok || !journal)
       return;
+   for(int i=0; i<ranges.count(); i++)
+      journal->Add(ranges[i].start,ranges[i].limit);
+}
 
-   off_t size=GetSize();
-   fprintf(f,"size=%lld\n",(long long)size);
+void pgetJob::RemoveStatus()
+{
+   journal=0;
+   remove(status_file);
+}
 
-   int i=0;
-   fprintf(f,"%d.pos=%lld\n",i,(long long)GetPos());
-   if(!chunks)
-      goto out_close;
-   fprintf(f,"%d.limit=%lld\n",i,(long long)limit0);
-   for(int chunk=0; chunk<chunks.count(); chunk++)
+// read the status file into the journal.
+bool pgetJob::LoadJournal()
+{
+   if(journal)
+      return true;
+   journal=new RangeJournal(status_file);
+   if(journal->Load() || LoadTextStatus())
+      return true;
+   journal=0;
+   return false;
+}
+
+static int range_cmp(const RangeJournal::Range *a,const RangeJournal::Range *b)
+{
+   return a->start<b->start ? -1 : a->start>b->start;
+}
+
+// convert the text status file of older versions.
+bool pgetJob::LoadTextStatus()
+{
+   FILE *f=fopen(status_file,"r");
+   if(!f)
+      return false;
+
+   long long size;
+   xarray<RangeJournal::Range> missing;
+   if(fscanf(f,"size=%lld\n",&size)==1)
    {
-      if(chunks[chunk]->Done())
-	 continue;
-      i++;
-      fprintf(f,"%d.pos=%lld\n",i,(long long)chunks[chunk]->GetPos());
-      fprintf(f,"%d.limit=%lld\n",i,(long long)chunks[chunk]->limit);
+      int i=0,j;
+      long long pos,limit;
+      while(fscanf(f,"%d.pos=%lld\n",&j,&pos)==2 && j==i)
+      {
+	 // only the main transfer is listed when there are no chunks.
+	 if(fscanf(f,"%d.limit=%lld\n",&j,&limit)<2 || j!=i)
+	    limit=size;
+	 RangeJournal::Range r={pos,limit};
+	 if(pos<limit)
+	    missing.append(r);
+	 i++;
+      }
+      if(i==0)
+	 size=-1;
    }
-out_close:
+   else
+      size=-1;
    fclose(f);
+   if(size<0)
+      return false;
+
+   missing.qsort(range_cmp);
+   off_t pos=0;
+   for(int i=0; i<missing.count(); i++)
+   {
+      journal->SetDone(pos,missing[i].start);
+      if(missing[i].limit>pos)
+	 pos=missing[i].limit;
+   }
+   journal->SetDone(pos,size);
+   journal->SetSize(size);
+   return true;
 }
+
 void pgetJob::LoadStatus0()
 {
    if(!status_file)
       return;
 
-   FILE *f=fopen(status_file,"r");
-   if(!f) {
+   if(!LoadJournal())
+   {
+      if(access(status_file,F_OK)==0)
+	 return;  // not a status file
       int saved_errno=errno;
+      if(upload)
+      {
+	 // continue after the remote file end, as plain put does.
+	 c->SetContinue(true);
+	 return;
+      }
       // Probably the file is already complete
       // or it was previously downloaded by plain get.
       struct stat st;
@@ -425,98 +810,56 @@ void pgetJob::LoadStatus0()
       return;
    }
 
-   long long size;
-   if(fscanf(f,"size=%lld\n",&size)<1)
-      goto out_close;
-
-   long long pos;
-   int j;
-   if(fscanf(f,"%d.pos=%lld\n",&j,&pos)<2 || j!=0)
-      goto out_close;
-   Log::global->Format(10,"pget: got chunk[%d] pos=%lld\n",j,pos);
+   off_t pos=journal->NextMissing(0);
+   Log::global->Format(10,"pget: got chunk[0] pos=%lld\n",(long long)pos);
    c->SetRange(pos,FILE_END);
-
-out_close:
-   fclose(f);
 }
-void pgetJob::LoadStatus()
+// returns the end of the part left to the main transfer.
+off_t pgetJob::LoadStatus()
 {
-   if(!status_file)
-      return;
+   if(!status_file || !LoadJournal())
+      return c->GetSize();
 
-   FILE *f=fopen(status_file,"r");
-   if(!f)
-      return;
+   // the file could have grown, the new part is missing then.
+   xarray<RangeJournal::Range> missing;
+   journal->GetMissing(c->GetSize(),&missing);
 
-   struct stat st;
-   if(fstat(fileno(f),&st)<0)
-   {
-   out_close:
-      fclose(f);
-      return;
-   }
+   // drop a damaged tail and the superseded records.
+   journal->SetSize(c->GetSize());
+   journal->Compact();
 
-   long long size;
-   if(fscanf(f,"size=%lld\n",&size)<1)
-      goto out_close;
-
-   int i=0;
-   int max_chunks=st.st_size/20; // highest estimate - min 20 bytes per chunk in status file.
-   long long *pos=(long long *)alloca(2*max_chunks*sizeof(*pos));
-   long long *limit=pos+max_chunks;
-   for(;;)
+   if(missing.count()<1)
+      return c->GetSize();
+   for(int i=0; i<missing.count(); i++)
    {
-      int j;
-      if(fscanf(f,"%d.pos=%lld\n",&j,pos+i)<2 || j!=i)
-	 break;
-      if(fscanf(f,"%d.limit=%lld\n",&j,limit+i)<2 || j!=i)
-	 goto out_close;
-      if(i>0 && pos[i]>=limit[i])
-	 continue;
-      Log::global->Format(10,"pget: got chunk[%d] pos=%lld\n",j,pos[i]);
-      Log::global->Format(10,"pget: got chunk[%d] limit=%lld\n",j,limit[i]);
-      i++;
+      Log::global->Format(10,"pget: got chunk[%d] pos=%lld\n",i,(long long)missing[i].start);
+      Log::global->Format(10,"pget: got chunk[%d] limit=%lld\n",i,(long long)missing[i].limit);
    }
-   if(i<1)
-      goto out_close;
-   if(size<c->GetSize())  // file grew?
-   {
-      if(limit[i-1]==size)
-	 limit[i-1]=c->GetSize();
-      else
-      {
-	 pos[i]=size;
-	 limit[i]=c->GetSize();
-	 i++;
-      }
-   }
-   int num_of_chunks=i-1;
-   start0=pos[0];
-   limit0=limit[0];
-   c->SetRange(pos[0],FILE_END);
-   if(num_of_chunks<1)
-      goto out_close;
-   for(i=0; i<num_of_chunks; i++)
+   start0=missing[0].start;
+   limit0=missing[0].limit;
+   c->SetRange(start0,FILE_END);
+   for(int i=1; i<missing.count(); i++)
    {
-      ChunkXfer *c=NewChunk(GetName(),pos[i+1],limit[i+1]);
+      ChunkXfer *c=NewChunk(GetName(),missing[i].start,missing[i].limit);
       c->SetParentFg(this,false);
       chunks.append(c);
    }
-   goto out_close;
+   return missing[0].limit;
 }
 
-void pgetJob::InitChunks(off_t offset,off_t size)
+// split offset..limit between the main transfer and new chunks.
+void pgetJob::InitChunks(off_t offset,off_t limit)
 {
    /* initialize chunks */
-   off_t chunk_size=(size-offset)/max_chunks;
+   off_t chunk_size=(limit-offset)/max_chunks;
    int min_chunk_size=ResMgr::Query("pget:min-chunk-size",0);
    if(chunk_size<min_chunk_size)
       chunk_size=min_chunk_size;
-   int num_of_chunks=(size-offset)/chunk_size-1;
+   int num_of_chunks=(limit-offset)/chunk_size-1;
    if(num_of_chunks<1)
       return;
    start0=0;
-   limit0=size-chunk_size*num_of_chunks;
+   limit0=limit-chunk_size*num_of_chunks;
    off_t curr_offs=limit0;
    for(int i=0; i<num_of_chunks; i++)
    {
@@ -525,5 +868,5 @@ void pgetJob::InitChunks(off_t offset,off_t size)
       chunks.append(c);
       curr_offs+=chunk_size;
    }
-   assert(curr_offs==size);
+   assert(curr_offs==limit);
 }
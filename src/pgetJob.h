@@ -21,6 +21,7 @@
 #define PGETJOB_H
 
 #include "CopyJob.h"
+#include "RangeJournal.h"
 
 class pgetJob : public CopyJob
 {
@@ -30,6 +31,8 @@ class pgetJob : public CopyJob
 
       off_t start;
       off_t limit;
+      off_t saved;     // the chunk's data up to here are in the journal
+      bool replaced;   // the freed connection has taken another chunk
 
       ChunkXfer(FileCopy *c,const char *n,off_t start,off_t limit);
    };
@@ -37,7 +40,7 @@ class pgetJob : public CopyJob
    TaskRefArray<ChunkXfer> chunks;
    int	 max_chunks;
    off_t chunks_bytes;
-   void InitChunks(off_t offset,off_t size);
+   void InitChunks(off_t offset,off_t limit);
 
    off_t start0;
    off_t limit0;
@@ -48,22 +51,40 @@ class pgetJob : public CopyJob
    bool	no_parallel:1;
    bool chunks_done:1;
    bool pget_cont:1;
+   bool upload:1;    // the source is local, the chunks write to the target
+   bool CanStoreRanges();
+   bool TargetCreated();
+   void LimitMainUpload();
+   void SetUploadStatusFile();
 
    void free_chunks();
    ChunkXfer *NewChunk(const char *remote,off_t start,off_t limit);
 
+   off_t main_replaced_at;   // limit0 when the main transfer was freed
+   bool SplitSlowestChunk(float rate);
+
    long total_eta;
 
    Timer status_timer;
    xstring status_file;
+   Ref<RangeJournal> journal;
+   off_t main_saved;	 // the main transfer's data up to here are in the journal
+   class StatusSync;
+   bool status_syncing;	 // a StatusSync is running
    void SaveStatus();
-   void LoadStatus();
+   void SaveRange(off_t *saved,off_t pos,off_t limit,xarray<RangeJournal::Range> *ranges);
+   void StatusSynced(const xarray<RangeJournal::Range>& ranges,bool ok);
+   bool LoadJournal();
+   bool LoadTextStatus();
+   void RemoveStatus();
+   off_t LoadStatus();
    void LoadStatus0();
 
 protected:
    void NextFile();
 
 public:
+   const char *GetClassName() { return "pgetJob"; }
    int Do();
    void ShowRunStatus(const SMTaskRef<StatusLine>&);
    xstring& FormatStatus(xstring&,int,const char *);
@@ -76,6 +97,7 @@ public:
    void SetMaxConn(int n) { max_chunks=n; }
 
    off_t GetBytesCount() { return total_xferred; }
+   bool IsFinishing() { return false; }  // the chunks may be still running
    double GetTransferRate() { return total_xfer_rate; }
 };
 
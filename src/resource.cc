@@ -165,6 +165,14 @@ static const char *SortByValidate(xstring_c *s)
    return SetValidate(*s,valid_set,"mirror:order-by");
 }
 
+static const char *IOEngineValidate(xstring_c *s)
+{
+   static const char * const valid_set[]={
+      "none", "auto", "io_uring", "threads", 0
+   };
+   return SetValidate(*s,valid_set,"file:io-engine");
+}
+
 #if USE_SSL
 static
 const char *AuthArgValidate(xstring_c *s)
@@ -217,6 +225,7 @@ static ResType lftp_vars[] = {
    {"ftp:mode-z-level",		 "6",	  ResMgr::UNumberValidate,0},
    {"ftp:nop-interval",		 "120",   ResMgr::UNumberValidate,0},
    {"ftp:passive-mode",		 "on",    ResMgr::BoolValidate,0},
+   {"ftp:pipeline-depth",	 "16",    ResMgr::UNumberValidate,0},
    {"ftp:port-range",		 "full",  ResMgr::RangeValidate,0},
    {"ftp:port-ipv4",		 "",	  ResMgr::IPv4AddrValidate,0},
    {"ftp:prefer-epsv",		 "no",	  ResMgr::BoolValidate,0},
@@ -361,6 +370,8 @@ static ResType lftp_vars[] = {
    {"file:charset",		 "",	  ResMgr::CharsetValidate,ResMgr::NoClosure},
    {"file:use-lock",		 "no",	  ResMgr::BoolValidate,ResMgr::NoClosure},
    {"file:use-fallocate",	 "yes",	  ResMgr::BoolValidate,ResMgr::NoClosure},
+   {"file:io-engine",		 "none",  IOEngineValidate,ResMgr::NoClosure},
+   {"file:io-queue-depth",	 "4",	  ResMgr::UNumberValidate,ResMgr::NoClosure},
 
    {"dns:cache-enable",		 "yes",	  ResMgr::BoolValidate,0},
    {"dns:cache-expire",		 "1h",	  ResMgr::TimeIntervalValidate,0},
@@ -375,6 +386,7 @@ static ResType lftp_vars[] = {
 #endif
    {"dns:order",		 DEFAULT_ORDER, OrderValidate,0},
    {"dns:SRV-query",		 "no",	  ResMgr::BoolValidate,0},
+   {"dns:threads",		 "8",	  ResMgr::UNumberValidate,ResMgr::NoClosure},
    {"dns:use-fork",		 "yes",	  ResMgr::BoolValidate,ResMgr::NoClosure},
 #ifdef DNSSEC_LOCAL_VALIDATION
    {"dns:strict-dnssec",	 "no",	  ResMgr::BoolValidate,0},
@@ -32,6 +32,7 @@ protected:
    bool recurse;
 
 public:
+   const char *GetClassName() { return "rmJob"; }
    void	SayFinal();
    void Recurse(); // rm -r
    void Rmdir() { mode=FA::REMOVE_DIR; }
@@ -0,0 +1,222 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 2026 by the lftp contributors (see the AUTHORS file)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef XTIMERWHEEL_H
+#define XTIMERWHEEL_H 1
+
+// hierarchical timer wheel with O(1) add and remove.
+//
+// Elements are placed by an integer tick (e.g. milliseconds). Level 0 holds
+// the ticks of the current 64-tick block, level 1 the rest of the current
+// 4096-tick block, and so on; far elements go to an overflow list. Slots of
+// upper levels are cascaded down when the wheel advances into them, elements
+// left behind go to the expired list.
+// get_min returns the exact minimum using T's operator<, only elements of
+// the first non-empty slot have to be compared.
+
+#include <assert.h>
+#include "xlist.h"
+
+template<class T>
+class xtimerwheel
+{
+public:
+   class node
+   {
+      T *obj;
+      xlist<node> link;
+      unsigned long long tick;
+      int slot;	  // level*SLOTS+index, OVERFLOW or EXPIRED
+      friend class xtimerwheel<T>;
+   public:
+      node(T *t) : obj(t), link(this), tick(0), slot(-1) {}
+      bool listed() const { return link.listed(); }
+   };
+
+private:
+   enum {
+      BITS=6,
+      SLOTS=1<<BITS,
+      LEVELS=5,
+      OVERFLOW=LEVELS*SLOTS,
+      EXPIRED=OVERFLOW+1,
+   };
+   xlist_head<node> slots[EXPIRED+1];
+   unsigned long long occupied[LEVELS];
+   unsigned long long current;
+   int count;
+   node *min_node;
+
+   static int index(unsigned long long tick,int level) {
+      return (tick>>(level*BITS))&(SLOTS-1);
+   }
+   static int first_bit(unsigned long long mask) {
+      return __builtin_ctzll(mask);
+   }
+   void place(node *n) {
+      unsigned long long t=n->tick;
+      int s=(t<current ? EXPIRED : OVERFLOW);
+      for(int level=0; level<LEVELS && s==OVERFLOW; level++) {
+	 if((t>>((level+1)*BITS))==(current>>((level+1)*BITS))) {
+	    int i=index(t,level);
+	    occupied[level]|=1ULL<<i;
+	    s=level*SLOTS+i;
+	    break;
+	 }
+      }
+      n->slot=s;
+      slots[s].add_tail(n->link);
+   }
+   void unlink(node *n) {
+      n->link.remove();
+      int s=n->slot;
+      n->slot=-1;
+      if(s<OVERFLOW && slots[s].get_next()==&slots[s])
+	 occupied[s/SLOTS]&=~(1ULL<<(s%SLOTS));
+   }
+   // re-place all elements of slot s according to the current tick
+   void cascade(int s) {
+      xlist_head<node> &h=slots[s];
+      xlist_head<node> tmp;
+      while(h.get_next()!=&h) {
+	 node *n=h.get_next()->get_obj();
+	 unlink(n);
+	 tmp.add_tail(n->link);
+      }
+      while(tmp.get_next()!=&tmp) {
+	 node *n=tmp.get_next()->get_obj();
+	 n->link.remove();
+	 place(n);
+      }
+   }
+   // the tick where the first occupied slot after the current one starts
+   unsigned long long next_event() const {
+      unsigned long long next=~0ULL;
+      for(int level=0; level<LEVELS; level++) {
+	 int shift=level*BITS;
+	 unsigned long long bits=occupied[level]&~((2ULL<<index(current,level))-1);
+	 if(!bits)
+	    continue;
+	 unsigned long long base=(current>>(shift+BITS))<<(shift+BITS);
+	 unsigned long long start=base+((unsigned long long)first_bit(bits)<<shift);
+	 if(start<next)
+	    next=start;
+      }
+      if(slots[OVERFLOW].get_next()!=&slots[OVERFLOW]) {
+	 unsigned long long start=((current>>(LEVELS*BITS))+1)<<(LEVELS*BITS);
+	 if(start<next)
+	    next=start;
+      }
+      return next;
+   }
+   // move current forward to tick t, cascading the slots entered on the way.
+   // Elements left behind in the current level 0 slot go to the expired list.
+   void advance(unsigned long long t) {
+      while(current<t) {
+	 int cur0=index(current,0);
+	 bool cur0_occupied=(occupied[0]&(1ULL<<cur0));
+	 unsigned long long next=(count>0 ? next_event() : ~0ULL);
+	 if(next>t) {
+	    current=t;
+	    if(cur0_occupied)
+	       cascade(cur0);
+	    break;
+	 }
+	 current=next;
+	 for(int level=LEVELS-1; level>=1; level--) {
+	    unsigned long long unit=1ULL<<(level*BITS);
+	    if(current&(unit-1))
+	       continue;
+	    int s=level*SLOTS+index(current,level);
+	    if(occupied[level]&(1ULL<<index(current,level)))
+	       cascade(s);
+	 }
+	 if((current&((1ULL<<(LEVELS*BITS))-1))==0)
+	    cascade(OVERFLOW);
+	 if(cur0_occupied)
+	    cascade(cur0);
+      }
+   }
+
+public:
+   xtimerwheel() : current(0), count(0), min_node(0) {
+      for(int i=0; i<LEVELS; i++)
+	 occupied[i]=0;
+   }
+   void set_current(unsigned long long t) { advance(t); }
+   int get_count() const { return count; }
+
+   void add(node& n,unsigned long long tick) {
+      if(n.listed())
+	 remove(n);
+      n.tick=tick;
+      place(&n);
+      count++;
+      if(min_node && *n.obj<*min_node->obj)
+	 min_node=&n;
+   }
+   void remove(node& n) {
+      if(!n.listed())
+	 return;
+      unlink(&n);
+      count--;
+      if(min_node==&n)
+	 min_node=0;
+   }
+   T *get_min(unsigned long long now) {
+      advance(now);
+      if(count==0)
+	 return 0;
+      if(min_node)
+	 return min_node->obj;
+      int s=-1;
+      if(slots[EXPIRED].get_next()!=&slots[EXPIRED])
+	 s=EXPIRED;
+      for(int level=0; level<LEVELS && s==-1; level++) {
+	 int i=index(current,level);
+	 // level 0 includes the current slot, upper levels don't.
+	 unsigned long long mask=(level==0 ? ~((1ULL<<i)-1) : ~((2ULL<<i)-1));
+	 if(level>0 && i==SLOTS-1)
+	    mask=0;
+	 unsigned long long bits=occupied[level]&mask;
+	 if(bits)
+	    s=level*SLOTS+first_bit(bits);
+      }
+      if(s==-1)
+	 s=OVERFLOW;
+      xlist_head<node> &h=slots[s];
+      assert(h.get_next()!=&h);
+      node *m=h.get_next()->get_obj();
+      for(xlist<node> *scan=m->link.get_next(); scan!=&h; scan=scan->get_next()) {
+	 node *n=scan->get_obj();
+	 if(*n->obj<*m->obj)
+	    m=n;
+      }
+      min_node=m;
+      return m->obj;
+   }
+   T *pop_min(unsigned long long now) {
+      T *m=get_min(now);
+      if(m)
+	 remove(*min_node);
+      return m;
+   }
+};
+
+#endif//XTIMERWHEEL_H
@@ -0,0 +1,133 @@
+/*
+	This writes a file through AsyncFile and reads it back with each
+	available I/O engine, checking the data.
+*/
+
+#include <config.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "AsyncIO.h"
+#include "ResMgr.h"
+#include "log.h"
+
+char *program_name;
+
+static void fill(char *buf,int len,off_t pos)
+{
+   for(int i=0; i<len; i++)
+      buf[i]=char((pos+i)*7>>3);
+}
+
+// returns 0 if the engine is not available, -1 on failure.
+static int test(const char *engine,long long total)
+{
+   ResMgr::Set("file:io-engine",0,engine);
+   char name[]="/tmp/async-io.XXXXXX";
+   int fd=mkstemp(name);
+   if(fd==-1)
+   {
+      perror("mkstemp");
+      return -1;
+   }
+   unlink(name);
+   AsyncFile *f=AsyncFile::Open(fd);
+   if(!f)
+   {
+      close(fd);
+      return 0;
+   }
+   const int size=0x10000;
+   char buf[size];
+   char check[size];
+   const char *error=0;
+
+   off_t pos=0;
+   while(pos<total)
+   {
+      fill(buf,size,pos);
+      int res=f->Write(pos,buf,size);
+      if(res==-1 && errno!=EAGAIN)
+      {
+	 error=strerror(errno);
+	 goto out;
+      }
+      if(res>0)
+	 pos+=res;
+      else
+      {
+	 // the engine collects the completions
+	 SMTask::Schedule();
+	 SMTask::Block();
+      }
+   }
+   if(f->Wait()==-1)
+   {
+      error=strerror(errno);
+      goto out;
+   }
+   if(lseek(fd,0,SEEK_END)!=total)
+   {
+      error="wrong file size";
+      goto out;
+   }
+
+   pos=0;
+   for(;;)
+   {
+      int res=f->Read(pos,buf,size);
+      if(res==-1 && errno!=EAGAIN)
+      {
+	 error=strerror(errno);
+	 goto out;
+      }
+      if(res==0)
+	 break;
+      if(res<0)
+      {
+	 SMTask::Schedule();
+	 SMTask::Block();
+	 continue;
+      }
+      fill(check,res,pos);
+      if(memcmp(buf,check,res))
+      {
+	 error="data mismatch";
+	 goto out;
+      }
+      pos+=res;
+   }
+   if(pos!=total)
+      error="short read";
+out:
+   delete f;
+   close(fd);
+   if(error)
+   {
+      fprintf(stderr,"%s: %s\n",engine,error);
+      return -1;
+   }
+   return 1;
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+   Log::global=new Log("debug");
+
+   ResMgr::Set("file:io-queue-depth",0,"8");
+   if(AsyncFile::Open(0)!=0)
+   {
+      fprintf(stderr,"the engine must be disabled by default\n");
+      return 1;
+   }
+
+   int threads=test("threads",4<<20);
+   int io_uring=test("io_uring",4<<20);
+   if(threads<0 || io_uring<0)
+      return 1;
+   if(io_uring==0)
+      printf("io_uring: not available\n");
+   return threads>0 || io_uring>0 ? 0 : 77;
+}
@@ -0,0 +1,267 @@
+/*
+	This measures the throughput of a loopback transfer going through
+	IOBuffer and a second Buffer, like FileCopy does, with linear and
+	with segmented buffers, and of the kernel-assisted transfer to and
+	from a file with IOBufferFDStream::DirectGet/DirectPut.
+*/
+
+#include <config.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "buffer.h"
+#include "log.h"
+
+char *program_name;
+
+static int loopback_pair(int *server)
+{
+   int l=socket(AF_INET,SOCK_STREAM,0);
+   struct sockaddr_in sa;
+   memset(&sa,0,sizeof(sa));
+   sa.sin_family=AF_INET;
+   sa.sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+   socklen_t len=sizeof(sa);
+   if(l==-1 || bind(l,(struct sockaddr*)&sa,len)==-1 || listen(l,1)==-1
+   || getsockname(l,(struct sockaddr*)&sa,&len)==-1)
+      return -1;
+   int c=socket(AF_INET,SOCK_STREAM,0);
+   if(c==-1 || connect(c,(struct sockaddr*)&sa,len)==-1)
+      return -1;
+   *server=accept(l,0,0);
+   close(l);
+   return *server==-1 ? -1 : c;
+}
+
+static void reader(int fd,long long total)
+{
+   static char buf[0x10000];
+   long long received=0;
+   for(;;)
+   {
+      int res=read(fd,buf,sizeof(buf));
+      if(res<0)
+	 _exit(1);
+      if(res==0)
+	 break;
+      for(int i=0; i<res; i++)
+	 if(buf[i]!=char((received+i)&255))
+	    _exit(1);
+      received+=res;
+   }
+   _exit(received==total?0:1);
+}
+
+static void writer(int fd,long long total)
+{
+   static char buf[0x10000];
+   for(int i=0; i<(int)sizeof(buf); i++)
+      buf[i]=i&255;
+   while(total>0)
+   {
+      int len=(total<(long long)sizeof(buf)?total:sizeof(buf));
+      int res=write(fd,buf,len);
+      if(res<=0)
+	 _exit(1);
+      total-=res;
+   }
+   _exit(0);
+}
+
+static double transfer(long long total,bool segmented)
+{
+   int fd,wfd;
+   fd=loopback_pair(&wfd);
+   if(fd==-1)
+   {
+      perror("loopback");
+      exit(1);
+   }
+   pid_t pid=fork();
+   if(pid==0)
+   {
+      close(fd);
+      writer(wfd,total);
+   }
+   close(wfd);
+   int null=open("/dev/null",O_WRONLY);
+
+   timespec start,end;
+   clock_gettime(CLOCK_MONOTONIC,&start);
+
+   SMTaskRef<IOBuffer> in(new IOBufferFDStream(new FDStream(fd,"loopback"),IOBuffer::GET));
+   in->SetSegmented(segmented);
+   Buffer out;
+   out.SetSegmented(segmented);
+   long long received=0;
+   for(;;)
+   {
+      SMTask::Schedule();
+      if(in->Error())
+      {
+	 fprintf(stderr,"buffer-copy: %s\n",in->ErrorText());
+	 exit(1);
+      }
+      int res=out.MoveDataHere(in,0x40000);
+      out.SpaceAdd(res);
+      while(out.Size()>0)
+      {
+	 const char *b;
+	 int s;
+	 out.GetSpan(&b,&s);
+	 if(b[0]!=char(received&255))
+	 {
+	    fprintf(stderr,"buffer-copy: data mismatch at %lld\n",received);
+	    exit(1);
+	 }
+	 write(null,b,s);
+	 out.Skip(s);
+	 received+=s;
+      }
+      if(in->Eof() && in->Size()==0)
+	 break;
+      if(res==0)
+	 SMTask::Block();
+   }
+   clock_gettime(CLOCK_MONOTONIC,&end);
+   in=0;
+   close(null);
+   waitpid(pid,0,0);
+   if(received!=total)
+   {
+      fprintf(stderr,"buffer-copy: received %lld of %lld bytes\n",received,total);
+      exit(1);
+   }
+   return (end.tv_sec-start.tv_sec)+(end.tv_nsec-start.tv_nsec)/1e9;
+}
+
+static void check_error(IOBuffer *b)
+{
+   if(b->Error())
+   {
+      fprintf(stderr,"buffer-copy: %s\n",b->ErrorText());
+      exit(1);
+   }
+}
+
+// receive into a file with splice, then send the file back with sendfile.
+static double direct_transfer(long long total,double *put_time)
+{
+   char name[]="/tmp/buffer-copy.XXXXXX";
+   int file=mkstemp(name);
+   if(file==-1)
+   {
+      perror("mkstemp");
+      exit(1);
+   }
+   unlink(name);
+
+   int fd,wfd;
+   fd=loopback_pair(&wfd);
+   if(fd==-1)
+   {
+      perror("loopback");
+      exit(1);
+   }
+   pid_t pid=fork();
+   if(pid==0)
+   {
+      close(fd);
+      writer(wfd,total);
+   }
+   close(wfd);
+
+   timespec start,end;
+   clock_gettime(CLOCK_MONOTONIC,&start);
+
+   SMTaskRef<IOBuffer> in(new IOBufferFDStream(new FDStream(fd,"loopback"),IOBuffer::GET));
+   in->SetDirect(true);
+   while(!in->Eof())
+   {
+      SMTask::Schedule();
+      int res=in->DirectGet(file,0x10000);
+      if(res<0 || in->Size()>0)
+      {
+	 fprintf(stderr,"buffer-copy: splice is not supported\n");
+	 exit(77);
+      }
+      check_error(in.get_non_const());
+      if(res==0 && !in->Eof())
+	 SMTask::Block();
+   }
+   clock_gettime(CLOCK_MONOTONIC,&end);
+   in=0;
+   close(fd);
+   waitpid(pid,0,0);
+   if(lseek(file,0,SEEK_CUR)!=total)
+   {
+      fprintf(stderr,"buffer-copy: received %lld of %lld bytes\n",
+	 (long long)lseek(file,0,SEEK_CUR),total);
+      exit(1);
+   }
+   double get_time=(end.tv_sec-start.tv_sec)+(end.tv_nsec-start.tv_nsec)/1e9;
+
+   lseek(file,0,SEEK_SET);
+   fd=loopback_pair(&wfd);
+   pid=fork();
+   if(pid==0)
+   {
+      close(fd);
+      reader(wfd,total);
+   }
+   close(wfd);
+   clock_gettime(CLOCK_MONOTONIC,&start);
+   SMTaskRef<IOBuffer> out(new IOBufferFDStream(new FDStream(fd,"loopback"),IOBuffer::PUT));
+   long long sent=0;
+   for(;;)
+   {
+      SMTask::Schedule();
+      int res=out->DirectPut(file,0x100000);
+      if(res<0)
+	 break;
+      check_error(out.get_non_const());
+      sent+=res;
+      if(res==0)
+	 SMTask::Block();
+   }
+   out=0;
+   close(fd);
+   int status;
+   waitpid(pid,&status,0);
+   clock_gettime(CLOCK_MONOTONIC,&end);
+   close(file);
+   if(sent!=total || !WIFEXITED(status) || WEXITSTATUS(status)!=0)
+   {
+      fprintf(stderr,"buffer-copy: sendfile transfer failed\n");
+      exit(1);
+   }
+   *put_time=(end.tv_sec-start.tv_sec)+(end.tv_nsec-start.tv_nsec)/1e9;
+   return get_time;
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+   Log::global=new Log("debug");
+   signal(SIGPIPE,SIG_IGN);
+
+   long long total=(argc>1?atoll(argv[1]):256)<<20;
+
+   double linear=transfer(total,false);
+   double segmented=transfer(total,true);
+
+   double direct_put;
+   double direct_get=direct_transfer(total,&direct_put);
+
+   printf("%lld MiB: linear %.1f MB/s, segmented %.1f MB/s,"
+      " splice %.1f MB/s, sendfile %.1f MB/s\n",total>>20,
+      total/linear/1e6,total/segmented/1e6,
+      total/direct_get/1e6,total/direct_put/1e6);
+   return 0;
+}
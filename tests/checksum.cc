@@ -0,0 +1,147 @@
+/*
+	This checks the checksums computed while copying against known
+	values and the parsing of checksums sent by servers.
+*/
+
+#include <config.h>
+#include <stdio.h>
+#include <string.h>
+#include "Checksum.h"
+#include "ResMgr.h"
+
+char *program_name;
+
+static int failures;
+
+static void check(bool ok,const char *what)
+{
+   if(ok)
+      return;
+   fprintf(stderr,"%s\n",what);
+   failures++;
+}
+
+static const unsigned all=(1<<Checksum::ALGO_COUNT)-1;
+
+static void check_digest(const Checksum& c,int a,const char *expect)
+{
+   if(!c.GetDigest(a) || strcmp(c.GetDigest(a),expect))
+   {
+      fprintf(stderr,"%s: got %s, expected %s\n",Checksum::AlgoName(a),c.GetDigest(a),expect);
+      failures++;
+   }
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+
+   {
+      Checksum c(all);
+      c.Update("123456789",9);
+      c.Finish();
+      check_digest(c,Checksum::CRC32,"cbf43926");
+      check_digest(c,Checksum::CRC32C,"e3069283");
+   }
+   {
+      Checksum c(all);
+      c.Update("a",1);
+      c.Update("bc",2);
+      c.Finish();
+      check_digest(c,Checksum::MD5,"900150983cd24fb0d6963f7d28e17f72");
+      check_digest(c,Checksum::SHA1,"a9993e364706816aba3e25717850c26c9cd0d89d");
+      check_digest(c,Checksum::SHA256,"ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+      check(c.GetSize()==3,"wrong size");
+
+      xstring msg;
+      check(c.Compare(&msg)==-1,"nothing to compare expected");
+
+      // Digest header, base64 and hex.
+      c.SetExpectedFromList("SHA-256=ungWv48Bz+pBQUDeXa4iI7ADYaOWF3qctBD/YfIAFa0=, md5=900150983CD24FB0D6963F7D28E17F72");
+      check(c.GetExpected(Checksum::SHA256) && c.GetExpected(Checksum::MD5),"Digest header not parsed");
+      check(c.Compare(&msg)==1,"correct checksum not accepted");
+
+      // FTP replies.
+      check(c.SetExpectedFromReply(Checksum::SHA1,"213 SHA-1 0-3 a9993e364706816aba3e25717850c26c9cd0d89d file name"),"HASH reply not parsed");
+      check(!c.SetExpectedFromReply(Checksum::CRC32,"500 XCRC not understood"),"error reply parsed");
+      check(c.SetExpectedFromReply(Checksum::CRC32,"250 352441C2"),"XCRC reply not parsed");
+      check(c.Compare(&msg)==1,"correct checksum not accepted");
+      check(!c.SetExpectedFromReply(Checksum::CRC32,"250 file 352441C2"),"XCRC digest not in the first field accepted");
+      check(!c.SetExpectedFromReply(Checksum::CRC32,"213 CRC32 0-3 bad 352441C2"),"HASH digest not after the range accepted");
+      check(c.SetExpectedFromReply(Checksum::SHA1,"250-first line\n250 0000000000000000000000000000000000000000"),"multiline reply not parsed");
+      check(c.Compare(&msg)==0 && msg,"wrong checksum accepted");
+   }
+
+   // the result does not depend on how the data are split.
+   {
+      char data[5000];
+      for(unsigned i=0; i<sizeof(data); i++)
+	 data[i]=(i*7919)>>3;
+      Checksum whole(all);
+      whole.Update(data,sizeof(data));
+      whole.Finish();
+      Checksum parts(all);
+      unsigned pos=0;
+      for(int n=1; pos<sizeof(data); n=n%13+1)
+      {
+	 unsigned len=(pos+n<=sizeof(data)?n:sizeof(data)-pos);
+	 parts.Update(data+pos,len);
+	 pos+=len;
+      }
+      parts.Finish();
+      for(int a=0; a<Checksum::ALGO_COUNT; a++)
+	 check_digest(parts,a,whole.GetDigest(a));
+   }
+
+   // the algorithms chosen after the data started to come.
+   {
+      Checksum c;
+      c.Update("a",1);
+      c.SetAlgos(1<<Checksum::MD5);
+      c.Update("bc",2);
+      c.Finish();
+      check_digest(c,Checksum::MD5,"900150983cd24fb0d6963f7d28e17f72");
+      check(!c.GetDigest(Checksum::SHA1),"an algorithm not chosen was computed");
+   }
+
+   // the data are not kept forever waiting for the choice.
+   {
+      Checksum c;
+      xstring data;
+      data.append_padding(1024*1024,'x');
+      for(int i=0; i<64 && !c.AlgosChosen(); i++)
+	 c.Update(data,data.length());
+      check(c.AlgosChosen() && !c.GetAlgos(),"the unchosen checksum was not given up");
+      c.SetAlgos(1<<Checksum::MD5);
+      c.Finish();
+      check(!c.GetDigest(Checksum::MD5),"a given up checksum was computed");
+   }
+
+   // the worker threads give the same result as the main loop.
+   {
+      xstring data;
+      data.get_space(1024*1024);
+      for(unsigned i=0; i<1024*1024; i++)
+	 data.append(char(i*7919>>5));
+      Checksum *c[2];
+      for(int t=0; t<2; t++)
+      {
+	 ResMgr::Set("xfer:worker-threads",0,t?"2":"0");
+	 c[t]=new Checksum(all);
+	 for(int pos=0; pos<(int)data.length(); pos+=10000)
+	    c[t]->Update(data+pos,pos+10000<=(int)data.length()?10000:data.length()-pos);
+	 c[t]->Finish();
+      }
+      for(int a=0; a<Checksum::ALGO_COUNT; a++)
+	 check_digest(*c[1],a,c[0]->GetDigest(a));
+      delete c[0];
+      delete c[1];
+   }
+
+   check(Checksum::ListAlgos("SHA-256=ungWv48Bz+pBQUDeXa4iI7ADYaOWF3qctBD/YfIAFa0=, md5=x")==(1<<Checksum::MD5|1<<Checksum::SHA256),"wrong Digest header algorithms");
+   check(Checksum::FindAlgo("SHA-256")==Checksum::SHA256 && Checksum::FindAlgo("SHA")==Checksum::SHA1
+      && Checksum::FindAlgo("CRC32c")==Checksum::CRC32C && Checksum::FindAlgo("sha-512")==-1,
+      "wrong algorithm name parsing");
+   check(Checksum::ParseList("md5, sha256")==(1<<Checksum::MD5|1<<Checksum::SHA256),"wrong algorithm list parsing");
+   return failures?1:0;
+}
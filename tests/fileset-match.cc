@@ -0,0 +1,81 @@
+/*
+	This checks matching of two file sets by names, as mirror does it
+	to compare the source and target directories.
+*/
+
+#include <config.h>
+#include <stdio.h>
+#include "FileSet.h"
+
+char *program_name;
+
+// the target has every other file of the source, every fourth with another size.
+static void fill(FileSet *set,int n,bool target)
+{
+   for(int i=0; i<n; i++)
+   {
+      if(target && i%2)
+	 continue;
+      FileInfo *fi=new FileInfo(xstring::format("file-%07d.dat",i));
+      fi->SetType(fi->NORMAL);
+      fi->SetSize(target && i%4==0 ? 1 : 2);
+      set->Add(fi);
+   }
+}
+
+// returns the failure, or 0.
+static const char *check(int n)
+{
+   FileSet source,target;
+   fill(&source,n,false);
+   fill(&target,n,true);
+
+   int found=0;
+   for(source.rewind(); source.curr(); source.next())
+      if(target.FindByName(source.curr()->name))
+	 found++;
+   if(found!=n/2)
+      return "wrong number of files found by name";
+
+   FileSet to_transfer(&source);
+   to_transfer.SubtractSame(&target,0);
+   if(to_transfer.count()!=n/2+n/4)
+      return "SubtractSame failed";
+   FileSet to_rm(&target);
+   to_rm.SubtractAny(&to_transfer);
+   if(to_rm.count()!=n/4)
+      return "SubtractAny failed";
+   FileSet same(&source);
+   same.SubtractNotIn(&to_rm);
+   if(same.count()!=n/4)
+      return "SubtractNotIn failed";
+
+   for(same.rewind(); same.curr(); same.next())
+   {
+      const FileInfo *fi=same.curr();
+      if(!target.FindByName(fi->name) || to_transfer.FindByName(fi->name))
+	 return "wrong file left by subtraction";
+   }
+   // the lookup index follows changes of the set.
+   target.SubtractAny(&same);
+   if(target.count()!=n/4 || target.FindByName(same[0]->name))
+      return "removed file found by name";
+   target.Add(new FileInfo(same[0]->name));
+   if(!target.FindByName(same[0]->name))
+      return "added file not found by name";
+
+   return 0;
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+
+   const char *error=check(1000);
+   if(error)
+   {
+      fprintf(stderr,"%s\n",error);
+      return 1;
+   }
+   return 0;
+}
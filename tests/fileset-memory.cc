@@ -0,0 +1,74 @@
+/*
+	This reports the memory taken per entry of a file set, as a mirror of
+	a big tree keeps millions of them. Entries parsed from ls lines keep
+	the line as the long name, others make it only when asked.
+*/
+
+#include <config.h>
+#include <stdio.h>
+#include <string.h>
+#include "FileSet.h"
+
+char *program_name;
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+
+   const int n=10000;
+   FileSet plain,parsed;
+   xstring line;
+   for(int i=0; i<n; i++)
+   {
+      line.setf("%crw-r--r--   1 user%d    group    %9d Jan %2d %02d:%02d file-%07d.dat",
+	 i%50?'-':'d',i%3,i*37%1000000,i%28+1,i%24,i%60,i);
+      FileInfo *fi=FileInfo::parse_ls_line(line,line.length(),"GMT");
+      if(!fi)
+      {
+	 fprintf(stderr,"cannot parse \"%s\"\n",line.get());
+	 return 1;
+      }
+      if(strcmp(fi->GetLongName(),line))
+      {
+	 fprintf(stderr,"long name \"%s\" is not the ls line\n",fi->GetLongName());
+	 return 1;
+      }
+      parsed.Add(fi);
+
+      FileInfo *p=new FileInfo(fi->name);
+      p->SetType(fi->filetype);
+      p->SetMode(fi->mode);
+      p->SetSize(fi->size);
+      p->SetDate(fi->date,fi->date.ts_prec);
+      p->SetUser(fi->user);
+      p->SetGroup(fi->group);
+      plain.Add(p);
+   }
+
+   const char *group=0;
+   for(parsed.rewind(); parsed.curr(); parsed.next())
+   {
+      const FileInfo *fi=parsed.curr();
+      if(group && fi->group!=group)
+      {
+	 fprintf(stderr,"group name is not shared\n");
+	 return 1;
+      }
+      group=fi->group;
+   }
+
+   size_t plain_mem=plain.EstimateMemory();
+   printf("sizeof(FileInfo)=%d\n",(int)sizeof(FileInfo));
+   printf("without long names: %.1f bytes per entry\n",(double)plain_mem/n);
+   printf("with ls long names: %.1f bytes per entry\n",(double)parsed.EstimateMemory()/n);
+
+   // a long name is made on demand.
+   plain.rewind();
+   plain.curr()->GetLongName();
+   if(plain.EstimateMemory()<=plain_mem)
+   {
+      fprintf(stderr,"long name is not made on demand\n");
+      return 1;
+   }
+   return 0;
+}
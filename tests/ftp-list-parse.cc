@@ -0,0 +1,89 @@
+/*
+	This measures parsing of FTP listings, the first one with detection
+	of the listing format and the next ones with the parser remembered
+	for the site, and checks that a listing in another format is still
+	recognized. Small directories are the ones which gain most, as the
+	format is hardly detected until the end of such a listing.
+*/
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "FileAccess.h"
+#include "log.h"
+
+char *program_name;
+
+static void make_unix(xstring& buf,int n)
+{
+   buf.truncate();
+   buf.append("total 123456\r\n");
+   for(int i=0; i<n; i++)
+      buf.appendf("%crw-r--r--   1 user     group    %9d Jan %2d %02d:%02d file-%07d.dat\r\n",
+	 i%50?'-':'d',i*37%1000000,i%28+1,i%24,i%60,i);
+}
+
+static void make_mlsd(xstring& buf,int n)
+{
+   buf.truncate();
+   for(int i=0; i<n; i++)
+      buf.appendf("modify=201605061402%02d;perm=adfrw;size=%d;type=file;UNIX.mode=0644; file-%07d.dat\r\n",
+	 i%60,i*37%1000000,i);
+}
+
+static double parse(FileAccess *f,const xstring& buf,int n)
+{
+   timespec start,end;
+   clock_gettime(CLOCK_MONOTONIC,&start);
+   int err=0;
+   FileSet *set=f->ParseLongList(buf,buf.length(),&err);
+   clock_gettime(CLOCK_MONOTONIC,&end);
+   if(!set || err>0 || set->count()!=n)
+   {
+      fprintf(stderr,"ftp-list-parse: count=%d err=%d (expected %d)\n",set?set->count():-1,err,n);
+      exit(1);
+   }
+   delete set;
+   return (end.tv_sec-start.tv_sec)+(end.tv_nsec-start.tv_nsec)/1e9;
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+   Log::global=new Log("debug");
+
+   int n=(argc>1?atoi(argv[1]):200000);
+
+   FileAccess *f=FileAccess::New("ftp","ftp.example.net");
+   if(!f)
+   {
+      fprintf(stderr,"ftp-list-parse: cannot create ftp session\n");
+      return 1;
+   }
+
+   xstring buf;
+   make_unix(buf,n);
+   double detect=parse(f,buf,n);
+   double known=parse(f,buf,n);
+
+   // the site has changed the listing format.
+   xstring mlsd;
+   make_mlsd(mlsd,n);
+   double changed=parse(f,mlsd,n);
+   double known_mlsd=parse(f,mlsd,n);
+
+   // many small directories.
+   xstring small;
+   make_unix(small,10);
+   double small_time=0;
+   for(int i=0; i<n/10; i++)
+      small_time+=parse(f,small,10);
+
+   printf("%d entries: detected %.0f/s, known %.0f/s;"
+      " changed format %.0f/s, known %.0f/s;"
+      " in directories of 10 %.0f/s\n",n,
+      n/detect,n/known,n/changed,n/known_mlsd,n/10*10/small_time);
+   SMTask::Delete(f);
+   return 0;
+}
@@ -0,0 +1,148 @@
+/*
+	This stores listings in the persistent cache, loads them back as
+	another lftp process would do, and checks that changes made by this
+	process and expiration are followed.
+*/
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "FileAccess.h"
+#include "LsCache.h"
+#include "ResMgr.h"
+#include "misc.h"
+
+char *program_name;
+
+static char tmp[]="/tmp/ls-cache-persist.XXXXXX";
+
+static void remove_dir(const char *dir_c)
+{
+   xstring dir(dir_c);  // dir_file below reuses its temporaries
+   DIR *d=opendir(dir);
+   if(!d)
+      return;
+   struct dirent *de;
+   while((de=readdir(d))!=0)
+   {
+      if(strcmp(de->d_name,".") && strcmp(de->d_name,".."))
+	 remove(dir_file(dir,de->d_name));
+   }
+   closedir(d);
+   rmdir(dir);
+}
+
+// returns the failure, or 0.
+static const char *check(FileAccess *f)
+{
+   xstring data;
+   for(int i=0; i<100; i++)
+      data.appendf("-rw-r--r--   1 user     group    %9d Jan %2d 12:00 file %03d.dat\r\n",i*37,i%28+1,i);
+   Ref<FileSet> set(f->ParseLongList(data,data.length()));
+   if(!set || set->count()!=100)
+      return "cannot parse listing";
+
+   for(int i=0; i<100; i++)
+   {
+      f->SetCwd(FileAccess::Path(xstring::format("/pub/dir-%06d",i)));
+      FileAccess::cache->Add(f,"",FA::LONG_LIST,FA::OK,data,data.length(),set);
+   }
+
+   // a new process has only the listings on disk.
+   FileAccess::cache->Flush();
+   for(int i=0; i<100; i++)
+   {
+      f->SetCwd(FileAccess::Path(xstring::format("/pub/dir-%06d",i)));
+      int err;
+      const char *d;
+      int len;
+      const FileSet *fs;
+      if(!FileAccess::cache->Find(f,"",FA::LONG_LIST,&err,&d,&len,&fs) || err!=FA::OK)
+	 return "stored listing not found";
+      if(len!=data.length() || memcmp(d,data,len) || !fs || fs->count()!=100)
+	 return "stored listing differs";
+      const FileInfo *fi=fs->FindByName("file 042.dat");
+      if(!fi || !fi->Has(fi->SIZE) || fi->size!=42*37 || xstrcmp(fi->user,"user")
+      || fi->date!=(*set)[42]->date || fi->defined!=(*set)[42]->defined)
+	 return "stored file information differs";
+   }
+
+   int err;
+   const char *d;
+   int len;
+   // an expired listing is used again if the server says it is not modified.
+   FileAccess::cache->Flush();
+   ResMgr::Set("cache:expire",0,"1s");
+   sleep(2);
+   SMTask::UpdateNow();
+   f->SetCwd(FileAccess::Path("/pub/dir-000000"));
+   if(FileAccess::cache->Find(f,"",FA::LONG_LIST,&err,&d,&len))
+      return "expired listing is used";
+   if(!FileAccess::cache->Revalidate(f,"",FA::LONG_LIST))
+      return "expired listing cannot be revalidated";
+   FileAccess::cache->Flush();
+   if(!FileAccess::cache->Find(f,"",FA::LONG_LIST,&err,&d,&len))
+      return "revalidated listing not found";
+   ResMgr::Set("cache:expire",0,"1h");
+
+   f->SetCwd(FileAccess::Path("/pub/dir-000001"));
+   FileAccess::cache->DirectoryChanged(f,".");
+   FileAccess::cache->Flush();
+   if(FileAccess::cache->Find(f,"",FA::LONG_LIST,&err,&d,&len))
+      return "changed directory is still cached on disk";
+
+   f->SetCwd(FileAccess::Path("/"));
+   FileAccess::cache->TreeChanged(f,"pub");
+   FileAccess::cache->Flush();
+   f->SetCwd(FileAccess::Path("/pub/dir-000002"));
+   if(FileAccess::cache->Find(f,"",FA::LONG_LIST,&err,&d,&len))
+      return "directory in a changed tree is still cached on disk";
+
+   return 0;
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+
+   // the lftp directories are looked up before main,
+   // so run again with LFTP_HOME set to a temporary directory.
+   const char *home=getenv("LFTP_HOME");
+   if(!home || strncmp(home,tmp,strlen(tmp)-6) || strlen(home)!=strlen(tmp))
+   {
+      if(!mkdtemp(tmp))
+      {
+	 perror("mkdtemp");
+	 return 1;
+      }
+      setenv("LFTP_HOME",tmp,1);
+      execv(argv[0],argv);
+      perror(argv[0]);
+      return 1;
+   }
+   strcpy(tmp,home);
+   if(strcmp(get_lftp_cache_dir(),tmp))
+   {
+      fprintf(stderr,"the cache directory is not in LFTP_HOME\n");
+      return 1;
+   }
+
+   ResMgr::Set("cache:persist",0,"yes");
+
+   FileAccess *f=FileAccess::New("ftp","ftp.example.net");
+   if(!f)
+   {
+      fprintf(stderr,"ftp: unknown protocol, cannot create ftp session\n");
+      return 1;
+   }
+   const char *error=check(f);
+   if(error)
+      fprintf(stderr,"%s\n",error);
+   FileAccess::cache->Flush();
+   SMTask::Delete(f);
+   remove_dir(dir_file(tmp,"ls"));
+   remove_dir(tmp);
+   return error?1:0;
+}
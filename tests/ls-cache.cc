@@ -0,0 +1,89 @@
+/*
+	This fills the listing cache with directories and looks them up, as
+	done on cd, completion and by mirror, then checks that a big site
+	does not push other sites out of the cache.
+*/
+
+#include <config.h>
+#include <stdio.h>
+#include "FileAccess.h"
+#include "LsCache.h"
+#include "ResMgr.h"
+
+char *program_name;
+
+// returns the failure, or 0.
+static const char *check(FileAccess *f,FileAccess *other)
+{
+   const int n=1000;
+   ResMgr::Set("cache:size",0,"1G");
+
+   for(int i=0; i<n; i++)
+   {
+      f->SetCwd(FileAccess::Path(xstring::format("/pub/dir-%06d",i)));
+      const char *data="drwxr-xr-x   2 user     group        4096 Jan  1 00:00 sub\r\n";
+      FileAccess::cache->Add(f,"",FA::LONG_LIST,FA::OK,data,strlen(data));
+   }
+
+   int found=0;
+   for(int i=0; i<n; i++)
+   {
+      f->SetCwd(FileAccess::Path(xstring::format("/pub/dir-%06d",(i*7919)%n)));
+      int err;
+      const char *data;
+      int len;
+      if(FileAccess::cache->Find(f,"",FA::LONG_LIST,&err,&data,&len) && err==FA::OK)
+	 found++;
+      if(FileAccess::cache->IsDirectory(f,"sub")!=1)
+	 return "cached subdirectory not found";
+   }
+   if(found!=n)
+      return "cached directory not found";
+
+   f->SetCwd(FileAccess::Path("/pub/dir-000001"));
+   FileAccess::cache->DirectoryChanged(f,".");
+   int err;
+   const char *data;
+   int len;
+   if(FileAccess::cache->Find(f,"",FA::LONG_LIST,&err,&data,&len))
+      return "changed directory is still cached";
+
+   other->SetCwd(FileAccess::Path("/pub"));
+   FileAccess::cache->Add(other,"",FA::LONG_LIST,FA::OK,"x\n",2);
+   ResMgr::Set("cache:size",0,"128k");
+   ResMgr::Set("cache:site-size","ftp.example.net","64k");
+   f->SetCwd(FileAccess::Path("/pub/new"));
+   FileAccess::cache->Add(f,"",FA::LONG_LIST,FA::OK,"y\n",2);
+   if(!FileAccess::cache->Find(other,"",FA::LONG_LIST,&err,&data,&len))
+      return "other site was pushed out of the cache";
+   if(!FileAccess::cache->Find(f,"",FA::LONG_LIST,&err,&data,&len))
+      return "new entry was not cached";
+   if(FileAccess::cache->TotalSize()>128*1024)
+      return "cache size limit was not applied";
+   // the recently used entries are kept.
+   f->SetCwd(FileAccess::Path(xstring::format("/pub/dir-%06d",(n-1)*7919%n)));
+   if(!FileAccess::cache->Find(f,"",FA::LONG_LIST,&err,&data,&len))
+      return "recently used entry was removed";
+
+   return 0;
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+
+   FileAccess *f=FileAccess::New("ftp","ftp.example.net");
+   FileAccess *other=FileAccess::New("ftp","ftp.other.net");
+   if(!f || !other)
+   {
+      fprintf(stderr,"ftp: unknown protocol, cannot create ftp session\n");
+      return 1;
+   }
+   const char *error=check(f,other);
+   if(error)
+      fprintf(stderr,"%s\n",error);
+   FileAccess::cache->Flush();
+   SMTask::Delete(f);
+   SMTask::Delete(other);
+   return error?1:0;
+}
@@ -0,0 +1,127 @@
+/*
+	This saves a snapshot of directories, loads it back as the next mirror
+	run would do, and checks which directories may be skipped.
+*/
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "MirrorSnapshot.h"
+#include "misc.h"
+
+char *program_name;
+
+static const char *dir_path(int i)
+{
+   return xstring::format("pub/%03d/dir %06d",i/1000,i);
+}
+
+// returns the failure, or 0.
+static const char *check(const char *tmp)
+{
+   const int n=1000;
+   const char *source="ftp://ftp.example.net/pub";
+   const char *target="file:/srv/mirror";
+   const char *options="120 *.tmp\nflags 18\n";
+   time_t base=1600000000;
+
+   FileInfo dir("x");
+   dir.SetType(dir.DIRECTORY);
+   FileInfo dav_dir("x");
+   dav_dir.SetType(dav_dir.DIRECTORY);
+
+   Ref<MirrorSnapshot> s(new MirrorSnapshot(tmp,source,target,options));
+   if(s->Load())
+      return "an empty file is loaded as a snapshot";
+   for(int i=0; i<n; i++)
+   {
+      dir.SetDate(base+i,0);
+      s->Add(dir_path(i),&dir,i%10!=0);
+   }
+   dav_dir.SetDate(base,0);
+   dav_dir.SetETag("\"etag-1\"");
+   s->Add("dav",&dav_dir,true);
+   dir.SetDate(base,60);
+   s->Add("coarse",&dir,true);
+   if(!s->Save())
+      return "cannot save the snapshot";
+
+   // the next run.
+   s=new MirrorSnapshot(tmp,source,target,options);
+   if(!s->Load() || s->GetCount()!=n+2)
+      return "cannot load the snapshot";
+   int unchanged=0;
+   for(int i=0; i<n; i++)
+   {
+      dir.SetDate(base+i,0);
+      if(s->Unchanged(dir_path(i),&dir))
+	 unchanged++;
+      else if(i%10!=0)
+	 return "an unchanged directory is not recognized";
+   }
+   if(unchanged!=n-(n+9)/10)
+      return "a directory with subdirectories would be skipped";
+   dir.SetDate(base+2,0);
+   if(s->Unchanged(dir_path(1),&dir))
+      return "a changed timestamp is not noticed";
+   dir.SetDate(base+1,60);
+   if(s->Unchanged(dir_path(1),&dir))
+      return "a coarse timestamp is trusted";
+   dir.SetDate(base,60);
+   if(s->Unchanged("coarse",&dir))
+      return "a coarse saved timestamp is trusted";
+   dav_dir.SetDate(base+1,0);
+   if(!s->Unchanged("dav",&dav_dir))
+      return "the same validator is not trusted";
+   dav_dir.SetDate(base,0);
+   dav_dir.SetETag("\"etag-2\"");
+   if(s->Unchanged("dav",&dav_dir))
+      return "a changed validator is not noticed";
+
+   // only the directories seen or kept in a run are saved.
+   s->Keep(dir_path(1));
+   dir.SetDate(base+5,0);
+   s->Add(dir_path(2),&dir,true);
+   s->Add("",&dir,true);  // the top directory
+   if(!s->Save())
+      return "cannot save the snapshot";
+   s=new MirrorSnapshot(tmp,source,target,options);
+   if(!s->Load() || s->GetCount()!=3)
+      return "cannot load the second snapshot";
+   if(!s->Unchanged("",&dir))
+      return "the top directory is lost";
+   dir.SetDate(base+1,0);
+   if(!s->Unchanged(dir_path(1),&dir))
+      return "a kept directory is lost";
+   dir.SetDate(base+5,0);
+   if(!s->Unchanged(dir_path(2),&dir))
+      return "a directory of the second run is lost";
+
+   s=new MirrorSnapshot(tmp,source,"file:/srv/other",options);
+   if(s->Load())
+      return "a snapshot of another target is loaded";
+   s=new MirrorSnapshot(tmp,source,target,"120 *.tmp\nflags 16\n");
+   if(s->Load())
+      return "a snapshot of other options is loaded";
+   return 0;
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+
+   char tmp[]="/tmp/mirror-snapshot.XXXXXX";
+   int fd=mkstemp(tmp);
+   if(fd==-1)
+   {
+      perror("mkstemp");
+      return 1;
+   }
+   close(fd);
+   const char *error=check(tmp);
+   if(error)
+      fprintf(stderr,"%s\n",error);
+   unlink(tmp);
+   return error?1:0;
+}
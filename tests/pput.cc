@@ -0,0 +1,164 @@
+/*
+	This uploads a file with pput to a local target, then continues an
+	interrupted upload from a status journal and checks that only the
+	missing ranges are written.
+*/
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "CmdExec.h"
+#include "RangeJournal.h"
+
+CDECL_BEGIN
+#include "md5.h"
+CDECL_END
+
+char *program_name;
+
+static const int size=256*1024;
+static char dir[]="/tmp/pput-XXXXXX";
+
+static bool write_file(const char *name,const xstring& data)
+{
+   FILE *f=fopen(name,"w");
+   if(!f)
+      return false;
+   bool ok=(fwrite(data.get(),1,data.length(),f)==data.length());
+   return fclose(f)==0 && ok;
+}
+
+// the status files left in the cache directory.
+static int count_status_files()
+{
+   DIR *d=opendir(xstring::cat(dir,"/pput",NULL));
+   if(!d)
+      return 0;
+   int n=0;
+   struct dirent *de;
+   while((de=readdir(d))!=0)
+      if(de->d_name[0]!='.')
+	 n++;
+   closedir(d);
+   return n;
+}
+
+static const char *status_file_for(const char *url)
+{
+   struct md5_ctx ctx;
+   md5_init_ctx(&ctx);
+   md5_process_bytes(url,strlen(url),&ctx);
+   xstring digest;
+   digest.get_space(MD5_DIGEST_SIZE);
+   md5_finish_ctx(&ctx,digest.get_non_const());
+   digest.set_length(MD5_DIGEST_SIZE);
+   xstring name;
+   digest.hexdump_to(name);
+   name.c_lc();
+   return xstring::cat(dir,"/pput/",name.get(),NULL);
+}
+
+static int run(const char *cmd)
+{
+   JobRef<CmdExec> exec(new CmdExec(0,0));
+   exec->FeedCmd("set pget:min-chunk-size 16k; set xfer:clobber yes;\n");
+   exec->FeedCmd(xstring::format("lcd %s; open file://%s\n",dir,dir));
+   exec->FeedCmd(cmd);
+   exec->FeedCmd("\n");
+   exec->WaitDone();
+   return exec->ExitCode();
+}
+
+// returns the failure, or 0.
+static const char *check(const char *src_name,const char *dst_name)
+{
+   xstring src;
+   srandom(1);
+   for(int i=0; i<size; i++)
+      src.append(char(random()));
+   if(!write_file(src_name,src))
+      return "cannot write a file";
+
+   xstring dst;
+   if(run("pput -n 4 src -o dst")!=0)
+      return "pput failed";
+   if(!read_file(dst_name,dst))
+      return "cannot read a file";
+   if(!dst.eq(src))
+      return "the uploaded file differs";
+   if(count_status_files()!=0)
+      return "the status file was not removed";
+   if(access(xstring::cat(dir,"/src.lftp-pput-status",NULL),F_OK)==0)
+      return "the status file was written beside the source";
+
+   // an interrupted upload: 100k-200k is missing. The stored ranges are
+   // marked so that rewriting them is noticed.
+   xstring expect;
+   expect.set(src);
+   memset(expect.get_non_const(),'d',100*1024);
+   memset(expect.get_non_const()+200*1024,'d',size-200*1024);
+   xstring partial;
+   partial.set(expect);
+   memset(partial.get_non_const()+100*1024,'x',100*1024);
+   if(!write_file(dst_name,partial))
+      return "cannot write a file";
+   {
+      RangeJournal j(status_file_for(xstring::cat("file:",dir,"/dst",NULL)));
+      j.SetSize(size);
+      j.Compact();  // create the file
+      j.Add(0,100*1024);
+      j.Add(200*1024,size);
+   }
+   if(count_status_files()!=1)
+      return "cannot create the status file";
+
+   if(run("pput -c -n 4 src -o dst")!=0)
+      return "pput -c failed";
+   if(!read_file(dst_name,dst))
+      return "cannot read a file";
+   if(!dst.eq(expect))
+      return "pput -c did not write exactly the missing range";
+   if(count_status_files()!=0)
+      return "the status file was not removed after pput -c";
+
+   return 0;
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+
+   // the lftp directories are looked up before main,
+   // so run again with LFTP_HOME set to a temporary directory.
+   const char *home=getenv("LFTP_HOME");
+   if(!home || strncmp(home,dir,10) || strlen(home)!=strlen(dir))
+   {
+      if(!mkdtemp(dir))
+      {
+	 perror("mkdtemp");
+	 return 1;
+      }
+      setenv("LFTP_HOME",dir,1);
+      execv(argv[0],argv);
+      perror(argv[0]);
+      return 1;
+   }
+   strcpy(dir,home);
+
+   xstring src_name,dst_name;
+   src_name.vset(dir,"/src",NULL);
+   dst_name.vset(dir,"/dst",NULL);
+   const char *error=check(src_name,dst_name);
+   if(error)
+      fprintf(stderr,"%s\n",error);
+
+   unlink(src_name);
+   unlink(dst_name);
+   unlink(xstring::cat(dir,"/transfer_log",NULL));
+   unlink(status_file_for(xstring::cat("file:",dir,"/dst",NULL)));
+   rmdir(xstring::cat(dir,"/pput",NULL));
+   rmdir(dir);
+   return error?1:0;
+}
@@ -0,0 +1,143 @@
+/*
+	This records ranges in a pget status journal, simulates a crash in
+	the middle of an append and checks what is loaded back.
+*/
+
+#include <config.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "RangeJournal.h"
+
+char *program_name;
+
+static off_t file_size(const char *f)
+{
+   struct stat st;
+   if(stat(f,&st)==-1)
+      return -1;
+   return st.st_size;
+}
+
+static bool missing_ok(const RangeJournal& j,off_t size,const off_t *expect,int n)
+{
+   xarray<RangeJournal::Range> missing;
+   j.GetMissing(size,&missing);
+   if(missing.count()!=n)
+      return false;
+   for(int i=0; i<n; i++)
+      if(missing[i].start!=expect[i*2] || missing[i].limit!=expect[i*2+1])
+	 return false;
+   return true;
+}
+
+// returns the failure, or 0.
+static const char *check(const char *name)
+{
+   {
+      RangeJournal j(name);
+      j.SetSize(1000);
+      j.Add(100,200);
+      j.Add(0,50);
+      j.Add(300,400);
+      j.Add(200,250);	// adjacent to 100-200
+      j.Add(40,60);	// overlaps 0-50
+      if(j.GetDone().count()!=3)
+	 return "ranges not merged";
+      if(!j.Sync())
+	 return "cannot sync the journal";
+   }
+   {
+      RangeJournal j(name);
+      if(!j.Load())
+	 return "cannot load the journal";
+      if(j.GetSize()!=1000)
+	 return "wrong size";
+      const off_t expect[]={60,100, 250,300, 400,1000};
+      if(!missing_ok(j,1000,expect,3))
+	 return "wrong missing ranges";
+      if(j.NextMissing(0)!=60 || j.NextMissing(120)!=250 || j.NextMissing(60)!=60)
+	 return "wrong next missing position";
+   }
+
+   // a torn record at the end is ignored.
+   {
+      RangeJournal j(name);
+      j.Load();
+      j.Add(600,700);	// compacts the loaded journal
+      j.Add(800,900);	// appended
+   }
+   if(truncate(name,file_size(name)-7)==-1)
+      return "truncate failed";
+   {
+      RangeJournal j(name);
+      if(!j.Load())
+	 return "cannot load the torn journal";
+      const off_t expect[]={60,100, 250,300, 400,600, 700,1000};
+      if(!missing_ok(j,1000,expect,4))
+	 return "wrong missing ranges";
+   }
+
+   // a damaged record ends the journal, the header and 0-60 are intact.
+   {
+      int fd=open(name,O_WRONLY);
+      bool damaged=(fd!=-1 && pwrite(fd,"X",1,2*20+3)==1);
+      if(fd!=-1)
+	 close(fd);
+      if(!damaged)
+	 return "cannot damage the journal";
+      RangeJournal j(name);
+      if(!j.Load())
+	 return "cannot load the damaged journal";
+      const off_t expect[]={60,1000};
+      if(!missing_ok(j,1000,expect,1))
+	 return "wrong missing ranges";
+   }
+
+   // many small records are compacted.
+   {
+      RangeJournal j(name);
+      j.SetSize(1<<20);
+      for(int i=0; i<5000; i++)
+	 j.Add(i*100,i*100+100);
+      if(file_size(name)>2048*20)
+	 return "the journal was not compacted";
+      RangeJournal j2(name);
+      if(!j2.Load())
+	 return "cannot load the compacted journal";
+      const off_t expect[]={500000,1<<20};
+      if(!missing_ok(j2,1<<20,expect,1))
+	 return "wrong missing ranges";
+   }
+
+   // the file grew after the journal was written.
+   {
+      RangeJournal j(name);
+      j.Load();
+      const off_t expect[]={500000,2<<20};
+      if(!missing_ok(j,2<<20,expect,1))
+	 return "wrong missing ranges";
+   }
+
+   return 0;
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+
+   char name[]="/tmp/range-journal-XXXXXX";
+   int fd=mkstemp(name);
+   if(fd==-1)
+   {
+      perror("mkstemp");
+      return 1;
+   }
+   close(fd);
+   const char *error=check(name);
+   if(error)
+      fprintf(stderr,"%s\n",error);
+   unlink(name);
+   return error?1:0;
+}
@@ -0,0 +1,134 @@
+/*
+	This resolves host names at once in the resolver threads and by
+	forking per lookup, checking the addresses. The names are mapped to
+	addresses with dns:name, so no DNS server is needed.
+*/
+
+#include <config.h>
+#include <stdio.h>
+#include <time.h>
+#include "Resolver.h"
+#include "ResMgr.h"
+#include "WorkerPool.h"
+#include "SignalHook.h"
+#include "log.h"
+
+char *program_name;
+
+static const char *host_name(int i)
+{
+   return xstring::format("host%d.test",i);
+}
+
+static int alive;
+class CountedResolver : public Resolver
+{
+public:
+   CountedResolver(const char *h) : Resolver(h,"80") { alive++; }
+   ~CountedResolver() { alive--; }
+};
+
+static const char *check_result(Resolver *r,int i)
+{
+   if(r->Error())
+      return xstring::get_tmp(r->ErrorMsg());
+   const xarray<sockaddr_u>& a=r->Result();
+   if(a.count()!=1 || a[0].family()!=AF_INET || a[0].port()!=80
+   || ntohl(a[0].in.sin_addr.s_addr)!=(0x7F000000|(i+1)))
+      return "wrong address";
+   return 0;
+}
+
+// returns the failure, or 0.
+static const char *resolve_all(int n)
+{
+   Resolver **r=new Resolver*[n];
+   for(int i=0; i<n; i++)
+   {
+      r[i]=new Resolver(host_name(i),"80");
+      r[i]->NoCache();
+      r[i]->IncRefCount();
+   }
+   for(;;)
+   {
+      int done=0;
+      for(int i=0; i<n; i++)
+	 done+=r[i]->Done();
+      if(done==n)
+	 break;
+      SMTask::Schedule();
+      SMTask::Block();
+   }
+   const char *error=0;
+   for(int i=0; i<n; i++)
+   {
+      if(!error)
+	 error=check_result(r[i],i);
+      r[i]->DecRefCount();
+      SMTask::Delete(r[i]);
+   }
+   delete[] r;
+   SMTask::CollectGarbage();
+   return error;
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+   Log::global=new Log("debug");
+   SignalHook::ClassInit();
+
+   const int n=20;
+   ResMgr::Set("dns:order",0,"inet");
+   for(int i=0; i<n; i++)
+   {
+      int a=i+1;
+      ResMgr::Set("dns:name",host_name(i),
+	 xstring::format("127.%d.%d.%d",a>>16&255,a>>8&255,a&255));
+   }
+
+   ResMgr::Set("dns:threads",0,"8");
+   if(WorkerPool::Threads(WorkerPool::RESOLVER)==0)
+   {
+      fprintf(stderr,"no resolver threads\n");
+      return 1;
+   }
+   const char *error=resolve_all(n);
+   if(error)
+   {
+      fprintf(stderr,"threads: %s\n",error);
+      return 1;
+   }
+
+   // a resolver deleted during the lookup is freed after the thread is done.
+   for(int i=0; i<n; i++)
+   {
+      Resolver *r=new CountedResolver(host_name(i));
+      r->NoCache();
+      SMTask::Schedule();
+      SMTask::Delete(r);
+   }
+   time_t deadline=time(0)+10;
+   while(alive>0 && time(0)<deadline)
+   {
+      SMTask::Schedule();
+      SMTask::CollectGarbage();
+      if(alive>0)
+	 SMTask::Block();
+   }
+   if(alive>0)
+   {
+      fprintf(stderr,"deleted resolvers are not freed\n");
+      return 1;
+   }
+
+   ResMgr::Set("dns:threads",0,"0");
+   ResMgr::Set("dns:use-fork",0,"yes");
+   error=resolve_all(n);
+   if(error)
+   {
+      fprintf(stderr,"fork: %s\n",error);
+      return 1;
+   }
+   return 0;
+}
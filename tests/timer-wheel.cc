@@ -0,0 +1,155 @@
+/*
+	This compares xtimerwheel against xheap: first checks that both
+	return the same minimum under random operations, then measures
+	a timer restart heavy workload.
+*/
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "xheap.h"
+#include "xtimerwheel.h"
+
+char *program_name;
+
+struct TestTimer
+{
+   unsigned long long stop;
+   int id;
+   xheap<TestTimer>::node heap_node;
+   xtimerwheel<TestTimer>::node wheel_node;
+   TestTimer() : stop(0), id(0), heap_node(this), wheel_node(this) {}
+};
+static bool operator<(const TestTimer& a,const TestTimer& b)
+{
+   return a.stop<b.stop || (a.stop==b.stop && a.id<b.id);
+}
+
+static unsigned long long random_delay()
+{
+   switch(random()%4)
+   {
+   case 0: return random()%64;
+   case 1: return random()%10000;
+   case 2: return random()%3600000;
+   default: return (unsigned long long)(random()%100000)*100000;
+   }
+}
+
+static int check(int n,int ops)
+{
+   TestTimer *t=new TestTimer[n];
+   xheap<TestTimer> heap;
+   xtimerwheel<TestTimer> wheel;
+   unsigned long long now=0;
+   for(int i=0; i<n; i++)
+      t[i].id=i;
+   for(int op=0; op<ops; op++)
+   {
+      TestTimer *e=&t[random()%n];
+      switch(random()%5)
+      {
+      case 0:
+      case 1:
+	 heap.remove(e->heap_node);
+	 e->stop=now+random_delay();
+	 heap.add(e->heap_node);
+	 wheel.add(e->wheel_node,e->stop);
+	 break;
+      case 2:
+	 heap.remove(e->heap_node);
+	 wheel.remove(e->wheel_node);
+	 break;
+      case 3:
+	 now+=random_delay()/16;
+	 break;
+      case 4:
+	 if(heap.get_min()!=wheel.get_min(now))
+	 {
+	    fprintf(stderr,"timer-wheel: minimum mismatch at op %d\n",op);
+	    return 1;
+	 }
+	 while(heap.get_min() && heap.get_min()->stop<=now)
+	 {
+	    if(heap.pop_min()!=wheel.pop_min(now))
+	    {
+	       fprintf(stderr,"timer-wheel: pop mismatch at op %d\n",op);
+	       return 1;
+	    }
+	 }
+	 break;
+      }
+   }
+   delete[] t;
+   return 0;
+}
+
+static double elapsed(const timespec &a,const timespec &b)
+{
+   return (b.tv_sec-a.tv_sec)+(b.tv_nsec-a.tv_nsec)/1e9;
+}
+
+// restart random timers and poll for the minimum, like Timer::re_sort
+// and Timer::GetTimeoutTV do.
+template<class Q,class A,class M>
+static double bench(TestTimer *t,int n,int ops,Q& q,A add,M get_min)
+{
+   timespec start,end;
+   clock_gettime(CLOCK_MONOTONIC,&start);
+   unsigned long long now=0;
+   for(int op=0; op<ops; op++)
+   {
+      TestTimer *e=&t[random()%n];
+      e->stop=now+1000+random()%300000;
+      add(q,e);
+      if(op%64==0)
+	 get_min(q,++now);
+   }
+   clock_gettime(CLOCK_MONOTONIC,&end);
+   return elapsed(start,end);
+}
+
+static void heap_add(xheap<TestTimer>& h,TestTimer *e)
+{
+   h.remove(e->heap_node);
+   h.add(e->heap_node);
+}
+static void heap_get_min(xheap<TestTimer>& h,unsigned long long)
+{
+   h.get_min();
+}
+static void wheel_add(xtimerwheel<TestTimer>& w,TestTimer *e)
+{
+   w.add(e->wheel_node,e->stop);
+}
+static void wheel_get_min(xtimerwheel<TestTimer>& w,unsigned long long now)
+{
+   w.get_min(now);
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+
+   srandom(1);
+   if(check(1000,1000000))
+      return 1;
+
+   int n=argc>1?atoi(argv[1]):50000;
+   int ops=argc>2?atoi(argv[2]):2000000;
+
+   TestTimer *t1=new TestTimer[n];
+   TestTimer *t2=new TestTimer[n];
+   xheap<TestTimer> heap;
+   xtimerwheel<TestTimer> wheel;
+
+   srandom(2);
+   double h=bench(t1,n,ops,heap,heap_add,heap_get_min);
+   srandom(2);
+   double w=bench(t2,n,ops,wheel,wheel_add,wheel_get_min);
+
+   printf("%d timers, %d restarts: heap %.1f ns/op, wheel %.1f ns/op\n",
+      n,ops,h*1e9/ops,w*1e9/ops);
+   return 0;
+}
@@ -0,0 +1,106 @@
+/*
+	This runs CPU-bound jobs on the worker pool and in the main loop and
+	checks the results.
+*/
+
+#include <config.h>
+#include <unistd.h>
+#include <string.h>
+#include "WorkerPool.h"
+#include "ResMgr.h"
+#include "log.h"
+
+char *program_name;
+
+static int finished;
+
+class SumJob : public WorkerJob
+{
+   unsigned n;
+   unsigned *result;
+   unsigned sum;
+   void Run() {
+      sum=0;
+      for(unsigned i=0; i<n; i++)
+	 sum=sum*31+i;
+   }
+   void Finish() { *result=sum; finished++; }
+public:
+   SumJob(unsigned n,unsigned *r) : n(n), result(r), sum(0) {}
+};
+
+static unsigned expected_sum(unsigned n)
+{
+   unsigned sum=0;
+   for(unsigned i=0; i<n; i++)
+      sum=sum*31+i;
+   return sum;
+}
+
+static const char *check_jobs()
+{
+   const int count=1000;
+   unsigned results[count];
+   finished=0;
+   for(int i=0; i<count; i++)
+      WorkerPool::Submit(new SumJob(100000+i,&results[i]));
+   while(finished<count)
+   {
+      SMTask::Schedule();
+      if(finished<count)
+	 SMTask::Block();
+   }
+   for(int i=0; i<count; i++)
+      if(results[i]!=expected_sum(100000+i))
+	 return "wrong job result";
+   return 0;
+}
+
+// Wait is only allowed for the jobs Submit has queued.
+static const char *check_wait(bool threads)
+{
+   unsigned result=0;
+   finished=0;
+   SumJob *j=new SumJob(100000,&result);
+   if(WorkerPool::Submit(j)!=threads)
+      return "Submit did not report whether the job was queued";
+   if(threads)
+      WorkerPool::Wait(j);
+   if(finished!=1 || result!=expected_sum(100000))
+      return "the job is not finished after Wait";
+   return 0;
+}
+
+static const char *check(bool threads)
+{
+   const char *error=check_jobs();
+   return error?error:check_wait(threads);
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+   Log::global=new Log("debug");
+
+   ResMgr::Set("xfer:worker-threads",0,"0");
+   const char *error=check(false);
+   if(error)
+   {
+      fprintf(stderr,"main loop: %s\n",error);
+      return 1;
+   }
+
+   ResMgr::Set("xfer:worker-threads",0,"4");
+   if(WorkerPool::Threads()==0)
+   {
+      printf("worker threads are not available\n");
+      return 77;
+   }
+   error=check(true);
+   if(error)
+   {
+      fprintf(stderr,"workers: %s\n",error);
+      return 1;
+   }
+   return 0;
+}